@@ -47,6 +47,7 @@ typedef Datum (*coearce_function) (dynamic_value *);
 Datum convert_to_scalar(coearce_function func, dynamic *agt, char *type);
 
 Datum dynamic_to_int8_internal(dynamic_value *gtv);
+Datum dynamic_to_float8_internal(dynamic_value *gtv);
 Datum dynamic_to_inet_internal(dynamic_value *gtv);
 Datum dynamic_to_box_internal(dynamic_value *gtv);
 
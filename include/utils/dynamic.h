@@ -181,6 +181,7 @@ typedef uint32 gtentry;
 #define GTENTRY_IS_NULL       0x40000000
 #define GTENTRY_IS_CONTAINER  0x50000000 /* array or object */
 #define GTENTRY_IS_DYNAMIC     0x60000000 /* extended type designator */
+#define GTENTRY_IS_KEY_REF    0x70000000 /* object key stored earlier */
 
 /* Access macros.  Note possible multiple evaluations */
 #define GTE_OFFLENFLD(agte_) \
@@ -203,6 +204,31 @@ typedef uint32 gtentry;
     (GTE_IS_BOOL_TRUE(agte_) || GTE_IS_BOOL_FALSE(agte_))
 #define GTE_IS_DYNAMIC(agte_) \
     (((agte_)&GTENTRY_TYPEMASK) == GTENTRY_IS_DYNAMIC)
+#define GTE_IS_KEY_REF(agte_) \
+    (((agte_)&GTENTRY_TYPEMASK) == GTENTRY_IS_KEY_REF)
+
+/*
+ * Arrays of objects tend to repeat the same keys in every element. A key of
+ * at least DYNAMIC_KEY_REF_MIN_LEN bytes that was already written earlier in
+ * the datum is stored as a gtentry_key_ref instead, whose data gives the
+ * distance back from its own position to the first copy of the key, and the
+ * key's length. Binary search over an object's keys works as before, since
+ * the references are resolved to the same bytes.
+ *
+ * References never point outside the value of a top level object key, so
+ * that value can be read on its own, and the keys of a top level object are
+ * never references. A container copied out of the datum it was read from
+ * must be rebuilt if its references reach out of it, or, when it becomes the
+ * root object of a datum, out of the value of one of its keys (see
+ * dynamic_value_to_dynamic).
+ */
+typedef struct gtentry_key_ref
+{
+    uint32 distance;
+    uint32 len;
+} gtentry_key_ref;
+
+#define DYNAMIC_KEY_REF_MIN_LEN 12
 
 /* Macro for advancing an offset variable to the next gtentry */
 #define GTE_ADVANCE_OFFSET(offset, agte) \
@@ -224,6 +250,17 @@ typedef uint32 gtentry;
  */
 #define GT_OFFSET_STRIDE 32
 
+/*
+ * Arrays and objects with GT_DENSE_OFFSET_THRESHOLD or more elements or pairs
+ * store an offset in every gtentry instead, so that finding the data of any
+ * child is a single lookup. Their gtentry arrays compress worse, but values
+ * that large are usually read a part at a time rather than as a whole. The
+ * same caution as for GT_OFFSET_STRIDE applies.
+ */
+#define GT_DENSE_OFFSET_THRESHOLD 512
+#define GT_OFFSET_STRIDE_FOR(count) \
+    ((count) >= GT_DENSE_OFFSET_THRESHOLD ? 1 : GT_OFFSET_STRIDE)
+
 /*
  * An dynamic array or object node, within an dynamic Datum.
  *
@@ -247,16 +284,32 @@ typedef struct dynamic_container
 #define GT_FSCALAR 0x10000000 /* flag bits */
 #define GT_FOBJECT 0x20000000
 #define GT_FARRAY  0x40000000
-#define GT_FBINARY 0x80000000
+#define GT_FVECTOR 0x80000000 /* packed array, only set along with GT_FARRAY */
 
 /* convenience macros for accessing an dynamic_container struct */
 #define DYNAMIC_CONTAINER_SIZE(agtc)       ((agtc)->header & GT_CMASK)
 #define DYNAMIC_CONTAINER_IS_SCALAR(agtc) (((agtc)->header & GT_FSCALAR) != 0)
 #define DYNAMIC_CONTAINER_IS_OBJECT(agtc) (((agtc)->header & GT_FOBJECT) != 0)
 #define DYNAMIC_CONTAINER_IS_ARRAY(agtc)  (((agtc)->header & GT_FARRAY)  != 0)
-#define DYNAMIC_CONTAINER_IS_BINARY(agtc) (((agtc)->header & GT_FBINARY) != 0)
+#define DYNAMIC_CONTAINER_IS_VECTOR(agtc) (((agtc)->header & GT_FVECTOR) != 0)
 #define DYNAMIC_CONTAINER_IS_EXTENDED_COMPOSITE(agtc) (((agtc)->header & GT_FEXTENDED_COMPOSITE) != 0)
 
+/*
+ * An array whose elements are all integers, all floats, all timestamps, all
+ * timestamptzs or all dates may be stored as a vector instead: the header
+ * has GT_FVECTOR set alongside GT_FARRAY, and in place of the gtentrys there
+ * is a single uint32 holding the DYNA_HEADER_* type of the elements, which
+ * follow as a packed C array of int64, float8 or DateADT.  The elements are
+ * only 4-byte aligned.  convert_dynamic_array chooses this form for arrays
+ * of at least DYNAMIC_VECTOR_MIN_ELEMS elements.
+ */
+#define DYNAMIC_VECTOR_MIN_ELEMS 4
+
+#define DYNAMIC_VECTOR_TYPE(agtc) ((agtc)->children[0])
+#define DYNAMIC_VECTOR_DATA(agtc) ((char *)&(agtc)->children[1])
+#define DYNAMIC_VECTOR_ELEM_SIZE(type_) \
+    ((type_) == DYNA_HEADER_DATE ? sizeof(DateADT) : sizeof(int64))
+
 // The top-level on-disk format for an dynamic datum.
 typedef struct
 {
@@ -272,8 +325,8 @@ typedef struct
     ((*(uint32 *)VARDATA(agtp_) & GT_FOBJECT) != 0)
 #define DYNA_ROOT_IS_ARRAY(agtp_) \
     ((*(uint32 *)VARDATA(agtp_) & GT_FARRAY) != 0)
-#define DYNA_ROOT_IS_BINARY(agtp_) \
-    ((*(uint32 *)VARDATA(agtp_) & GT_FBINARY) != 0)
+#define DYNA_ROOT_IS_VECTOR(agtp_) \
+    ((*(uint32 *)VARDATA(agtp_) & GT_FVECTOR) != 0)
 #define DYNA_ROOT_IS_EXTENDED_COMPOSITE(agtp_) \
     ((*(uint32 *)VARDATA(agtp_) & GT_FEXTENDED_COMPOSITE) != 0)
 #define DYNA_ROOT_BINARY_FLAGS(agtp_) \
@@ -317,111 +370,136 @@ typedef struct
 #define DYNA_HEADER_RANGE_DATE_MULTI 0x00000023
 #define DYNA_HEADER_BYTEA            0x00000024
 
+/*
+ * Compact variants of the DYNAMIC header, chosen by ag_serialize_extended_type
+ * when the value allows it.
+ *
+ * With DYNA_HEADER_COMPACT set, the header holds the whole value: bits 24-30
+ * carry the type from the list above and the low 24 bits a signed immediate,
+ * so no data follows. Used for integers and dates that fit, and for times
+ * with whole seconds, in which case the immediate counts seconds.
+ *
+ * With DYNA_HEADER_INT32 set, the low bits carry the type and 4 bytes of data
+ * follow instead of 8: an int32 for integers, or whole seconds for
+ * timestamps and timestamptzs.
+ */
+#define DYNA_HEADER_COMPACT          0x80000000
+#define DYNA_HEADER_INT32            0x40000000
+#define DYNA_HEADER_COMPACT_MIN      (-0x800000)
+#define DYNA_HEADER_COMPACT_MAX      0x7FFFFF
+
+#define DYNA_HEADER_MAKE_COMPACT(type_, value_) \
+    (DYNA_HEADER_COMPACT | ((uint32) (type_) << 24) | ((uint32) (value_) & 0x00FFFFFF))
+#define DYNA_HEADER_COMPACT_VALUE(header_) \
+    (((int32) ((uint32) (header_) << 8)) >> 8)
+#define DYNA_HEADER_BASE_TYPE(header_) \
+    (((header_) & DYNA_HEADER_COMPACT) ? (((header_) >> 24) & 0x7F) : ((header_) & ~DYNA_HEADER_INT32))
+
 
 #define DYNA_IS_INTEGER(agte_) \
-    (((agte_) == DYNA_HEADER_INTEGER))
+    ((DYNA_HEADER_BASE_TYPE(agte_) == DYNA_HEADER_INTEGER))
 
 #define DYNA_IS_FLOAT(agte_) \
-    (((agte_) == DYNA_HEADER_FLOAT))
+    ((DYNA_HEADER_BASE_TYPE(agte_) == DYNA_HEADER_FLOAT))
 
 #define DYNAMIC_IS_INTEGER(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_INTEGER)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_INTEGER)
 
 #define DYNAMIC_IS_FLOAT(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_FLOAT)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_FLOAT)
 
 #define DYNA_IS_TIMESTAMP(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_TIMESTAMP)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_TIMESTAMP)
 
 #define DYNA_IS_TIMESTAMPTZ(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_TIMESTAMPTZ)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_TIMESTAMPTZ)
 
 #define DYNA_IS_DATE(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_DATE)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_DATE)
 
 #define DYNA_IS_INTERVAL(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_INTERVAL)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_INTERVAL)
 
 #define DYNA_IS_TIME(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_TIME)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_TIME)
 
 #define DYNA_IS_TIMETZ(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_TIMETZ)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_TIMETZ)
 
 #define DYNA_IS_INET(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_INET)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_INET)
 
 #define DYNA_IS_CIDR(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_CIDR)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_CIDR)
 
 #define DYNA_IS_MACADDR(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_MAC)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_MAC)
 
 #define DYNA_IS_MACADDR8(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_MAC8)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_MAC8)
 
 #define DYNA_IS_POINT(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_POINT)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_POINT)
 
 #define DYNA_IS_PATH(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_PATH)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_PATH)
 
 #define DYNA_IS_LSEG(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_LSEG)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_LSEG)
 
 #define DYNA_IS_LINE(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_LINE)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_LINE)
 
 #define DYNA_IS_POLYGON(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_POLYGON)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_POLYGON)
 
 #define DYNA_IS_CIRCLE(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_CIRCLE)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_CIRCLE)
 
 #define DYNA_IS_BOX(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_BOX)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_BOX)
 
 #define DYNA_IS_BOX2D(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_BOX2D)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_BOX2D)
 
 #define DYNA_IS_BOX3D(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_BOX3D)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_BOX3D)
 
 #define DYNA_IS_SPHEROID(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_SPHEREOID)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_SPHEREOID)
 
 #define DYNA_IS_GSERIALIZED(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_GSERIALIZED)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_GSERIALIZED)
 
 #define DYNA_IS_GEOMETRY(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_GSERIALIZED)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_GSERIALIZED)
 
 #define DYNA_IS_TSVECTOR(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_TSVECTOR)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_TSVECTOR)
 
 #define DYNA_IS_TSQUERY(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_TSQUERY)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_TSQUERY)
 
 #define DYNA_IS_RANGE_INT(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_RANGE_INT)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_RANGE_INT)
 
 #define DYNA_IS_RANGE_NUM(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_RANGE_NUM)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_RANGE_NUM)
 
 #define DYNA_IS_RANGE_TS(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_RANGE_TS)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_RANGE_TS)
 
 #define DYNA_IS_RANGE_TSTZ(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_RANGE_TSTZ)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_RANGE_TSTZ)
 
 #define DYNA_IS_RANGE_DATE(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_RANGE_DATE)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_RANGE_DATE)
 
 #define DYNA_IS_RANGE_INT_MULTI(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_RANGE_INT_MULTI)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_RANGE_INT_MULTI)
 
 #define DYNA_IS_RANGE_TS_MULTI(agt) \
-    (GTE_IS_DYNAMIC(agt->root.children[0]) && agt->root.children[1] == DYNA_HEADER_RANGE_TS_MULTI)
+    (GTE_IS_DYNAMIC(agt->root.children[0]) && DYNA_HEADER_BASE_TYPE(agt->root.children[1]) == DYNA_HEADER_RANGE_TS_MULTI)
 
 enum dynamic_value_type
 {
@@ -526,6 +604,26 @@ struct dynamic_pair
     uint32 order; /* Pair's index in original sequence */
 };
 
+/*
+ * Maximum number of elements in an array (or key/value pairs in an object).
+ * This is limited by two things: the size of the gtentry array must fit
+ * in MaxAllocSize, and the number of elements (or pairs) must fit in the bits
+ * reserved for that in the dynamic_container.header field.
+ *
+ * (The total size of an array's or object's elements is also limited by
+ * GTENTRY_OFFLENMASK, but we're not concerned about that here.)
+ */
+#define DYNAMIC_MAX_ELEMS (Min(MaxAllocSize / sizeof(dynamic_value), GT_CMASK))
+#define DYNAMIC_MAX_PAIRS (Min(MaxAllocSize / sizeof(dynamic_pair), GT_CMASK))
+
+/*
+ * Deepest container nesting, counted in levels below the root container. The
+ * parser, the builder and the conversions to dynamic refuse to go deeper, and
+ * binary data that did not come from our own serialization code is checked
+ * against it too.
+ */
+#define DYNAMIC_MAX_DEPTH 4096
+
 /* Conversion state used when parsing dynamic from text, or for type coercion */
 typedef struct dynamic_parse_state
 {
@@ -553,7 +651,9 @@ typedef enum
     GTI_ARRAY_ELEM,
     GTI_OBJECT_START,
     GTI_OBJECT_KEY,
-    GTI_OBJECT_VALUE
+    GTI_OBJECT_VALUE,
+    GTI_VECTOR_START,
+    GTI_VECTOR_ELEM
 } gt_iterator_state;
 
 typedef struct dynamic_iterator
@@ -575,10 +675,20 @@ typedef struct dynamic_iterator
     struct dynamic_iterator *parent;
 } dynamic_iterator;
 
+/*
+ * Serializes a dynamic as its parts arrive, without building a dynamic_value
+ * tree first. Containers are begun and ended, object keys and scalars are
+ * added in between, in text order.
+ */
+typedef struct dynamic_builder dynamic_builder;
+
 /* dynamic parse state */
 typedef struct dynamic_in_state {
-    dynamic_parse_state *parse_state;
-    dynamic_value *res;
+    dynamic_builder *builder;
+    List *annotations; // type annotations resolved so far in this parse
+    struct dynamic_lex_context *lex; // for the scans of number tokens, if any
+    Node *escontext; // where to save errors about values, if not thrown
+    MemoryContext cxt; // for what has to last the whole parse
 } dynamic_in_state;
 
 /* Support functions */
@@ -589,10 +699,25 @@ uint32 get_dynamic_length(const dynamic_container *agtc, int index);
 int compare_dynamic_containers_orderability(dynamic_container *a, dynamic_container *b);
 dynamic_value *find_dynamic_value_from_container(dynamic_container *container, uint32 flags, const dynamic_value *key);
 dynamic_value *get_ith_dynamic_value_from_container(dynamic_container *container, uint32 i);
+dynamic_value *find_dynamic_object_field(Datum d, const char *key, int keylen);
+void validate_dynamic_container(dynamic_container *container, uint32 len, int level);
+bool dynamic_container_is_valid(dynamic_container *container, uint32 len, const char **detail);
+void check_dynamic_depth(int level);
+void check_dynamic_container_depth(dynamic_container *container, uint32 len, int level);
 dynamic_value *push_dynamic_value(dynamic_parse_state **pstate, dynamic_iterator_token seq, dynamic_value *agtval);
 dynamic_iterator *dynamic_iterator_init(dynamic_container *container);
 dynamic_iterator_token dynamic_iterator_next(dynamic_iterator **it, dynamic_value *val, bool skip_nested);
 dynamic *dynamic_value_to_dynamic(dynamic_value *val);
+dynamic *scalar_value_to_dynamic(dynamic_value *scalar_val);
+dynamic *vector_to_dynamic(uint32 vector_type, const char *elems, int num_elems);
+dynamic_builder *dynamic_builder_create(void);
+void dynamic_builder_begin_array(dynamic_builder *builder);
+void dynamic_builder_begin_object(dynamic_builder *builder);
+void dynamic_builder_key(dynamic_builder *builder, const char *key, int len);
+void dynamic_builder_scalar(dynamic_builder *builder, dynamic_value *scalar_val);
+void dynamic_builder_end(dynamic_builder *builder);
+dynamic *dynamic_builder_finish(dynamic_builder *builder);
+dynamic *dynamic_builder_next(dynamic_builder *builder);
 bool dynamic_deep_contains(dynamic_iterator **val, dynamic_iterator **m_contained);
 void dynamic_hash_scalar_value(const dynamic_value *scalar_val, uint32 *hash);
 void dynamic_hash_scalar_value_extended(const dynamic_value *scalar_val, uint64 *hash, uint64 seed);
@@ -603,7 +728,7 @@ bool is_numeric_result(dynamic_value *lhs, dynamic_value *rhs);
 char *dynamic_to_cstring(StringInfo out, dynamic_container *in, int estimated_len);
 char *dynamic_to_cstring_indent(StringInfo out, dynamic_container *in, int estimated_len);
 
-Datum dynamic_from_cstring(char *str, int len);
+Datum dynamic_from_cstring(char *str, int len, Node *escontext);
 bool is_dynamic_numeric(dynamic *agt);
 
 size_t check_string_length(size_t len);
@@ -0,0 +1,69 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef AG_DYNAMIC_EXPANDED_H
+#define AG_DYNAMIC_EXPANDED_H
+
+#include "postgres.h"
+
+#include "utils/expandeddatum.h"
+
+#include "utils/dynamic.h"
+
+#define EDYNAMIC_MAGIC 0x4459454F // ID for debugging crosschecks
+
+/*
+ * Expanded in-memory representation of a dynamic, following PostgreSQL's
+ * expanded object protocol (see utils/expandeddatum.h).
+ *
+ * The top level array or object is held as a dynamic_value whose elements or
+ * pairs can be added to in place. Nested containers are left serialized as
+ * DYNAMIC_BINARY values pointing into the flat datum the object was built
+ * from, or into the flat value given to dynamic_set, and are copied over as
+ * they are when the object is flattened.
+ *
+ * Pairs added to an object are appended without regard to order; they are
+ * sorted and uniqueified, last set wins, before the object is flattened or
+ * when the pairs array has to grow.
+ */
+typedef struct ExpandedDynamicHeader
+{
+    // Standard header for expanded objects 
+    ExpandedObjectHeader hdr;
+
+    // Magic value identifying an expanded dynamic (for debugging only) 
+    int ed_magic;
+
+    // The top level container, with room for capacity elements or pairs 
+    dynamic_value root;
+    int capacity;
+
+    // True if pairs were appended since the object was last uniqueified 
+    bool unsorted;
+
+    // The flat value, NULL if root was modified since it was last flattened 
+    dynamic *flat;
+
+    // The flat value the object was expanded from, which root refers into 
+    dynamic *source;
+} ExpandedDynamicHeader;
+
+Datum expand_dynamic(Datum dynamicdatum, MemoryContext parentcontext);
+
+#endif
@@ -31,6 +31,13 @@
 bool ag_serialize_extended_type(StringInfo buffer, gtentry *gtentry,
                                 dynamic_value *scalar_val);
 
+/*
+ * Function returns the number of bytes ag_serialize_extended_type writes for
+ * the scalar, not counting alignment padding. Returns 0 if the type is not
+ * defined.
+ */
+int ag_extended_type_size(dynamic_value *scalar_val);
+
 /*
  * Function deserializes the data from the buffer pointed to by base_addr.
  * NOTE: This function writes to the error log and exits for any UNKNOWN
@@ -39,4 +46,10 @@ bool ag_serialize_extended_type(StringInfo buffer, gtentry *gtentry,
 void ag_deserialize_extended_type(char *base_addr, uint32 offset,
                                   dynamic_value *result);
 
+/*
+ * Function checks that the extended type stored at base_addr + offset is
+ * well formed and occupies exactly len bytes, including alignment padding.
+ */
+bool ag_validate_extended_type(char *base_addr, uint32 offset, uint32 len);
+
 #endif
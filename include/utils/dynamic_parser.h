@@ -58,6 +58,21 @@ typedef enum
     DYNAMIC_TOKEN_END
 } dynamic_token_type;
 
+/*
+ * The digits of a number token as the lexer scanned them. The token's value
+ * is mantissa * 10^exponent, where the mantissa holds the first 19
+ * significant digits. inexact is set when nonzero digits beyond those were
+ * dropped, or when the token is not a decimal number at all (inf, NaN), in
+ * which case the token text has to be converted instead.
+ */
+typedef struct dynamic_number
+{
+    uint64 mantissa;
+    int32 exponent;
+    bool negative;
+    bool inexact;
+} dynamic_number;
+
 /*
  * All the fields in this structure should be treated as read-only.
  *
@@ -70,6 +85,14 @@ typedef enum
  * token_terminator and prev_token_terminator point to the character
  * AFTER the end of the token, i.e. where there would be a nul byte
  * if we were using nul-terminated strings.
+ * number is the scan of the look-ahead token when that is a number, and
+ * scalar_number the scan of the number token being handed to the scalar
+ * action.
+ * If escontext is set, errors in the input are saved there as soft errors
+ * rather than thrown, and parsing stops. The semantic actions may save
+ * errors about the values there too.
+ * arena is the block the lexemes handed to the semantic actions are copied
+ * into, and inc the state kept between chunks by the incremental parser.
  */
 typedef struct dynamic_lex_context
 {
@@ -83,6 +106,13 @@ typedef struct dynamic_lex_context
     int line_number;
     char *line_start;
     StringInfo strval;
+    dynamic_number number;
+    dynamic_number scalar_number;
+    struct Node *escontext;
+    char *arena;
+    int arena_used;
+    int arena_size;
+    struct dynamic_incremental_state *inc;
 } dynamic_lex_context;
 
 typedef void (*dynamic_struct_action)(void *state);
@@ -98,9 +128,10 @@ typedef void (*dynamic_annotation_actions)(void *state, char *anotation);
  * to doing a pure parse with no side-effects, and is therefore exactly
  * what the dynamic input routines do.
  *
- * The 'fname' and 'token' strings passed to these actions are palloc'd.
- * They are not free'd or used further by the parser, so the action function
- * is free to do what it wishes with them.
+ * The 'fname' and 'token' strings passed to these actions are copied into
+ * blocks owned by the lex context, and stay valid as long as it does. They
+ * are not used further by the parser, so the action function may modify
+ * them, but must not pfree them.
  */
 typedef struct dynamic_sem_action
 {
@@ -125,8 +156,21 @@ typedef struct dynamic_sem_action
  * should be passed to them as a member of whatever semstate
  * points to. If the action pointers are NULL the parser
  * does nothing and just continues.
+ *
+ * Returns false if the input was rejected with a soft error, see
+ * escontext above.
  */
-void parse_dynamic(dynamic_lex_context *lex, dynamic_sem_action *sem);
+bool parse_dynamic(dynamic_lex_context *lex, dynamic_sem_action *sem);
+
+/*
+ * parse_dynamic_incremental does the same for input that arrives a chunk at
+ * a time, such as a file being read, so the whole document never has to be
+ * in memory. The lex has to come from make_dynamic_lex_context_incremental().
+ * It is called once per chunk, with is_last set for the final one. Strings
+ * passed to the semantic actions are only good until the action returns.
+ */
+bool parse_dynamic_incremental(dynamic_lex_context *lex, dynamic_sem_action *sem, char *chunk, int len,
+                               bool is_last);
 
 /*
  * constructors for dynamic_lex_context, with or without strval element.
@@ -140,6 +184,15 @@ void parse_dynamic(dynamic_lex_context *lex, dynamic_sem_action *sem);
 dynamic_lex_context *make_dynamic_lex_context(text *t, bool need_escapes);
 dynamic_lex_context *make_dynamic_lex_context_cstring_len(char *str, int len,
                                                         bool need_escapes);
+dynamic_lex_context *make_dynamic_lex_context_incremental(bool need_escapes);
+
+/*
+ * Point a lex made by one of the first two constructors at another input, to
+ * parse a batch of them with one lex. The strval and the lexeme arena are
+ * kept, so the strings handed to the semantic actions for the previous input
+ * are overwritten.
+ */
+void reset_dynamic_lex_context(dynamic_lex_context *lex, char *str, int len);
 
 /*
  * Utility function to check if a string is a valid dynamic number.
@@ -148,6 +201,20 @@ dynamic_lex_context *make_dynamic_lex_context_cstring_len(char *str, int len,
  */
 extern bool is_valid_dynamic_number(const char *str, int len);
 
-extern char *dynamic_encode_date_time(char *buf, Datum value, Oid typid);
+/*
+ * Exact conversions of a scanned number token. They return false when the
+ * scan alone cannot decide the result, and the token text has to be
+ * converted the regular way.
+ */
+extern bool dynamic_number_to_int64(const dynamic_number *num, int64 *result);
+extern bool dynamic_number_to_float8(const dynamic_number *num, float8 *result);
+
+/*
+ * Length of the run at the start of s that a string holds as it is, without
+ * escapes.
+ */
+extern int dynamic_string_plain_len(const char *s, int len);
+
+extern char *dynamic_encode_date_time(char *buf, Datum value, Oid typid, int style);
 
 #endif
@@ -135,9 +135,105 @@ RETURNS NULL ON NULL INPUT
 PARALLEL SAFE
 AS 'MODULE_PATHNAME', 'dynamic_tobox';
 
+CREATE FUNCTION dynamic_to_float8_array(dynamic) RETURNS float8[]
+LANGUAGE C IMMUTABLE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'dynamic_to_float8_array';
+
+CREATE CAST (dynamic as float8[]) WITH FUNCTION dynamic_to_float8_array(dynamic);
+
+CREATE FUNCTION float8_array_to_dynamic(float8[]) RETURNS dynamic
+LANGUAGE C IMMUTABLE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'float8_array_to_dynamic';
+
+CREATE CAST (float8[] as dynamic) WITH FUNCTION float8_array_to_dynamic(float8[]);
+
+CREATE FUNCTION dynamic_to_int8_array(dynamic) RETURNS int8[]
+LANGUAGE C IMMUTABLE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'dynamic_to_int8_array';
+
+CREATE CAST (dynamic as int8[]) WITH FUNCTION dynamic_to_int8_array(dynamic);
+
+CREATE FUNCTION int8_array_to_dynamic(int8[]) RETURNS dynamic
+LANGUAGE C IMMUTABLE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'int8_array_to_dynamic';
+
+CREATE CAST (int8[] as dynamic) WITH FUNCTION int8_array_to_dynamic(int8[]);
+
+CREATE FUNCTION jsonb_to_dynamic(jsonb) RETURNS dynamic
+LANGUAGE C IMMUTABLE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'jsonb_to_dynamic';
+
+CREATE CAST (jsonb as dynamic) WITH FUNCTION jsonb_to_dynamic(jsonb);
+
+CREATE FUNCTION dynamic_to_jsonb(dynamic) RETURNS jsonb
+LANGUAGE C IMMUTABLE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'dynamic_to_jsonb';
+
+CREATE CAST (dynamic as jsonb) WITH FUNCTION dynamic_to_jsonb(dynamic);
+
+CREATE FUNCTION dynamic_to_text(dynamic, compact boolean) RETURNS text
+LANGUAGE C IMMUTABLE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'dynamic_to_text';
+
+CREATE FUNCTION dynamic_to_json(dynamic, compact boolean DEFAULT false) RETURNS json
+LANGUAGE C IMMUTABLE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'dynamic_to_json';
+
 --
 -- Operators
 --
+CREATE FUNCTION dynamic_array_element(dynamic, int4) RETURNS dynamic
+LANGUAGE C IMMUTABLE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'dynamic_array_element';
+
+CREATE OPERATOR -> (
+    FUNCTION = dynamic_array_element,
+    LEFTARG = dynamic,
+    RIGHTARG = int4
+);
+
+CREATE FUNCTION dynamic_object_field(dynamic, text) RETURNS dynamic
+LANGUAGE C IMMUTABLE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'dynamic_object_field';
+
+CREATE OPERATOR -> (
+    FUNCTION = dynamic_object_field,
+    LEFTARG = dynamic,
+    RIGHTARG = text
+);
+
+CREATE FUNCTION dynamic_object_field_text(dynamic, text) RETURNS text
+LANGUAGE C IMMUTABLE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'dynamic_object_field_text';
+
+CREATE OPERATOR ->> (
+    FUNCTION = dynamic_object_field_text,
+    LEFTARG = dynamic,
+    RIGHTARG = text
+);
+
 CREATE FUNCTION dynamic_add(dynamic, dynamic) RETURNS dynamic
 LANGUAGE C IMMUTABLE
 RETURNS NULL ON NULL INPUT
@@ -243,4 +339,83 @@ CREATE FUNCTION lcm(dynamic, dynamic) RETURNS dynamic
 LANGUAGE C IMMUTABLE
 RETURNS NULL ON NULL INPUT
 PARALLEL SAFE
-AS 'MODULE_PATHNAME', 'dynamic_lcm';
\ No newline at end of file
+AS 'MODULE_PATHNAME', 'dynamic_lcm';
+
+--
+-- Object and Array Functions
+--
+CREATE FUNCTION dynamic_expanded_support(internal) RETURNS internal
+LANGUAGE C IMMUTABLE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'dynamic_expanded_support';
+
+CREATE FUNCTION dynamic_set(dynamic, text, dynamic) RETURNS dynamic
+LANGUAGE C IMMUTABLE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+SUPPORT dynamic_expanded_support
+AS 'MODULE_PATHNAME', 'dynamic_set';
+
+CREATE FUNCTION dynamic_append(dynamic, dynamic) RETURNS dynamic
+LANGUAGE C IMMUTABLE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+SUPPORT dynamic_expanded_support
+AS 'MODULE_PATHNAME', 'dynamic_append';
+
+--
+-- Input and Validation Functions
+--
+CREATE FUNCTION dynamic_validate(bytea) RETURNS boolean
+LANGUAGE C IMMUTABLE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'dynamic_validate';
+
+CREATE FUNCTION dynamic_is_valid(text) RETURNS boolean
+LANGUAGE C IMMUTABLE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'dynamic_is_valid';
+
+CREATE FUNCTION dynamic_read_file(text) RETURNS dynamic
+LANGUAGE C VOLATILE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'dynamic_read_file';
+
+CREATE FUNCTION dynamic_in_many(text[]) RETURNS dynamic[]
+LANGUAGE C IMMUTABLE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'dynamic_in_many';
+
+CREATE FUNCTION dynamic_read_ndjson(text) RETURNS SETOF dynamic
+LANGUAGE C VOLATILE
+RETURNS NULL ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'dynamic_read_ndjson';
+
+--
+-- Aggregates
+--
+CREATE FUNCTION dynamic_to_arrow_transfn(internal, dynamic) RETURNS internal
+LANGUAGE C IMMUTABLE
+CALLED ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'dynamic_to_arrow_transfn';
+
+CREATE FUNCTION dynamic_to_arrow_finalfn(internal) RETURNS bytea
+LANGUAGE C IMMUTABLE
+CALLED ON NULL INPUT
+PARALLEL SAFE
+AS 'MODULE_PATHNAME', 'dynamic_to_arrow_finalfn';
+
+CREATE AGGREGATE dynamic_to_arrow(dynamic) (
+    SFUNC = dynamic_to_arrow_transfn,
+    STYPE = internal,
+    FINALFUNC = dynamic_to_arrow_finalfn,
+    FINALFUNC_MODIFY = READ_WRITE,
+    PARALLEL = SAFE
+);
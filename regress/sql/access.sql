@@ -0,0 +1,115 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+--
+-- Object field access
+--
+SELECT '{"a": 1, "bb": [1, 2]}'::dynamic -> 'a', '{"a": 1, "bb": [1, 2]}'::dynamic -> 'bb', '{"a": 1, "bb": [1, 2]}'::dynamic -> 'c';
+SELECT '{"a": "text", "b": 1.5}'::dynamic ->> 'a', '{"a": "text", "b": 1.5}'::dynamic ->> 'b';
+SELECT '[1, 2]'::dynamic -> 'a', '"a"'::dynamic -> 'a';
+
+--
+-- Large values are read in slices
+--
+CREATE TABLE access_table (e dynamic, c dynamic);
+ALTER TABLE access_table ALTER COLUMN e SET STORAGE external;
+INSERT INTO access_table
+SELECT v, v FROM (SELECT dynamic_set(dynamic_set(dynamic_set(dynamic_set(
+    '{"a": 1, "zz": [1, 2, 3, 4]}',
+    'big', ('"' || repeat('x', 10000) || '"')::dynamic),
+    'c', '"c"'),
+    'n', '1.5::numeric'),
+    'o', '{"inner": {"k": true}}') AS v) AS s;
+
+SELECT e -> 'a', e -> 'zz', e ->> 'c', e -> 'n', e -> 'o', e -> 'missing' FROM access_table;
+SELECT c -> 'a', c -> 'zz', c ->> 'c', c -> 'n', c -> 'o', c -> 'missing' FROM access_table;
+SELECT length(e ->> 'big'), length(c ->> 'big') FROM access_table;
+
+DROP TABLE access_table;
+
+--
+-- Large containers store dense offsets
+--
+SELECT a -> 0, a -> 550, a -> -1 FROM (SELECT ('[' || string_agg('"s' || i || '"', ', ' ORDER BY i) || ']')::dynamic AS a FROM generate_series(0, 599) i) AS s;
+SELECT o -> 'k0', o -> 'k550', o ->> 'k599' FROM (SELECT ('{' || string_agg('"k' || i || '": ' || i, ', ') || '}')::dynamic AS o FROM generate_series(0, 599) i) AS s;
+-- in a large array every gtentry holds an offset, in a smaller one only every
+-- GT_OFFSET_STRIDE'th does; HAS_OFF is the high bit of the gtentry
+SELECT n, count(*) FILTER (WHERE get_byte(b, 6 + 4 * i + CASE get_byte(b, 1) WHEN ascii('L') THEN 3 ELSE 0 END) >= 128) AS offsets
+FROM (SELECT n, dynamic_send(('[' || string_agg('"s' || i || '"', ', ') || ']')::dynamic) AS b
+      FROM (VALUES (511), (512)) AS v(n), generate_series(1, n) AS i GROUP BY n) AS s,
+     generate_series(0, n - 1) AS i
+GROUP BY n ORDER BY n;
+
+--
+-- Repeated object keys are stored as references
+--
+SELECT '[{"event_timestamp": 1, "event_category": "a"}, {"event_timestamp": 2, "event_category": "b"}]'::dynamic;
+SELECT d -> 1, d -> 1 ->> 'event_category', d::jsonb, dynamic_validate(dynamic_send(d))
+FROM (SELECT '[{"event_timestamp": 1, "event_category": "a"}, {"event_timestamp": 2, "event_category": "b"}]'::dynamic AS d) AS s;
+SELECT pg_column_size('[{"event_category": 1}, {"event_category": 2}]'::dynamic) <
+       pg_column_size('[{"event_category": 1}, {"event_categorz": 2}]'::dynamic);
+SELECT '{"events": [{"event_category": "a"}, {"event_category": "b"}]}'::dynamic -> 'events';
+-- the references all stay within the fetched array, which is copied as is
+SELECT pg_column_size(e) = pg_column_size('[{"event_category": "a"}, {"event_category": "b"}]'::dynamic),
+       e -> 1 ->> 'event_category', dynamic_validate(dynamic_send(e))
+FROM (SELECT '{"events": [{"event_category": "a"}, {"event_category": "b"}]}'::dynamic -> 'events' AS e) AS s;
+SELECT dynamic_append('[{"event_category": "a"}, {"event_category": "b"}]', '{"event_category": "c"}');
+
+CREATE TABLE access_table (e dynamic, c dynamic);
+ALTER TABLE access_table ALTER COLUMN e SET STORAGE external;
+INSERT INTO access_table
+SELECT v, v FROM (SELECT ('{"n": 1, "events": [' ||
+    string_agg('{"event_category": "cat' || i || '", "event_timestamp": ' || i || '}', ', ' ORDER BY i) ||
+    ']}')::dynamic AS v FROM generate_series(0, 599) i) AS s;
+
+SELECT e -> 'events' -> 599 ->> 'event_category', c -> 'events' -> 0 -> 'event_timestamp' FROM access_table;
+SELECT dynamic_validate(dynamic_send(e)), dynamic_validate(dynamic_send(c)) FROM access_table;
+
+DROP TABLE access_table;
+
+--
+-- Key order, duplicate keys and references in nested objects
+--
+SELECT '{"bb": 1, "a": 2, "bb": 3, "ccc": {"x": 1, "x": [1, 2, 3, 4]}}'::dynamic;
+SELECT d, d -> 1 -> 'x', dynamic_validate(dynamic_send(d))
+FROM (SELECT '[{"event_category": 1}, {"x": {"event_category": 2}, "x": {"event_category": 3}, "event_timestamp": [[{"event_category": 4}]]}]'::dynamic AS d) AS s;
+
+-- objects with many keys are sorted and deduplicated the way jsonb does it
+CREATE TABLE many_keys AS
+SELECT n, '{' || string_agg(format('%s: %s', to_json(k), i), ', ' ORDER BY i) || '}' AS doc
+FROM (SELECT n, i, CASE n WHEN 1 THEN 'key' || (i * 7919 % 150)
+                          WHEN 2 THEN md5((i % 90)::text)
+                          ELSE 'a shared prefix of many bytes ' || (i % 70) END AS k
+      FROM generate_series(1, 3) AS n, generate_series(1, 200) AS i) AS t
+GROUP BY n;
+SELECT n, doc::dynamic::text = doc::jsonb::text AS text_input,
+       dynamic_set(doc::dynamic, 'key7', '0')::text = jsonb_set(doc::jsonb, '{key7}', '0')::text AS set
+FROM many_keys ORDER BY n;
+DROP TABLE many_keys;
+
+-- a value fetched from a value fetched from an array becomes a root object,
+-- whose values must not refer to its keys, and still goes through binary COPY
+SELECT current_setting('data_directory') || '/pg_dynamic_access.bin' AS bin_path \gset
+CREATE TABLE key_ref_table (v dynamic);
+INSERT INTO key_ref_table
+SELECT ('[{"a_long_key_name": 0}, {"x": {"a_long_key_name": {"a_long_key_name": 1}}}]'::dynamic -> 1) -> 'x';
+COPY key_ref_table TO :'bin_path' WITH (FORMAT binary);
+COPY key_ref_table FROM :'bin_path' WITH (FORMAT binary);
+SELECT v, v -> 'a_long_key_name' ->> 'a_long_key_name', dynamic_validate(dynamic_send(v)) FROM key_ref_table;
+DROP TABLE key_ref_table;
@@ -0,0 +1,37 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+--
+-- Scalar annotations
+--
+SELECT '"2020-01-01"::DATE'::dynamic;
+SELECT '"08:00:2b:01:02:03:04:05"::macaddr8'::dynamic;
+SELECT '{"a": "1"::int2, "b": "2.5"::float4, "c": "t"::boolean}'::dynamic;
+SELECT '"(1, 2)"::point'::dynamic;
+SELECT '["[1,2]"::int8range, "[3,4]"::int8range]'::dynamic;
+SELECT '"A0EEBC99-9C0B-4EF8-BB6D-6BB9BD380A11"::uuid'::dynamic;
+SELECT '"abc"::uuid'::dynamic;
+SELECT '"abc"::no_such_type'::dynamic;
+
+--
+-- Scalars are output the way their types output them
+--
+SET DateStyle = 'ISO, YMD';
+SELECT '["2023-06-23 13:39:40.5"::timestamp, "1997-12-17"::date, "07:37:16"::time, 0.1, 1e20, "10.0.0.0/8"::cidr]'::dynamic;
+RESET DateStyle;
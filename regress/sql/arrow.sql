@@ -0,0 +1,54 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+--
+-- Arrow export
+--
+CREATE TABLE arrow_table (id int, d dynamic);
+INSERT INTO arrow_table VALUES
+    (1, '{"i": 1, "f": 1.5, "s": "abc", "b": true, "o": {"x": 1}}'),
+    (2, '{"i": 2.5, "d": "2020-01-01"::date, "t": "2020-01-01 00:00:00"::timestamp}'),
+    (3, NULL),
+    (4, '{"s": null, "z": null}');
+
+-- a schema message, a record batch and the end of stream marker
+SELECT length(a), substring(a from 1 for 4) = '\xffffffff'::bytea AS starts,
+       substring(a from length(a) - 7) = '\xffffffff00000000'::bytea AS ends
+FROM (SELECT dynamic_to_arrow(d ORDER BY id) AS a FROM arrow_table) AS t;
+
+-- the whole stream of a small batch: the schema, then a record batch with
+-- the validity bitmaps, values and string offsets of its two columns
+SELECT i * 32 AS pos, encode(substring(a from i * 32 + 1 for 32), 'hex') AS bytes
+FROM (SELECT dynamic_to_arrow(d ORDER BY id) AS a
+      FROM (VALUES (1, '{"a": 1, "s": "x"}'::dynamic), (2, NULL), (3, '{"a": null, "s": "yz"}')) AS t(id, d)) AS s,
+     generate_series(0, (length(a) - 1) / 32) AS i
+ORDER BY i;
+
+-- no rows
+SELECT dynamic_to_arrow(d) IS NULL AS no_rows FROM arrow_table WHERE false;
+
+--
+-- Errors
+--
+SELECT dynamic_to_arrow(d) FROM (VALUES ('{"a": 1}'::dynamic), ('{"a": "x"}')) AS t(d);
+SELECT dynamic_to_arrow(d) FROM (VALUES ('{"a": [1, 2]}'::dynamic)) AS t(d);
+SELECT dynamic_to_arrow(d) FROM (VALUES ('[1, 2]'::dynamic)) AS t(d);
+SELECT dynamic_to_arrow(d) FROM (VALUES ('{"a": "infinity"::timestamp}'::dynamic)) AS t(d);
+
+DROP TABLE arrow_table;
@@ -0,0 +1,67 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+--
+-- dynamic_set
+--
+SELECT dynamic_set('{"b": 1}', 'a', '[1, 2]');
+SELECT dynamic_set('{"a": 1, "b": 2}', 'a', '3');
+SELECT dynamic_set('{}', 'o', '{"x": [1.5, 2.5, 3.5, 4.5]}');
+SELECT dynamic_set(dynamic_set(dynamic_set('{}', 'bb', '1'), 'a', '"x"'), 'bb', 'null');
+SELECT dynamic_set('[1]', 'a', '1');
+
+--
+-- dynamic_append
+--
+SELECT dynamic_append('[1, 2]', '{"a": 1}');
+SELECT dynamic_append(dynamic_append(dynamic_append('[]', '1'), '2'), '[3]');
+SELECT dynamic_append('{"a": 1}', '1');
+SELECT dynamic_append('1', '1');
+
+--
+-- PL/pgSQL
+--
+CREATE FUNCTION build_object(n int) RETURNS dynamic AS $$
+DECLARE
+    result dynamic := '{}';
+BEGIN
+    FOR i IN 1..n LOOP
+        result := dynamic_set(result, 'k' || (i % 3), i::int8::dynamic);
+    END LOOP;
+    RETURN result;
+END
+$$ LANGUAGE plpgsql;
+
+CREATE FUNCTION build_array(n int) RETURNS dynamic AS $$
+DECLARE
+    result dynamic := '[]';
+BEGIN
+    FOR i IN 1..n LOOP
+        result := dynamic_append(result, i::int8::dynamic);
+    END LOOP;
+    RETURN result;
+END
+$$ LANGUAGE plpgsql;
+
+SELECT build_object(10);
+SELECT build_array(6);
+SELECT build_array(1000)::int8[] = array(SELECT generate_series(1, 1000)::int8);
+
+DROP FUNCTION build_object;
+DROP FUNCTION build_array;
@@ -0,0 +1,46 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+
+--
+-- dynamic_in_many parses a batch of documents with one lex and builder
+--
+SELECT n, d
+FROM unnest(dynamic_in_many(ARRAY['{"b": [1, 2], "a": 1}', '"x"', NULL, '[1.5::numeric, {"c": null}]', '{}']))
+     WITH ORDINALITY AS t(d, n);
+
+-- the results are the same as from the input function
+CREATE TABLE in_many_table AS
+SELECT i, CASE i % 3 WHEN 0 THEN format('[{"a long key name": %s, "other": "x%s"}, {"a long key name": %s}]', i, i, -i)
+                     WHEN 1 THEN format('{"n": %s::numeric, "s": "doc %s", "nested": {"k": [%s, true, null]}}', i, i, i * 0.5)
+                     ELSE i::text END AS doc
+FROM generate_series(1, 1000) AS i;
+SELECT count(*) AS docs, bool_and(d::text = doc::dynamic::text) AS same
+FROM in_many_table
+JOIN unnest((SELECT dynamic_in_many(array_agg(doc ORDER BY i)) FROM in_many_table)) WITH ORDINALITY AS t(d, n)
+  ON n = i;
+
+-- the result has the dimensions of the argument
+SELECT array_dims(dynamic_in_many('[0:1][1:2]={1,2,3,4}'::text[]));
+SELECT cardinality(dynamic_in_many('{}'));
+
+--
+-- Errors
+--
+SELECT dynamic_in_many(ARRAY['1', '{"a": [1, 2}']);
+
+DROP TABLE in_many_table;
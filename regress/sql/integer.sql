@@ -116,3 +116,9 @@ SELECT '-10000'::dynamic / '100'::dynamic;
  SELECT lcm('50::numeric'::dynamic, '100'::dynamic);
  SELECT lcm('-1'::dynamic, '100'::dynamic);
  SELECT lcm('101'::dynamic, '100'::dynamic);
+
+/*
+ * Compact storage
+ */
+SELECT '8388607'::dynamic, '-8388608'::dynamic, '8388608'::dynamic, '2147483648'::dynamic;
+SELECT pg_column_size('1'::dynamic), pg_column_size('8388608'::dynamic), pg_column_size('2147483648'::dynamic);
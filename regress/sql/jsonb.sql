@@ -0,0 +1,34 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+--
+-- jsonb to dynamic
+--
+SELECT '{"a": 1, "b": [true, null, "x", 1.5]}'::jsonb::dynamic;
+SELECT '"abc"'::jsonb::dynamic, '[]'::jsonb::dynamic, 'null'::jsonb::dynamic;
+
+--
+-- dynamic to jsonb
+--
+SELECT '{"a": 1::numeric, "b": [true, null, "x"]}'::dynamic::jsonb;
+SELECT '{"i": 1, "f": 1.5, "ip": "192.168.1.5"::inet, "arr": [1, 2, 3, 4]}'::dynamic::jsonb;
+SELECT '1.5'::dynamic::jsonb, '"abc"'::dynamic::jsonb, '[1, "a"]'::dynamic::jsonb;
+-- floats keep all 17 significant digits
+SELECT '[1.0000000000000002, 0.1, 123456789.12345679]'::dynamic::jsonb;
+SELECT '{"a": [1, {"b": null}], "c": "d"}'::jsonb::dynamic::jsonb;
@@ -0,0 +1,38 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+--
+-- Numbers are converted from the digits the lexer accumulated, check that
+-- the results are the same bits float8in gives
+--
+SELECT v, float8send((('[' || v || ']')::dynamic::float8[])[1]) = float8send(v::float8) AS same
+FROM (VALUES ('0.0'), ('-0.0'), ('0.1'), ('0.3'), ('-2.5e-5'), ('1e23'),
+             ('9007199254740993.0'), ('7.3177701707893310e15'),
+             ('123456789012345678e-30'), ('1.7976931348623157e308'),
+             ('2.2250738585072014e-308'), ('4.9e-324'),
+             ('1.00000000000000011102230246251565404236316680908203125')) AS t(v);
+SELECT '[1.5e3, -2.5e-3, 0.000001, 100000000.000001]'::dynamic;
+
+--
+-- Integers
+--
+SELECT '[9223372036854775807, -9223372036854775808, 0, -0, 120]'::dynamic;
+SELECT '9223372036854775808'::dynamic;
+SELECT '-9223372036854775809'::dynamic;
+SELECT '1e400'::dynamic;
@@ -0,0 +1,39 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+--
+-- Compact output
+--
+SELECT dynamic_to_text('{"a": [1, 2, {"b": null}], "c": "x, y: z"}'::dynamic, true);
+SELECT dynamic_to_text('[[], {}, 1]'::dynamic, true);
+SELECT dynamic_to_text('[[], {}, 1]'::dynamic, false);
+
+--
+-- JSON output
+--
+SELECT dynamic_to_json('{"n": 1.5::numeric, "d": "2020-01-01"::date, "f": "NaN"::float8, "i": 1, "s": "abc"}'::dynamic);
+SELECT dynamic_to_json('["(1, 2)"::point, 2.5, true, null]'::dynamic);
+SELECT dynamic_to_json('1.5::numeric'::dynamic);
+SELECT dynamic_to_json('{"n": 1.5::numeric, "d": "2020-01-01"::date, "f": "Infinity"::float8}'::dynamic)::jsonb;
+
+-- both
+SELECT dynamic_to_json('{"n": -1::numeric, "p": "(1, 2)"::point}'::dynamic, true);
+
+-- the output function always keeps the annotations
+SELECT '{"n": 1.5::numeric, "d": "2020-01-01"::date}'::dynamic;
@@ -0,0 +1,81 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+--
+-- dynamic_read_file parses a file on the server a chunk at a time
+--
+SELECT current_setting('data_directory') || '/pg_dynamic_read_file.dyn' AS path \gset
+COPY (SELECT '{"a": [1, 2.5, "x", null, true], "bb": {"c": false}}') TO :'path';
+SELECT dynamic_read_file(:'path');
+
+-- a document over many chunks, with tokens split between them
+CREATE TABLE read_file_table AS
+SELECT '{"items": [' ||
+       string_agg(format('{"id": %s, "name": "item %s", "tags": ["a", "b"], "price": %s}', i, i, i * 0.25), ', ') ||
+       '], "count": 5000}' AS doc
+FROM generate_series(1, 5000) AS i;
+COPY read_file_table TO :'path';
+SELECT length(doc) > 65536 AS many_chunks, dynamic_read_file(:'path')::text = doc::dynamic::text AS same
+FROM read_file_table;
+
+--
+-- Errors
+--
+COPY (SELECT '{"a": [1, 2}') TO :'path';
+SELECT dynamic_read_file(:'path');
+COPY (SELECT repeat('[', 4098) || repeat(']', 4098)) TO :'path';
+SELECT dynamic_read_file(:'path');
+SELECT dynamic_read_file('/nonexistent/pg_dynamic_read_file.dyn');
+CREATE ROLE regress_read_file_role;
+SET ROLE regress_read_file_role;
+SELECT dynamic_read_file(:'path');
+RESET ROLE;
+DROP ROLE regress_read_file_role;
+
+
+--
+-- dynamic_read_ndjson returns the dynamic on each line of a file
+--
+SELECT current_setting('data_directory') || '/pg_dynamic_read_ndjson.dyn' AS ndjson_path \gset
+COPY (VALUES ('{"b": [true, null], "a": 1}'), (''), ('"x"'), ('[1.5::numeric, {"c": "d"}]')) TO :'ndjson_path';
+SELECT * FROM dynamic_read_ndjson(:'ndjson_path') WITH ORDINALITY;
+
+-- one lex and builder for many lines
+COPY (SELECT format('{"id": %s, "tags": [{"a long key name": %s}, {"a long key name": "x"}]}', i, i)
+      FROM generate_series(1, 10000) AS i) TO :'ndjson_path';
+SELECT count(*) AS lines,
+       bool_and(d::text = format('{"id": %s, "tags": [{"a long key name": %s}, {"a long key name": "x"}]}', i, i)::dynamic::text) AS same
+FROM dynamic_read_ndjson(:'ndjson_path') WITH ORDINALITY AS t(d, i);
+
+-- a line longer than the chunks the file is read in
+COPY (VALUES ((SELECT '[' || string_agg(i::text, ', ') || ']' FROM generate_series(1, 20000) AS i)), ('"end"'))
+    TO :'ndjson_path';
+SELECT i, length(d::text) FROM dynamic_read_ndjson(:'ndjson_path') WITH ORDINALITY AS t(d, i);
+
+-- errors name the line of the file, a relative path is in the data directory
+COPY (VALUES ('1'), ('[1, 2}')) TO :'ndjson_path';
+SELECT * FROM dynamic_read_ndjson('pg_dynamic_read_ndjson.dyn');
+SELECT * FROM dynamic_read_ndjson('/nonexistent/pg_dynamic_read_ndjson.dyn');
+CREATE ROLE regress_read_file_role;
+SET ROLE regress_read_file_role;
+SELECT * FROM dynamic_read_ndjson(:'ndjson_path');
+RESET ROLE;
+DROP ROLE regress_read_file_role;
+
+DROP TABLE read_file_table;
@@ -0,0 +1,35 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+--
+-- Strings are scanned in chunks, so put special characters on both sides
+-- of chunk boundaries
+--
+SELECT '"0123456789abcdef0123456789abcdef"'::dynamic;
+SELECT '"0123456789abcde\"0123456789abcdef\\x"'::dynamic;
+SELECT '"0123456789abcdef\n0123456789abcdef\t"'::dynamic;
+SELECT '"é 0123456789abcdef0123456789 é"'::dynamic;
+SELECT '"€ 0123456789abcdef0123456789abcdef"'::dynamic;
+SELECT '"éééééééééééééééééééé"'::dynamic;
+SELECT '{"0123456789abcdef0123456789abcdef": "0123456789abcdef0123456789abcdef"}'::dynamic;
+
+--
+-- Indented input
+--
+SELECT E'{\n                "a":                [1,\n\t\t\t\t2],\r\n                "b": "c"                }'::dynamic;
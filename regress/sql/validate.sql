@@ -0,0 +1,113 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+--
+-- Values produced by dynamic_send are valid
+--
+SELECT i, dynamic_validate(dynamic_send(v)) AS valid
+FROM (VALUES (1, 'null'::dynamic),
+             (2, '"abc"'::dynamic),
+             (3, '1.5::numeric'::dynamic),
+             (4, '[]'::dynamic),
+             (5, '{}'::dynamic),
+             (6, '[1, 2, 3, 4]'::dynamic),
+             (7, '[1.5, 2.5, 3.5, 4.5]'::dynamic),
+             (8, '{"a": 1, "b": [true, null, "x", 1.5]}'::dynamic),
+             (9, '{"ip": "192.168.1.5"::inet, "b": "(1,1), (2,2)"::box}'::dynamic),
+             (10, '{"a": [1, {"b": null}], "c": "d"}'::dynamic),
+             (11, (SELECT jsonb_agg(g) FROM generate_series(1, 600) g)::dynamic),
+             (12, (SELECT jsonb_object_agg('k' || g, g) FROM generate_series(1, 600) g)::dynamic)) AS t(i, v)
+ORDER BY i;
+SELECT dynamic_validate(NULL);
+
+--
+-- Bad headers and truncated data
+--
+SELECT dynamic_validate(''::bytea);
+SELECT dynamic_validate('\x00'::bytea);
+SELECT dynamic_validate(set_byte(dynamic_send('[1, 2, "abc"]'), 0, 1));
+SELECT dynamic_validate(set_byte(dynamic_send('[1, 2, "abc"]'), 1, ascii('X')));
+SELECT dynamic_validate(substring(dynamic_send('[1, 2, "abc"]') from 1 for 10));
+SELECT dynamic_validate(dynamic_send('[1, 2, "abc"]') || '\x00'::bytea);
+
+--
+-- Corrupted containers
+--
+-- bytes 2-5 are the root header, 6-13 the gtentries, then "ab", two bytes
+-- of padding and the nested object
+SELECT dynamic_validate(dynamic_send('["ab", {"x": 1}]'));
+SELECT dynamic_validate(set_byte(dynamic_send('["ab", {"x": 1}]'), 14, ascii('z')));
+SELECT dynamic_validate(set_byte(dynamic_send('["ab", {"x": 1}]'), 14, 255));
+SELECT dynamic_validate(set_byte(dynamic_send('["ab", {"x": 1}]'), 16, 1));
+SELECT dynamic_validate(set_byte(dynamic_send('["ab", {"x": 1}]'), 5, 0));
+SELECT dynamic_validate(set_byte(dynamic_send('["ab", {"x": 1}]'), 6, 200));
+-- keys start at byte 22 and must stay sorted
+SELECT dynamic_validate(set_byte(dynamic_send('{"a": 1, "b": 2}'), 22, ascii('0')));
+SELECT dynamic_validate(set_byte(dynamic_send('{"a": 1, "b": 2}'), 22, ascii('c')));
+SELECT dynamic_validate(set_byte(dynamic_send('{"a": 1, "b": 2}'), 22, ascii('b')));
+
+--
+-- Corrupted extended types, a raw scalar starts at byte 14
+--
+SELECT dynamic_validate(dynamic_send('"a:1"::tsvector'));
+-- the position of the lexeme, in the high bits of its WordEntry at 22-25
+SELECT dynamic_validate(set_byte(dynamic_send('"a:1"::tsvector'), 25, 255));
+SELECT dynamic_validate(dynamic_send('"[1,5)"::int4range'));
+-- the flags in the last byte
+SELECT dynamic_validate(set_byte(r, length(r) - 1, 32)) FROM dynamic_send('"[1,5)"::int4range') AS r;
+SELECT dynamic_validate(set_byte(r, length(r) - 1, 17)) FROM dynamic_send('"[1,5)"::int4range') AS r;
+-- the type oid at 18-21 turned into int8range's, whose bounds do not fit
+SELECT dynamic_validate(set_byte(dynamic_send('"[1,5)"::int4range'), 18, 86));
+SELECT dynamic_validate(dynamic_send('"a & b"::tsquery'));
+-- the offset of the left operand of the root operator, at 26-29
+SELECT dynamic_validate(set_byte(dynamic_send('"a & b"::tsquery'), 26, 100));
+SELECT dynamic_validate(dynamic_send('"{[1,2), [3,4)}"::int4multirange'));
+-- the length of the first range, at 26-29
+SELECT dynamic_validate(set_byte(dynamic_send('"{[1,2), [3,4)}"::int4multirange'), 29, 127));
+
+--
+-- Checking text input without building the dynamic, only the syntax is
+-- checked so the out of range integer passes
+--
+SELECT dynamic_is_valid('{"a": [1, 2.5, "x\n"], "b": "2020-01-01"::date}');
+SELECT dynamic_is_valid('{"a": [1, 2.5, "x"]');
+SELECT dynamic_is_valid('[1, 2,]');
+SELECT dynamic_is_valid('"\u0000"');
+SELECT dynamic_is_valid('9223372036854775808');
+
+--
+-- Soft errors from the input function
+--
+SELECT pg_input_is_valid('{"a": [1, 2.5, "x"]}', 'dynamic');
+SELECT pg_input_is_valid('{"a": [1, 2.5, "x"]', 'dynamic');
+SELECT pg_input_is_valid('9223372036854775808', 'dynamic');
+SELECT pg_input_is_valid('["abc"::uuid]', 'dynamic');
+SELECT * FROM pg_input_error_info('[1, 2', 'dynamic');
+SELECT * FROM pg_input_error_info('[1, 9223372036854775808]', 'dynamic');
+SELECT * FROM pg_input_error_info('{"a": "abc"::no_such_type}', 'dynamic');
+
+--
+-- Containers nested deeper than DYNAMIC_MAX_DEPTH are rejected wherever the
+-- value comes from
+--
+SELECT dynamic_validate(dynamic_send((repeat('[', 4097) || repeat(']', 4097))::dynamic));
+SELECT dynamic_is_valid(repeat('[', 4098) || repeat(']', 4098));
+SELECT * FROM pg_input_error_info(repeat('[', 4098) || repeat(']', 4098), 'dynamic');
+SELECT * FROM pg_input_error_info(repeat('{"a": ', 4098) || '1' || repeat('}', 4098), 'dynamic');
+SELECT (repeat('[', 4098) || repeat(']', 4098))::jsonb::dynamic;
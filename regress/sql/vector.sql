@@ -0,0 +1,44 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+--
+-- Typecasting
+--
+SELECT '[1.5, 2.5, 3.5, 4.5]'::dynamic::float8[];
+SELECT '[1, 2.5, null]'::dynamic::float8[];
+SELECT '[1, 2, 3, 4, 5]'::dynamic::int8[];
+SELECT '[1, 2.0, 3::numeric]'::dynamic::int8[];
+SELECT '{"a": 1}'::dynamic::int8[];
+
+SELECT '{1.5,2.5,3.5,4.5}'::float8[]::dynamic;
+SELECT '{1,2,3,4,5}'::int8[]::dynamic;
+SELECT '{1,NULL,3}'::int8[]::dynamic;
+
+--
+-- Element access
+--
+SELECT '[10, 20, 30, 40, 50]'::dynamic -> 0, '[10, 20, 30, 40, 50]'::dynamic -> -1, '[10, 20, 30, 40, 50]'::dynamic -> 5;
+SELECT '[1.5, 2.5, 3.5, 4.5]'::dynamic -> 2;
+SELECT '[[1, 2, 3, 4], "a"]'::dynamic -> 0;
+SELECT '{"a": [1, 2, 3, 4]}'::dynamic -> 0;
+
+--
+-- Storage
+--
+SELECT pg_column_size('[1.5, 2.5, 3.5, 4.5]'::dynamic);
@@ -0,0 +1,883 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * dynamic_to_arrow(): an aggregate that exports dynamic objects as an Arrow
+ * IPC stream, so that analytics clients get columns they can use as they are
+ * instead of the text of every row.
+ *
+ * The schema is inferred from the values. Each key of the objects becomes a
+ * nullable field, typed after the values found under it:
+ *
+ *     integer          int64
+ *     float            double, integers and floats can be mixed
+ *     boolean          bool
+ *     string           utf8
+ *     date             date32
+ *     timestamp        timestamp[us]
+ *     timestamptz      timestamp[us, tz=UTC]
+ *     object           struct, with a field for each of its keys
+ *     only nulls       null
+ *
+ * Rows are not kept around. Each value is appended to the buffers of its
+ * field straight from the on-disk container when its row comes in. A field
+ * that first shows up in a later row, or that a row does not have, is caught
+ * up with nulls the next time it is written to, and at the end. The final
+ * function writes the schema and a single record batch with all the rows.
+ *
+ * The flatbuffers of the Arrow metadata are written by hand, see the fb_*
+ * functions.
+ */
+
+#include "postgres.h"
+
+#include "common/int.h"
+#include "datatype/timestamp.h"
+#include "fmgr.h"
+#include "mb/pg_wchar.h"
+#include "miscadmin.h"
+#include "utils/date.h"
+#include "utils/memutils.h"
+
+#include "utils/dynamic.h"
+
+// Arrow IPC constants, from Message.fbs and Schema.fbs of the Arrow format
+#define ARROW_CONTINUATION 0xFFFFFFFF
+#define ARROW_METADATA_V5 4
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_PRECISION_DOUBLE 2
+#define ARROW_DATE_DAY 0
+#define ARROW_TIME_MICROSECOND 2
+
+// the values in the buffers are in the byte order of the server
+#ifdef WORDS_BIGENDIAN
+#define ARROW_ENDIANNESS 1
+#else
+#define ARROW_ENDIANNESS 0
+#endif
+
+typedef enum arrow_column_type
+{
+    COLUMN_NULL,
+    COLUMN_BOOL,
+    COLUMN_INT64,
+    COLUMN_DOUBLE,
+    COLUMN_UTF8,
+    COLUMN_DATE,
+    COLUMN_TIMESTAMP,
+    COLUMN_TIMESTAMPTZ,
+    COLUMN_STRUCT
+} arrow_column_type;
+
+static const struct
+{
+    const char *name;
+    uint8 type_id; // in the Type union of Schema.fbs
+    int width;     // of a fixed width value
+} column_types[] = {
+    [COLUMN_NULL] = {"null", 1, 0},
+    [COLUMN_BOOL] = {"boolean", 6, 0},
+    [COLUMN_INT64] = {"integer", 2, sizeof(int64)},
+    [COLUMN_DOUBLE] = {"float", 3, sizeof(float8)},
+    [COLUMN_UTF8] = {"string", 5, 0},
+    [COLUMN_DATE] = {"date", 8, sizeof(int32)},
+    [COLUMN_TIMESTAMP] = {"timestamp", 10, sizeof(int64)},
+    [COLUMN_TIMESTAMPTZ] = {"timestamptz", 10, sizeof(int64)},
+    [COLUMN_STRUCT] = {"object", 13, 0}
+};
+
+typedef struct arrow_column
+{
+    char *name;
+    int name_len;
+    arrow_column_type type;
+    int64 length;            // values written, nulls included
+    int64 null_count;
+    StringInfoData validity; // a bit for each value, set if it is not null
+    StringInfoData values;   // fixed width values, bits of a bool, or offsets of a utf8
+    StringInfoData chars;    // characters of a utf8
+    struct arrow_column **fields; // of a struct
+    int num_fields;
+    int max_fields;
+    int next_field;          // where looking up the next key starts
+} arrow_column;
+
+typedef struct arrow_state
+{
+    MemoryContext cxt;
+    arrow_column root; // a struct with a value for each row
+} arrow_state;
+
+typedef struct arrow_buffer
+{
+    const char *data;
+    int64 len;
+} arrow_buffer;
+
+typedef struct arrow_batch
+{
+    arrow_column **columns; // in the order of their FieldNodes
+    int num_columns;
+    int max_columns;
+    arrow_buffer *buffers;
+    int num_buffers;
+    int max_buffers;
+    int64 body_len;
+} arrow_batch;
+
+// a field of a flatbuffer table, absent if size is 0
+typedef struct fb_field
+{
+    int size;
+    uint64 value;
+    bool is_offset; // to be set with fb_patch() once what it points to is written
+    int pos;        // set by fb_table()
+} fb_field;
+
+#define FB_SCALAR(size, value) ((fb_field) {(size), (value), false, 0})
+#define FB_OFFSET ((fb_field) {4, 0, true, 0})
+#define FB_ABSENT ((fb_field) {0, 0, false, 0})
+
+static void append_object(arrow_state *state, arrow_column *col, int64 index, dynamic_container *container);
+static void append_value(arrow_state *state, arrow_column *col, int64 index, dynamic_value *v);
+static arrow_column_type column_type_of(arrow_column *col, dynamic_value *v);
+static arrow_column *lookup_field(arrow_state *state, arrow_column *col, char *name, int len);
+static void start_column(arrow_state *state, arrow_column *col, arrow_column_type type);
+static void int64_to_double(arrow_column *col);
+static void append_nulls(arrow_column *col, int64 length);
+static void finish_column(arrow_column *col);
+static void append_zeros(StringInfo buf, Size len);
+static void extend_bitmap(StringInfo buf, int64 nbits);
+static void set_bit(StringInfo buf, int64 i);
+static void collect_buffers(arrow_batch *batch, arrow_column *col);
+static void add_buffer(arrow_batch *batch, const char *data, int64 len);
+static int begin_message(StringInfo fb, uint8 header_type, int64 body_len);
+static void write_schema(StringInfo fb, arrow_column *root);
+static void write_fields(StringInfo fb, int at, arrow_column *col);
+static void write_field(StringInfo fb, int at, arrow_column *col);
+static void write_record_batch(StringInfo fb, arrow_batch *batch, int64 length);
+static char *put_message(char *p, StringInfo fb);
+static char *put_uint32(char *p, uint32 value);
+static int fb_table(StringInfo fb, fb_field *fields, int nfields);
+static int fb_string(StringInfo fb, const char *str, int len);
+static int fb_vector(StringInfo fb, int count, int elem_size, int elem_align);
+static void fb_patch(StringInfo fb, int at, int target);
+static void fb_put(StringInfo fb, int pos, uint64 value, int size);
+static void fb_align(StringInfo fb, int align);
+
+PG_FUNCTION_INFO_V1(dynamic_to_arrow_transfn);
+Datum
+dynamic_to_arrow_transfn(PG_FUNCTION_ARGS) {
+    MemoryContext aggcxt;
+    arrow_state *state;
+
+    if (!AggCheckCallContext(fcinfo, &aggcxt))
+        elog(ERROR, "dynamic_to_arrow_transfn called in non-aggregate context");
+
+    if (PG_ARGISNULL(0)) {
+        state = MemoryContextAllocZero(aggcxt, sizeof(arrow_state));
+        state->cxt = aggcxt;
+        state->root.type = COLUMN_STRUCT;
+    } else {
+        state = (arrow_state *) PG_GETARG_POINTER(0);
+    }
+
+    // A null row has a null in every field
+    if (!PG_ARGISNULL(1)) {
+        dynamic *agt = AG_GET_ARG_DYNAMIC_P(1);
+
+        if (!DYNA_ROOT_IS_OBJECT(agt))
+            ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                            errmsg("dynamic_to_arrow() can only export objects")));
+
+        append_object(state, &state->root, state->root.length, &agt->root);
+    }
+    state->root.length++;
+
+    PG_RETURN_POINTER(state);
+}
+
+PG_FUNCTION_INFO_V1(dynamic_to_arrow_finalfn);
+Datum
+dynamic_to_arrow_finalfn(PG_FUNCTION_ARGS) {
+    arrow_state *state;
+    arrow_batch batch = {0};
+    StringInfoData schema;
+    StringInfoData record_batch;
+    Size size;
+    bytea *result;
+    char *p;
+    int i;
+
+    if (PG_ARGISNULL(0))
+        PG_RETURN_NULL();
+
+    state = (arrow_state *) PG_GETARG_POINTER(0);
+
+    // pads the columns to the batch's length, so the aggregate is FINALFUNC_MODIFY = READ_WRITE
+    finish_column(&state->root);
+
+    for (i = 0; i < state->root.num_fields; i++)
+        collect_buffers(&batch, state->root.fields[i]);
+
+    write_schema(&schema, &state->root);
+    write_record_batch(&record_batch, &batch, state->root.length);
+
+    // both messages, the body and the end of stream marker
+    size = 8 + TYPEALIGN(8, schema.len) + 8 + TYPEALIGN(8, record_batch.len) + batch.body_len + 8;
+    if (size > MaxAllocSize - VARHDRSZ)
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("Arrow stream of %zu bytes is too large for a bytea", size)));
+
+    result = palloc(VARHDRSZ + size);
+    SET_VARSIZE(result, VARHDRSZ + size);
+
+    p = put_message(VARDATA(result), &schema);
+    p = put_message(p, &record_batch);
+    for (i = 0; i < batch.num_buffers; i++) {
+        arrow_buffer *buf = &batch.buffers[i];
+        int64 padded_len = TYPEALIGN(8, buf->len);
+
+        if (buf->len > 0)
+            memcpy(p, buf->data, buf->len);
+        memset(p + buf->len, 0, padded_len - buf->len);
+        p += padded_len;
+    }
+    p = put_uint32(p, ARROW_CONTINUATION);
+    p = put_uint32(p, 0);
+
+    Assert(p == VARDATA(result) + size);
+
+    PG_RETURN_BYTEA_P(result);
+}
+
+/*
+ * Append the pairs of an object to the fields of col, as its index'th value.
+ */
+static void append_object(arrow_state *state, arrow_column *col, int64 index, dynamic_container *container) {
+    dynamic_iterator *it = dynamic_iterator_init(container);
+    dynamic_iterator_token tok;
+    dynamic_value v;
+    arrow_column *field = NULL;
+
+    while ((tok = dynamic_iterator_next(&it, &v, true)) != WGT_DONE) {
+        if (tok == WGT_KEY)
+            field = lookup_field(state, col, v.val.string.val, v.val.string.len);
+        else if (tok == WGT_VALUE)
+            append_value(state, field, index, &v);
+    }
+}
+
+/*
+ * Append v to col as its index'th value.
+ */
+static void append_value(arrow_state *state, arrow_column *col, int64 index, dynamic_value *v) {
+    arrow_column_type type;
+
+    check_stack_depth();
+
+    // the values before it that were missing are nulls
+    append_nulls(col, index);
+
+    if (v->type == DYNAMIC_NULL) {
+        append_nulls(col, index + 1);
+        return;
+    }
+
+    type = column_type_of(col, v);
+    if (col->type == COLUMN_NULL)
+        start_column(state, col, type);
+    else if (col->type == COLUMN_INT64 && type == COLUMN_DOUBLE)
+        int64_to_double(col);
+    else if (col->type != type && !(col->type == COLUMN_DOUBLE && type == COLUMN_INT64))
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                        errmsg("cannot export field \"%s\" to Arrow", col->name),
+                        errdetail("It has both %s and %s values.",
+                                  column_types[col->type].name, column_types[type].name)));
+
+    set_bit(&col->validity, col->length);
+
+    switch (col->type) {
+    case COLUMN_BOOL:
+        extend_bitmap(&col->values, col->length + 1);
+        if (v->val.boolean)
+            set_bit(&col->values, col->length);
+        break;
+    case COLUMN_INT64:
+        appendBinaryStringInfo(&col->values, &v->val.int_value, sizeof(int64));
+        break;
+    case COLUMN_DOUBLE:
+    {
+        float8 value = v->type == DYNAMIC_INTEGER ? (float8) v->val.int_value : v->val.float_value;
+
+        appendBinaryStringInfo(&col->values, &value, sizeof(float8));
+        break;
+    }
+    case COLUMN_UTF8:
+    {
+        char *str = pg_server_to_any(v->val.string.val, v->val.string.len, PG_UTF8);
+        int32 offset;
+
+        appendBinaryStringInfo(&col->chars, str, str == v->val.string.val ? v->val.string.len : strlen(str));
+        offset = col->chars.len;
+        appendBinaryStringInfo(&col->values, &offset, sizeof(int32));
+        break;
+    }
+    case COLUMN_DATE:
+    {
+        int32 days;
+
+        if (DATE_NOT_FINITE(v->val.date))
+            ereport(ERROR, (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+                            errmsg("cannot export infinite date to Arrow")));
+
+        // days since 1970-01-01 instead of 2000-01-01
+        days = v->val.date + (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE);
+        appendBinaryStringInfo(&col->values, &days, sizeof(int32));
+        break;
+    }
+    case COLUMN_TIMESTAMP:
+    case COLUMN_TIMESTAMPTZ:
+    {
+        int64 usecs;
+
+        if (TIMESTAMP_NOT_FINITE(v->val.int_value))
+            ereport(ERROR, (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+                            errmsg("cannot export infinite timestamp to Arrow")));
+
+        // microseconds since 1970-01-01 instead of 2000-01-01
+        if (pg_add_s64_overflow(v->val.int_value,
+                                (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * USECS_PER_DAY, &usecs))
+            ereport(ERROR, (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+                            errmsg("timestamp out of range")));
+
+        appendBinaryStringInfo(&col->values, &usecs, sizeof(int64));
+        break;
+    }
+    case COLUMN_STRUCT:
+        append_object(state, col, col->length, v->val.binary.data);
+        break;
+    case COLUMN_NULL:
+        Assert(false);
+        break;
+    }
+
+    col->length++;
+}
+
+static arrow_column_type column_type_of(arrow_column *col, dynamic_value *v) {
+    switch (v->type) {
+    case DYNAMIC_BOOL:
+        return COLUMN_BOOL;
+    case DYNAMIC_INTEGER:
+        return COLUMN_INT64;
+    case DYNAMIC_FLOAT:
+        return COLUMN_DOUBLE;
+    case DYNAMIC_STRING:
+        return COLUMN_UTF8;
+    case DYNAMIC_DATE:
+        return COLUMN_DATE;
+    case DYNAMIC_TIMESTAMP:
+        return COLUMN_TIMESTAMP;
+    case DYNAMIC_TIMESTAMPTZ:
+        return COLUMN_TIMESTAMPTZ;
+    case DYNAMIC_BINARY:
+        if (DYNAMIC_CONTAINER_IS_OBJECT(v->val.binary.data))
+            return COLUMN_STRUCT;
+        break;
+    default:
+        break;
+    }
+
+    ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                    errmsg("cannot export field \"%s\" to Arrow", col->name),
+                    errdetail("Only null, boolean, integer, float, string, date, timestamp and object values can be exported.")));
+
+    return COLUMN_NULL;
+}
+
+/*
+ * Find the field of a struct column for a key, adding it if it is new.
+ */
+static arrow_column *lookup_field(arrow_state *state, arrow_column *col, char *name, int len) {
+    arrow_column *field;
+    int i;
+
+    // The objects of a column tend to have the same keys, so the next key
+    // is usually the field after the last one found
+    for (i = 0; i < col->num_fields; i++) {
+        int j = (col->next_field + i) % col->num_fields;
+
+        field = col->fields[j];
+        if (field->name_len == len && memcmp(field->name, name, len) == 0) {
+            col->next_field = j + 1;
+            return field;
+        }
+    }
+
+    if (col->num_fields == col->max_fields) {
+        col->max_fields = col->max_fields ? col->max_fields * 2 : 8;
+        if (col->fields)
+            col->fields = repalloc(col->fields, sizeof(arrow_column *) * col->max_fields);
+        else
+            col->fields = MemoryContextAlloc(state->cxt, sizeof(arrow_column *) * col->max_fields);
+    }
+
+    field = MemoryContextAllocZero(state->cxt, sizeof(arrow_column));
+    field->name = MemoryContextAlloc(state->cxt, len + 1);
+    memcpy(field->name, name, len);
+    field->name[len] = '\0';
+    field->name_len = len;
+    field->type = COLUMN_NULL;
+
+    col->fields[col->num_fields++] = field;
+    col->next_field = col->num_fields;
+
+    return field;
+}
+
+/*
+ * Give a column that only had nulls so far its type, and the buffers for it.
+ */
+static void start_column(arrow_state *state, arrow_column *col, arrow_column_type type) {
+    MemoryContext old_cxt = MemoryContextSwitchTo(state->cxt);
+    int64 length = col->length;
+
+    col->type = type;
+    initStringInfo(&col->validity);
+    initStringInfo(&col->values);
+    if (type == COLUMN_UTF8) {
+        int32 offset = 0;
+
+        initStringInfo(&col->chars);
+        appendBinaryStringInfo(&col->values, &offset, sizeof(int32));
+    }
+
+    MemoryContextSwitchTo(old_cxt);
+
+    // write out the nulls so far
+    col->length = 0;
+    col->null_count = 0;
+    append_nulls(col, length);
+}
+
+static void int64_to_double(arrow_column *col) {
+    char *p = col->values.data;
+    int64 i;
+
+    for (i = 0; i < col->length; i++, p += sizeof(int64)) {
+        int64 int_value;
+        float8 value;
+
+        memcpy(&int_value, p, sizeof(int64));
+        value = (float8) int_value;
+        memcpy(p, &value, sizeof(float8));
+    }
+
+    col->type = COLUMN_DOUBLE;
+}
+
+/*
+ * Bring col up to length values with nulls.
+ */
+static void append_nulls(arrow_column *col, int64 length) {
+    int64 n = length - col->length;
+
+    if (n <= 0)
+        return;
+
+    col->length = length;
+    col->null_count += n;
+
+    if (col->type == COLUMN_NULL)
+        return;
+
+    // their validity bits stay unset
+    extend_bitmap(&col->validity, length);
+
+    switch (col->type) {
+    case COLUMN_BOOL:
+        extend_bitmap(&col->values, length);
+        break;
+    case COLUMN_UTF8:
+    {
+        int32 offset = col->chars.len;
+
+        for (; n > 0; n--)
+            appendBinaryStringInfo(&col->values, &offset, sizeof(int32));
+        break;
+    }
+    case COLUMN_STRUCT:
+        // its fields are brought up to length when written to
+        break;
+    default:
+        append_zeros(&col->values, n * column_types[col->type].width);
+        break;
+    }
+}
+
+/*
+ * Bring the fields of structs up to the length of the struct.
+ */
+static void finish_column(arrow_column *col) {
+    int i;
+
+    for (i = 0; i < col->num_fields; i++) {
+        append_nulls(col->fields[i], col->length);
+        finish_column(col->fields[i]);
+    }
+}
+
+static void append_zeros(StringInfo buf, Size len) {
+    if (len >= MaxAllocSize)
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("too many values to export to Arrow")));
+
+    enlargeStringInfo(buf, len);
+    memset(buf->data + buf->len, 0, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+}
+
+static void extend_bitmap(StringInfo buf, int64 nbits) {
+    int64 len = (nbits + 7) / 8;
+
+    if (len > buf->len)
+        append_zeros(buf, len - buf->len);
+}
+
+static void set_bit(StringInfo buf, int64 i) {
+    extend_bitmap(buf, i + 1);
+    buf->data[i / 8] |= 1 << (i % 8);
+}
+
+/*
+ * Add the FieldNode and buffers of a column and of its fields to the record
+ * batch, in the order the format has them.
+ */
+static void collect_buffers(arrow_batch *batch, arrow_column *col) {
+    int i;
+
+    if (batch->num_columns == batch->max_columns) {
+        batch->max_columns = batch->max_columns ? batch->max_columns * 2 : 16;
+        if (batch->columns)
+            batch->columns = repalloc(batch->columns, sizeof(arrow_column *) * batch->max_columns);
+        else
+            batch->columns = palloc(sizeof(arrow_column *) * batch->max_columns);
+    }
+    batch->columns[batch->num_columns++] = col;
+
+    // a null has no buffers at all
+    if (col->type == COLUMN_NULL)
+        return;
+
+    // the validity bitmap can be left out if there are no nulls
+    if (col->null_count == 0)
+        add_buffer(batch, NULL, 0);
+    else
+        add_buffer(batch, col->validity.data, (col->length + 7) / 8);
+
+    switch (col->type) {
+    case COLUMN_BOOL:
+        add_buffer(batch, col->values.data, (col->length + 7) / 8);
+        break;
+    case COLUMN_UTF8:
+        add_buffer(batch, col->values.data, (col->length + 1) * sizeof(int32));
+        add_buffer(batch, col->chars.data, col->chars.len);
+        break;
+    case COLUMN_STRUCT:
+        for (i = 0; i < col->num_fields; i++)
+            collect_buffers(batch, col->fields[i]);
+        break;
+    default:
+        add_buffer(batch, col->values.data, col->length * column_types[col->type].width);
+        break;
+    }
+}
+
+static void add_buffer(arrow_batch *batch, const char *data, int64 len) {
+    if (batch->num_buffers == batch->max_buffers) {
+        batch->max_buffers = batch->max_buffers ? batch->max_buffers * 2 : 32;
+        if (batch->buffers)
+            batch->buffers = repalloc(batch->buffers, sizeof(arrow_buffer) * batch->max_buffers);
+        else
+            batch->buffers = palloc(sizeof(arrow_buffer) * batch->max_buffers);
+    }
+
+    batch->buffers[batch->num_buffers].data = data;
+    batch->buffers[batch->num_buffers].len = len;
+    batch->num_buffers++;
+
+    // each buffer starts 8 byte aligned in the body
+    batch->body_len += TYPEALIGN(8, len);
+}
+
+/*
+ * Start the flatbuffer of a Message, returning where the offset of its header
+ * goes.
+ */
+static int begin_message(StringInfo fb, uint8 header_type, int64 body_len) {
+    fb_field fields[4];
+
+    fields[0] = FB_SCALAR(2, ARROW_METADATA_V5); // version
+    fields[1] = FB_SCALAR(1, header_type);       // header_type
+    fields[2] = FB_OFFSET;                       // header
+    fields[3] = FB_SCALAR(8, body_len);          // bodyLength
+
+    initStringInfo(fb);
+
+    // the offset of the root table
+    append_zeros(fb, 4);
+    fb_patch(fb, 0, fb_table(fb, fields, 4));
+
+    return fields[2].pos;
+}
+
+static void write_schema(StringInfo fb, arrow_column *root) {
+    int header = begin_message(fb, ARROW_HEADER_SCHEMA, 0);
+    fb_field fields[2];
+
+    fields[0] = FB_SCALAR(2, ARROW_ENDIANNESS); // endianness
+    fields[1] = FB_OFFSET;                      // fields
+    fb_patch(fb, header, fb_table(fb, fields, 2));
+
+    write_fields(fb, fields[1].pos, root);
+}
+
+/*
+ * Write the vector of the Fields of a struct column, and its offset at at.
+ */
+static void write_fields(StringInfo fb, int at, arrow_column *col) {
+    int vector = fb_vector(fb, col->num_fields, 4, 4);
+    int i;
+
+    fb_patch(fb, at, vector);
+
+    for (i = 0; i < col->num_fields; i++)
+        write_field(fb, vector + 4 + 4 * i, col->fields[i]);
+}
+
+static void write_field(StringInfo fb, int at, arrow_column *col) {
+    fb_field fields[6];
+    fb_field type[2];
+    int num_type_fields = 0;
+    char *name;
+
+    fields[0] = FB_OFFSET;                                     // name
+    fields[1] = FB_SCALAR(1, true);                            // nullable
+    fields[2] = FB_SCALAR(1, column_types[col->type].type_id); // type_type
+    fields[3] = FB_OFFSET;                                     // type
+    fields[4] = FB_ABSENT;                                     // dictionary
+    fields[5] = FB_OFFSET;                                     // children
+    fb_patch(fb, at, fb_table(fb, fields, 6));
+
+    name = pg_server_to_any(col->name, col->name_len, PG_UTF8);
+    fb_patch(fb, fields[0].pos, fb_string(fb, name, strlen(name)));
+
+    switch (col->type) {
+    case COLUMN_INT64:
+        type[0] = FB_SCALAR(4, 64);   // bitWidth
+        type[1] = FB_SCALAR(1, true); // is_signed
+        num_type_fields = 2;
+        break;
+    case COLUMN_DOUBLE:
+        type[0] = FB_SCALAR(2, ARROW_PRECISION_DOUBLE); // precision
+        num_type_fields = 1;
+        break;
+    case COLUMN_DATE:
+        type[0] = FB_SCALAR(2, ARROW_DATE_DAY); // unit
+        num_type_fields = 1;
+        break;
+    case COLUMN_TIMESTAMP:
+        type[0] = FB_SCALAR(2, ARROW_TIME_MICROSECOND); // unit
+        num_type_fields = 1;
+        break;
+    case COLUMN_TIMESTAMPTZ:
+        type[0] = FB_SCALAR(2, ARROW_TIME_MICROSECOND); // unit
+        type[1] = FB_OFFSET;                            // timezone
+        num_type_fields = 2;
+        break;
+    default:
+        // the other types have no parameters
+        break;
+    }
+    fb_patch(fb, fields[3].pos, fb_table(fb, type, num_type_fields));
+
+    if (col->type == COLUMN_TIMESTAMPTZ)
+        fb_patch(fb, type[1].pos, fb_string(fb, "UTC", 3));
+
+    write_fields(fb, fields[5].pos, col);
+}
+
+static void write_record_batch(StringInfo fb, arrow_batch *batch, int64 length) {
+    int header = begin_message(fb, ARROW_HEADER_RECORD_BATCH, batch->body_len);
+    fb_field fields[3];
+    int64 offset = 0;
+    int vector;
+    int i;
+
+    fields[0] = FB_SCALAR(8, length); // length
+    fields[1] = FB_OFFSET;            // nodes
+    fields[2] = FB_OFFSET;            // buffers
+    fb_patch(fb, header, fb_table(fb, fields, 3));
+
+    // FieldNode structs of length and null_count
+    vector = fb_vector(fb, batch->num_columns, 16, 8);
+    fb_patch(fb, fields[1].pos, vector);
+    for (i = 0; i < batch->num_columns; i++) {
+        fb_put(fb, vector + 4 + 16 * i, batch->columns[i]->length, 8);
+        fb_put(fb, vector + 12 + 16 * i, batch->columns[i]->null_count, 8);
+    }
+
+    // Buffer structs of offset and length
+    vector = fb_vector(fb, batch->num_buffers, 16, 8);
+    fb_patch(fb, fields[2].pos, vector);
+    for (i = 0; i < batch->num_buffers; i++) {
+        fb_put(fb, vector + 4 + 16 * i, offset, 8);
+        fb_put(fb, vector + 12 + 16 * i, batch->buffers[i].len, 8);
+        offset += TYPEALIGN(8, batch->buffers[i].len);
+    }
+}
+
+/*
+ * Write an encapsulated message: a continuation marker, the length of the
+ * metadata padded to 8 bytes, and the metadata.
+ */
+static char *put_message(char *p, StringInfo fb) {
+    int len = TYPEALIGN(8, fb->len);
+
+    p = put_uint32(p, ARROW_CONTINUATION);
+    p = put_uint32(p, len);
+    memcpy(p, fb->data, fb->len);
+    memset(p + fb->len, 0, len - fb->len);
+
+    return p + len;
+}
+
+static char *put_uint32(char *p, uint32 value) {
+    int i;
+
+    for (i = 0; i < 4; i++)
+        p[i] = (value >> (8 * i)) & 0xff;
+
+    return p + 4;
+}
+
+/*
+ * Flatbuffers are written front to back, so that the offsets from a table to
+ * what it points to, which have to be positive, can be patched in once that
+ * is written after it.
+ */
+
+/*
+ * Write a vtable and the table it describes, setting the pos of the fields to
+ * where they were put. Returns the position of the table.
+ */
+static int fb_table(StringInfo fb, fb_field *fields, int nfields) {
+    static const int sizes[] = {4, 8, 2, 1};
+    int inline_size = 4; // the table starts with the offset of its vtable
+    int vtable;
+    int table;
+    int i;
+    int j;
+
+    // lay out the fields after it with as little padding as possible
+    for (j = 0; j < lengthof(sizes); j++) {
+        for (i = 0; i < nfields; i++) {
+            if (fields[i].size != sizes[j])
+                continue;
+            inline_size = TYPEALIGN(sizes[j], inline_size);
+            fields[i].pos = inline_size;
+            inline_size += sizes[j];
+        }
+    }
+
+    fb_align(fb, 2);
+    vtable = fb->len;
+    append_zeros(fb, 4 + 2 * nfields);
+    fb_put(fb, vtable, 4 + 2 * nfields, 2);
+    fb_put(fb, vtable + 2, inline_size, 2);
+    for (i = 0; i < nfields; i++)
+        if (fields[i].size > 0)
+            fb_put(fb, vtable + 4 + 2 * i, fields[i].pos, 2);
+
+    fb_align(fb, 8);
+    table = fb->len;
+    append_zeros(fb, inline_size);
+    fb_put(fb, table, table - vtable, 4);
+    for (i = 0; i < nfields; i++) {
+        if (fields[i].size == 0)
+            continue;
+        fields[i].pos += table;
+        if (!fields[i].is_offset)
+            fb_put(fb, fields[i].pos, fields[i].value, fields[i].size);
+    }
+
+    return table;
+}
+
+static int fb_string(StringInfo fb, const char *str, int len) {
+    int pos;
+
+    fb_align(fb, 4);
+    pos = fb->len;
+    append_zeros(fb, 4);
+    fb_put(fb, pos, len, 4);
+    appendBinaryStringInfo(fb, str, len);
+    appendStringInfoChar(fb, '\0');
+
+    return pos;
+}
+
+/*
+ * Write a vector with room for count elements, aligned to elem_align, to be
+ * filled in by the caller. Returns the position of its length, which the
+ * elements follow.
+ */
+static int fb_vector(StringInfo fb, int count, int elem_size, int elem_align) {
+    int pos;
+
+    fb_align(fb, 4);
+    if ((fb->len + 4) % elem_align != 0)
+        append_zeros(fb, elem_align - (fb->len + 4) % elem_align);
+    pos = fb->len;
+    append_zeros(fb, 4 + (Size) count * elem_size);
+    fb_put(fb, pos, count, 4);
+
+    return pos;
+}
+
+static void fb_patch(StringInfo fb, int at, int target) {
+    Assert(target > at);
+    fb_put(fb, at, target - at, 4);
+}
+
+// flatbuffers are little endian
+static void fb_put(StringInfo fb, int pos, uint64 value, int size) {
+    int i;
+
+    for (i = 0; i < size; i++)
+        fb->data[pos + i] = (value >> (8 * i)) & 0xff;
+}
+
+static void fb_align(StringInfo fb, int align) {
+    if (fb->len % align != 0)
+        append_zeros(fb, align - fb->len % align);
+}
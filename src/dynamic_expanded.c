@@ -0,0 +1,424 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Expanded dynamic objects, and the functions that modify them in place.
+ *
+ * Building an object key by key with dynamic_set used to deserialize and
+ * reserialize the whole value on each call. Chained calls, and PL/pgSQL
+ * assignments where the server passes us the variable read/write, now
+ * append to the expanded object and it is only flattened once, when the
+ * value is stored or handed to a function that needs the flat format.
+ */
+
+#include "postgres.h"
+
+#include "nodes/nodeFuncs.h"
+#include "nodes/supportnodes.h"
+#include "utils/builtins.h"
+#include "utils/expandeddatum.h"
+#include "utils/memutils.h"
+#include "fmgr.h"
+
+#include "utils/dynamic.h"
+#include "utils/dynamic_expanded.h"
+
+static Size EDY_get_flat_size(ExpandedObjectHeader *eohptr);
+static void EDY_flatten_into(ExpandedObjectHeader *eohptr, void *result, Size allocated_size);
+
+static const ExpandedObjectMethods EDY_methods =
+{
+    EDY_get_flat_size,
+    EDY_flatten_into
+};
+
+static dynamic *flatten_expanded_dynamic(ExpandedDynamicHeader *edh);
+static void uniqueify_expanded_dynamic(ExpandedDynamicHeader *edh);
+static void make_room_expanded_dynamic(ExpandedDynamicHeader *edh);
+static void modified_expanded_dynamic(ExpandedDynamicHeader *edh);
+static ExpandedDynamicHeader *get_expanded_dynamic_arg(FunctionCallInfo fcinfo, int argno);
+static void get_expanded_dynamic_value(ExpandedDynamicHeader *edh, Datum d, dynamic_value *result);
+
+/*
+ * Expand a dynamic datum into a new expanded object, a child of
+ * parentcontext. Only the top level container is unpacked.
+ */
+Datum expand_dynamic(Datum dynamicdatum, MemoryContext parentcontext)
+{
+    ExpandedDynamicHeader *edh;
+    MemoryContext objcxt;
+    MemoryContext oldcxt;
+    dynamic_iterator *it;
+    dynamic_iterator_token tok;
+    dynamic_value v;
+    dynamic *agt;
+    int n = 0;
+
+    objcxt = AllocSetContextCreate(parentcontext, "expanded dynamic",
+                                   ALLOCSET_START_SMALL_SIZES);
+
+    edh = (ExpandedDynamicHeader *) MemoryContextAlloc(objcxt, sizeof(ExpandedDynamicHeader));
+
+    EOH_init_header(&edh->hdr, &EDY_methods, objcxt);
+    edh->ed_magic = EDYNAMIC_MAGIC;
+
+    oldcxt = MemoryContextSwitchTo(objcxt);
+
+    /*
+     * The unpacked values point into the flat value, so it has to live as
+     * long as the expanded object. This also flattens a read-only expanded
+     * dynamic given to us, which is cheap when it has not been modified since
+     * it was last flattened.
+     */
+    agt = (dynamic *) PG_DETOAST_DATUM_COPY(dynamicdatum);
+
+    edh->source = agt;
+    edh->flat = agt;
+    edh->unsorted = false;
+    edh->capacity = Max(DYNA_ROOT_COUNT(agt), 8);
+
+    if (DYNA_ROOT_IS_OBJECT(agt))
+    {
+        edh->root.type = DYNAMIC_OBJECT;
+        edh->root.val.object.num_pairs = 0;
+        edh->root.val.object.pairs = palloc(sizeof(dynamic_pair) * edh->capacity);
+    }
+    else
+    {
+        edh->root.type = DYNAMIC_ARRAY;
+        edh->root.val.array.num_elems = 0;
+        edh->root.val.array.raw_scalar = DYNA_ROOT_IS_SCALAR(agt);
+        edh->root.val.array.elems = palloc(sizeof(dynamic_value) * edh->capacity);
+    }
+
+    it = dynamic_iterator_init(&agt->root);
+    while ((tok = dynamic_iterator_next(&it, &v, true)) != WGT_DONE)
+    {
+        switch (tok)
+        {
+        case WGT_KEY:
+            edh->root.val.object.pairs[n].key = v;
+            edh->root.val.object.pairs[n].order = n;
+            break;
+        case WGT_VALUE:
+            edh->root.val.object.pairs[n++].value = v;
+            edh->root.val.object.num_pairs = n;
+            break;
+        case WGT_ELEM:
+        case WGT_VECTOR_VALUE:
+            edh->root.val.array.elems[n++] = v;
+            edh->root.val.array.num_elems = n;
+            break;
+        default:
+            break;
+        }
+    }
+
+    MemoryContextSwitchTo(oldcxt);
+
+    return EOHPGetRWDatum(&edh->hdr);
+}
+
+static Size EDY_get_flat_size(ExpandedObjectHeader *eohptr)
+{
+    ExpandedDynamicHeader *edh = (ExpandedDynamicHeader *) eohptr;
+
+    Assert(edh->ed_magic == EDYNAMIC_MAGIC);
+
+    return VARSIZE(flatten_expanded_dynamic(edh));
+}
+
+static void EDY_flatten_into(ExpandedObjectHeader *eohptr, void *result, Size allocated_size)
+{
+    ExpandedDynamicHeader *edh = (ExpandedDynamicHeader *) eohptr;
+    dynamic *flat;
+
+    Assert(edh->ed_magic == EDYNAMIC_MAGIC);
+
+    // get_flat_size was called first, so this only returns the cached value 
+    flat = flatten_expanded_dynamic(edh);
+
+    Assert(allocated_size == VARSIZE(flat));
+    memcpy(result, flat, allocated_size);
+}
+
+/*
+ * Serialize the expanded object, unless that was already done since it was
+ * last modified. The result lives in the object's memory context.
+ */
+static dynamic *flatten_expanded_dynamic(ExpandedDynamicHeader *edh)
+{
+    MemoryContext oldcxt;
+
+    if (edh->flat != NULL)
+        return edh->flat;
+
+    oldcxt = MemoryContextSwitchTo(edh->hdr.eoh_context);
+
+    uniqueify_expanded_dynamic(edh);
+    edh->flat = dynamic_value_to_dynamic(&edh->root);
+
+    MemoryContextSwitchTo(oldcxt);
+
+    return edh->flat;
+}
+
+/*
+ * Sort and uniqueify the pairs of an object. The surviving pairs are
+ * renumbered, so that pairs appended afterwards still win over them.
+ */
+static void uniqueify_expanded_dynamic(ExpandedDynamicHeader *edh)
+{
+    int i;
+
+    if (!edh->unsorted)
+        return;
+
+    uniqueify_dynamic_object(&edh->root);
+
+    for (i = 0; i < edh->root.val.object.num_pairs; i++)
+        edh->root.val.object.pairs[i].order = i;
+
+    edh->unsorted = false;
+}
+
+/*
+ * Make sure there is room for one more element or pair. Duplicate keys are
+ * dropped before an object's pairs are allowed to grow, so setting the same
+ * keys over and over does not use more and more memory.
+ */
+static void make_room_expanded_dynamic(ExpandedDynamicHeader *edh)
+{
+    int count;
+
+    if (edh->root.type == DYNAMIC_OBJECT)
+    {
+        count = edh->root.val.object.num_pairs;
+
+        if (count >= DYNAMIC_MAX_PAIRS)
+            ereport(ERROR,
+                    (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                     errmsg("number of dynamic object pairs exceeds the maximum allowed (%zu)",
+                            DYNAMIC_MAX_PAIRS)));
+
+        if (count < edh->capacity)
+            return;
+
+        uniqueify_expanded_dynamic(edh);
+
+        if (edh->root.val.object.num_pairs <= edh->capacity / 2)
+            return;
+
+        edh->capacity *= 2;
+        edh->root.val.object.pairs = repalloc(edh->root.val.object.pairs,
+                                              sizeof(dynamic_pair) * edh->capacity);
+    }
+    else
+    {
+        count = edh->root.val.array.num_elems;
+
+        if (count >= DYNAMIC_MAX_ELEMS)
+            ereport(ERROR,
+                    (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                     errmsg("number of dynamic array elements exceeds the maximum allowed (%zu)",
+                            DYNAMIC_MAX_ELEMS)));
+
+        if (count < edh->capacity)
+            return;
+
+        edh->capacity *= 2;
+        edh->root.val.array.elems = repalloc(edh->root.val.array.elems,
+                                             sizeof(dynamic_value) * edh->capacity);
+    }
+}
+
+/*
+ * Forget the flat value after root was changed. The source value is still
+ * referenced by root and must be kept.
+ */
+static void modified_expanded_dynamic(ExpandedDynamicHeader *edh)
+{
+    if (edh->flat != NULL && edh->flat != edh->source)
+        pfree(edh->flat);
+
+    edh->flat = NULL;
+}
+
+/*
+ * Get argument argno as an expanded dynamic we are allowed to modify. A
+ * read/write expanded pointer is ours to change; anything else, including a
+ * read-only expanded pointer, is expanded into a new object.
+ */
+static ExpandedDynamicHeader *get_expanded_dynamic_arg(FunctionCallInfo fcinfo, int argno)
+{
+    Datum d = PG_GETARG_DATUM(argno);
+
+    if (VARATT_IS_EXTERNAL_EXPANDED_RW(DatumGetPointer(d)))
+    {
+        ExpandedDynamicHeader *edh = (ExpandedDynamicHeader *) DatumGetEOHP(d);
+
+        Assert(edh->ed_magic == EDYNAMIC_MAGIC);
+        return edh;
+    }
+
+    return (ExpandedDynamicHeader *) DatumGetEOHP(expand_dynamic(d, CurrentMemoryContext));
+}
+
+/*
+ * Turn a dynamic datum into a value that can be stored in the expanded
+ * object. The datum is copied into the object's memory context; containers
+ * are kept in their serialized form.
+ */
+static void get_expanded_dynamic_value(ExpandedDynamicHeader *edh, Datum d, dynamic_value *result)
+{
+    MemoryContext oldcxt;
+    dynamic *agt;
+
+    oldcxt = MemoryContextSwitchTo(edh->hdr.eoh_context);
+
+    agt = (dynamic *) PG_DETOAST_DATUM_COPY(d);
+
+    if (DYNA_ROOT_IS_SCALAR(agt))
+    {
+        *result = *get_ith_dynamic_value_from_container(&agt->root, 0);
+    }
+    else
+    {
+        result->type = DYNAMIC_BINARY;
+        result->val.binary.data = &agt->root;
+        result->val.binary.len = VARSIZE(agt) - VARHDRSZ;
+    }
+
+    MemoryContextSwitchTo(oldcxt);
+}
+
+/*
+ * dynamic_set(object, key, value): set a key of an object, replacing any
+ * value it already has.
+ */
+PG_FUNCTION_INFO_V1(dynamic_set);
+
+Datum dynamic_set(PG_FUNCTION_ARGS)
+{
+    ExpandedDynamicHeader *edh = get_expanded_dynamic_arg(fcinfo, 0);
+    text *key = PG_GETARG_TEXT_PP(1);
+    dynamic_pair *pair;
+
+    if (edh->root.type != DYNAMIC_OBJECT)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("cannot set a key on a non-object dynamic")));
+
+    make_room_expanded_dynamic(edh);
+
+    pair = &edh->root.val.object.pairs[edh->root.val.object.num_pairs];
+
+    pair->key.type = DYNAMIC_STRING;
+    pair->key.val.string.len = VARSIZE_ANY_EXHDR(key);
+    pair->key.val.string.val = MemoryContextAlloc(edh->hdr.eoh_context,
+                                                  pair->key.val.string.len);
+    memcpy(pair->key.val.string.val, VARDATA_ANY(key), pair->key.val.string.len);
+
+    get_expanded_dynamic_value(edh, PG_GETARG_DATUM(2), &pair->value);
+
+    pair->order = edh->root.val.object.num_pairs;
+    edh->root.val.object.num_pairs++;
+
+    edh->unsorted = true;
+    modified_expanded_dynamic(edh);
+
+    PG_RETURN_DATUM(EOHPGetRWDatum(&edh->hdr));
+}
+
+/*
+ * dynamic_append(array, value): add an element to the end of an array.
+ */
+PG_FUNCTION_INFO_V1(dynamic_append);
+
+Datum dynamic_append(PG_FUNCTION_ARGS)
+{
+    ExpandedDynamicHeader *edh = get_expanded_dynamic_arg(fcinfo, 0);
+
+    if (edh->root.type != DYNAMIC_ARRAY || edh->root.val.array.raw_scalar)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("cannot append to a non-array dynamic")));
+
+    make_room_expanded_dynamic(edh);
+
+    get_expanded_dynamic_value(edh, PG_GETARG_DATUM(1),
+                               &edh->root.val.array.elems[edh->root.val.array.num_elems]);
+    edh->root.val.array.num_elems++;
+
+    modified_expanded_dynamic(edh);
+
+    PG_RETURN_DATUM(EOHPGetRWDatum(&edh->hdr));
+}
+
+#if PG_VERSION_NUM >= 180000
+static bool param_is_referenced(Node *node, int *paramid)
+{
+    if (node == NULL)
+        return false;
+
+    if (IsA(node, Param))
+        return ((Param *) node)->paramkind == PARAM_EXTERN &&
+               ((Param *) node)->paramid == *paramid;
+
+    return expression_tree_walker(node, param_is_referenced, paramid);
+}
+#endif
+
+/*
+ * Planner support function for dynamic_set and dynamic_append. Servers that
+ * ask support functions about in-place modification (PostgreSQL 18 on) will
+ * then pass a PL/pgSQL variable read/write in "x := dynamic_set(x, ...)", so
+ * a loop appends to the variable's expanded object instead of copying it.
+ * Older servers only do this for a fixed set of built-in functions.
+ */
+PG_FUNCTION_INFO_V1(dynamic_expanded_support);
+
+Datum dynamic_expanded_support(PG_FUNCTION_ARGS)
+{
+    Node *ret = NULL;
+
+#if PG_VERSION_NUM >= 180000
+    Node *rawreq = (Node *) PG_GETARG_POINTER(0);
+
+    if (IsA(rawreq, SupportRequestModifyInPlace))
+    {
+        SupportRequestModifyInPlace *req = (SupportRequestModifyInPlace *) rawreq;
+        Param *arg = linitial(req->args);
+        ListCell *lc;
+
+        // The variable must be the first argument and appear nowhere else
+        if (arg && IsA(arg, Param) && arg->paramkind == PARAM_EXTERN &&
+            arg->paramid == req->paramid)
+        {
+            ret = (Node *) arg;
+
+            for_each_from(lc, req->args, 1)
+            {
+                if (param_is_referenced(lfirst(lc), &req->paramid))
+                    ret = NULL;
+            }
+        }
+    }
+#endif
+
+    PG_RETURN_POINTER(ret);
+}
@@ -57,7 +57,7 @@ int8_to_dynamic(PG_FUNCTION_ARGS) {
         .val.int_value = PG_GETARG_INT64(0)
     };
 
-    AG_RETURN_DYNAMIC_P(dynamic_value_to_dynamic(&gtv));
+    AG_RETURN_DYNAMIC_P(scalar_value_to_dynamic(&gtv));
 }
 
 PG_FUNCTION_INFO_V1(dynamic_tobigint);
@@ -72,7 +72,7 @@ dynamic_tobigint(PG_FUNCTION_ARGS) {
 
     PG_FREE_IF_COPY(agt, 0);
 
-    AG_RETURN_DYNAMIC_P(dynamic_value_to_dynamic(&gtv));
+    AG_RETURN_DYNAMIC_P(scalar_value_to_dynamic(&gtv));
 }
 
 Datum
@@ -107,7 +107,7 @@ dynamic_abs(PG_FUNCTION_ARGS) {
 
     PG_FREE_IF_COPY(agt, 0);
 
-    AG_RETURN_DYNAMIC_P(dynamic_value_to_dynamic(&gtv));
+    AG_RETURN_DYNAMIC_P(scalar_value_to_dynamic(&gtv));
 }
 
 
@@ -127,7 +127,7 @@ dynamic_gcd(PG_FUNCTION_ARGS) {
     PG_FREE_IF_COPY(agt_0, 0);
     PG_FREE_IF_COPY(agt_1, 0);
     
-    AG_RETURN_DYNAMIC_P(dynamic_value_to_dynamic(&gtv));
+    AG_RETURN_DYNAMIC_P(scalar_value_to_dynamic(&gtv));
 }
 
 PG_FUNCTION_INFO_V1(dynamic_lcm);
@@ -146,6 +146,6 @@ dynamic_lcm(PG_FUNCTION_ARGS) {
     PG_FREE_IF_COPY(agt_0, 0);
     PG_FREE_IF_COPY(agt_1, 0);
     
-    AG_RETURN_DYNAMIC_P(dynamic_value_to_dynamic(&gtv));
+    AG_RETURN_DYNAMIC_P(scalar_value_to_dynamic(&gtv));
 }
 
@@ -34,26 +34,36 @@
 #include "catalog/pg_operator.h"
 #include "catalog/pg_type.h"
 #include "catalog/pg_aggregate_d.h"
+#include "catalog/pg_authid.h"
 #include "catalog/pg_collation_d.h"
 #include "catalog/pg_operator_d.h"
+#include "common/shortest_dec.h"
 #include "executor/nodeAgg.h"
 #include "funcapi.h"
 #include "libpq/pqformat.h"
+#include "mb/pg_wchar.h"
 #include "miscadmin.h"
 #include "parser/parse_coerce.h"
+#include "parser/parse_type.h"
 #include "portability/instr_time.h"
+#include "nodes/miscnodes.h"
 #include "nodes/pg_list.h"
+#include "storage/fd.h"
+#include "utils/acl.h"
 #include "utils/builtins.h"
+#include "utils/datetime.h"
 #include "utils/float.h"
 #include "utils/fmgroids.h"
 //#include "utils/int8.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/snapmgr.h"
 #include "utils/timestamp.h"
 #include "utils/typcache.h"
 
 #include "utils/dynamic.h"
+#include "utils/dynamic_ext.h"
 #include "utils/dynamic_parser.h"
 #include "dynamic_typecasting.h"
 
@@ -86,7 +96,49 @@ typedef enum // type categories for
     AGT_TYPE_OTHER // all else 
 } agt_type_category;
 
+// the size of the buffer float8out() formats into
+#define DYNAMIC_FLOAT_OUT_LEN 32
+
+/*
+ * The length dynamic_text_size() expects the text of a container to have,
+ * limited to what a StringInfo can be enlarged to.
+ */
+#define DYNAMIC_TEXT_SIZE(container, compact, json) \
+    ((int) Min(dynamic_text_size(container, (compact) ? 1 : 2, json), MaxAllocSize - 1))
+
+// typical lengths of the output of these types, for dynamic_text_size()
+#define DYNAMIC_FLOAT_TEXT_LEN 20
+#define DYNAMIC_TIMESTAMP_TEXT_LEN 40
+#define DYNAMIC_DATE_TEXT_LEN 10
+#define DYNAMIC_TIME_TEXT_LEN 24
+
+// how much of a file dynamic_read_file() and dynamic_read_ndjson() read at a time
+#define DYNAMIC_READ_CHUNK_SIZE 65536
+
+/*
+ * What dynamic_read_ndjson() keeps between calls: the open file, the part of
+ * it read but not parsed yet, and the lex and builder every line is parsed
+ * with.
+ */
+typedef struct dynamic_ndjson_state
+{
+    char *filename;
+    FILE *file;
+    StringInfoData buf;
+    int pos;       // where the next line starts in buf
+    int scanned;   // how far from pos buf is known to hold no newline
+    int64 line_number; // of the line being parsed
+    dynamic_lex_context *lex;
+    dynamic_in_state in;
+    dynamic_sem_action sem;
+} dynamic_ndjson_state;
+
 size_t check_string_length(size_t len);
+static void dynamic_in_init(dynamic_in_state *state, dynamic_sem_action *sem, dynamic_lex_context *lex,
+                            Node *escontext);
+static void check_read_server_files(void);
+static bool dynamic_ndjson_next_line(dynamic_ndjson_state *state, char **line, int *len);
+static void dynamic_ndjson_error_callback(void *arg);
 static void dynamic_in_object_start(void *pstate);
 static void dynamic_in_object_end(void *pstate);
 static void dynamic_in_array_start(void *pstate);
@@ -94,10 +146,28 @@ static void dynamic_in_array_end(void *pstate);
 static void dynamic_in_object_field_start(void *pstate, char *fname, bool isnull);
 static void dynamic_put_array(StringInfo out, dynamic_value *scalar_val);
 static void dynamic_put_object(StringInfo out, dynamic_value *scalar_val);
-static void escape_dynamic(StringInfo buf, const char *str);
+static void escape_dynamic(StringInfo buf, const char *str, int len);
+static void append_integer(StringInfo out, int64 val);
+static void append_float(StringInfo out, float8 val);
+static int format_float(char *buf, float8 val);
+static void append_date_time(StringInfo out, Datum value, Oid typid);
+static void append_inet(StringInfo out, inet *ip, bool is_cidr);
 bool is_decimal_needed(char *numstr);
 static void dynamic_in_scalar(void *pstate, char *token, dynamic_token_type tokentype, char *annotation);
-static char *dynamic_to_cstring_worker(StringInfo out, dynamic_container *in, int estimated_len, bool indent);
+static dynamic_token_type annotation_token_type(const char *annotation);
+static bool annotated_scalar_value(dynamic_in_state *state, char *token, char *annotation,
+                                   dynamic_value *result);
+static bool scalar_input(dynamic_in_state *state, PGFunction func, char *token, Datum *result);
+static char *dynamic_to_cstring_worker(StringInfo out, dynamic_container *in, int estimated_len, bool indent,
+                                       bool compact, bool json);
+static void put_output_value(StringInfo out, dynamic_value *v, bool json);
+static void put_quoted_value(StringInfo out, dynamic_value *v);
+static Size dynamic_text_size(dynamic_container *container, int sep_len, bool json);
+static Size dynamic_child_text_size(gtentry entry, char *base_addr, uint32 offset, uint32 len, int sep_len,
+                                    bool json);
+static Size dynamic_string_text_size(const char *str, int len);
+static Size dynamic_scalar_text_size(dynamic_value *v, uint32 len, bool json);
+static int int64_text_len(int64 val);
 static void add_indent(StringInfo out, bool indent, int level);
 static dynamic_value *execute_array_access_operator_internal(dynamic *array, int64 array_index);
 static dynamic_iterator *get_next_object_key(dynamic_iterator *it, dynamic_container *agtc, dynamic_value *key);
@@ -131,14 +201,26 @@ bool is_dynamic_string(dynamic *agt) {
     return DYNA_ROOT_IS_SCALAR(agt) && GTE_IS_STRING(agt->root.children[0]);
 }
 
+/*
+ * Version 2 of the binary format sends the on-disk representation as is,
+ * which is in the sending server's byte order. A marker byte follows the
+ * version number so that dynamic_recv can refuse data that was produced on
+ * a machine of the other endianness rather than misread it.
+ */
+#ifdef WORDS_BIGENDIAN
+#define DYNAMIC_BINARY_BYTE_ORDER 'B'
+#else
+#define DYNAMIC_BINARY_BYTE_ORDER 'L'
+#endif
+
 /*
  * dynamic recv function copied from PGs jsonb_recv as dynamic is based
  * off of jsonb
  *
- * The type is sent as text in binary mode, so this is almost the same
- * as the input function, but it's prefixed with a version number so we
- * can change the binary format sent in future if necessary. For now,
- * only version 1 is supported.
+ * The data is prefixed with a version number. Version 1 is the type as
+ * text, so this is almost the same as the input function. Version 2 is the
+ * native binary representation, which is copied into place and checked
+ * with validate_dynamic_container, as it must not be trusted.
  */
 PG_FUNCTION_INFO_V1(dynamic_recv);
 
@@ -149,37 +231,91 @@ Datum dynamic_recv(PG_FUNCTION_ARGS) {
     int nbytes = 0;
 
     if (version == 1)
+    {
         str = pq_getmsgtext(buf, buf->len - buf->cursor, &nbytes);
+    }
+    else if (version == 2)
+    {
+        dynamic *agt;
+        int byte_order = pq_getmsgint(buf, 1);
+
+        if (byte_order != DYNAMIC_BINARY_BYTE_ORDER)
+            ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                            errmsg("dynamic binary data has a foreign byte order")));
+
+        nbytes = buf->len - buf->cursor;
+
+        // the copy also gives the container the alignment it requires
+        agt = palloc(VARHDRSZ + nbytes);
+        SET_VARSIZE(agt, VARHDRSZ + nbytes);
+        pq_copymsgbytes(buf, VARDATA(agt), nbytes);
+
+        validate_dynamic_container(&agt->root, nbytes, 0);
+
+        AG_RETURN_DYNAMIC_P(agt);
+    }
     else
+    {
         elog(ERROR, "unsupported dynamic version number %d", version);
+    }
 
-    return dynamic_from_cstring(str, nbytes);
+    return dynamic_from_cstring(str, nbytes, NULL);
 }
 
 /*
  * dynamic send function copied from PGs jsonb_send as dynamic is based
  * off of jsonb
  *
- * Just send dynamic as a version number, then a string of text
+ * Send the version number and byte order marker, then the on-disk
+ * representation, so neither side has to print or parse the value.
  */
 PG_FUNCTION_INFO_V1(dynamic_send);
 Datum dynamic_send(PG_FUNCTION_ARGS) {
     dynamic *agt = AG_GET_ARG_DYNAMIC_P(0);
     StringInfoData buf;
-    StringInfo dynamic_text = makeStringInfo();
-    int version = 1;
-
-    (void) dynamic_to_cstring(dynamic_text, &agt->root, VARSIZE(agt));
+    int version = 2;
 
     pq_begintypsend(&buf);
     pq_sendint8(&buf, version);
-    pq_sendtext(&buf, dynamic_text->data, dynamic_text->len);
-    pfree(dynamic_text->data);
-    pfree(dynamic_text);
+    pq_sendint8(&buf, DYNAMIC_BINARY_BYTE_ORDER);
+    pq_sendbytes(&buf, VARDATA(agt), VARSIZE(agt) - VARHDRSZ);
 
     PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
 }
 
+/*
+ * Check whether a bytea holds a well formed dynamic in the binary format
+ * produced by dynamic_send, without converting it.  Meant for screening data
+ * from foreign sources before it is loaded; see validate_dynamic_container.
+ * Extended types are checked as far as the server reads them, including the
+ * entries of tsvectors and tsqueries and the bounds of ranges, but not the
+ * values themselves: a numeric bound can still hold digits out of range.
+ */
+PG_FUNCTION_INFO_V1(dynamic_validate);
+Datum dynamic_validate(PG_FUNCTION_ARGS) {
+    bytea *data = PG_GETARG_BYTEA_PP(0);
+    char *bytes = VARDATA_ANY(data);
+    int nbytes = VARSIZE_ANY_EXHDR(data);
+    char *copy;
+    bool result;
+
+    if (nbytes < 2 || bytes[0] != 2 || bytes[1] != DYNAMIC_BINARY_BYTE_ORDER)
+        PG_RETURN_BOOL(false);
+
+    nbytes -= 2;
+
+    // the two byte prefix leaves the container unaligned, so it is read from a copy
+    copy = palloc(Max(nbytes, 1));
+    memcpy(copy, bytes + 2, nbytes);
+
+    result = dynamic_container_is_valid((dynamic_container *) copy, nbytes, NULL);
+
+    pfree(copy);
+    PG_FREE_IF_COPY(data, 0);
+
+    PG_RETURN_BOOL(result);
+}
+
 PG_FUNCTION_INFO_V1(dynamic_in);
 /*
  * dynamic type input function
@@ -187,7 +323,28 @@ PG_FUNCTION_INFO_V1(dynamic_in);
 Datum dynamic_in(PG_FUNCTION_ARGS) {
     char *str = PG_GETARG_CSTRING(0);
 
-    return dynamic_from_cstring(str, strlen(str));
+    return dynamic_from_cstring(str, strlen(str), fcinfo->context);
+}
+
+/*
+ * Check the syntax of a text as dynamic without building anything: the
+ * parser runs without semantic actions and without de-escaping strings.
+ * Scalars are not converted either, so a value its type rejects, such as an
+ * integer out of range or a bad annotated value, is only caught by
+ * pg_input_is_valid().
+ */
+PG_FUNCTION_INFO_V1(dynamic_is_valid);
+Datum dynamic_is_valid(PG_FUNCTION_ARGS) {
+    text *t = PG_GETARG_TEXT_PP(0);
+    ErrorSaveContext escontext = {T_ErrorSaveContext};
+    dynamic_lex_context *lex;
+    dynamic_sem_action sem;
+
+    memset(&sem, 0, sizeof(sem));
+    lex = make_dynamic_lex_context(t, false);
+    lex->escontext = (Node *) &escontext;
+
+    PG_RETURN_BOOL(parse_dynamic(lex, &sem));
 }
 
 PG_FUNCTION_INFO_V1(dynamic_out);
@@ -200,41 +357,370 @@ Datum dynamic_out(PG_FUNCTION_ARGS) {
 
     agt = AG_GET_ARG_DYNAMIC_P(0);
 
-    out = dynamic_to_cstring(NULL, &agt->root, VARSIZE(agt));
+    out = dynamic_to_cstring_worker(NULL, &agt->root, DYNAMIC_TEXT_SIZE(&agt->root, false, false),
+                                    false, false, false);
 
     PG_RETURN_CSTRING(out);
 }
 
+/*
+ * The text of dynamic_out(), or without the space after commas and colons if
+ * compact is set. The output function itself has no such option, since what
+ * it returns must not depend on the session.
+ */
+PG_FUNCTION_INFO_V1(dynamic_to_text);
+Datum dynamic_to_text(PG_FUNCTION_ARGS) {
+    dynamic *agt = AG_GET_ARG_DYNAMIC_P(0);
+    bool compact = PG_GETARG_BOOL(1);
+    char *out;
+
+    out = dynamic_to_cstring_worker(NULL, &agt->root, DYNAMIC_TEXT_SIZE(&agt->root, compact, false),
+                                    false, compact, false);
+
+    PG_RETURN_TEXT_P(cstring_to_text(out));
+}
+
+/*
+ * Output a dynamic as JSON: numerics lose their annotation, and NaN and
+ * infinite numbers, as well as the scalars JSON has no literal for, become
+ * strings. Such text does not always read back in as the same dynamic.
+ */
+PG_FUNCTION_INFO_V1(dynamic_to_json);
+Datum dynamic_to_json(PG_FUNCTION_ARGS) {
+    dynamic *agt = AG_GET_ARG_DYNAMIC_P(0);
+    bool compact = PG_GETARG_BOOL(1);
+    char *out;
+
+    out = dynamic_to_cstring_worker(NULL, &agt->root, DYNAMIC_TEXT_SIZE(&agt->root, compact, true),
+                                    false, compact, true);
+
+    PG_RETURN_TEXT_P(cstring_to_text(out));
+}
+
 /*
  * dynamic_from_cstring
  *
  * Turns dynamic string into an dynamic Datum.
  *
  * Uses the dynamic parser (with hooks) to construct an dynamic.
+ *
+ * If escontext points to an ErrorSaveContext, bad input is reported there
+ * and (Datum) 0 is returned, rather than throwing an error.
  */
-Datum dynamic_from_cstring(char *str, int len)
+Datum dynamic_from_cstring(char *str, int len, Node *escontext)
 {
     dynamic_lex_context *lex;
     dynamic_in_state state;
     dynamic_sem_action sem;
 
-    memset(&state, 0, sizeof(state));
-    memset(&sem, 0, sizeof(sem));
     lex = make_dynamic_lex_context_cstring_len(str, len, true);
+    dynamic_in_init(&state, &sem, lex, escontext);
+
+    if (!parse_dynamic(lex, &sem))
+        return (Datum) 0;
+
+    PG_RETURN_POINTER(dynamic_builder_finish(state.builder));
+}
+
+/*
+ * Read a dynamic from a file on the server. The file is parsed a chunk at a
+ * time as it is read, so apart from the result only one chunk of it and the
+ * state of the objects and arrays that are open at the time are in memory.
+ */
+PG_FUNCTION_INFO_V1(dynamic_read_file);
+Datum dynamic_read_file(PG_FUNCTION_ARGS) {
+    char *filename = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    int encoding = GetDatabaseEncoding();
+    dynamic_lex_context *lex;
+    dynamic_in_state state;
+    dynamic_sem_action sem;
+    FILE *file;
+    char *buf;
+    int carry = 0;
+    bool is_last = false;
+
+    check_read_server_files();
+
+    file = AllocateFile(filename, PG_BINARY_R);
+    if (file == NULL)
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not open file \"%s\" for reading: %m", filename)));
+
+    lex = make_dynamic_lex_context_incremental(true);
+    dynamic_in_init(&state, &sem, lex, NULL);
+
+    // room for the start of a character the previous chunk ended in
+    buf = palloc(DYNAMIC_READ_CHUNK_SIZE + MAX_MULTIBYTE_CHAR_LEN);
+
+    while (!is_last)
+    {
+        int len;
+        int valid;
+
+        CHECK_FOR_INTERRUPTS();
+
+        len = carry + fread(buf + carry, 1, DYNAMIC_READ_CHUNK_SIZE, file);
+        if (ferror(file))
+            ereport(ERROR, (errcode_for_file_access(),
+                            errmsg("could not read file \"%s\": %m", filename)));
+        is_last = feof(file);
+
+        /*
+         * The text is checked the way the input function gets it. A
+         * character cut off at the end of the chunk is kept for the next
+         * one, anything else that is invalid is an error.
+         */
+        valid = pg_encoding_verifymbstr(encoding, buf, len);
+        if (valid < len && (is_last || len - valid >= pg_encoding_max_length(encoding)))
+            report_invalid_encoding(encoding, buf + valid, len - valid);
+
+        parse_dynamic_incremental(lex, &sem, buf, valid, is_last);
+
+        carry = len - valid;
+        memmove(buf, buf + valid, carry);
+    }
+
+    if (FreeFile(file) != 0)
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not close file \"%s\": %m", filename)));
+
+    PG_RETURN_POINTER(dynamic_builder_finish(state.builder));
+}
+
+/*
+ * Return the dynamic on each line of a newline delimited file on the server,
+ * one per call. The file is read a chunk at a time, and every line is parsed
+ * straight from the chunk with the same lex and builder, so only the current
+ * line and its result are kept in memory however large the file. Empty
+ * lines are skipped, and a line may end in "\r\n".
+ */
+PG_FUNCTION_INFO_V1(dynamic_read_ndjson);
+Datum dynamic_read_ndjson(PG_FUNCTION_ARGS) {
+    FuncCallContext *funcctx;
+    dynamic_ndjson_state *state;
+    ErrorContextCallback errcallback;
+    char *line;
+    int len;
+    int valid;
+    int encoding = GetDatabaseEncoding();
+
+    if (SRF_IS_FIRSTCALL())
+    {
+        MemoryContext oldcxt;
+
+        check_read_server_files();
+
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcxt = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        state = palloc0(sizeof(dynamic_ndjson_state));
+        state->filename = text_to_cstring(PG_GETARG_TEXT_PP(0));
+
+        // as with pg_ls_dir, a scan that is not run to the end leaves the
+        // file to be closed at the end of the transaction
+        state->file = AllocateFile(state->filename, PG_BINARY_R);
+        if (state->file == NULL)
+            ereport(ERROR, (errcode_for_file_access(),
+                            errmsg("could not open file \"%s\" for reading: %m", state->filename)));
+
+        initStringInfo(&state->buf);
+
+        state->lex = make_dynamic_lex_context_cstring_len(NULL, 0, true);
+        dynamic_in_init(&state->in, &state->sem, state->lex, NULL);
+
+        funcctx->user_fctx = state;
+
+        MemoryContextSwitchTo(oldcxt);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    state = (dynamic_ndjson_state *)funcctx->user_fctx;
+
+    do
+    {
+        if (!dynamic_ndjson_next_line(state, &line, &len))
+        {
+            if (FreeFile(state->file) != 0)
+                ereport(ERROR, (errcode_for_file_access(),
+                                errmsg("could not close file \"%s\": %m", state->filename)));
+
+            SRF_RETURN_DONE(funcctx);
+        }
+
+        if (len > 0 && line[len - 1] == '\r')
+            len--;
+    } while (len == 0);
+
+    CHECK_FOR_INTERRUPTS();
+
+    errcallback.callback = dynamic_ndjson_error_callback;
+    errcallback.arg = state;
+    errcallback.previous = error_context_stack;
+    error_context_stack = &errcallback;
+
+    valid = pg_encoding_verifymbstr(encoding, line, len);
+    if (valid < len)
+        report_invalid_encoding(encoding, line + valid, len - valid);
+
+    reset_dynamic_lex_context(state->lex, line, len);
+    parse_dynamic(state->lex, &state->sem);
+
+    error_context_stack = errcallback.previous;
+
+    SRF_RETURN_NEXT(funcctx, PointerGetDatum(dynamic_builder_next(state->in.builder)));
+}
+
+/*
+ * Find the next line of the file, reading more of it when the buffer holds
+ * no complete line. The line stays valid until the next call. Returns false
+ * at the end of the file.
+ */
+static bool dynamic_ndjson_next_line(dynamic_ndjson_state *state, char **line, int *len) {
+    StringInfo buf = &state->buf;
+
+    for (;;)
+    {
+        char *start = buf->data + state->pos;
+        char *end = memchr(start + state->scanned, '\n', buf->len - state->pos - state->scanned);
+        size_t nread;
+
+        if (end != NULL || (feof(state->file) && state->pos < buf->len))
+        {
+            if (end == NULL)
+                end = buf->data + buf->len;
+
+            *line = start;
+            *len = end - start;
+
+            state->pos = Min(end - buf->data + 1, buf->len);
+            state->scanned = 0;
+            state->line_number++;
+            return true;
+        }
+
+        if (feof(state->file))
+            return false;
+
+        // keep only the unfinished line before reading the next chunk after it
+        state->scanned = buf->len - state->pos;
+        memmove(buf->data, start, state->scanned);
+        buf->len = state->scanned;
+        state->pos = 0;
+
+        if (buf->len > MaxAllocSize - DYNAMIC_READ_CHUNK_SIZE - 1)
+            ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                            errmsg("line %lld of file \"%s\" is too long", (long long)state->line_number + 1,
+                                   state->filename)));
+
+        enlargeStringInfo(buf, DYNAMIC_READ_CHUNK_SIZE);
+        nread = fread(buf->data + buf->len, 1, DYNAMIC_READ_CHUNK_SIZE, state->file);
+        if (ferror(state->file))
+            ereport(ERROR, (errcode_for_file_access(),
+                            errmsg("could not read file \"%s\": %m", state->filename)));
+
+        buf->len += nread;
+        buf->data[buf->len] = '\0';
+
+        CHECK_FOR_INTERRUPTS();
+    }
+}
+
+static void dynamic_ndjson_error_callback(void *arg) {
+    dynamic_ndjson_state *state = (dynamic_ndjson_state *)arg;
+
+    errcontext("line %lld of file \"%s\"", (long long)state->line_number, state->filename);
+}
+
+/*
+ * Parse every element of a text[] into a dynamic[] of the same shape, with
+ * null elements left null. The documents share one lex, one builder and the
+ * annotations resolved so far, where the input function would set all of
+ * these up again for each of them.
+ */
+PG_FUNCTION_INFO_V1(dynamic_in_many);
+Datum dynamic_in_many(PG_FUNCTION_ARGS) {
+    ArrayType *docs = PG_GETARG_ARRAYTYPE_P(0);
+    Oid elemtype = get_element_type(get_fn_expr_rettype(fcinfo->flinfo));
+    dynamic_lex_context *lex;
+    dynamic_in_state state;
+    dynamic_sem_action sem;
+    Datum *elems;
+    bool *nulls;
+    int num_elems;
+    int16 typlen;
+    bool typbyval;
+    char typalign;
+    int i;
+
+    if (!OidIsValid(elemtype))
+        elog(ERROR, "could not determine the element type of the result of dynamic_in_many");
+
+    deconstruct_array_builtin(docs, TEXTOID, &elems, &nulls, &num_elems);
+
+    if (num_elems == 0)
+        PG_RETURN_ARRAYTYPE_P(construct_empty_array(elemtype));
 
-    sem.semstate = (void *)&state;
+    lex = make_dynamic_lex_context_cstring_len(NULL, 0, true);
+    dynamic_in_init(&state, &sem, lex, NULL);
 
-    sem.object_start = dynamic_in_object_start;
-    sem.array_start = dynamic_in_array_start;
-    sem.object_end = dynamic_in_object_end;
-    sem.array_end = dynamic_in_array_end;
-    sem.scalar = dynamic_in_scalar;
-    sem.object_field_start = dynamic_in_object_field_start;
+    for (i = 0; i < num_elems; i++)
+    {
+        text *doc;
+
+        if (nulls[i])
+            continue;
+
+        CHECK_FOR_INTERRUPTS();
+
+        doc = DatumGetTextPP(elems[i]);
+        reset_dynamic_lex_context(lex, VARDATA_ANY(doc), VARSIZE_ANY_EXHDR(doc));
+
+        parse_dynamic(lex, &sem);
+
+        elems[i] = PointerGetDatum(dynamic_builder_next(state.builder));
+    }
 
-    parse_dynamic(lex, &sem);
+    get_typlenbyvalalign(elemtype, &typlen, &typbyval, &typalign);
 
-    // after parsing, the item member has the composed dynamic structure 
-    PG_RETURN_POINTER(dynamic_value_to_dynamic(state.res));
+    PG_RETURN_ARRAYTYPE_P(construct_md_array(elems, nulls, ARR_NDIM(docs), ARR_DIMS(docs), ARR_LBOUND(docs),
+                                             elemtype, typlen, typbyval, typalign));
+}
+
+/*
+ * Reading files on the server takes the same privilege as COPY FROM a file.
+ */
+static void check_read_server_files(void) {
+    if (!has_privs_of_role(GetUserId(), ROLE_PG_READ_SERVER_FILES))
+        ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+                        errmsg("permission denied to read dynamic from a file"),
+                        errdetail("Only roles with privileges of the \"%s\" role may read server files.",
+                                  "pg_read_server_files")));
+}
+
+/*
+ * Set up the semantic actions that build a dynamic from what the parser
+ * finds in lex.
+ */
+static void dynamic_in_init(dynamic_in_state *state, dynamic_sem_action *sem, dynamic_lex_context *lex,
+                            Node *escontext) {
+    memset(state, 0, sizeof(dynamic_in_state));
+    memset(sem, 0, sizeof(dynamic_sem_action));
+
+    lex->escontext = escontext;
+
+    state->builder = dynamic_builder_create();
+    state->lex = lex;
+    state->escontext = escontext;
+    state->cxt = CurrentMemoryContext;
+
+    sem->semstate = (void *)state;
+
+    sem->object_start = dynamic_in_object_start;
+    sem->array_start = dynamic_in_array_start;
+    sem->object_end = dynamic_in_object_end;
+    sem->array_end = dynamic_in_array_end;
+    sem->scalar = dynamic_in_scalar;
+    sem->object_field_start = dynamic_in_object_field_start;
 }
 
 size_t check_string_length(size_t len) {
@@ -248,37 +734,33 @@ size_t check_string_length(size_t len) {
 static void dynamic_in_object_start(void *pstate) {
     dynamic_in_state *_state = (dynamic_in_state *)pstate;
 
-    _state->res = push_dynamic_value(&_state->parse_state, WGT_BEGIN_OBJECT, NULL);
+    dynamic_builder_begin_object(_state->builder);
 }
 
 static void dynamic_in_object_end(void *pstate) {
     dynamic_in_state *_state = (dynamic_in_state *)pstate;
 
-    _state->res = push_dynamic_value(&_state->parse_state, WGT_END_OBJECT, NULL);
+    dynamic_builder_end(_state->builder);
 }
 
 static void dynamic_in_array_start(void *pstate) {
     dynamic_in_state *_state = (dynamic_in_state *)pstate;
 
-    _state->res = push_dynamic_value(&_state->parse_state, WGT_BEGIN_ARRAY, NULL);
+    dynamic_builder_begin_array(_state->builder);
 }
 
 static void dynamic_in_array_end(void *pstate) {
     dynamic_in_state *_state = (dynamic_in_state *)pstate;
 
-    _state->res = push_dynamic_value(&_state->parse_state, WGT_END_ARRAY, NULL);
+    dynamic_builder_end(_state->builder);
 }
 
 static void dynamic_in_object_field_start(void *pstate, char *fname, bool isnull) {
     dynamic_in_state *_state = (dynamic_in_state *)pstate;
-    dynamic_value v;
 
     Assert(fname != NULL);
-    v.type = DYNAMIC_STRING;
-    v.val.string.len = check_string_length(strlen(fname));
-    v.val.string.val = fname;
 
-    _state->res = push_dynamic_value(&_state->parse_state, WGT_KEY, &v);
+    dynamic_builder_key(_state->builder, fname, check_string_length(strlen(fname)));
 }
 
 Datum
@@ -322,7 +804,7 @@ void dynamic_put_escaped_value(StringInfo out, dynamic_value *scalar_val)
         appendBinaryStringInfo(out, "null", 4);
         break;
     case DYNAMIC_STRING:
-        escape_dynamic(out, pnstrdup(scalar_val->val.string.val, scalar_val->val.string.len));
+        escape_dynamic(out, scalar_val->val.string.val, scalar_val->val.string.len);
         break;
     case DYNAMIC_NUMERIC:
         appendStringInfoString(
@@ -330,47 +812,35 @@ void dynamic_put_escaped_value(StringInfo out, dynamic_value *scalar_val)
         appendBinaryStringInfo(out, "::numeric", 9);
         break;
     case DYNAMIC_INTEGER:
-        appendStringInfoString(
-            out, DatumGetCString(DirectFunctionCall1(int8out, Int64GetDatum(scalar_val->val.int_value))));
+        append_integer(out, scalar_val->val.int_value);
         break;
     case DYNAMIC_FLOAT:
-        numstr = DatumGetCString(DirectFunctionCall1(float8out, Float8GetDatum(scalar_val->val.float_value)));
-        appendStringInfoString(out, numstr);
-
-        if (is_decimal_needed(numstr))
-            appendBinaryStringInfo(out, ".0", 2);
+        append_float(out, scalar_val->val.float_value);
         break;
     case DYNAMIC_TIMESTAMP:
-	numstr = DatumGetCString(DirectFunctionCall1(timestamp_out, TimestampGetDatum(scalar_val->val.int_value)));
-	appendStringInfoString(out, numstr);
-	break;
+        append_date_time(out, TimestampGetDatum(scalar_val->val.int_value), TIMESTAMPOID);
+        break;
     case DYNAMIC_TIMESTAMPTZ:
-        numstr = DatumGetCString(DirectFunctionCall1(timestamptz_out, TimestampGetDatum(scalar_val->val.int_value)));
-        appendStringInfoString(out, numstr);
+        append_date_time(out, TimestampTzGetDatum(scalar_val->val.int_value), TIMESTAMPTZOID);
         break;
     case DYNAMIC_DATE:
-        numstr = DatumGetCString(DirectFunctionCall1(date_out, DateADTGetDatum(scalar_val->val.date)));
-        appendStringInfoString(out, numstr);
+        append_date_time(out, DateADTGetDatum(scalar_val->val.date), DATEOID);
         break;
     case DYNAMIC_TIME:
-        numstr = DatumGetCString(DirectFunctionCall1(time_out, TimeADTGetDatum(scalar_val->val.int_value)));
-        appendStringInfoString(out, numstr);
+        append_date_time(out, TimeADTGetDatum(scalar_val->val.int_value), TIMEOID);
         break;
     case DYNAMIC_TIMETZ:
-        numstr = DatumGetCString(DirectFunctionCall1(timetz_out, DatumGetTimeTzADTP(&scalar_val->val.timetz)));
-        appendStringInfoString(out, numstr);
+        append_date_time(out, TimeTzADTPGetDatum(&scalar_val->val.timetz), TIMETZOID);
         break;
     case DYNAMIC_INTERVAL:
         numstr = DatumGetCString(DirectFunctionCall1(interval_out, IntervalPGetDatum(&scalar_val->val.interval)));
         appendStringInfoString(out, numstr);
         break;
     case DYNAMIC_INET:
-        numstr = DatumGetCString(DirectFunctionCall1(inet_out, InetPGetDatum(&scalar_val->val.inet)));
-        appendStringInfoString(out, numstr);
+        append_inet(out, &scalar_val->val.inet, false);
         break;
     case DYNAMIC_CIDR:
-        numstr = DatumGetCString(DirectFunctionCall1(cidr_out, InetPGetDatum(&scalar_val->val.inet)));
-        appendStringInfoString(out, numstr);
+        append_inet(out, &scalar_val->val.inet, true);
         break;
     case DYNAMIC_MAC:
         numstr = DatumGetCString(DirectFunctionCall1(macaddr_out, MacaddrPGetDatum(&scalar_val->val.mac)));
@@ -447,45 +917,116 @@ void dynamic_put_escaped_value(StringInfo out, dynamic_value *scalar_val)
     }
 }
 
+/*
+ * The scalar formatters below write what the type's output function would
+ * return straight into out, instead of into a string of its own that is
+ * then copied.
+ */
+static void append_integer(StringInfo out, int64 val) {
+    enlargeStringInfo(out, MAXINT8LEN);
+    out->len += pg_lltoa(val, out->data + out->len);
+}
+
+static void append_float(StringInfo out, float8 val) {
+    enlargeStringInfo(out, DYNAMIC_FLOAT_OUT_LEN + 2);
+    out->len += format_float(out->data + out->len, val);
+}
+
+/*
+ * Same as float8out(), followed by ".0" if the result looks like an integer.
+ * buf must have room for DYNAMIC_FLOAT_OUT_LEN + 3 bytes. Returns the length
+ * of the text.
+ */
+static int format_float(char *buf, float8 val) {
+    int len;
+
+    if (extra_float_digits > 0)
+        len = double_to_shortest_decimal_bufn(val, buf);
+    else
+        len = pg_strfromd(buf, DYNAMIC_FLOAT_OUT_LEN, DBL_DIG + extra_float_digits, val);
+    buf[len] = '\0';
+
+    if (is_decimal_needed(buf))
+    {
+        memcpy(buf + len, ".0", 3);
+        len += 2;
+    }
+
+    return len;
+}
+
+static void append_date_time(StringInfo out, Datum value, Oid typid) {
+    char buf[MAXDATELEN + 1];
+
+    appendStringInfoString(out, dynamic_encode_date_time(buf, value, typid, DateStyle));
+}
+
+/*
+ * Same as inet_out() and cidr_out(), which add the netmask for a cidr even
+ * when it covers the whole address.
+ */
+static void append_inet(StringInfo out, inet *ip, bool is_cidr) {
+    char buf[sizeof("xxxx:xxxx:xxxx:xxxx:xxxx:xxxx:255.255.255.255/128")];
+
+    if (pg_inet_net_ntop(ip_family(ip), ip_addr(ip), ip_bits(ip), buf, sizeof(buf)) == NULL)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("could not format inet value: %m")));
+
+    appendStringInfoString(out, buf);
+
+    if (is_cidr && strchr(buf, '/') == NULL)
+        appendStringInfo(out, "/%u", ip_bits(ip));
+}
+
 /*
  * Produce an dynamic string literal, properly escaping characters in the text.
+ * Runs of characters that need no escape are found a vector register at a
+ * time and appended whole, into room reserved up front for the string as it
+ * is.
  */
-static void escape_dynamic(StringInfo buf, const char *str) {
-    const char *p;
+static void escape_dynamic(StringInfo buf, const char *str, int len) {
+    int i = 0;
+
+    enlargeStringInfo(buf, len + 2);
 
     appendStringInfoCharMacro(buf, '"');
-    for (p = str; *p; p++)
+    while (i < len)
     {
-        switch (*p)
+        int plain = dynamic_string_plain_len(str + i, len - i);
+
+        appendBinaryStringInfo(buf, str + i, plain);
+        i += plain;
+        if (i == len)
+            break;
+
+        switch (str[i])
         {
         case '\b':
-            appendStringInfoString(buf, "\\b");
+            appendBinaryStringInfo(buf, "\\b", 2);
             break;
         case '\f':
-            appendStringInfoString(buf, "\\f");
+            appendBinaryStringInfo(buf, "\\f", 2);
             break;
         case '\n':
-            appendStringInfoString(buf, "\\n");
+            appendBinaryStringInfo(buf, "\\n", 2);
             break;
         case '\r':
-            appendStringInfoString(buf, "\\r");
+            appendBinaryStringInfo(buf, "\\r", 2);
             break;
         case '\t':
-            appendStringInfoString(buf, "\\t");
+            appendBinaryStringInfo(buf, "\\t", 2);
             break;
         case '"':
-            appendStringInfoString(buf, "\\\"");
+            appendBinaryStringInfo(buf, "\\\"", 2);
             break;
         case '\\':
-            appendStringInfoString(buf, "\\\\");
+            appendBinaryStringInfo(buf, "\\\\", 2);
             break;
         default:
-            if ((unsigned char)*p < ' ')
-                appendStringInfo(buf, "\\u%04x", (int)*p);
-            else
-                appendStringInfoCharMacro(buf, *p);
+            appendStringInfo(buf, "\\u%04x", (int)str[i]);
             break;
         }
+        i++;
     }
     appendStringInfoCharMacro(buf, '"');
 }
@@ -507,56 +1048,324 @@ bool is_decimal_needed(char *numstr) {
     return true;
 }
 
+/*
+ * Map a type annotation to the token type of one of the types the parser
+ * converts itself. Dispatches on length and first letter, so at most one
+ * string comparison is done. Returns DYNAMIC_TOKEN_INVALID for any other
+ * annotation.
+ */
+static dynamic_token_type annotation_token_type(const char *annotation) {
+    dynamic_token_type result = DYNAMIC_TOKEN_INVALID;
+    const char *name = NULL;
+
+    switch (strlen(annotation))
+    {
+    case 3:
+        name = "box";
+        result = DYNAMIC_TOKEN_BOX;
+        break;
+    case 4:
+        switch (pg_ascii_tolower((unsigned char)annotation[0]))
+        {
+        case 'c':
+            name = "cidr";
+            result = DYNAMIC_TOKEN_CIDR;
+            break;
+        case 'd':
+            name = "date";
+            result = DYNAMIC_TOKEN_DATE;
+            break;
+        case 'i':
+            name = "inet";
+            result = DYNAMIC_TOKEN_INET;
+            break;
+        case 't':
+            name = "time";
+            result = DYNAMIC_TOKEN_TIME;
+            break;
+        }
+        break;
+    case 5:
+        name = "float";
+        result = DYNAMIC_TOKEN_FLOAT;
+        break;
+    case 6:
+        name = "timetz";
+        result = DYNAMIC_TOKEN_TIMETZ;
+        break;
+    case 7:
+        switch (pg_ascii_tolower((unsigned char)annotation[0]))
+        {
+        case 'i':
+            name = "integer";
+            result = DYNAMIC_TOKEN_INTEGER;
+            break;
+        case 'm':
+            name = "macaddr";
+            result = DYNAMIC_TOKEN_MACADDR;
+            break;
+        case 'n':
+            name = "numeric";
+            result = DYNAMIC_TOKEN_NUMERIC;
+            break;
+        }
+        break;
+    case 8:
+        switch (pg_ascii_tolower((unsigned char)annotation[0]))
+        {
+        case 'i':
+            name = "interval";
+            result = DYNAMIC_TOKEN_INTERVAL;
+            break;
+        case 'm':
+            name = "macaddr8";
+            result = DYNAMIC_TOKEN_MACADDR8;
+            break;
+        }
+        break;
+    case 9:
+        name = "timestamp";
+        result = DYNAMIC_TOKEN_TIMESTAMP;
+        break;
+    case 11:
+        name = "timestamptz";
+        result = DYNAMIC_TOKEN_TIMESTAMPTZ;
+        break;
+    }
+
+    if (name == NULL || pg_strcasecmp(annotation, name) != 0)
+        return DYNAMIC_TOKEN_INVALID;
+
+    return result;
+}
+
+/*
+ * An annotation naming a type the parser does not convert itself, resolved
+ * to the type's input function.
+ */
+typedef struct dynamic_annotation {
+    char *name;
+    Oid typoid;
+    int32 typmod;
+    Oid typioparam;
+    FmgrInfo input;
+} dynamic_annotation;
+
+/*
+ * Convert a scalar annotated with any other type name by running it through
+ * that type's input function. The type is looked up once per parse. Types
+ * dynamic can store are kept as such; for the rest, the type's canonical text
+ * form is stored as a string.
+ */
+static bool annotated_scalar_value(dynamic_in_state *state, char *token, char *annotation,
+                                   dynamic_value *result) {
+    dynamic_annotation *entry = NULL;
+    ListCell *lc;
+    Datum d;
+
+    foreach (lc, state->annotations)
+    {
+        dynamic_annotation *a = (dynamic_annotation *)lfirst(lc);
+
+        if (strcmp(a->name, annotation) == 0)
+        {
+            entry = a;
+            break;
+        }
+    }
+
+    if (entry == NULL)
+    {
+        ErrorSaveContext escontext = {T_ErrorSaveContext};
+        MemoryContext oldcxt;
+        Oid typoid;
+        int32 typmod;
+        Oid typinput;
+
+        if (!parseTypeString(annotation, &typoid, &typmod, (Node *)&escontext))
+            ereturn(state->escontext, false,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("invalid annotation value for scalar"),
+                     errdetail("Type \"%s\" does not exist.", annotation)));
+
+        // the actions may run in a context that is reset before the parse ends
+        oldcxt = MemoryContextSwitchTo(state->cxt);
+
+        entry = palloc(sizeof(dynamic_annotation));
+        entry->name = pstrdup(annotation);
+        entry->typoid = typoid;
+        entry->typmod = typmod;
+
+        getTypeInputInfo(entry->typoid, &typinput, &entry->typioparam);
+        fmgr_info(typinput, &entry->input);
+
+        state->annotations = lappend(state->annotations, entry);
+
+        MemoryContextSwitchTo(oldcxt);
+    }
+
+    if (!InputFunctionCallSafe(&entry->input, token, entry->typioparam, entry->typmod,
+                               state->escontext, &d))
+        return false;
+
+    switch (entry->typoid)
+    {
+    case BOOLOID:
+        result->type = DYNAMIC_BOOL;
+        result->val.boolean = DatumGetBool(d);
+        break;
+    case INT2OID:
+        result->type = DYNAMIC_INTEGER;
+        result->val.int_value = DatumGetInt16(d);
+        break;
+    case INT4OID:
+        result->type = DYNAMIC_INTEGER;
+        result->val.int_value = DatumGetInt32(d);
+        break;
+    case INT8OID:
+        result->type = DYNAMIC_INTEGER;
+        result->val.int_value = DatumGetInt64(d);
+        break;
+    case FLOAT4OID:
+        result->type = DYNAMIC_FLOAT;
+        result->val.float_value = DatumGetFloat4(d);
+        break;
+    case FLOAT8OID:
+        result->type = DYNAMIC_FLOAT;
+        result->val.float_value = DatumGetFloat8(d);
+        break;
+    case POINTOID:
+        result->type = DYNAMIC_POINT;
+        result->val.point = DatumGetPointP(d);
+        break;
+    case LSEGOID:
+        result->type = DYNAMIC_LSEG;
+        result->val.lseg = DatumGetLsegP(d);
+        break;
+    case LINEOID:
+        result->type = DYNAMIC_LINE;
+        result->val.line = DatumGetLineP(d);
+        break;
+    case PATHOID:
+        result->type = DYNAMIC_PATH;
+        result->val.path = DatumGetPathP(d);
+        break;
+    case POLYGONOID:
+        result->type = DYNAMIC_POLYGON;
+        result->val.polygon = DatumGetPolygonP(d);
+        break;
+    case CIRCLEOID:
+        result->type = DYNAMIC_CIRCLE;
+        result->val.circle = DatumGetCircleP(d);
+        break;
+    case BYTEAOID:
+        result->type = DYNAMIC_BYTEA;
+        result->val.bytea = DatumGetByteaP(d);
+        break;
+    case TSVECTOROID:
+        result->type = DYNAMIC_TSVECTOR;
+        result->val.tsvector = DatumGetTSVector(d);
+        break;
+    case TSQUERYOID:
+        result->type = DYNAMIC_TSQUERY;
+        result->val.tsquery = DatumGetTSQuery(d);
+        break;
+    case INT4RANGEOID:
+    case INT8RANGEOID:
+        result->type = DYNAMIC_RANGE_INT;
+        result->val.range = DatumGetRangeTypeP(d);
+        break;
+    case NUMRANGEOID:
+        result->type = DYNAMIC_RANGE_NUM;
+        result->val.range = DatumGetRangeTypeP(d);
+        break;
+    case TSRANGEOID:
+        result->type = DYNAMIC_RANGE_TS;
+        result->val.range = DatumGetRangeTypeP(d);
+        break;
+    case TSTZRANGEOID:
+        result->type = DYNAMIC_RANGE_TSTZ;
+        result->val.range = DatumGetRangeTypeP(d);
+        break;
+    case DATERANGEOID:
+        result->type = DYNAMIC_RANGE_DATE;
+        result->val.range = DatumGetRangeTypeP(d);
+        break;
+    case INT4MULTIRANGEOID:
+    case INT8MULTIRANGEOID:
+        result->type = DYNAMIC_RANGE_INT_MULTI;
+        result->val.multirange = DatumGetMultirangeTypeP(d);
+        break;
+    case NUMMULTIRANGEOID:
+        result->type = DYNAMIC_RANGE_NUM_MULTI;
+        result->val.multirange = DatumGetMultirangeTypeP(d);
+        break;
+    case TSMULTIRANGEOID:
+        result->type = DYNAMIC_RANGE_TS_MULTI;
+        result->val.multirange = DatumGetMultirangeTypeP(d);
+        break;
+    case TSTZMULTIRANGEOID:
+        result->type = DYNAMIC_RANGE_TSTZ_MULTI;
+        result->val.multirange = DatumGetMultirangeTypeP(d);
+        break;
+    case DATEMULTIRANGEOID:
+        result->type = DYNAMIC_RANGE_DATE_MULTI;
+        result->val.multirange = DatumGetMultirangeTypeP(d);
+        break;
+    default:
+    {
+        Oid typoutput;
+        bool typisvarlena;
+        char *str;
+
+        getTypeOutputInfo(entry->typoid, &typoutput, &typisvarlena);
+        str = OidOutputFunctionCall(typoutput, d);
+
+        result->type = DYNAMIC_STRING;
+        result->val.string.len = check_string_length(strlen(str));
+        result->val.string.val = str;
+        break;
+    }
+    }
+
+    return true;
+}
+
+/*
+ * Convert a scalar with the input function of its type. Errors about the
+ * value are saved if the parse has an escontext, in which case false is
+ * returned.
+ */
+static bool scalar_input(dynamic_in_state *state, PGFunction func, char *token, Datum *result) {
+    return DirectInputFunctionCallSafe(func, token, InvalidOid, -1, state->escontext, result);
+}
+
 /*
  * For dynamic we always want the de-escaped value - that's what's in token
  */
 static void dynamic_in_scalar(void *pstate, char *token, dynamic_token_type tokentype, char *annotation) {
     dynamic_in_state *_state = (dynamic_in_state *)pstate;
     dynamic_value v;
-    Datum numd;
+    Datum d;
 
     /*
      * Process the scalar typecast annotations, if present, but not if the
      * argument is a null. Typecasting a null is a null.
      */
-    if (annotation != NULL && tokentype != DYNAMIC_TOKEN_NULL) {
-        int len = strlen(annotation);
-
-        if (pg_strcasecmp(annotation, "numeric") == 0)
-            tokentype = DYNAMIC_TOKEN_NUMERIC;
-        else if (pg_strcasecmp(annotation, "integer") == 0)
-            tokentype = DYNAMIC_TOKEN_INTEGER;
-        else if (pg_strcasecmp(annotation, "float") == 0)
-            tokentype = DYNAMIC_TOKEN_FLOAT;
-        else if (pg_strcasecmp(annotation, "timestamp") == 0)
-            tokentype = DYNAMIC_TOKEN_TIMESTAMP;
-        else if (len == 11 && pg_strcasecmp(annotation, "timestamptz") == 0)
-            tokentype = DYNAMIC_TOKEN_TIMESTAMPTZ;
-	else if (len == 4 && pg_strcasecmp(annotation, "date") == 0)
-            tokentype = DYNAMIC_TOKEN_DATE;
-        else if (len == 4 && pg_strcasecmp(annotation, "time") == 0)
-            tokentype = DYNAMIC_TOKEN_TIME;
-        else if (len == 6 && pg_strcasecmp(annotation, "timetz") == 0)
-            tokentype = DYNAMIC_TOKEN_TIMETZ;
-	else if (len == 8 && pg_strcasecmp(annotation, "interval") == 0)
-            tokentype = DYNAMIC_TOKEN_INTERVAL;
-         else if (pg_strcasecmp(annotation, "box") == 0)
-            tokentype = DYNAMIC_TOKEN_BOX;           
-        else if (len == 4 && pg_strcasecmp(annotation, "inet") == 0)
-            tokentype = DYNAMIC_TOKEN_INET;
-        else if (len == 4 && pg_strcasecmp(annotation, "cidr") == 0)
-            tokentype = DYNAMIC_TOKEN_CIDR;
-        else if (len == 7 && pg_strcasecmp(annotation, "macaddr") == 0)
-            tokentype = DYNAMIC_TOKEN_MACADDR;
-        else if (len == 8 && pg_strcasecmp(annotation, "macaddr8") == 0)
-            tokentype = DYNAMIC_TOKEN_MACADDR;
-	else
-            ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                     errmsg("invalid annotation value for scalar")));
-    }
+    if (annotation != NULL && tokentype != DYNAMIC_TOKEN_NULL)
+        tokentype = annotation_token_type(annotation);
 
+    /*
+     * A value that does not convert leaves a soft error behind, if the parse
+     * has an escontext, and is not added.
+     */
     switch (tokentype)
     {
+    case DYNAMIC_TOKEN_INVALID:
+        // an annotation naming any other type
+        if (!annotated_scalar_value(_state, token, annotation, &v))
+            return;
+        break;
     case DYNAMIC_TOKEN_STRING:
         Assert(token != NULL);
         v.type = DYNAMIC_STRING;
@@ -566,58 +1375,71 @@ static void dynamic_in_scalar(void *pstate, char *token, dynamic_token_type toke
     case DYNAMIC_TOKEN_INTEGER:
         Assert(token != NULL);
         v.type = DYNAMIC_INTEGER;
-	    v.val.int_value = pg_strtoint64_safe(token, NULL);
-        //scanint8(token, false, &v.val.int_value);
+        /*
+         * Unless an annotation made this an integer, the lexer has already
+         * accumulated the digits. The text is only needed for the error.
+         */
+        if (annotation != NULL || _state->lex == NULL ||
+            !dynamic_number_to_int64(&_state->lex->scalar_number, &v.val.int_value)) {
+            v.val.int_value = pg_strtoint64_safe(token, _state->escontext);
+            if (SOFT_ERROR_OCCURRED(_state->escontext))
+                return;
+        }
         break;
     case DYNAMIC_TOKEN_FLOAT:
         Assert(token != NULL);
         v.type = DYNAMIC_FLOAT;
-	    v.val.float_value = float8in_internal(token, NULL, "double precision", token, NULL);
+        if (annotation != NULL || _state->lex == NULL ||
+            !dynamic_number_to_float8(&_state->lex->scalar_number, &v.val.float_value)) {
+            v.val.float_value = float8in_internal(token, NULL, "double precision", token, _state->escontext);
+            if (SOFT_ERROR_OCCURRED(_state->escontext))
+                return;
+        }
         break;
     case DYNAMIC_TOKEN_NUMERIC:
         Assert(token != NULL);
         v.type = DYNAMIC_NUMERIC;
-        numd = DirectFunctionCall3(numeric_in,
-			           CStringGetDatum(token),
-				   ObjectIdGetDatum(InvalidOid),
-				   Int32GetDatum(-1));
-        v.val.numeric = DatumGetNumeric(numd);
+        if (!scalar_input(_state, numeric_in, token, &d))
+            return;
+        v.val.numeric = DatumGetNumeric(d);
         break;
     case DYNAMIC_TOKEN_TIMESTAMP:
         Assert(token != NULL);
         v.type = DYNAMIC_TIMESTAMP;
-        v.val.int_value = DatumGetInt64(DirectFunctionCall3(timestamp_in,
-				                            CStringGetDatum(token),
-							    ObjectIdGetDatum(InvalidOid),
-							    Int32GetDatum(-1)));
+        if (!scalar_input(_state, timestamp_in, token, &d))
+            return;
+        v.val.int_value = DatumGetInt64(d);
         break;
     case DYNAMIC_TOKEN_TIMESTAMPTZ:
         v.type = DYNAMIC_TIMESTAMPTZ;
-        v.val.int_value = DatumGetInt64(DirectFunctionCall3(timestamptz_in,
-                                                            CStringGetDatum(token),
-                                                            ObjectIdGetDatum(InvalidOid),
-                                                            Int32GetDatum(-1)));
+        if (!scalar_input(_state, timestamptz_in, token, &d))
+            return;
+        v.val.int_value = DatumGetInt64(d);
         break;
     case DYNAMIC_TOKEN_DATE:
         v.type = DYNAMIC_DATE;
-        v.val.date = DatumGetInt32(DirectFunctionCall1(date_in, CStringGetDatum(token)));
+        if (!scalar_input(_state, date_in, token, &d))
+            return;
+        v.val.date = DatumGetInt32(d);
         break;
     case DYNAMIC_TOKEN_TIME:
         v.type = DYNAMIC_TIME;
-        v.val.int_value = DatumGetInt64(DirectFunctionCall3(time_in,
-                                                            CStringGetDatum(token),
-                                                            ObjectIdGetDatum(InvalidOid),
-                                                            Int32GetDatum(-1)));
-	break;
+        if (!scalar_input(_state, time_in, token, &d))
+            return;
+        v.val.int_value = DatumGetInt64(d);
+        break;
     case DYNAMIC_TOKEN_TIMETZ:
+        {
+        TimeTzADT *timetz;
+
         v.type = DYNAMIC_TIMETZ;
-        TimeTzADT * timetz= DatumGetTimeTzADTP(DirectFunctionCall3(timetz_in,
-                                                                   CStringGetDatum(token),
-                                                                   ObjectIdGetDatum(InvalidOid),
-                                                                   Int32GetDatum(-1)));
+        if (!scalar_input(_state, timetz_in, token, &d))
+            return;
+        timetz = DatumGetTimeTzADTP(d);
         v.val.timetz.time = timetz->time;
         v.val.timetz.zone = timetz->zone;
         break;
+        }
     case DYNAMIC_TOKEN_INTERVAL:
         {
         Interval *interval;
@@ -625,10 +1447,9 @@ static void dynamic_in_scalar(void *pstate, char *token, dynamic_token_type toke
         Assert(token != NULL);
 
         v.type = DYNAMIC_INTERVAL;
-        interval = DatumGetIntervalP(DirectFunctionCall3(interval_in,
-				             CStringGetDatum(token),
-                                             ObjectIdGetDatum(InvalidOid),
-                                             Int32GetDatum(-1)));
+        if (!scalar_input(_state, interval_in, token, &d))
+            return;
+        interval = DatumGetIntervalP(d);
 
         v.val.interval.time = interval->time;
         v.val.interval.day = interval->day;
@@ -640,7 +1461,9 @@ static void dynamic_in_scalar(void *pstate, char *token, dynamic_token_type toke
         Assert(token != NULL);
 
         v.type = DYNAMIC_BOX;
-        v.val.box = DatumGetBoxP(DirectFunctionCall1(box_in, CStringGetDatum(token)));
+        if (!scalar_input(_state, box_in, token, &d))
+            return;
+        v.val.box = DatumGetBoxP(d);
         break;
         }        
     case DYNAMIC_TOKEN_INET:
@@ -650,7 +1473,9 @@ static void dynamic_in_scalar(void *pstate, char *token, dynamic_token_type toke
         Assert(token != NULL);
 
         v.type = DYNAMIC_INET;
-        i = DatumGetInetPP(DirectFunctionCall1(inet_in, CStringGetDatum(token)));
+        if (!scalar_input(_state, inet_in, token, &d))
+            return;
+        i = DatumGetInetPP(d);
 
 	memcpy(&v.val.inet, i, sizeof(char) * 22);
         break;
@@ -662,7 +1487,9 @@ static void dynamic_in_scalar(void *pstate, char *token, dynamic_token_type toke
         Assert(token != NULL);
 
         v.type = DYNAMIC_CIDR;
-        i = DatumGetInetPP(DirectFunctionCall1(cidr_in, CStringGetDatum(token)));
+        if (!scalar_input(_state, cidr_in, token, &d))
+            return;
+        i = DatumGetInetPP(d);
 
         memcpy(&v.val.inet, i, sizeof(char) * 22);
         break;
@@ -674,7 +1501,9 @@ static void dynamic_in_scalar(void *pstate, char *token, dynamic_token_type toke
         Assert(token != NULL);
 
         v.type = DYNAMIC_MAC;
-        mac = DatumGetMacaddrP(DirectFunctionCall1(macaddr_in, CStringGetDatum(token)));
+        if (!scalar_input(_state, macaddr_in, token, &d))
+            return;
+        mac = DatumGetMacaddrP(d);
 
         memcpy(&v.val.mac, mac, sizeof(char) * 6);
         break;
@@ -686,9 +1515,11 @@ static void dynamic_in_scalar(void *pstate, char *token, dynamic_token_type toke
         Assert(token != NULL);
 
         v.type = DYNAMIC_MAC8;
-        mac = DatumGetMacaddrP(DirectFunctionCall1(macaddr8_in, CStringGetDatum(token)));
+        if (!scalar_input(_state, macaddr8_in, token, &d))
+            return;
+        mac = DatumGetMacaddr8P(d);
 
-        memcpy(&v.val.mac, mac, sizeof(char) * 8);
+        memcpy(&v.val.mac8, mac, sizeof(char) * 8);
         break;
         }
     case DYNAMIC_TOKEN_TRUE:
@@ -708,32 +1539,8 @@ static void dynamic_in_scalar(void *pstate, char *token, dynamic_token_type toke
         break;
     }
 
-    if (_state->parse_state == NULL) {
-        // single scalar 
-        dynamic_value va;
-
-        va.type = DYNAMIC_ARRAY;
-        va.val.array.raw_scalar = true;
-        va.val.array.num_elems = 1;
-
-        _state->res = push_dynamic_value(&_state->parse_state, WGT_BEGIN_ARRAY, &va);
-        _state->res = push_dynamic_value(&_state->parse_state, WGT_ELEM, &v);
-        _state->res = push_dynamic_value(&_state->parse_state, WGT_END_ARRAY, NULL);
-    } else {
-        dynamic_value *o = &_state->parse_state->cont_val;
-
-        switch (o->type)
-        {
-        case DYNAMIC_ARRAY:
-            _state->res = push_dynamic_value(&_state->parse_state, WGT_ELEM, &v);
-            break;
-        case DYNAMIC_OBJECT:
-            _state->res = push_dynamic_value(&_state->parse_state, WGT_VALUE, &v);
-            break;
-        default:
-            elog(ERROR, "unexpected parent of nested structure");
-        }
-    }
+    // a scalar outside of any container becomes a raw scalar 
+    dynamic_builder_scalar(_state->builder, &v);
 }
 
 /*
@@ -748,20 +1555,22 @@ static void dynamic_in_scalar(void *pstate, char *token, dynamic_token_type toke
  * if they are converting it to a text* object.
  */
 char *dynamic_to_cstring(StringInfo out, dynamic_container *in, int estimated_len) {
-    return dynamic_to_cstring_worker(out, in, estimated_len, false);
+    return dynamic_to_cstring_worker(out, in, estimated_len, false, false, false);
 }
 
 /*
  * same thing but with indentation turned on
  */
 char *dynamic_to_cstring_indent(StringInfo out, dynamic_container *in, int estimated_len) {
-    return dynamic_to_cstring_worker(out, in, estimated_len, true);
+    return dynamic_to_cstring_worker(out, in, estimated_len, true, false, false);
 }
 
 /*
- * common worker for above two functions
+ * common worker for above two functions and dynamic_out(), which also passes
+ * the compact and JSON output options
  */
-static char *dynamic_to_cstring_worker(StringInfo out, dynamic_container *in, int estimated_len, bool indent)
+static char *dynamic_to_cstring_worker(StringInfo out, dynamic_container *in, int estimated_len, bool indent,
+                                       bool compact, bool json)
 {
     bool first = true;
     dynamic_iterator *it;
@@ -770,8 +1579,8 @@ static char *dynamic_to_cstring_worker(StringInfo out, dynamic_container *in, in
     int level = 0;
     bool redo_switch = false;
 
-    // If we are indenting, don't add a space after a comma 
-    int ispaces = indent ? 1 : 2;
+    // If we are indenting or compact, don't add a space after a comma 
+    int ispaces = (indent || compact) ? 1 : 2;
 
     /*
      * Don't indent the very first item. This gets set to the indent flag at
@@ -782,9 +1591,15 @@ static char *dynamic_to_cstring_worker(StringInfo out, dynamic_container *in, in
     bool last_was_key = false;
 
     if (out == NULL)
-        out = makeStringInfo();
-
-    enlargeStringInfo(out, (estimated_len >= 0) ? estimated_len : 64);
+    {
+        // allocate exactly the estimate, which enlargeStringInfo() would round up
+        out = palloc(sizeof(StringInfoData));
+        out->maxlen = ((estimated_len >= 0) ? estimated_len : 64) + 1;
+        out->data = palloc(out->maxlen);
+        resetStringInfo(out);
+    }
+    else
+        enlargeStringInfo(out, (estimated_len >= 0) ? estimated_len : 64);
 
     it = dynamic_iterator_init(in);
 
@@ -794,6 +1609,7 @@ static char *dynamic_to_cstring_worker(StringInfo out, dynamic_container *in, in
         redo_switch = false;
         switch (type)
         {
+        case WGT_BEGIN_VECTOR:
         case WGT_BEGIN_ARRAY:
             if (!first)
                 appendBinaryStringInfo(out, ", ", ispaces);
@@ -827,12 +1643,12 @@ static char *dynamic_to_cstring_worker(StringInfo out, dynamic_container *in, in
 
             // dynamic rules guarantee this is a string 
             dynamic_put_escaped_value(out, &v);
-            appendBinaryStringInfo(out, ": ", 2);
+            appendBinaryStringInfo(out, ": ", (!indent && compact) ? 1 : 2);
 
             type = dynamic_iterator_next(&it, &v, false);
             if (type == WGT_VALUE) {
                 first = false;
-                dynamic_put_escaped_value(out, &v);
+                put_output_value(out, &v, json);
             } else {
                 Assert(type == WGT_BEGIN_OBJECT || type == WGT_BEGIN_ARRAY || type == WGT_BEGIN_VECTOR);
 
@@ -844,6 +1660,7 @@ static char *dynamic_to_cstring_worker(StringInfo out, dynamic_container *in, in
                 redo_switch = true;
             }
             break;
+        case WGT_VECTOR_VALUE:
         case WGT_ELEM:
             if (!first)
                 appendBinaryStringInfo(out, ", ", ispaces);
@@ -851,8 +1668,9 @@ static char *dynamic_to_cstring_worker(StringInfo out, dynamic_container *in, in
 
             if (!raw_scalar)
                 add_indent(out, use_indent, level);
-            dynamic_put_escaped_value(out, &v);
+            put_output_value(out, &v, json);
             break;
+        case WGT_END_VECTOR:
         case WGT_END_ARRAY:
             level--;
             if (!raw_scalar) {
@@ -879,6 +1697,247 @@ static char *dynamic_to_cstring_worker(StringInfo out, dynamic_container *in, in
     return out->data;
 }
 
+/*
+ * Output a value of an array or object. With json the text has to be valid
+ * JSON, so numerics go without their annotation, and the scalars JSON has
+ * no literal for are output as strings.
+ */
+static void put_output_value(StringInfo out, dynamic_value *v, bool json) {
+    if (!json)
+    {
+        dynamic_put_escaped_value(out, v);
+        return;
+    }
+
+    switch (v->type)
+    {
+    case DYNAMIC_NULL:
+    case DYNAMIC_BOOL:
+    case DYNAMIC_STRING:
+    case DYNAMIC_INTEGER:
+        dynamic_put_escaped_value(out, v);
+        break;
+    case DYNAMIC_NUMERIC:
+    {
+        char *numstr = DatumGetCString(DirectFunctionCall1(numeric_out, NumericGetDatum(v->val.numeric)));
+
+        if (numeric_is_nan(v->val.numeric) || numeric_is_inf(v->val.numeric))
+            escape_dynamic(out, numstr, strlen(numstr));
+        else
+            appendStringInfoString(out, numstr);
+        break;
+    }
+    case DYNAMIC_FLOAT:
+        if (isnan(v->val.float_value) || isinf(v->val.float_value))
+            put_quoted_value(out, v);
+        else
+            dynamic_put_escaped_value(out, v);
+        break;
+    default:
+        put_quoted_value(out, v);
+        break;
+    }
+}
+
+/*
+ * Output a scalar's usual text as a string.
+ */
+static void put_quoted_value(StringInfo out, dynamic_value *v) {
+    int start = out->len;
+    char *str;
+    int len;
+
+    dynamic_put_escaped_value(out, v);
+
+    len = out->len - start;
+    str = pnstrdup(out->data + start, len);
+    out->len = start;
+    escape_dynamic(out, str, len);
+
+    pfree(str);
+}
+
+/*
+ * Estimate the length of the text dynamic_to_cstring() produces for a
+ * container, so that it can be written into a single allocation. sep_len is
+ * the length of the separators after elements and keys, and json whether
+ * scalars are output as JSON. The punctuation, strings, keys, integers,
+ * booleans and nulls are counted exactly. Other scalars are counted at a
+ * typical length for their type, or from their stored size, and if the text
+ * turns out longer the buffer still grows as needed.
+ */
+static Size dynamic_text_size(dynamic_container *container, int sep_len, bool json) {
+    uint32 count = DYNAMIC_CONTAINER_SIZE(container);
+    uint32 nchildren;
+    char *base_addr;
+    uint32 offset = 0;
+    Size size;
+    uint32 i;
+
+    // brackets, and the separators between elements or pairs
+    size = DYNAMIC_CONTAINER_IS_SCALAR(container) ? 0 : 2;
+    if (count > 1)
+        size += sep_len * (count - 1);
+
+    if (DYNAMIC_CONTAINER_IS_VECTOR(container))
+    {
+        uint32 vector_type = DYNAMIC_VECTOR_TYPE(container);
+        dynamic_value v;
+
+        if (vector_type == DYNA_HEADER_INTEGER)
+        {
+            int64 *elems = (int64 *)DYNAMIC_VECTOR_DATA(container);
+
+            for (i = 0; i < count; i++)
+            {
+                int64 elem;
+
+                // the elements are only int-aligned
+                memcpy(&elem, &elems[i], sizeof(int64));
+                size += int64_text_len(elem);
+            }
+
+            return size;
+        }
+
+        if (vector_type == DYNA_HEADER_FLOAT)
+            v.type = DYNAMIC_FLOAT;
+        else if (vector_type == DYNA_HEADER_DATE)
+            v.type = DYNAMIC_DATE;
+        else
+            v.type = DYNAMIC_TIMESTAMP;
+
+        return size + count * dynamic_scalar_text_size(&v, DYNAMIC_VECTOR_ELEM_SIZE(vector_type), json);
+    }
+
+    if (DYNAMIC_CONTAINER_IS_OBJECT(container))
+    {
+        // and the separator after each key
+        size += sep_len * count;
+        nchildren = count * 2;
+    }
+    else
+        nchildren = count;
+
+    base_addr = (char *)&container->children[nchildren];
+
+    for (i = 0; i < nchildren; i++)
+    {
+        gtentry entry = container->children[i];
+        uint32 len = GTE_OFFLENFLD(entry);
+
+        if (GTE_HAS_OFF(entry))
+            len -= offset;
+
+        size += dynamic_child_text_size(entry, base_addr, offset, len, sep_len, json);
+        offset += len;
+    }
+
+    return size;
+}
+
+static Size dynamic_child_text_size(gtentry entry, char *base_addr, uint32 offset, uint32 len, int sep_len,
+                                    bool json) {
+    if (GTE_IS_STRING(entry))
+        return dynamic_string_text_size(base_addr + offset, len);
+
+    if (GTE_IS_KEY_REF(entry))
+    {
+        gtentry_key_ref ref;
+
+        memcpy(&ref, base_addr + offset, sizeof(gtentry_key_ref));
+        return dynamic_string_text_size(base_addr + offset - ref.distance, ref.len);
+    }
+
+    if (GTE_IS_NULL(entry) || GTE_IS_BOOL_TRUE(entry))
+        return 4;
+
+    if (GTE_IS_BOOL_FALSE(entry))
+        return 5;
+
+    if (GTE_IS_CONTAINER(entry))
+        return dynamic_text_size((dynamic_container *)(base_addr + INTALIGN(offset)), sep_len, json);
+
+    if (GTE_IS_DYNAMIC(entry))
+    {
+        dynamic_value v;
+
+        ag_deserialize_extended_type(base_addr, offset, &v);
+        return dynamic_scalar_text_size(&v, len, json);
+    }
+
+    // a numeric, followed by "::numeric"
+    return 2 * (Size) len + 16;
+}
+
+/*
+ * The length of a string with its quotes and escapes, see escape_dynamic().
+ */
+static Size dynamic_string_text_size(const char *str, int len) {
+    Size size = len + 2;
+    int i = 0;
+
+    while (i < len)
+    {
+        i += dynamic_string_plain_len(str + i, len - i);
+        if (i == len)
+            break;
+
+        switch (str[i])
+        {
+        case '\b':
+        case '\f':
+        case '\n':
+        case '\r':
+        case '\t':
+        case '"':
+        case '\\':
+            size += 1;
+            break;
+        default:
+            size += 5;
+            break;
+        }
+        i++;
+    }
+
+    return size;
+}
+
+static Size dynamic_scalar_text_size(dynamic_value *v, uint32 len, bool json) {
+    switch (v->type)
+    {
+    case DYNAMIC_INTEGER:
+        return int64_text_len(v->val.int_value);
+    case DYNAMIC_FLOAT:
+        return DYNAMIC_FLOAT_TEXT_LEN;
+    case DYNAMIC_TIMESTAMP:
+    case DYNAMIC_TIMESTAMPTZ:
+        return DYNAMIC_TIMESTAMP_TEXT_LEN;
+    case DYNAMIC_DATE:
+        // and the quotes around it as JSON
+        return json ? DYNAMIC_DATE_TEXT_LEN + 2 : DYNAMIC_DATE_TEXT_LEN;
+    case DYNAMIC_TIME:
+    case DYNAMIC_TIMETZ:
+        return DYNAMIC_TIME_TEXT_LEN;
+    default:
+        return 2 * (Size) len + 16;
+    }
+}
+
+static int int64_text_len(int64 val) {
+    uint64 uval = (val < 0) ? -(uint64) val : (uint64) val;
+    int len = (val < 0) ? 2 : 1;
+
+    while (uval >= 10)
+    {
+        uval /= 10;
+        len++;
+    }
+
+    return len;
+}
+
 static void add_indent(StringInfo out, bool indent, int level) {
     if (indent) {
         int i;
@@ -889,3 +1948,89 @@ static void add_indent(StringInfo out, bool indent, int level) {
     }
 }
 
+
+/*
+ * dynamic -> int: return the element at the given index of an array, counting
+ * from the end when the index is negative. Elements of a vector are found
+ * by position without walking the array.
+ */
+PG_FUNCTION_INFO_V1(dynamic_array_element);
+
+Datum dynamic_array_element(PG_FUNCTION_ARGS) {
+    dynamic *agt = AG_GET_ARG_DYNAMIC_P(0);
+    int element = PG_GETARG_INT32(1);
+
+    return dynamic_array_element_impl(fcinfo, agt, element, false);
+}
+
+Datum dynamic_array_element_impl(FunctionCallInfo fcinfo, dynamic *dynamic_in, int element, bool as_text) {
+    dynamic_value *v;
+
+    if (!DYNA_ROOT_IS_ARRAY(dynamic_in) || DYNA_ROOT_IS_SCALAR(dynamic_in))
+        PG_RETURN_NULL();
+
+    v = execute_array_access_operator_internal(dynamic_in, element);
+
+    return process_access_operator_result(fcinfo, v, as_text);
+}
+
+/*
+ * dynamic -> text and dynamic ->> text: return the value of a key of an
+ * object, as dynamic or as text. The argument is not detoasted as a whole,
+ * see find_dynamic_object_field.
+ */
+PG_FUNCTION_INFO_V1(dynamic_object_field);
+
+Datum dynamic_object_field(PG_FUNCTION_ARGS) {
+    text *key = PG_GETARG_TEXT_PP(1);
+    dynamic_value *v;
+
+    v = find_dynamic_object_field(PG_GETARG_DATUM(0), VARDATA_ANY(key), VARSIZE_ANY_EXHDR(key));
+
+    return process_access_operator_result(fcinfo, v, false);
+}
+
+PG_FUNCTION_INFO_V1(dynamic_object_field_text);
+
+Datum dynamic_object_field_text(PG_FUNCTION_ARGS) {
+    text *key = PG_GETARG_TEXT_PP(1);
+    dynamic_value *v;
+
+    v = find_dynamic_object_field(PG_GETARG_DATUM(0), VARDATA_ANY(key), VARSIZE_ANY_EXHDR(key));
+
+    return process_access_operator_result(fcinfo, v, true);
+}
+
+static dynamic_value *execute_array_access_operator_internal(dynamic *array, int64 array_index) {
+    uint32 size = DYNA_ROOT_COUNT(array);
+
+    if (array_index < 0) {
+        array_index = size + array_index;
+        if (array_index < 0)
+            return NULL;
+    } else if (array_index >= size) {
+        return NULL;
+    }
+
+    return get_ith_dynamic_value_from_container(&array->root, array_index);
+}
+
+static Datum process_access_operator_result(FunctionCallInfo fcinfo, dynamic_value *agtv, bool as_text) {
+    dynamic *result;
+
+    if (agtv == NULL)
+        PG_RETURN_NULL();
+
+    if (as_text && agtv->type == DYNAMIC_STRING)
+        PG_RETURN_TEXT_P(cstring_to_text_with_len(agtv->val.string.val, agtv->val.string.len));
+
+    if (as_text && agtv->type == DYNAMIC_NULL)
+        PG_RETURN_NULL();
+
+    result = dynamic_value_to_dynamic(agtv);
+
+    if (as_text)
+        PG_RETURN_TEXT_P(cstring_to_text(dynamic_to_cstring(NULL, &result->root, DYNAMIC_TEXT_SIZE(&result->root, false, false))));
+
+    AG_RETURN_DYNAMIC_P(result);
+}
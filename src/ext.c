@@ -20,6 +20,9 @@
 #include "utils/dynamic_ext.h"
 #include "utils/dynamic.h"
 
+#include "access/tupmacs.h"
+#include "mb/pg_wchar.h"
+
 /* define the type and size of the agt_header */
 #define DYNA_HEADER_TYPE uint32
 #define DYNA_HEADER_SIZE sizeof(DYNA_HEADER_TYPE)
@@ -36,6 +39,49 @@ static short ag_serialize_header(StringInfo buffer, uint32 type)
     return padlen;
 }
 
+/*
+ * Whether a value fits in the immediate of a DYNA_HEADER_COMPACT header.
+ */
+static inline bool fits_in_compact_header(int64 value)
+{
+    return value >= DYNA_HEADER_COMPACT_MIN && value <= DYNA_HEADER_COMPACT_MAX;
+}
+
+/*
+ * Whether a timestamp or time holds whole seconds that fit in an int32.
+ */
+static inline bool is_whole_seconds_int32(int64 usecs)
+{
+    return usecs % USECS_PER_SEC == 0 &&
+           usecs / USECS_PER_SEC >= PG_INT32_MIN &&
+           usecs / USECS_PER_SEC <= PG_INT32_MAX;
+}
+
+/*
+ * Serializes a value that fits in the header itself, see DYNA_HEADER_COMPACT.
+ * Returns the gtentry for it.
+ */
+static gtentry ag_serialize_compact(StringInfo buffer, uint32 type, int32 value)
+{
+    short padlen = ag_serialize_header(buffer, DYNA_HEADER_MAKE_COMPACT(type, value));
+
+    return GTENTRY_IS_DYNAMIC | (padlen + DYNA_HEADER_SIZE);
+}
+
+/*
+ * Serializes a value as a header and 4 bytes of data, see DYNA_HEADER_INT32.
+ * Returns the gtentry for it.
+ */
+static gtentry ag_serialize_int32(StringInfo buffer, uint32 type, int32 value)
+{
+    short padlen = ag_serialize_header(buffer, type | DYNA_HEADER_INT32);
+    int offset = reserve_from_buffer(buffer, sizeof(int32));
+
+    *((int32 *)(buffer->data + offset)) = value;
+
+    return GTENTRY_IS_DYNAMIC | (padlen + sizeof(int32) + DYNA_HEADER_SIZE);
+}
+
 /*
  * Function serializes the data into the buffer provided.
  * Returns false if the type is not defined. Otherwise, true.
@@ -50,6 +96,17 @@ bool ag_serialize_extended_type(StringInfo buffer, gtentry *gtentry,
     switch (scalar_val->type)
     {
     case DYNAMIC_INTEGER:
+        if (fits_in_compact_header(scalar_val->val.int_value))
+        {
+            *gtentry = ag_serialize_compact(buffer, DYNA_HEADER_INTEGER, (int32) scalar_val->val.int_value);
+            break;
+        }
+        if (scalar_val->val.int_value >= PG_INT32_MIN && scalar_val->val.int_value <= PG_INT32_MAX)
+        {
+            *gtentry = ag_serialize_int32(buffer, DYNA_HEADER_INTEGER, (int32) scalar_val->val.int_value);
+            break;
+        }
+
         padlen = ag_serialize_header(buffer, DYNA_HEADER_INTEGER);
 
         /* copy in the int_value data */
@@ -71,14 +128,28 @@ bool ag_serialize_extended_type(StringInfo buffer, gtentry *gtentry,
         *gtentry = GTENTRY_IS_DYNAMIC | (padlen + numlen + DYNA_HEADER_SIZE);
         break;
     case DYNAMIC_TIMESTAMP:
+        if (is_whole_seconds_int32(scalar_val->val.int_value))
+        {
+            *gtentry = ag_serialize_int32(buffer, DYNA_HEADER_TIMESTAMP,
+                                          (int32) (scalar_val->val.int_value / USECS_PER_SEC));
+            break;
+        }
+
         padlen = ag_serialize_header(buffer, DYNA_HEADER_TIMESTAMP);
 
         offset = reserve_from_buffer(buffer, sizeof(int64));
         *((int64 *)(buffer->data + offset)) = scalar_val->val.int_value;
 
-	*gtentry = GTENTRY_IS_DYNAMIC | (sizeof(int64) + DYNA_HEADER_SIZE);
+        *gtentry = GTENTRY_IS_DYNAMIC | (padlen + sizeof(int64) + DYNA_HEADER_SIZE);
         break;
     case DYNAMIC_TIMESTAMPTZ:
+        if (is_whole_seconds_int32(scalar_val->val.int_value))
+        {
+            *gtentry = ag_serialize_int32(buffer, DYNA_HEADER_TIMESTAMPTZ,
+                                          (int32) (scalar_val->val.int_value / USECS_PER_SEC));
+            break;
+        }
+
         padlen = ag_serialize_header(buffer, DYNA_HEADER_TIMESTAMPTZ);
 
         /* copy in the int_value data */
@@ -89,6 +160,12 @@ bool ag_serialize_extended_type(StringInfo buffer, gtentry *gtentry,
         *gtentry = GTENTRY_IS_DYNAMIC | (padlen + numlen + DYNA_HEADER_SIZE);
         break;
     case DYNAMIC_DATE:
+        if (fits_in_compact_header(scalar_val->val.date))
+        {
+            *gtentry = ag_serialize_compact(buffer, DYNA_HEADER_DATE, scalar_val->val.date);
+            break;
+        }
+
         padlen = ag_serialize_header(buffer, DYNA_HEADER_DATE);
 
         /* copy in the date data */
@@ -99,6 +176,14 @@ bool ag_serialize_extended_type(StringInfo buffer, gtentry *gtentry,
         *gtentry = GTENTRY_IS_DYNAMIC | (padlen + numlen + DYNA_HEADER_SIZE);
 	break;
     case DYNAMIC_TIME:
+        if (scalar_val->val.int_value % USECS_PER_SEC == 0 &&
+            fits_in_compact_header(scalar_val->val.int_value / USECS_PER_SEC))
+        {
+            *gtentry = ag_serialize_compact(buffer, DYNA_HEADER_TIME,
+                                            (int32) (scalar_val->val.int_value / USECS_PER_SEC));
+            break;
+        }
+
         padlen = ag_serialize_header(buffer, DYNA_HEADER_TIME);
         numlen = sizeof(int64);
         offset = reserve_from_buffer(buffer, numlen);
@@ -354,6 +439,94 @@ bool ag_serialize_extended_type(StringInfo buffer, gtentry *gtentry,
     return true;
 }
 
+/*
+ * Function returns the number of bytes ag_serialize_extended_type writes for
+ * the scalar, not counting alignment padding. Returns 0 if the type is not
+ * defined.
+ */
+int ag_extended_type_size(dynamic_value *scalar_val)
+{
+    int numlen;
+
+    switch (scalar_val->type)
+    {
+    case DYNAMIC_INTEGER:
+        if (fits_in_compact_header(scalar_val->val.int_value))
+            numlen = 0;
+        else if (scalar_val->val.int_value >= PG_INT32_MIN && scalar_val->val.int_value <= PG_INT32_MAX)
+            numlen = sizeof(int32);
+        else
+            numlen = sizeof(int64);
+        break;
+    case DYNAMIC_TIMESTAMP:
+    case DYNAMIC_TIMESTAMPTZ:
+        numlen = is_whole_seconds_int32(scalar_val->val.int_value) ? sizeof(int32) : sizeof(int64);
+        break;
+    case DYNAMIC_TIME:
+        numlen = (scalar_val->val.int_value % USECS_PER_SEC == 0 &&
+                  fits_in_compact_header(scalar_val->val.int_value / USECS_PER_SEC)) ? 0 : sizeof(int64);
+        break;
+    case DYNAMIC_DATE:
+        numlen = fits_in_compact_header(scalar_val->val.date) ? 0 : sizeof(int32);
+        break;
+    case DYNAMIC_FLOAT:
+        numlen = sizeof(float8);
+        break;
+    case DYNAMIC_TIMETZ:
+        numlen = sizeof(TimeTzADT);
+        break;
+    case DYNAMIC_INTERVAL:
+        numlen = sizeof(TimeOffset) + (2 * sizeof(int32));
+        break;
+    case DYNAMIC_INET:
+    case DYNAMIC_CIDR:
+        numlen = sizeof(char) * 22;
+        break;
+    case DYNAMIC_MAC:
+        numlen = sizeof(char) * 6;
+        break;
+    case DYNAMIC_MAC8:
+        numlen = sizeof(char) * 8;
+        break;
+    case DYNAMIC_POINT:
+        numlen = sizeof(Point);
+        break;
+    case DYNAMIC_LSEG:
+        numlen = sizeof(LSEG);
+        break;
+    case DYNAMIC_LINE:
+        numlen = sizeof(LINE);
+        break;
+    case DYNAMIC_CIRCLE:
+        numlen = sizeof(CIRCLE);
+        break;
+    case DYNAMIC_BOX:
+        numlen = sizeof(BOX);
+        break;
+    case DYNAMIC_PATH:
+    case DYNAMIC_POLYGON:
+    case DYNAMIC_BYTEA:
+    case DYNAMIC_TSVECTOR:
+    case DYNAMIC_TSQUERY:
+    case DYNAMIC_RANGE_INT:
+    case DYNAMIC_RANGE_NUM:
+    case DYNAMIC_RANGE_TS:
+    case DYNAMIC_RANGE_TSTZ:
+    case DYNAMIC_RANGE_DATE:
+    case DYNAMIC_RANGE_INT_MULTI:
+    case DYNAMIC_RANGE_NUM_MULTI:
+    case DYNAMIC_RANGE_TS_MULTI:
+    case DYNAMIC_RANGE_TSTZ_MULTI:
+    case DYNAMIC_RANGE_DATE_MULTI:
+        numlen = VARSIZE(scalar_val->val.extended);
+        break;
+    default:
+        return 0;
+    }
+
+    return DYNA_HEADER_SIZE + numlen;
+}
+
 /*
  * Function deserializes the data from the buffer pointed to by base_addr.
  * NOTE: This function writes to the error log and exits for any UNKNOWN
@@ -363,6 +536,54 @@ void ag_deserialize_extended_type(char *base_addr, uint32 offset, dynamic_value
     char *base = base_addr + INTALIGN(offset);
     DYNA_HEADER_TYPE agt_header = *((DYNA_HEADER_TYPE *)base);
 
+    // compact forms, see DYNA_HEADER_COMPACT and DYNA_HEADER_INT32 
+    if (agt_header & DYNA_HEADER_COMPACT)
+    {
+        int32 value = DYNA_HEADER_COMPACT_VALUE(agt_header);
+
+        switch (DYNA_HEADER_BASE_TYPE(agt_header))
+        {
+        case DYNA_HEADER_INTEGER:
+            result->type = DYNAMIC_INTEGER;
+            result->val.int_value = value;
+            break;
+        case DYNA_HEADER_DATE:
+            result->type = DYNAMIC_DATE;
+            result->val.date = value;
+            break;
+        case DYNA_HEADER_TIME:
+            result->type = DYNAMIC_TIME;
+            result->val.int_value = (int64) value * USECS_PER_SEC;
+            break;
+        default:
+            elog(ERROR, "Invalid AGT header value.");
+        }
+        return;
+    }
+    else if (agt_header & DYNA_HEADER_INT32)
+    {
+        int32 value = *((int32 *)(base + DYNA_HEADER_SIZE));
+
+        switch (DYNA_HEADER_BASE_TYPE(agt_header))
+        {
+        case DYNA_HEADER_INTEGER:
+            result->type = DYNAMIC_INTEGER;
+            result->val.int_value = value;
+            break;
+        case DYNA_HEADER_TIMESTAMP:
+            result->type = DYNAMIC_TIMESTAMP;
+            result->val.int_value = (int64) value * USECS_PER_SEC;
+            break;
+        case DYNA_HEADER_TIMESTAMPTZ:
+            result->type = DYNAMIC_TIMESTAMPTZ;
+            result->val.int_value = (int64) value * USECS_PER_SEC;
+            break;
+        default:
+            elog(ERROR, "Invalid AGT header value.");
+        }
+        return;
+    }
+
     switch (agt_header)
     {
     case DYNA_HEADER_INTEGER:
@@ -501,3 +722,414 @@ void ag_deserialize_extended_type(char *base_addr, uint32 offset, dynamic_value
         elog(ERROR, "Invalid AGT header value.");
     }
 }
+
+/*
+ * Checks that a varlena embedded in an extended type fills exactly len bytes.
+ */
+static bool validate_embedded_varlena(char *data, uint32 len, Size min_size)
+{
+    return len >= Max(VARHDRSZ, min_size) && VARATT_IS_4B_U(data) &&
+           VARSIZE(data) == len;
+}
+
+/*
+ * Checks the WordEntrys of a tsvector, and that the lexemes and positions
+ * they point to are within it, the way tsvectorout() reads them.
+ */
+static bool validate_tsvector(char *data, uint32 len)
+{
+    TSVector tsv = (TSVector) data;
+    char *strs;
+    uint64 strs_len;
+    int i;
+
+    if (!validate_embedded_varlena(data, len, DATAHDRSIZE) || tsv->size < 0 ||
+        (uint64) tsv->size * sizeof(WordEntry) > len - DATAHDRSIZE)
+        return false;
+
+    strs = STRPTR(tsv);
+    strs_len = len - DATAHDRSIZE - (uint64) tsv->size * sizeof(WordEntry);
+
+    for (i = 0; i < tsv->size; i++)
+    {
+        WordEntry *entry = &tsv->entries[i];
+        uint64 end = (uint64) entry->pos + entry->len;
+
+        if (end > strs_len || !pg_verifymbstr(strs + entry->pos, entry->len, true))
+            return false;
+
+        if (entry->haspos)
+        {
+            uint64 pos_start = SHORTALIGN(end);
+            uint16 npos;
+
+            if (pos_start + sizeof(uint16) > strs_len)
+                return false;
+
+            memcpy(&npos, strs + pos_start, sizeof(uint16));
+            if (npos == 0 ||
+                pos_start + sizeof(uint16) + npos * sizeof(WordEntryPos) > strs_len)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Checks the QueryItems of a tsquery: operands have to be null terminated
+ * strings within it, and operators have to point to items after them, so
+ * that walking the tree from the first item stays within the tsquery and
+ * ends.
+ */
+static bool validate_tsquery(char *data, uint32 len)
+{
+    TSQuery query = (TSQuery) data;
+    char *operands;
+    uint64 operands_len;
+    int i;
+
+    if (!validate_embedded_varlena(data, len, HDRSIZETQ) || query->size < 0 ||
+        (uint64) query->size * sizeof(QueryItem) > len - HDRSIZETQ)
+        return false;
+
+    operands = GETOPERAND(query);
+    operands_len = len - HDRSIZETQ - (uint64) query->size * sizeof(QueryItem);
+
+    for (i = 0; i < query->size; i++)
+    {
+        QueryItem *item = &GETQUERY(query)[i];
+
+        if (item->type == QI_VAL)
+        {
+            QueryOperand *operand = &item->qoperand;
+            uint64 end = (uint64) operand->distance + operand->length;
+
+            if (operand->length > MAXSTRLEN || end >= operands_len ||
+                operands[end] != '\0' ||
+                !pg_verifymbstr(operands + operand->distance, operand->length, true) ||
+                strlen(operands + operand->distance) != operand->length)
+                return false;
+        }
+        else if (item->type == QI_OPR)
+        {
+            QueryOperator *opr = &item->qoperator;
+
+            if (opr->oper != OP_NOT && opr->oper != OP_AND &&
+                opr->oper != OP_OR && opr->oper != OP_PHRASE)
+                return false;
+
+            /* the right operand, or the only one of a NOT, is the next item */
+            if (i + 1 >= query->size)
+                return false;
+
+            if (opr->oper != OP_NOT &&
+                (opr->left == 0 || (uint64) i + opr->left >= query->size))
+                return false;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * The storage of the bounds of the range types dynamic supports.
+ */
+static bool get_range_bound_layout(Oid rngtypid, int16 *typlen, char *typalign)
+{
+    switch (rngtypid)
+    {
+    case INT4RANGEOID:
+    case INT4MULTIRANGEOID:
+    case DATERANGEOID:
+    case DATEMULTIRANGEOID:
+        *typlen = sizeof(int32);
+        *typalign = TYPALIGN_INT;
+        return true;
+    case INT8RANGEOID:
+    case INT8MULTIRANGEOID:
+    case TSRANGEOID:
+    case TSMULTIRANGEOID:
+    case TSTZRANGEOID:
+    case TSTZMULTIRANGEOID:
+        *typlen = sizeof(int64);
+        *typalign = TYPALIGN_DOUBLE;
+        return true;
+    case NUMRANGEOID:
+    case NUMMULTIRANGEOID:
+        *typlen = -1;
+        *typalign = TYPALIGN_INT;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Only the flags range_serialize() sets, and nothing but RANGE_EMPTY for an
+ * empty range.
+ */
+static bool validate_range_flags(char flags, bool allow_empty)
+{
+    if (flags & ~(RANGE_EMPTY | RANGE_LB_INC | RANGE_UB_INC | RANGE_LB_INF | RANGE_UB_INF))
+        return false;
+
+    if (flags & RANGE_EMPTY)
+        return allow_empty && flags == RANGE_EMPTY;
+
+    return true;
+}
+
+/*
+ * Checks a bound value at ptr, aligned the way range_deserialize() aligns
+ * it if align is set. Numerics have to have at least their header. Returns
+ * where the bound ends, or NULL if it does not fit before end.
+ */
+static char *validate_range_bound(char *ptr, char *end, int16 typlen, char typalign, bool align)
+{
+    Size size;
+    Size hdr_size;
+    uint16 n_header;
+
+    if (align)
+    {
+        if (typlen != -1 || ptr >= end || !VARATT_NOT_PAD_BYTE(ptr))
+            ptr = (char *) att_align_nominal(ptr, typalign);
+    }
+
+    if (typlen > 0)
+        return ptr + typlen <= end ? ptr + typlen : NULL;
+
+    if (ptr >= end || VARATT_IS_EXTERNAL(ptr) || VARATT_IS_COMPRESSED(ptr))
+        return NULL;
+
+    if (VARATT_IS_1B(ptr))
+    {
+        hdr_size = VARHDRSZ_SHORT;
+        size = VARSIZE_1B(ptr);
+    }
+    else
+    {
+        if (end - ptr < VARHDRSZ)
+            return NULL;
+        hdr_size = VARHDRSZ;
+        size = VARSIZE_4B(ptr);
+    }
+
+    if (size > (Size) (end - ptr) || size < hdr_size + sizeof(uint16))
+        return NULL;
+
+    /* a numeric without the short header flag has a longer header */
+    memcpy(&n_header, ptr + hdr_size, sizeof(uint16));
+    if (!(n_header & 0x8000) && size < hdr_size + 2 * sizeof(uint16))
+        return NULL;
+
+    return ptr + size;
+}
+
+/*
+ * Checks the flags and bounds of a range, which range_deserialize() finds
+ * from the flags in its last byte.
+ */
+static bool validate_range(char *data, uint32 len, Oid rngtypid)
+{
+    RangeType *range = (RangeType *) data;
+    char *end = data + len - 1;
+    char *ptr = data + sizeof(RangeType);
+    int16 typlen;
+    char typalign;
+    char flags;
+
+    if (!validate_embedded_varlena(data, len, sizeof(RangeType) + 1) ||
+        RangeTypeGetOid(range) != rngtypid ||
+        !get_range_bound_layout(rngtypid, &typlen, &typalign))
+        return false;
+
+    flags = *end;
+    if (!validate_range_flags(flags, true))
+        return false;
+
+    if (RANGE_HAS_LBOUND(flags))
+        ptr = validate_range_bound(ptr, end, typlen, typalign, true);
+    if (ptr != NULL && RANGE_HAS_UBOUND(flags))
+        ptr = validate_range_bound(ptr, end, typlen, typalign, true);
+
+    return ptr != NULL;
+}
+
+/*
+ * Checks the offsets, flags and bounds of the ranges of a multirange, the
+ * way multirange_get_range() finds them. The ranges are stored without their
+ * RangeType header, after an array of offsets or lengths of all but the last
+ * and an array of their flags.
+ */
+static bool validate_multirange(char *data, uint32 len, Oid mltrngtypid)
+{
+    MultirangeType *multirange = (MultirangeType *) data;
+    uint32 *items = (uint32 *) (data + sizeof(MultirangeType));
+    char *end = data + len;
+    char *boundaries;
+    uint8 *flags;
+    uint64 header_len;
+    int16 typlen;
+    char typalign;
+    int32 i;
+
+    if (!validate_embedded_varlena(data, len, sizeof(MultirangeType)) ||
+        MultirangeTypeGetOid(multirange) != mltrngtypid ||
+        !get_range_bound_layout(mltrngtypid, &typlen, &typalign) ||
+        multirange->rangeCount < 0)
+        return false;
+
+    if (multirange->rangeCount == 0)
+        return true;
+
+    header_len = sizeof(MultirangeType) +
+                 (uint64) (multirange->rangeCount - 1) * sizeof(uint32) +
+                 multirange->rangeCount * sizeof(uint8);
+    if (att_align_nominal(header_len, typalign) > len)
+        return false;
+
+    flags = (uint8 *) (items + multirange->rangeCount - 1);
+    boundaries = data + att_align_nominal(header_len, typalign);
+
+    for (i = 0; i < multirange->rangeCount; i++)
+    {
+        uint64 offset = 0;
+        int32 j = i;
+        char *ptr;
+
+        /* the lengths of the ranges before it, up to one with an offset */
+        while (j > 0)
+        {
+            offset += items[j - 1] & 0x7FFFFFFF;
+            if (items[j - 1] & 0x80000000)
+                break;
+            j--;
+        }
+
+        if (offset > (uint64) (end - boundaries) || !validate_range_flags(flags[i], false))
+            return false;
+
+        ptr = boundaries + offset;
+        if (RANGE_HAS_LBOUND(flags[i]))
+            ptr = validate_range_bound(ptr, end, typlen, typalign, false);
+        if (ptr != NULL && RANGE_HAS_UBOUND(flags[i]))
+            ptr = validate_range_bound(ptr, end, typlen, typalign, true);
+        if (ptr == NULL)
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Function checks that the extended type stored at base_addr + offset is
+ * well formed and, including its alignment padding, occupies exactly len
+ * bytes. Returns false otherwise. Used on data from untrusted sources before
+ * it is handed to ag_deserialize_extended_type. The inner structure of
+ * tsvectors, tsqueries, ranges and multiranges is checked as far as their
+ * output and deserialization functions read it.
+ */
+bool ag_validate_extended_type(char *base_addr, uint32 offset, uint32 len)
+{
+    uint32 padlen = INTALIGN(offset) - offset;
+    char *base = base_addr + INTALIGN(offset);
+    char *data = base + DYNA_HEADER_SIZE;
+    uint32 datalen;
+
+    if (len < padlen + DYNA_HEADER_SIZE)
+        return false;
+
+    datalen = len - padlen - DYNA_HEADER_SIZE;
+
+    if (*((DYNA_HEADER_TYPE *)base) & DYNA_HEADER_COMPACT)
+    {
+        uint32 type = DYNA_HEADER_BASE_TYPE(*((DYNA_HEADER_TYPE *)base));
+
+        return datalen == 0 &&
+               (type == DYNA_HEADER_INTEGER || type == DYNA_HEADER_DATE ||
+                type == DYNA_HEADER_TIME);
+    }
+    else if (*((DYNA_HEADER_TYPE *)base) & DYNA_HEADER_INT32)
+    {
+        uint32 type = DYNA_HEADER_BASE_TYPE(*((DYNA_HEADER_TYPE *)base));
+
+        return datalen == sizeof(int32) &&
+               (type == DYNA_HEADER_INTEGER || type == DYNA_HEADER_TIMESTAMP ||
+                type == DYNA_HEADER_TIMESTAMPTZ);
+    }
+
+    switch (*((DYNA_HEADER_TYPE *)base))
+    {
+    case DYNA_HEADER_INTEGER:
+    case DYNA_HEADER_FLOAT:
+    case DYNA_HEADER_TIMESTAMP:
+    case DYNA_HEADER_TIMESTAMPTZ:
+    case DYNA_HEADER_TIME:
+        return datalen == sizeof(int64);
+    case DYNA_HEADER_DATE:
+        return datalen == sizeof(int32);
+    case DYNA_HEADER_TIMETZ:
+        return datalen == sizeof(TimeTzADT);
+    case DYNA_HEADER_INTERVAL:
+        return datalen == sizeof(TimeOffset) + (2 * sizeof(int32));
+    case DYNA_HEADER_INET:
+    case DYNA_HEADER_CIDR:
+        return datalen == sizeof(char) * 22;
+    case DYNA_HEADER_MAC:
+        return datalen == sizeof(char) * 6;
+    case DYNA_HEADER_MAC8:
+        return datalen == sizeof(char) * 8;
+    case DYNA_HEADER_POINT:
+        return datalen == sizeof(Point);
+    case DYNA_HEADER_LSEG:
+        return datalen == sizeof(LSEG);
+    case DYNA_HEADER_LINE:
+        return datalen == sizeof(LINE);
+    case DYNA_HEADER_CIRCLE:
+        return datalen == sizeof(CIRCLE);
+    case DYNA_HEADER_BOX:
+        return datalen == sizeof(BOX);
+    case DYNA_HEADER_PATH:
+        return validate_embedded_varlena(data, datalen, offsetof(PATH, p)) &&
+               offsetof(PATH, p) + ((PATH *)data)->npts * sizeof(Point) == datalen;
+    case DYNA_HEADER_POLYGON:
+        return validate_embedded_varlena(data, datalen, offsetof(POLYGON, p)) &&
+               offsetof(POLYGON, p) + ((POLYGON *)data)->npts * sizeof(Point) == datalen;
+    case DYNA_HEADER_BYTEA:
+        return validate_embedded_varlena(data, datalen, VARHDRSZ);
+    case DYNA_HEADER_TSVECTOR:
+        return validate_tsvector(data, datalen);
+    case DYNA_HEADER_TSQUERY:
+        return validate_tsquery(data, datalen);
+    case DYNA_HEADER_RANGE_INT:
+        return validate_range(data, datalen, INT4RANGEOID) ||
+               validate_range(data, datalen, INT8RANGEOID);
+    case DYNA_HEADER_RANGE_NUM:
+        return validate_range(data, datalen, NUMRANGEOID);
+    case DYNA_HEADER_RANGE_TS:
+        return validate_range(data, datalen, TSRANGEOID);
+    case DYNA_HEADER_RANGE_TSTZ:
+        return validate_range(data, datalen, TSTZRANGEOID);
+    case DYNA_HEADER_RANGE_DATE:
+        return validate_range(data, datalen, DATERANGEOID);
+    case DYNA_HEADER_RANGE_INT_MULTI:
+        return validate_multirange(data, datalen, INT4MULTIRANGEOID) ||
+               validate_multirange(data, datalen, INT8MULTIRANGEOID);
+    case DYNA_HEADER_RANGE_NUM_MULTI:
+        return validate_multirange(data, datalen, NUMMULTIRANGEOID);
+    case DYNA_HEADER_RANGE_TS_MULTI:
+        return validate_multirange(data, datalen, TSMULTIRANGEOID);
+    case DYNA_HEADER_RANGE_TSTZ_MULTI:
+        return validate_multirange(data, datalen, TSTZMULTIRANGEOID);
+    case DYNA_HEADER_RANGE_DATE_MULTI:
+        return validate_multirange(data, datalen, DATEMULTIRANGEOID);
+    default:
+        return false;
+    }
+}
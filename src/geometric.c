@@ -51,7 +51,7 @@ box_to_dynamic(PG_FUNCTION_ARGS) {
         .val.box = PG_GETARG_BOX_P(0)
     };
 
-    AG_RETURN_DYNAMIC_P(dynamic_value_to_dynamic(&dynav));
+    AG_RETURN_DYNAMIC_P(scalar_value_to_dynamic(&dynav));
 }
 
 PG_FUNCTION_INFO_V1(dynamic_tobox);
@@ -66,7 +66,7 @@ dynamic_tobox(PG_FUNCTION_ARGS) {
 
     PG_FREE_IF_COPY(dyna, 0);
 
-    AG_RETURN_DYNAMIC_P(dynamic_value_to_dynamic(&dynav));
+    AG_RETURN_DYNAMIC_P(scalar_value_to_dynamic(&dynav));
 }
 
 Datum
@@ -0,0 +1,207 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Casts between jsonb and dynamic.
+ *
+ * The dynamic on-disk format is jsonb's with more scalar types: containers,
+ * gtentrys, key order and alignment rules are the same, and the jsonb scalar
+ * types have the same gtentry type codes. So any jsonb is already a valid
+ * dynamic, and a dynamic that only uses those scalar types is a valid jsonb.
+ * Neither direction has to go through the text representation.
+ */
+
+#include "postgres.h"
+
+#include <math.h>
+
+#include "common/shortest_dec.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+#include "utils/float.h"
+#include "utils/fmgrprotos.h"
+#include "utils/jsonb.h"
+#include "utils/numeric.h"
+#include "fmgr.h"
+
+#include "utils/dynamic.h"
+
+static bool is_jsonb_compatible(dynamic_container *agtc);
+static void dynamic_value_to_jsonb_value(dynamic_value *v, JsonbValue *result);
+
+/*
+ * Typecasting
+ */
+PG_FUNCTION_INFO_V1(jsonb_to_dynamic);
+Datum
+jsonb_to_dynamic(PG_FUNCTION_ARGS) {
+    dynamic *agt = AG_GET_ARG_DYNAMIC_P(0);
+
+    // Numbers stay numerics, everything else maps one to one, but jsonb may nest deeper
+    check_dynamic_container_depth(&agt->root, VARSIZE(agt) - VARHDRSZ, 0);
+
+    PG_RETURN_POINTER(agt);
+}
+
+PG_FUNCTION_INFO_V1(dynamic_to_jsonb);
+Datum
+dynamic_to_jsonb(PG_FUNCTION_ARGS) {
+    dynamic *agt = AG_GET_ARG_DYNAMIC_P(0);
+    JsonbParseState *state = NULL;
+    JsonbValue *res = NULL;
+    JsonbValue jbv;
+    dynamic_iterator *it;
+    dynamic_iterator_token tok;
+    dynamic_value v;
+
+    if (is_jsonb_compatible(&agt->root))
+        PG_RETURN_POINTER(agt);
+
+    // Rebuild it, turning the types jsonb does not have into numbers and strings 
+    it = dynamic_iterator_init(&agt->root);
+    while ((tok = dynamic_iterator_next(&it, &v, false)) != WGT_DONE) {
+        switch (tok) {
+        case WGT_BEGIN_ARRAY:
+            if (v.val.array.raw_scalar) {
+                jbv.type = jbvArray;
+                jbv.val.array.nElems = 1;
+                jbv.val.array.elems = NULL;
+                jbv.val.array.rawScalar = true;
+                res = pushJsonbValue(&state, WJB_BEGIN_ARRAY, &jbv);
+            } else {
+                res = pushJsonbValue(&state, WJB_BEGIN_ARRAY, NULL);
+            }
+            break;
+        case WGT_BEGIN_VECTOR:
+            res = pushJsonbValue(&state, WJB_BEGIN_ARRAY, NULL);
+            break;
+        case WGT_END_ARRAY:
+        case WGT_END_VECTOR:
+            res = pushJsonbValue(&state, WJB_END_ARRAY, NULL);
+            break;
+        case WGT_BEGIN_OBJECT:
+            res = pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
+            break;
+        case WGT_END_OBJECT:
+            res = pushJsonbValue(&state, WJB_END_OBJECT, NULL);
+            break;
+        case WGT_KEY:
+            dynamic_value_to_jsonb_value(&v, &jbv);
+            res = pushJsonbValue(&state, WJB_KEY, &jbv);
+            break;
+        case WGT_VALUE:
+            dynamic_value_to_jsonb_value(&v, &jbv);
+            res = pushJsonbValue(&state, WJB_VALUE, &jbv);
+            break;
+        case WGT_ELEM:
+        case WGT_VECTOR_VALUE:
+            dynamic_value_to_jsonb_value(&v, &jbv);
+            res = pushJsonbValue(&state, WJB_ELEM, &jbv);
+            break;
+        default:
+            elog(ERROR, "unknown dynamic iterator token type");
+        }
+    }
+
+    PG_RETURN_POINTER(JsonbValueToJsonb(res));
+}
+
+/*
+ * Check whether a container only holds what jsonb can represent: no vectors,
+ * no extended scalar types and no key references, at any level.
+ */
+static bool
+is_jsonb_compatible(dynamic_container *agtc) {
+    uint32 count = DYNAMIC_CONTAINER_SIZE(agtc);
+    uint32 nchildren = DYNAMIC_CONTAINER_IS_OBJECT(agtc) ? count * 2 : count;
+    char *base_addr = (char *)&agtc->children[nchildren];
+    uint32 offset = 0;
+    uint32 i;
+
+    check_stack_depth();
+
+    if (DYNAMIC_CONTAINER_IS_VECTOR(agtc))
+        return false;
+
+    for (i = 0; i < nchildren; i++) {
+        gtentry entry = agtc->children[i];
+
+        if (GTE_IS_DYNAMIC(entry) || GTE_IS_KEY_REF(entry))
+            return false;
+
+        if (GTE_IS_CONTAINER(entry) &&
+            !is_jsonb_compatible((dynamic_container *)(base_addr + INTALIGN(offset))))
+            return false;
+
+        GTE_ADVANCE_OFFSET(offset, entry);
+    }
+
+    return true;
+}
+
+static void
+dynamic_value_to_jsonb_value(dynamic_value *v, JsonbValue *result) {
+    StringInfoData buf;
+
+    switch (v->type) {
+    case DYNAMIC_NULL:
+        result->type = jbvNull;
+        break;
+    case DYNAMIC_STRING:
+        result->type = jbvString;
+        result->val.string.len = v->val.string.len;
+        result->val.string.val = v->val.string.val;
+        break;
+    case DYNAMIC_BOOL:
+        result->type = jbvBool;
+        result->val.boolean = v->val.boolean;
+        break;
+    case DYNAMIC_NUMERIC:
+        result->type = jbvNumeric;
+        result->val.numeric = v->val.numeric;
+        break;
+    case DYNAMIC_INTEGER:
+        result->type = jbvNumeric;
+        result->val.numeric = int64_to_numeric(v->val.int_value);
+        break;
+    case DYNAMIC_FLOAT:
+        // jsonb numbers cannot be NaN or infinite, those become strings 
+        if (!isnan(v->val.float_value) && !isinf(v->val.float_value)) {
+            char str[DOUBLE_SHORTEST_DECIMAL_LEN];
+
+            // float8_numeric rounds to DBL_DIG digits, keep every digit
+            double_to_shortest_decimal_buf(v->val.float_value, str);
+
+            result->type = jbvNumeric;
+            result->val.numeric = DatumGetNumeric(DirectFunctionCall3(numeric_in, CStringGetDatum(str),
+                                                                      ObjectIdGetDatum(InvalidOid),
+                                                                      Int32GetDatum(-1)));
+            break;
+        }
+        // fall through 
+    default:
+        initStringInfo(&buf);
+        dynamic_put_escaped_value(&buf, v);
+
+        result->type = jbvString;
+        result->val.string.len = buf.len;
+        result->val.string.val = buf.data;
+        break;
+    }
+}
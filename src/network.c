@@ -52,7 +52,7 @@ inet_to_dynamic(PG_FUNCTION_ARGS) {
     gtv.type = DYNAMIC_INET;
     memcpy(&gtv.val.inet, ip, sizeof(char) * 22);
 
-    AG_RETURN_DYNAMIC_P(dynamic_value_to_dynamic(&gtv));
+    AG_RETURN_DYNAMIC_P(scalar_value_to_dynamic(&gtv));
 }
 
 PG_FUNCTION_INFO_V1(dynamic_toinet);
@@ -68,7 +68,7 @@ dynamic_toinet(PG_FUNCTION_ARGS) {
 
     PG_FREE_IF_COPY(dyna, 0);
 
-    AG_RETURN_DYNAMIC_P(dynamic_value_to_dynamic(&dynav));
+    AG_RETURN_DYNAMIC_P(scalar_value_to_dynamic(&dynav));
 }
 
 
@@ -47,7 +47,7 @@ dynamic_add(PG_FUNCTION_ARGS) {
     PG_FREE_IF_COPY(lhs, 0);
     PG_FREE_IF_COPY(rhs, 0);
     
-    AG_RETURN_DYNAMIC_P(dynamic_value_to_dynamic(&dyna_val));    
+    AG_RETURN_DYNAMIC_P(scalar_value_to_dynamic(&dyna_val));    
 }
 
 PG_FUNCTION_INFO_V1(dynamic_sub);
@@ -66,7 +66,7 @@ dynamic_sub(PG_FUNCTION_ARGS) {
     PG_FREE_IF_COPY(lhs, 0);
     PG_FREE_IF_COPY(rhs, 0);
     
-    AG_RETURN_DYNAMIC_P(dynamic_value_to_dynamic(&dyna_val));    
+    AG_RETURN_DYNAMIC_P(scalar_value_to_dynamic(&dyna_val));    
 }
 
 PG_FUNCTION_INFO_V1(dynamic_mul);
@@ -85,7 +85,7 @@ dynamic_mul(PG_FUNCTION_ARGS) {
     PG_FREE_IF_COPY(lhs, 0);
     PG_FREE_IF_COPY(rhs, 0);
     
-    AG_RETURN_DYNAMIC_P(dynamic_value_to_dynamic(&dyna_val));    
+    AG_RETURN_DYNAMIC_P(scalar_value_to_dynamic(&dyna_val));    
 }
 
 PG_FUNCTION_INFO_V1(dynamic_div);
@@ -104,7 +104,7 @@ dynamic_div(PG_FUNCTION_ARGS) {
     PG_FREE_IF_COPY(lhs, 0);
     PG_FREE_IF_COPY(rhs, 0);
     
-    AG_RETURN_DYNAMIC_P(dynamic_value_to_dynamic(&dyna_val));    
+    AG_RETURN_DYNAMIC_P(scalar_value_to_dynamic(&dyna_val));    
 }
 
 PG_FUNCTION_INFO_V1(dynamic_uplus);
@@ -120,7 +120,7 @@ dynamic_uplus(PG_FUNCTION_ARGS) {
 
     PG_FREE_IF_COPY(rhs, 0);
     
-    AG_RETURN_DYNAMIC_P(dynamic_value_to_dynamic(&dyna_val));    
+    AG_RETURN_DYNAMIC_P(scalar_value_to_dynamic(&dyna_val));    
 }
 
 PG_FUNCTION_INFO_V1(dynamic_uminus);
@@ -136,7 +136,7 @@ dynamic_uminus(PG_FUNCTION_ARGS) {
 
     PG_FREE_IF_COPY(rhs, 0);
     
-    AG_RETURN_DYNAMIC_P(dynamic_value_to_dynamic(&dyna_val));    
+    AG_RETURN_DYNAMIC_P(scalar_value_to_dynamic(&dyna_val));    
 }
 /*
 PG_FUNCTION_INFO_V1(dynamic_overlap);
@@ -161,6 +161,6 @@ dynamic_overlap(PG_FUNCTION_ARGS) {
 
     dyna_val.val.boolean = DatumGetBool(result);
 
-    AG_RETURN_DYNAMIC_P(dynamic_value_to_dynamic(&dyna_val));
+    AG_RETURN_DYNAMIC_P(scalar_value_to_dynamic(&dyna_val));
 }
 */
\ No newline at end of file
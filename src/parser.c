@@ -25,9 +25,13 @@
 #include "catalog/pg_type.h"
 #include "libpq/pqformat.h"
 #include "miscadmin.h"
+#include "nodes/miscnodes.h"
+#include "port/simd.h"
 #include "utils/date.h"
 #include "utils/datetime.h"
+#include "utils/memutils.h"
 
+#include "utils/dynamic.h"
 #include "utils/dynamic_parser.h"
 
 /*
@@ -48,20 +52,84 @@ typedef enum /* contexts of dynamic parser */
     DYNAMIC_PARSE_END /* saw the end of a document, expect nothing */
 } dynamic_parse_context;
 
-static inline void dynamic_lex(dynamic_lex_context *lex);
-static inline void dynamic_lex_string(dynamic_lex_context *lex);
-static inline void dynamic_lex_number(dynamic_lex_context *lex, char *s, bool *num_err, int *total_len);
-static void parse_scalar_annotation(dynamic_lex_context *lex, void *func, char **annotation);
-static inline void parse_scalar(dynamic_lex_context *lex, dynamic_sem_action *sem);
-static void parse_object_field(dynamic_lex_context *lex, dynamic_sem_action *sem);
-static void parse_object(dynamic_lex_context *lex, dynamic_sem_action *sem);
-static void parse_array_element(dynamic_lex_context *lex, dynamic_sem_action *sem);
-static void parse_array(dynamic_lex_context *lex, dynamic_sem_action *sem);
-static void report_parse_error(dynamic_parse_context ctx, dynamic_lex_context *lex) pg_attribute_noreturn();
-static void report_invalid_token(dynamic_lex_context *lex) pg_attribute_noreturn();
+/*
+ * Where the incremental parser is in the document, in place of the call
+ * stack of the recursive descent parser. levels[0] is the document itself,
+ * and each object or array that is open adds a level.
+ */
+typedef struct dynamic_incremental_level
+{
+    dynamic_parse_context expect; /* what the next token may be */
+    bool is_object;
+    int fname; /* offset in names of the field being parsed, or -1 */
+    bool isnull; /* whether the field or element being parsed is a null */
+} dynamic_incremental_level;
+
+typedef struct dynamic_incremental_state
+{
+    MemoryContext cxt; /* for what has to last from one chunk to the next */
+    MemoryContext chunk_cxt; /* for anything else, reset after each chunk */
+    dynamic_incremental_level *levels;
+    int nlevels;
+    int levels_size;
+
+    /*
+     * A scalar can only be passed on once the next token has shown whether
+     * an annotation follows it.
+     */
+    dynamic_token_type scalar_type; /* DYNAMIC_TOKEN_INVALID if none */
+    bool scalar_has_val; /* whether scalar_val holds the lexeme */
+    StringInfoData scalar_val;
+    dynamic_number scalar_number;
+    bool want_annotation; /* saw the '::', expecting the type name */
+
+    /* the names of the fields being parsed, one after another */
+    StringInfoData names;
+    StringInfoData annotation;
+
+    /* the start of a token that goes on in the next chunk */
+    StringInfoData partial;
+    bool partial_pending;
+    bool partial_escaped; /* the partial string ends in a backslash */
+
+    int line_base; /* line number the buffer being lexed starts on */
+} dynamic_incremental_state;
+
+/* the name of the field a level is parsing, wherever names is now */
+static inline char *incremental_fname(dynamic_incremental_state *inc, dynamic_incremental_level *level) {
+    return level->fname >= 0 ? inc->names.data + level->fname : NULL;
+}
+
+static inline bool dynamic_lex(dynamic_lex_context *lex);
+static char *lex_arena_copy(dynamic_lex_context *lex, const char *s, int len);
+static inline bool dynamic_lex_string(dynamic_lex_context *lex);
+static inline bool dynamic_lex_number(dynamic_lex_context *lex, char *s, bool *num_err, int *total_len);
+static inline void dynamic_number_add_digit(dynamic_number *num, int *ndigits, int digit, bool fraction);
+static bool parse_scalar_annotation(dynamic_lex_context *lex, void *func, char **annotation);
+static inline bool parse_scalar(dynamic_lex_context *lex, dynamic_sem_action *sem);
+static bool parse_object_field(dynamic_lex_context *lex, dynamic_sem_action *sem);
+static bool parse_object(dynamic_lex_context *lex, dynamic_sem_action *sem);
+static bool parse_array_element(dynamic_lex_context *lex, dynamic_sem_action *sem);
+static bool parse_array(dynamic_lex_context *lex, dynamic_sem_action *sem);
+static bool incremental_parse_buffer(dynamic_lex_context *lex, dynamic_sem_action *sem, char *buf, int len,
+                                     bool complete);
+static int incremental_token_end(char first, const char *s, int len, bool *escaped);
+static bool incremental_token(dynamic_lex_context *lex, dynamic_sem_action *sem);
+static bool incremental_value(dynamic_lex_context *lex, dynamic_sem_action *sem, dynamic_token_type tok);
+static bool incremental_scalar(dynamic_lex_context *lex, dynamic_sem_action *sem, char *annotation);
+static void incremental_value_done(dynamic_lex_context *lex, dynamic_sem_action *sem);
+static void incremental_pop(dynamic_lex_context *lex, dynamic_sem_action *sem);
+static char *incremental_lexeme(dynamic_lex_context *lex, StringInfo buf);
+static bool report_parse_error(dynamic_parse_context ctx, dynamic_lex_context *lex);
+static bool report_invalid_token(dynamic_lex_context *lex);
+static bool report_too_deep(dynamic_lex_context *lex);
 static int report_dynamic_context(dynamic_lex_context *lex);
 static char *extract_mb_char(char *s);
 
+/* sizes of the blocks lexemes are copied into */
+#define DYNAMIC_ARENA_MIN_BLOCK 1024
+#define DYNAMIC_ARENA_MAX_BLOCK (1024 * 1024)
+
 /* Recursive Descent parser support routines */
 
 /*
@@ -76,42 +144,65 @@ static inline dynamic_token_type lex_peek(dynamic_lex_context *lex) {
 /*
  * lex_accept
  *
- * accept the look_ahead token and move the lexer to the next token if the
- * look_ahead token matches the token parameter. In that case, and if required,
- * also hand back the de-escaped lexeme.
+ * accept the look_ahead token and move the lexer to the next token. If
+ * required, also hand back the de-escaped lexeme.
  *
- * returns true if the token matched, false otherwise.
+ * returns false if lexing the next token failed with a soft error.
  */
-static inline bool lex_accept(dynamic_lex_context *lex, dynamic_token_type token, char **lexeme) {
-    if (lex->token_type == token) {
-        if (lexeme != NULL) {
-            if (lex->token_type == DYNAMIC_TOKEN_STRING) {
-                if (lex->strval != NULL)
-                    *lexeme = pstrdup(lex->strval->data);
-            } else {
-                int len = (lex->token_terminator - lex->token_start);
-                char *tokstr = palloc(len + 1);
-
-                memcpy(tokstr, lex->token_start, len);
-                tokstr[len] = '\0';
-                *lexeme = tokstr;
-            }
+static inline bool lex_accept(dynamic_lex_context *lex, char **lexeme) {
+    if (lexeme != NULL) {
+        if (lex->token_type == DYNAMIC_TOKEN_STRING) {
+            if (lex->strval != NULL)
+                *lexeme = lex_arena_copy(lex, lex->strval->data, lex->strval->len);
+        } else {
+            *lexeme = lex_arena_copy(lex, lex->token_start, lex->token_terminator - lex->token_start);
         }
-        dynamic_lex(lex);
-        return true;
     }
-    return false;
+    return dynamic_lex(lex);
 }
 
 /*
- * lex_accept
+ * lex_arena_copy
+ *
+ * copy a lexeme for the semantic actions. The copies are carved out of
+ * blocks that are only freed along with the lex context, instead of being
+ * allocated one at a time. The blocks are allocated in the memory context of
+ * the lex and each starts with a pointer to the one before it, so that
+ * reset_dynamic_lex_context() can free all but the last.
+ */
+static char *lex_arena_copy(dynamic_lex_context *lex, const char *s, int len) {
+    char *result;
+
+    if (lex->arena_size - lex->arena_used < len + 1) {
+        char *block;
+
+        /* the lexemes in the old block may still be in use, it is left alone */
+        lex->arena_size = Min(Max(lex->arena_size * 2, DYNAMIC_ARENA_MIN_BLOCK), DYNAMIC_ARENA_MAX_BLOCK);
+        lex->arena_size = Max(lex->arena_size, (int) sizeof(char *) + len + 1);
+        block = MemoryContextAlloc(GetMemoryChunkContext(lex), lex->arena_size);
+        *(char **) block = lex->arena;
+        lex->arena = block;
+        lex->arena_used = sizeof(char *);
+    }
+
+    result = lex->arena + lex->arena_used;
+    memcpy(result, s, len);
+    result[len] = '\0';
+    lex->arena_used += len + 1;
+
+    return result;
+}
+
+/*
+ * lex_expect
  *
  * move the lexer to the next token if the current look_ahead token matches
  * the parameter token. Otherwise, report an error.
  */
-static inline void lex_expect(dynamic_parse_context ctx, dynamic_lex_context *lex, dynamic_token_type token) {
-    if (!lex_accept(lex, token, NULL))
-        report_parse_error(ctx, lex);
+static inline bool lex_expect(dynamic_parse_context ctx, dynamic_lex_context *lex, dynamic_token_type token) {
+    if (lex_peek(lex) != token)
+        return report_parse_error(ctx, lex);
+    return dynamic_lex(lex);
 }
 
 /* chars to consider as part of an alphanumeric token */
@@ -178,6 +269,73 @@ dynamic_lex_context *make_dynamic_lex_context_cstring_len(char *str, int len, bo
     return lex;
 }
 
+/*
+ * reset_dynamic_lex_context
+ *
+ * Start lexing another input with an existing lex context. The lexemes of
+ * the previous input are no longer in use, so the last arena block is
+ * rewound and the ones before it are freed.
+ */
+void reset_dynamic_lex_context(dynamic_lex_context *lex, char *str, int len) {
+    Assert(lex->inc == NULL);
+
+    lex->input = lex->token_terminator = lex->line_start = str;
+    lex->input_length = len;
+    lex->token_start = lex->prev_token_terminator = NULL;
+    lex->token_type = DYNAMIC_TOKEN_INVALID;
+    lex->lex_level = 0;
+    lex->line_number = 1;
+    memset(&lex->number, 0, sizeof(lex->number));
+    memset(&lex->scalar_number, 0, sizeof(lex->scalar_number));
+    if (lex->arena != NULL) {
+        char *block = *(char **) lex->arena;
+
+        while (block != NULL) {
+            char *prev = *(char **) block;
+
+            pfree(block);
+            block = prev;
+        }
+        *(char **) lex->arena = NULL;
+        lex->arena_used = sizeof(char *);
+    }
+    if (lex->strval != NULL)
+        resetStringInfo(lex->strval);
+}
+
+/*
+ * make_dynamic_lex_context_incremental
+ *
+ * lex constructor for parse_dynamic_incremental(), which is handed the input
+ * a chunk at a time instead. Everything the parse keeps between chunks is
+ * allocated in the current memory context.
+ */
+dynamic_lex_context *make_dynamic_lex_context_incremental(bool need_escapes) {
+    dynamic_lex_context *lex = make_dynamic_lex_context_cstring_len(NULL, 0, need_escapes);
+    dynamic_incremental_state *inc = palloc0(sizeof(dynamic_incremental_state));
+
+    inc->cxt = CurrentMemoryContext;
+    inc->chunk_cxt = AllocSetContextCreate(CurrentMemoryContext, "dynamic incremental parse",
+                                           ALLOCSET_DEFAULT_SIZES);
+
+    inc->levels_size = 8;
+    inc->levels = palloc(sizeof(dynamic_incremental_level) * inc->levels_size);
+    inc->nlevels = 1;
+    inc->levels[0].expect = DYNAMIC_PARSE_VALUE;
+    inc->levels[0].is_object = false;
+    inc->levels[0].fname = -1;
+    inc->levels[0].isnull = false;
+
+    inc->scalar_type = DYNAMIC_TOKEN_INVALID;
+    initStringInfo(&inc->scalar_val);
+    initStringInfo(&inc->names);
+    initStringInfo(&inc->annotation);
+    initStringInfo(&inc->partial);
+
+    lex->inc = inc;
+    return lex;
+}
+
 /*
  * parse_dynamic
  *
@@ -187,13 +345,18 @@ dynamic_lex_context *make_dynamic_lex_context_cstring_len(char *str, int len, bo
  * make_dynamic_lex_context(). sem is a structure of function pointers to
  * semantic action routines to be called at appropriate spots during parsing,
  * and a pointer to a state object to be passed to those routines.
+ *
+ * Returns false if the input was rejected with a soft error saved into
+ * lex->escontext. Without an escontext errors are thrown and the result is
+ * always true.
  */
-void parse_dynamic(dynamic_lex_context *lex, dynamic_sem_action *sem) {
+bool parse_dynamic(dynamic_lex_context *lex, dynamic_sem_action *sem) {
     dynamic_token_type tok;
-    char **valaddr;
+    bool result;
 
     /* get the initial token */
-    dynamic_lex(lex);
+    if (!dynamic_lex(lex))
+        return false;
 
     tok = lex_peek(lex);
 
@@ -201,57 +364,37 @@ void parse_dynamic(dynamic_lex_context *lex, dynamic_sem_action *sem) {
     switch (tok)
     {
     case DYNAMIC_TOKEN_OBJECT_START:
-        parse_object(lex, sem);
+        result = parse_object(lex, sem);
         break;
     case DYNAMIC_TOKEN_ARRAY_START:
-        parse_array(lex, sem);
+        result = parse_array(lex, sem);
         break;
     default:
-        parse_scalar(lex, sem); /* dynamic can be a bare scalar */
+        result = parse_scalar(lex, sem); /* dynamic can be a bare scalar */
     }
 
-    //parse_annotation(lex, &annotation);
-
-    lex_expect(DYNAMIC_PARSE_END, lex, DYNAMIC_TOKEN_END);
-}
-
-static void parse_annotation(dynamic_lex_context *lex, void *func, char **annotation) {
-    /* check next token for annotations (typecasts, etc.) */
-    if (lex_peek(lex) == DYNAMIC_TOKEN_ANNOTATION) {
-        /* eat the annotation token */
-        lex_accept(lex, DYNAMIC_TOKEN_ANNOTATION, NULL);
-        if (lex_peek(lex) == DYNAMIC_TOKEN_IDENTIFIER) {
-            /* eat the identifier token and get the annotation value */
-            if (func != NULL)
-                lex_accept(lex, DYNAMIC_TOKEN_IDENTIFIER, annotation);
-            else
-                lex_accept(lex, DYNAMIC_TOKEN_IDENTIFIER, NULL);
-        }
-        else
-            ereport(ERROR,
-                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                     errmsg("invalid value for annotation")));
-    }
+    return result && lex_expect(DYNAMIC_PARSE_END, lex, DYNAMIC_TOKEN_END);
 }
 
-
-static void parse_scalar_annotation(dynamic_lex_context *lex, void *func, char **annotation) {
+static bool parse_scalar_annotation(dynamic_lex_context *lex, void *func, char **annotation) {
     /* check next token for annotations (typecasts, etc.) */
     if (lex_peek(lex) == DYNAMIC_TOKEN_ANNOTATION) {
         /* eat the annotation token */
-        lex_accept(lex, DYNAMIC_TOKEN_ANNOTATION, NULL);
+        if (!lex_accept(lex, NULL))
+            return false;
         if (lex_peek(lex) == DYNAMIC_TOKEN_IDENTIFIER) {
             /* eat the identifier token and get the annotation value */
             if (func != NULL)
-                lex_accept(lex, DYNAMIC_TOKEN_IDENTIFIER, annotation);
+                return lex_accept(lex, annotation);
             else
-                lex_accept(lex, DYNAMIC_TOKEN_IDENTIFIER, NULL);
+                return lex_accept(lex, NULL);
         }
         else
-            ereport(ERROR,
+            ereturn(lex->escontext, false,
                     (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
                      errmsg("invalid value for annotation")));
     }
+    return true;
 }
 
 /*
@@ -262,8 +405,10 @@ static void parse_scalar_annotation(dynamic_lex_context *lex, void *func, char *
  *    - array element
  *    - object ( { } )
  *    - object field
+ *
+ *  Each returns false if it stopped at a soft error.
  */
-static inline void parse_scalar(dynamic_lex_context *lex, dynamic_sem_action *sem) {
+static inline bool parse_scalar(dynamic_lex_context *lex, dynamic_sem_action *sem) {
     char *val = NULL;
     char *annotation = NULL;
     dynamic_scalar_action sfunc = sem->scalar;
@@ -276,37 +421,37 @@ static inline void parse_scalar(dynamic_lex_context *lex, dynamic_sem_action *se
     switch (tok)
     {
     case DYNAMIC_TOKEN_TRUE:
-        lex_accept(lex, DYNAMIC_TOKEN_TRUE, valaddr);
-        break;
     case DYNAMIC_TOKEN_FALSE:
-        lex_accept(lex, DYNAMIC_TOKEN_FALSE, valaddr);
-        break;
     case DYNAMIC_TOKEN_NULL:
-        lex_accept(lex, DYNAMIC_TOKEN_NULL, valaddr);
+    case DYNAMIC_TOKEN_STRING:
+    case DYNAMIC_TOKEN_INET:
         break;
     case DYNAMIC_TOKEN_INTEGER:
-        lex_accept(lex, DYNAMIC_TOKEN_INTEGER, valaddr);
-        break;
     case DYNAMIC_TOKEN_FLOAT:
-        lex_accept(lex, DYNAMIC_TOKEN_FLOAT, valaddr);
-        break;
-    case DYNAMIC_TOKEN_STRING:
-        lex_accept(lex, DYNAMIC_TOKEN_STRING, valaddr);
-        break;
-    case DYNAMIC_TOKEN_INET:
-        lex_accept(lex, DYNAMIC_TOKEN_INET, valaddr);
+        lex->scalar_number = lex->number;
         break;
     default:
-        report_parse_error(DYNAMIC_PARSE_VALUE, lex);
+        return report_parse_error(DYNAMIC_PARSE_VALUE, lex);
     }
 
-    parse_scalar_annotation(lex, sfunc, &annotation);
+    if (!lex_accept(lex, valaddr))
+        return false;
+
+    if (!parse_scalar_annotation(lex, sfunc, &annotation))
+        return false;
 
-    if (sfunc != NULL)
+    if (sfunc != NULL) {
         (*sfunc)(sem->semstate, val, tok, annotation);
+
+        /* the value itself may have been rejected */
+        if (SOFT_ERROR_OCCURRED(lex->escontext))
+            return false;
+    }
+
+    return true;
 }
 
-static void parse_object_field(dynamic_lex_context *lex, dynamic_sem_action *sem) {
+static bool parse_object_field(dynamic_lex_context *lex, dynamic_sem_action *sem) {
     /*
      * An object field is "fieldname" : value where value can be a scalar,
      * object or array.  Note: in user-facing docs and error messages, we
@@ -318,14 +463,18 @@ static void parse_object_field(dynamic_lex_context *lex, dynamic_sem_action *sem
     bool isnull;
     char **fnameaddr = NULL;
     dynamic_token_type tok;
+    bool result;
 
     if (ostart != NULL || oend != NULL)
         fnameaddr = &fname;
 
-    if (!lex_accept(lex, DYNAMIC_TOKEN_STRING, fnameaddr))
-        report_parse_error(DYNAMIC_PARSE_STRING, lex);
+    if (lex_peek(lex) != DYNAMIC_TOKEN_STRING)
+        return report_parse_error(DYNAMIC_PARSE_STRING, lex);
+    if (!lex_accept(lex, fnameaddr))
+        return false;
 
-    lex_expect(DYNAMIC_PARSE_OBJECT_LABEL, lex, DYNAMIC_TOKEN_COLON);
+    if (!lex_expect(DYNAMIC_PARSE_OBJECT_LABEL, lex, DYNAMIC_TOKEN_COLON))
+        return false;
 
     tok = lex_peek(lex);
     isnull = tok == DYNAMIC_TOKEN_NULL;
@@ -336,20 +485,25 @@ static void parse_object_field(dynamic_lex_context *lex, dynamic_sem_action *sem
     switch (tok)
     {
     case DYNAMIC_TOKEN_OBJECT_START:
-        parse_object(lex, sem);
+        result = parse_object(lex, sem);
         break;
     case DYNAMIC_TOKEN_ARRAY_START:
-        parse_array(lex, sem);
+        result = parse_array(lex, sem);
         break;
     default:
-        parse_scalar(lex, sem);
+        result = parse_scalar(lex, sem);
     }
 
+    if (!result)
+        return false;
+
     if (oend != NULL)
         (*oend)(sem->semstate, fname, isnull);
+
+    return true;
 }
 
-static void parse_object(dynamic_lex_context *lex, dynamic_sem_action *sem) {
+static bool parse_object(dynamic_lex_context *lex, dynamic_sem_action *sem) {
     /*
      * an object is a possibly empty sequence of object fields, separated by
      * commas and surrounded by curly braces.
@@ -360,6 +514,9 @@ static void parse_object(dynamic_lex_context *lex, dynamic_sem_action *sem) {
 
     check_stack_depth();
 
+    if (lex->lex_level > DYNAMIC_MAX_DEPTH)
+        return report_too_deep(lex);
+
     if (ostart != NULL)
         (*ostart)(sem->semstate);
 
@@ -372,38 +529,44 @@ static void parse_object(dynamic_lex_context *lex, dynamic_sem_action *sem) {
     lex->lex_level++;
 
     /* we know this will succeed, just clearing the token */
-    lex_expect(DYNAMIC_PARSE_OBJECT_START, lex, DYNAMIC_TOKEN_OBJECT_START);
+    if (!lex_expect(DYNAMIC_PARSE_OBJECT_START, lex, DYNAMIC_TOKEN_OBJECT_START))
+        return false;
 
     tok = lex_peek(lex);
     switch (tok)
     {
     case DYNAMIC_TOKEN_STRING:
-        parse_object_field(lex, sem);
-        while (lex_accept(lex, DYNAMIC_TOKEN_COMMA, NULL))
-            parse_object_field(lex, sem);
+        if (!parse_object_field(lex, sem))
+            return false;
+        while (lex_peek(lex) == DYNAMIC_TOKEN_COMMA) {
+            if (!lex_accept(lex, NULL) || !parse_object_field(lex, sem))
+                return false;
+        }
         break;
     case DYNAMIC_TOKEN_OBJECT_END:
         break;
     default:
         /* case of an invalid initial token inside the object */
-        report_parse_error(DYNAMIC_PARSE_OBJECT_START, lex);
+        return report_parse_error(DYNAMIC_PARSE_OBJECT_START, lex);
     }
 
-    lex_expect(DYNAMIC_PARSE_OBJECT_NEXT, lex, DYNAMIC_TOKEN_OBJECT_END);
+    if (!lex_expect(DYNAMIC_PARSE_OBJECT_NEXT, lex, DYNAMIC_TOKEN_OBJECT_END))
+        return false;
 
     lex->lex_level--;
 
     if (oend != NULL)
         (*oend)(sem->semstate);
 
+    return true;
 }
 
-static void parse_array_element(dynamic_lex_context *lex, dynamic_sem_action *sem) {
+static bool parse_array_element(dynamic_lex_context *lex, dynamic_sem_action *sem) {
     dynamic_aelem_action astart = sem->array_element_start;
     dynamic_aelem_action aend = sem->array_element_end;
     dynamic_token_type tok = lex_peek(lex);
-
     bool isnull;
+    bool result;
 
     isnull = tok == DYNAMIC_TOKEN_NULL;
 
@@ -414,20 +577,25 @@ static void parse_array_element(dynamic_lex_context *lex, dynamic_sem_action *se
     switch (tok)
     {
     case DYNAMIC_TOKEN_OBJECT_START:
-        parse_object(lex, sem);
+        result = parse_object(lex, sem);
         break;
     case DYNAMIC_TOKEN_ARRAY_START:
-        parse_array(lex, sem);
+        result = parse_array(lex, sem);
         break;
     default:
-        parse_scalar(lex, sem);
+        result = parse_scalar(lex, sem);
     }
 
+    if (!result)
+        return false;
+
     if (aend != NULL)
         (*aend)(sem->semstate, isnull);
+
+    return true;
 }
 
-static void parse_array(dynamic_lex_context *lex, dynamic_sem_action *sem) {
+static bool parse_array(dynamic_lex_context *lex, dynamic_sem_action *sem) {
     /*
      * an array is a possibly empty sequence of array elements, separated by
      * commas and surrounded by square brackets.
@@ -437,6 +605,9 @@ static void parse_array(dynamic_lex_context *lex, dynamic_sem_action *sem) {
 
     check_stack_depth();
 
+    if (lex->lex_level > DYNAMIC_MAX_DEPTH)
+        return report_too_deep(lex);
+
     if (astart != NULL)
         (*astart)(sem->semstate);
 
@@ -448,33 +619,479 @@ static void parse_array(dynamic_lex_context *lex, dynamic_sem_action *sem) {
      */
     lex->lex_level++;
 
-    lex_expect(DYNAMIC_PARSE_ARRAY_START, lex, DYNAMIC_TOKEN_ARRAY_START);
+    if (!lex_expect(DYNAMIC_PARSE_ARRAY_START, lex, DYNAMIC_TOKEN_ARRAY_START))
+        return false;
     if (lex_peek(lex) != DYNAMIC_TOKEN_ARRAY_END) {
-        parse_array_element(lex, sem);
+        if (!parse_array_element(lex, sem))
+            return false;
 
-        while (lex_accept(lex, DYNAMIC_TOKEN_COMMA, NULL))
-            parse_array_element(lex, sem);
+        while (lex_peek(lex) == DYNAMIC_TOKEN_COMMA) {
+            if (!lex_accept(lex, NULL) || !parse_array_element(lex, sem))
+                return false;
+        }
     }
 
-    lex_expect(DYNAMIC_PARSE_ARRAY_NEXT, lex, DYNAMIC_TOKEN_ARRAY_END);
+    if (!lex_expect(DYNAMIC_PARSE_ARRAY_NEXT, lex, DYNAMIC_TOKEN_ARRAY_END))
+        return false;
 
     lex->lex_level--;
 
     if (aend != NULL)
         (*aend)(sem->semstate);
 
+    return true;
+}
+
+/*
+ * parse_dynamic_incremental
+ *
+ * Publicly visible entry point for parsing a document that is handed over a
+ * chunk at a time, with a lexing context made by
+ * make_dynamic_lex_context_incremental(). Call it for each chunk in order,
+ * with is_last set for the final one, which may be empty. A token may be
+ * split anywhere between chunks; its start is kept until the rest arrives.
+ *
+ * The semantic actions are called at the same points as with parse_dynamic(),
+ * but the parser keeps no more than one level of state per open object or
+ * array, and the strings passed to the actions are in buffers that are
+ * reused, so the actions have to copy whatever they keep.
+ *
+ * Returns false if the input was rejected with a soft error, in which case
+ * the parse can't go on.
+ */
+bool parse_dynamic_incremental(dynamic_lex_context *lex, dynamic_sem_action *sem, char *chunk, int len,
+                               bool is_last) {
+    dynamic_incremental_state *inc = lex->inc;
+    MemoryContext oldcxt;
+    int used = 0;
+    bool result = true;
+
+    Assert(inc != NULL);
+
+    oldcxt = MemoryContextSwitchTo(inc->chunk_cxt);
+
+    /* First finish the token the previous chunk ended in. */
+    if (inc->partial_pending) {
+        int n = incremental_token_end(inc->partial.data[0], chunk, len, &inc->partial_escaped);
+
+        if (n < 0 && !is_last) {
+            appendBinaryStringInfo(&inc->partial, chunk, len);
+            MemoryContextSwitchTo(oldcxt);
+            return true;
+        }
+
+        used = n < 0 ? len : n;
+        appendBinaryStringInfo(&inc->partial, chunk, used);
+        inc->partial_pending = false;
+
+        /*
+         * The buffer now ends where the token does, so whatever it lexes to
+         * is complete.
+         */
+        result = incremental_parse_buffer(lex, sem, inc->partial.data, inc->partial.len, true);
+    }
+
+    if (result && (used < len || used == 0))
+        result = incremental_parse_buffer(lex, sem, chunk + used, len - used, is_last);
+
+    if (result && is_last) {
+        lex->token_start = NULL;
+        lex->prev_token_terminator = lex->token_terminator;
+        lex->token_type = DYNAMIC_TOKEN_END;
+
+        result = incremental_token(lex, sem);
+    }
+
+    MemoryContextSwitchTo(oldcxt);
+
+    /* a soft error may refer to what was allocated for this chunk */
+    if (result)
+        MemoryContextReset(inc->chunk_cxt);
+
+    return result;
+}
+
+/*
+ * Lex and parse the tokens in buf. Unless the buffer is complete, a token
+ * running into its end may go on in the next chunk, and is kept in
+ * inc->partial instead.
+ */
+static bool incremental_parse_buffer(dynamic_lex_context *lex, dynamic_sem_action *sem, char *buf, int len,
+                                     bool complete) {
+    dynamic_incremental_state *inc = lex->inc;
+    char *end = buf + len;
+
+    lex->input = lex->token_terminator = lex->line_start = buf;
+    lex->input_length = len;
+    inc->line_base = lex->line_number;
+
+    for (;;) {
+        char *s = lex->token_terminator;
+        bool escaped = false;
+
+        while (s < end && (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r')) {
+            if (*s == '\n')
+                ++lex->line_number;
+            ++s;
+        }
+        lex->token_terminator = s;
+
+        if (s == end)
+            return true;
+
+        if (!complete && incremental_token_end(*s, s + 1, end - s - 1, &escaped) < 0) {
+            resetStringInfo(&inc->partial);
+            appendBinaryStringInfo(&inc->partial, s, end - s);
+            inc->partial_pending = true;
+            inc->partial_escaped = escaped;
+            return true;
+        }
+
+        if (!dynamic_lex(lex) || !incremental_token(lex, sem))
+            return false;
+    }
+}
+
+/*
+ * Find where a token starting with the character first ends in the len bytes
+ * at s, which follow what has been seen of it so far. Returns how many of
+ * them are part of the token, or -1 if all of them are and the token may go
+ * on. This only has to find the end, the lexer checks the token itself, so
+ * anything that could be part of a number or a word counts. *escaped carries
+ * whether a string has stopped right after a backslash from call to call.
+ */
+static int incremental_token_end(char first, const char *s, int len, bool *escaped) {
+    int i = 0;
+
+    switch (first)
+    {
+    case '"':
+        while (i < len) {
+            if (*escaped) {
+                *escaped = false;
+                i++;
+                continue;
+            }
+
+            i += dynamic_string_plain_len(s + i, len - i);
+            if (i >= len)
+                break;
+            if (s[i] == '"')
+                return i + 1;
+            if (s[i] == '\\')
+                *escaped = true;
+            i++;
+        }
+        return -1;
+    case ':':
+        /* a colon or an annotation '::' */
+        if (len == 0)
+            return -1;
+        return s[0] == ':' ? 1 : 0;
+    case '{':
+    case '}':
+    case '[':
+    case ']':
+    case ',':
+        return 0;
+    default:
+        if (first != '-' && !DYNAMIC_ALPHANUMERIC_CHAR(first))
+            return 0;
+
+        for (; i < len; i++) {
+            if (!DYNAMIC_ALPHANUMERIC_CHAR(s[i]) && s[i] != '.' && s[i] != '+' && s[i] != '-')
+                return i;
+        }
+        return -1;
+    }
+}
+
+/*
+ * Handle the token the lexer has just read, according to the level the
+ * document is at.
+ */
+static bool incremental_token(dynamic_lex_context *lex, dynamic_sem_action *sem) {
+    dynamic_incremental_state *inc = lex->inc;
+    dynamic_incremental_level *level;
+    dynamic_token_type tok = lex_peek(lex);
+
+    if (inc->scalar_type != DYNAMIC_TOKEN_INVALID) {
+        if (inc->want_annotation) {
+            char *annotation = NULL;
+
+            if (tok != DYNAMIC_TOKEN_IDENTIFIER)
+                ereturn(lex->escontext, false,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("invalid value for annotation")));
+
+            if (sem->scalar != NULL)
+                annotation = incremental_lexeme(lex, &inc->annotation);
+
+            return incremental_scalar(lex, sem, annotation);
+        }
+
+        if (tok == DYNAMIC_TOKEN_ANNOTATION) {
+            inc->want_annotation = true;
+            return true;
+        }
+
+        /* no annotation, the token is the one after the scalar */
+        if (!incremental_scalar(lex, sem, NULL))
+            return false;
+    }
+
+    level = &inc->levels[inc->nlevels - 1];
+
+    switch (level->expect)
+    {
+    case DYNAMIC_PARSE_VALUE:
+        return incremental_value(lex, sem, tok);
+    case DYNAMIC_PARSE_ARRAY_START:
+        if (tok == DYNAMIC_TOKEN_ARRAY_END) {
+            incremental_pop(lex, sem);
+            return true;
+        }
+        return incremental_value(lex, sem, tok);
+    case DYNAMIC_PARSE_ARRAY_NEXT:
+        if (tok == DYNAMIC_TOKEN_COMMA) {
+            level->expect = DYNAMIC_PARSE_VALUE;
+            return true;
+        }
+        if (tok == DYNAMIC_TOKEN_ARRAY_END) {
+            incremental_pop(lex, sem);
+            return true;
+        }
+        break;
+    case DYNAMIC_PARSE_OBJECT_START:
+        if (tok == DYNAMIC_TOKEN_OBJECT_END) {
+            incremental_pop(lex, sem);
+            return true;
+        }
+        /* FALLTHROUGH */
+    case DYNAMIC_PARSE_OBJECT_COMMA:
+        if (tok == DYNAMIC_TOKEN_STRING) {
+            /* the name has to last until the value is done */
+            if ((sem->object_field_start != NULL || sem->object_field_end != NULL) && lex->strval != NULL) {
+                level->fname = inc->names.len;
+                appendBinaryStringInfo(&inc->names, lex->strval->data, lex->strval->len + 1);
+            }
+            level->expect = DYNAMIC_PARSE_OBJECT_LABEL;
+            return true;
+        }
+        break;
+    case DYNAMIC_PARSE_OBJECT_LABEL:
+        if (tok == DYNAMIC_TOKEN_COLON) {
+            level->expect = DYNAMIC_PARSE_VALUE;
+            return true;
+        }
+        break;
+    case DYNAMIC_PARSE_OBJECT_NEXT:
+        if (tok == DYNAMIC_TOKEN_COMMA) {
+            level->expect = DYNAMIC_PARSE_OBJECT_COMMA;
+            return true;
+        }
+        if (tok == DYNAMIC_TOKEN_OBJECT_END) {
+            incremental_pop(lex, sem);
+            return true;
+        }
+        break;
+    case DYNAMIC_PARSE_END:
+        if (tok == DYNAMIC_TOKEN_END)
+            return true;
+        break;
+    default:
+        elog(ERROR, "unexpected dynamic parse state: %d", level->expect);
+    }
+
+    return report_parse_error(level->expect, lex);
+}
+
+/*
+ * Start a value: open an object or array, or hold on to a scalar until it is
+ * known whether an annotation follows.
+ */
+static bool incremental_value(dynamic_lex_context *lex, dynamic_sem_action *sem, dynamic_token_type tok) {
+    dynamic_incremental_state *inc = lex->inc;
+    dynamic_incremental_level *level = &inc->levels[inc->nlevels - 1];
+
+    level->isnull = tok == DYNAMIC_TOKEN_NULL;
+
+    if (inc->nlevels > 1) {
+        if (level->is_object) {
+            if (sem->object_field_start != NULL)
+                (*sem->object_field_start)(sem->semstate, incremental_fname(inc, level), level->isnull);
+        } else {
+            if (sem->array_element_start != NULL)
+                (*sem->array_element_start)(sem->semstate, level->isnull);
+        }
+    }
+
+    switch (tok)
+    {
+    case DYNAMIC_TOKEN_OBJECT_START:
+    case DYNAMIC_TOKEN_ARRAY_START:
+    case DYNAMIC_TOKEN_TRUE:
+    case DYNAMIC_TOKEN_FALSE:
+    case DYNAMIC_TOKEN_NULL:
+    case DYNAMIC_TOKEN_STRING:
+    case DYNAMIC_TOKEN_INET:
+    case DYNAMIC_TOKEN_INTEGER:
+    case DYNAMIC_TOKEN_FLOAT:
+        break;
+    default:
+        return report_parse_error(DYNAMIC_PARSE_VALUE, lex);
+    }
+
+    if (tok == DYNAMIC_TOKEN_OBJECT_START || tok == DYNAMIC_TOKEN_ARRAY_START) {
+        bool is_object = tok == DYNAMIC_TOKEN_OBJECT_START;
+
+        /* the levels are kept on the heap, but are capped like parse_object's */
+        if (lex->lex_level > DYNAMIC_MAX_DEPTH)
+            return report_too_deep(lex);
+
+        if (is_object) {
+            if (sem->object_start != NULL)
+                (*sem->object_start)(sem->semstate);
+        } else {
+            if (sem->array_start != NULL)
+                (*sem->array_start)(sem->semstate);
+        }
+
+        lex->lex_level++;
+
+        if (inc->nlevels == inc->levels_size) {
+            inc->levels_size *= 2;
+            inc->levels = repalloc(inc->levels, sizeof(dynamic_incremental_level) * inc->levels_size);
+        }
+
+        level = &inc->levels[inc->nlevels++];
+        level->expect = is_object ? DYNAMIC_PARSE_OBJECT_START : DYNAMIC_PARSE_ARRAY_START;
+        level->is_object = is_object;
+        level->fname = -1;
+        level->isnull = false;
+
+        return true;
+    }
+
+    inc->scalar_type = tok;
+    inc->scalar_has_val = sem->scalar != NULL && (tok != DYNAMIC_TOKEN_STRING || lex->strval != NULL);
+    if (inc->scalar_has_val)
+        incremental_lexeme(lex, &inc->scalar_val);
+    if (tok == DYNAMIC_TOKEN_INTEGER || tok == DYNAMIC_TOKEN_FLOAT)
+        inc->scalar_number = lex->number;
+
+    return true;
+}
+
+/*
+ * Pass the scalar being held on to the scalar action.
+ */
+static bool incremental_scalar(dynamic_lex_context *lex, dynamic_sem_action *sem, char *annotation) {
+    dynamic_incremental_state *inc = lex->inc;
+
+    if (sem->scalar != NULL) {
+        lex->scalar_number = inc->scalar_number;
+        (*sem->scalar)(sem->semstate, inc->scalar_has_val ? inc->scalar_val.data : NULL, inc->scalar_type,
+                       annotation);
+
+        /* the value itself may have been rejected */
+        if (SOFT_ERROR_OCCURRED(lex->escontext))
+            return false;
+    }
+
+    inc->scalar_type = DYNAMIC_TOKEN_INVALID;
+    inc->want_annotation = false;
+
+    incremental_value_done(lex, sem);
+
+    return true;
+}
+
+/*
+ * Close the field or element a value has just been completed for.
+ */
+static void incremental_value_done(dynamic_lex_context *lex, dynamic_sem_action *sem) {
+    dynamic_incremental_state *inc = lex->inc;
+    dynamic_incremental_level *level = &inc->levels[inc->nlevels - 1];
+
+    if (inc->nlevels == 1) {
+        level->expect = DYNAMIC_PARSE_END;
+        return;
+    }
+
+    if (level->is_object) {
+        if (sem->object_field_end != NULL)
+            (*sem->object_field_end)(sem->semstate, incremental_fname(inc, level), level->isnull);
+        if (level->fname >= 0)
+            inc->names.len = level->fname;
+        level->fname = -1;
+        level->expect = DYNAMIC_PARSE_OBJECT_NEXT;
+    } else {
+        if (sem->array_element_end != NULL)
+            (*sem->array_element_end)(sem->semstate, level->isnull);
+        level->expect = DYNAMIC_PARSE_ARRAY_NEXT;
+    }
+}
+
+/*
+ * Close the innermost object or array, which is a completed value of the
+ * level below.
+ */
+static void incremental_pop(dynamic_lex_context *lex, dynamic_sem_action *sem) {
+    dynamic_incremental_state *inc = lex->inc;
+    bool is_object = inc->levels[inc->nlevels - 1].is_object;
+
+    inc->nlevels--;
+    lex->lex_level--;
+
+    if (is_object) {
+        if (sem->object_end != NULL)
+            (*sem->object_end)(sem->semstate);
+    } else {
+        if (sem->array_end != NULL)
+            (*sem->array_end)(sem->semstate);
+    }
+
+    incremental_value_done(lex, sem);
+}
+
+/*
+ * Copy the current token, de-escaped if it is a string, into buf, which is
+ * reused from token to token.
+ */
+static char *incremental_lexeme(dynamic_lex_context *lex, StringInfo buf) {
+    resetStringInfo(buf);
+
+    if (lex->token_type == DYNAMIC_TOKEN_STRING)
+        appendBinaryStringInfo(buf, lex->strval->data, lex->strval->len);
+    else
+        appendBinaryStringInfo(buf, lex->token_start, lex->token_terminator - lex->token_start);
+
+    return buf->data;
 }
 
 /*
  * Lex one token from the input stream.
  */
-static inline void dynamic_lex(dynamic_lex_context *lex) {
+static inline bool dynamic_lex(dynamic_lex_context *lex) {
     char *s;
     int len;
 
     /* Skip leading whitespace. */
     s = lex->token_terminator;
     len = s - lex->input;
+
+    /* Indentation comes in long runs of spaces, skip those a word at a time. */
+    while (len + (int) sizeof(uint64) <= lex->input_length) {
+        uint64 chunk;
+
+        memcpy(&chunk, s, sizeof(uint64));
+        if (chunk != UINT64CONST(0x2020202020202020))
+            break;
+        s += sizeof(uint64);
+        len += sizeof(uint64);
+    }
+
     while (len < lex->input_length && (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r')) {
         if (*s == '\n')
             ++lex->line_number;
@@ -533,7 +1150,8 @@ static inline void dynamic_lex(dynamic_lex_context *lex) {
             break;
         case '"':
             /* string */
-            dynamic_lex_string(lex);
+            if (!dynamic_lex_string(lex))
+                return false;
             lex->token_type = DYNAMIC_TOKEN_STRING;
             break;
         case '-':
@@ -564,9 +1182,14 @@ static inline void dynamic_lex(dynamic_lex_context *lex) {
                     break;
                 }
                 if (lex->token_type == DYNAMIC_TOKEN_INVALID)
-                    report_invalid_token(lex);
+                    return report_invalid_token(lex);
+
+                /* no digits to go by, float8in has to handle these */
+                lex->number.inexact = true;
             } else {
-                dynamic_lex_number(lex, s + 1, NULL, NULL);
+                if (!dynamic_lex_number(lex, s + 1, NULL, NULL))
+                    return false;
+                lex->number.negative = true;
             }
             /* token is assigned in dynamic_lex_number */
             break;
@@ -581,7 +1204,8 @@ static inline void dynamic_lex(dynamic_lex_context *lex) {
         case '8':
         case '9':
             /* Positive number. */
-            dynamic_lex_number(lex, s, NULL, NULL);
+            if (!dynamic_lex_number(lex, s, NULL, NULL))
+                return false;
             /* token is assigned in dynamic_lex_number */
             break;
         default:
@@ -608,7 +1232,7 @@ static inline void dynamic_lex(dynamic_lex_context *lex) {
             if (p == s) {
                 lex->prev_token_terminator = lex->token_terminator;
                 lex->token_terminator = s + 1;
-                report_invalid_token(lex);
+                return report_invalid_token(lex);
             }
 
             /*
@@ -650,15 +1274,48 @@ static inline void dynamic_lex(dynamic_lex_context *lex) {
                     lex->token_type = DYNAMIC_TOKEN_FLOAT;
                 break;
             }
+
+            if (lex->token_type == DYNAMIC_TOKEN_FLOAT)
+                lex->number.inexact = true;
         } /* end of default case */
         } /* end of switch */
     }
+
+    return true;
+}
+
+/*
+ * Return how many of the len bytes at s can go into a string value as they
+ * are, that is, up to the first quote, backslash or control character. A
+ * vector register's worth of bytes is checked at a time, falling back to
+ * single bytes for the tail. The same bytes are the ones output escapes.
+ */
+int dynamic_string_plain_len(const char *s, int len) {
+    int i = 0;
+
+    while (i + (int) sizeof(Vector8) <= len) {
+        Vector8 chunk;
+
+        vector8_load(&chunk, (const uint8 *) s + i);
+        if (vector8_has(chunk, (uint8) '"') || vector8_has(chunk, (uint8) '\\') ||
+            vector8_has_le(chunk, (uint8) 31))
+            break;
+        i += sizeof(Vector8);
+    }
+
+    while (i < len && s[i] != '"' && s[i] != '\\' && (unsigned char) s[i] >= 32)
+        i++;
+
+    return i;
 }
 
 /*
  * The next token in the input stream is known to be a string; lex it.
+ *
+ * All the checks are made whether or not lex->strval is there to collect
+ * the de-escaped string, so validating without it accepts the same input.
  */
-static inline void dynamic_lex_string(dynamic_lex_context *lex) {
+static inline bool dynamic_lex_string(dynamic_lex_context *lex) {
     char *s;
     int len;
     int hi_surrogate = -1;
@@ -670,19 +1327,38 @@ static inline void dynamic_lex_string(dynamic_lex_context *lex) {
     s = lex->token_start;
     len = lex->token_start - lex->input;
     for (;;) {
+        int plain_len;
+
         s++;
         len++;
+
+        /* Copy everything up to the next byte that needs a closer look at once. */
+        plain_len = len < lex->input_length ? dynamic_string_plain_len(s, lex->input_length - len) : 0;
+        if (plain_len > 0) {
+            if (hi_surrogate != -1)
+                ereturn(lex->escontext, false,
+                    (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                     errmsg("invalid input syntax for type %s", "dynamic"),
+                     errdetail( "Unicode low surrogate must follow a high surrogate."),
+                     report_dynamic_context(lex)));
+
+            if (lex->strval != NULL)
+                appendBinaryStringInfo(lex->strval, s, plain_len);
+            s += plain_len;
+            len += plain_len;
+        }
+
         /* Premature end of the string. */
         if (len >= lex->input_length) {
             lex->token_terminator = s;
-            report_invalid_token(lex);
+            return report_invalid_token(lex);
         } else if (*s == '"') {
             break;
         } else if ((unsigned char)*s < 32) {
             /* Per RFC4627, these characters MUST be escaped. */
             /* Since *s isn't printable, exclude it from the context string */
             lex->token_terminator = s;
-            ereport(ERROR,
+            ereturn(lex->escontext, false,
                     (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                      errmsg("invalid input syntax for type %s", "dynamic"),
                      errdetail("Character with value 0x%02x must be escaped.",
@@ -694,17 +1370,19 @@ static inline void dynamic_lex_string(dynamic_lex_context *lex) {
             len++;
             if (len >= lex->input_length) {
                 lex->token_terminator = s;
-                report_invalid_token(lex);
+                return report_invalid_token(lex);
             } else if (*s == 'u') {
                 int i;
                 int ch = 0;
+                char utf8str[5];
+                int utf8len;
 
                 for (i = 1; i <= 4; i++) {
                     s++;
                     len++;
                     if (len >= lex->input_length) {
                         lex->token_terminator = s;
-                        report_invalid_token(lex);
+                        return report_invalid_token(lex);
                     } else if (*s >= '0' && *s <= '9') {
                         ch = (ch * 16) + (*s - '0');
                     } else if (*s >= 'a' && *s <= 'f') {
@@ -713,8 +1391,7 @@ static inline void dynamic_lex_string(dynamic_lex_context *lex) {
                         ch = (ch * 16) + (*s - 'A') + 10;
                     } else {
                         lex->token_terminator = s + pg_mblen(s);
-                        ereport(
-                            ERROR,
+                        ereturn(lex->escontext, false,
                             (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                              errmsg("invalid input syntax for type %s",
                                     "dynamic"),
@@ -723,76 +1400,74 @@ static inline void dynamic_lex_string(dynamic_lex_context *lex) {
                              report_dynamic_context(lex)));
                     }
                 }
-                if (lex->strval != NULL) {
-                    char utf8str[5];
-                    int utf8len;
-
-                    if (ch >= 0xd800 && ch <= 0xdbff) {
-                        if (hi_surrogate != -1) {
-                            ereport( ERROR,
-                                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-                                 errmsg("invalid input syntax for type %s", "dynamic"),
-                                 errdetail( "Unicode high surrogate must not follow a high surrogate."),
-                                 report_dynamic_context(lex)));
-                        }
-                        hi_surrogate = (ch & 0x3ff) << 10;
-                        continue;
-                    } else if (ch >= 0xdc00 && ch <= 0xdfff) {
-                        if (hi_surrogate == -1) {
-                            ereport( ERROR,
-                                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-                                 errmsg("invalid input syntax for type %s", "dynamic"),
-                                 errdetail( "Unicode low surrogate must follow a high surrogate."),
-                                 report_dynamic_context(lex)));
-                        }
-                        ch = 0x10000 + hi_surrogate + (ch & 0x3ff);
-                        hi_surrogate = -1;
-                    }
 
+                if (ch >= 0xd800 && ch <= 0xdbff) {
                     if (hi_surrogate != -1) {
-                        ereport( ERROR,
+                        ereturn(lex->escontext, false,
+                            (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                             errmsg("invalid input syntax for type %s", "dynamic"),
+                             errdetail( "Unicode high surrogate must not follow a high surrogate."),
+                             report_dynamic_context(lex)));
+                    }
+                    hi_surrogate = (ch & 0x3ff) << 10;
+                    continue;
+                } else if (ch >= 0xdc00 && ch <= 0xdfff) {
+                    if (hi_surrogate == -1) {
+                        ereturn(lex->escontext, false,
                             (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                              errmsg("invalid input syntax for type %s", "dynamic"),
                              errdetail( "Unicode low surrogate must follow a high surrogate."),
                              report_dynamic_context(lex)));
                     }
+                    ch = 0x10000 + hi_surrogate + (ch & 0x3ff);
+                    hi_surrogate = -1;
+                }
 
-                    /*
-                     * For UTF8, replace the escape sequence by the actual
-                     * utf8 character in lex->strval. Do this also for other
-                     * encodings if the escape designates an ASCII character,
-                     * otherwise raise an error.
-                     */
-                    if (ch == 0) {
-                        /* We can't allow this, since our TEXT type doesn't */
-                        ereport( ERROR,
-                            (errcode(ERRCODE_UNTRANSLATABLE_CHARACTER),
-                             errmsg("unsupported Unicode escape sequence"),
-                             errdetail("\\u0000 cannot be converted to text."),
-                             report_dynamic_context(lex)));
-                    } else if (GetDatabaseEncoding() == PG_UTF8) {
+                if (hi_surrogate != -1) {
+                    ereturn(lex->escontext, false,
+                        (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                         errmsg("invalid input syntax for type %s", "dynamic"),
+                         errdetail( "Unicode low surrogate must follow a high surrogate."),
+                         report_dynamic_context(lex)));
+                }
+
+                /*
+                 * For UTF8, replace the escape sequence by the actual
+                 * utf8 character in lex->strval. Do this also for other
+                 * encodings if the escape designates an ASCII character,
+                 * otherwise raise an error.
+                 */
+                if (ch == 0) {
+                    /* We can't allow this, since our TEXT type doesn't */
+                    ereturn(lex->escontext, false,
+                        (errcode(ERRCODE_UNTRANSLATABLE_CHARACTER),
+                         errmsg("unsupported Unicode escape sequence"),
+                         errdetail("\\u0000 cannot be converted to text."),
+                         report_dynamic_context(lex)));
+                } else if (GetDatabaseEncoding() == PG_UTF8) {
+                    if (lex->strval != NULL) {
                         unicode_to_utf8(ch, (unsigned char *)utf8str);
                         utf8len = pg_utf_mblen((unsigned char *)utf8str);
                         appendBinaryStringInfo(lex->strval, utf8str, utf8len);
-                    } else if (ch <= 0x007f) {
-                        /*
-                         * This is the only way to designate things like a
-                         * form feed character in dynamic, so it's useful in all
-                         * encodings.
-                         */
-                        appendStringInfoChar(lex->strval, (char)ch);
-                    } else {
-                        ereport(
-                            ERROR,
-                            (errcode(ERRCODE_UNTRANSLATABLE_CHARACTER),
-                             errmsg("unsupported Unicode escape sequence"),
-                             errdetail( "Unicode escape values cannot be used for code point values above 007F when the server encoding is not UTF8."),
-                             report_dynamic_context(lex)));
                     }
+                } else if (ch <= 0x007f) {
+                    /*
+                     * This is the only way to designate things like a
+                     * form feed character in dynamic, so it's useful in all
+                     * encodings.
+                     */
+                    if (lex->strval != NULL)
+                        appendStringInfoChar(lex->strval, (char)ch);
+                } else {
+                    ereturn(lex->escontext, false,
+                        (errcode(ERRCODE_UNTRANSLATABLE_CHARACTER),
+                         errmsg("unsupported Unicode escape sequence"),
+                         errdetail( "Unicode escape values cannot be used for code point values above 007F when the server encoding is not UTF8."),
+                         report_dynamic_context(lex)));
                 }
-            } else if (lex->strval != NULL) {
+            } else {
                 if (hi_surrogate != -1)
-                    ereport( ERROR,
+                    ereturn(lex->escontext, false,
                         (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                          errmsg("invalid input syntax for type %s", "dynamic"),
                          errdetail( "Unicode low surrogate must follow a high surrogate."),
@@ -803,26 +1478,34 @@ static inline void dynamic_lex_string(dynamic_lex_context *lex) {
                 case '"':
                 case '\\':
                 case '/':
-                    appendStringInfoChar(lex->strval, *s);
+                    if (lex->strval != NULL)
+                        appendStringInfoChar(lex->strval, *s);
                     break;
                 case 'b':
-                    appendStringInfoChar(lex->strval, '\b');
+                    if (lex->strval != NULL)
+                        appendStringInfoChar(lex->strval, '\b');
                     break;
                 case 'f':
-                    appendStringInfoChar(lex->strval, '\f');
+                    if (lex->strval != NULL)
+                        appendStringInfoChar(lex->strval, '\f');
                     break;
                 case 'n':
-                    appendStringInfoChar(lex->strval, '\n');
+                    if (lex->strval != NULL)
+                        appendStringInfoChar(lex->strval, '\n');
                     break;
                 case 'r':
-                    appendStringInfoChar(lex->strval, '\r');
+                    if (lex->strval != NULL)
+                        appendStringInfoChar(lex->strval, '\r');
                     break;
                 case 't':
-                    appendStringInfoChar(lex->strval, '\t');
+                    if (lex->strval != NULL)
+                        appendStringInfoChar(lex->strval, '\t');
                     break;
                 case 'x':
-                    appendStringInfoChar(lex->strval, '\\');
-                    appendStringInfoChar(lex->strval, 'x');
+                    if (lex->strval != NULL) {
+                        appendStringInfoChar(lex->strval, '\\');
+                        appendStringInfoChar(lex->strval, 'x');
+                    }
                     break;
                 case '0':
                 case '1':
@@ -834,53 +1517,26 @@ static inline void dynamic_lex_string(dynamic_lex_context *lex) {
                 case '7':
                 case '8':
                 case '9':
-                    appendStringInfoChar(lex->strval, '\\');
-                    appendStringInfoChar(lex->strval, *s);\
+                    if (lex->strval != NULL) {
+                        appendStringInfoChar(lex->strval, '\\');
+                        appendStringInfoChar(lex->strval, *s);
+                    }
                     break;
                 default:
-                    if (extract_mb_char(s)[0] == 'x') {
-                        //appendStringInfoChar(lex->strval, '\\');
-                        appendStringInfoChar(lex->strval, 'x');
-                        break;
-                    } else {
                     /* Not a valid string escape, so error out. */
                     lex->token_terminator = s + pg_mblen(s);
-                    ereport( ERROR,
+                    ereturn(lex->escontext, false,
                         (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                          errmsg("invalid input syntax for type %s", "dynamic"),
                          errdetail("Escape sequence \"\\%s\" is invalid.", extract_mb_char(s)),
                          report_dynamic_context(lex)));
-                    }
                 }
-            } else if (strchr("\"\\/bfnrt", *s) == NULL) {
-                /*
-                 * Simpler processing if we're not bothered about de-escaping
-                 *
-                 * It's very tempting to remove the strchr() call here and
-                 * replace it with a switch statement, but testing so far has
-                 * shown it's not a performance win.
-                 */
-                lex->token_terminator = s + pg_mblen(s);
-                ereport(ERROR,
-                        (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-                         errmsg("invalid input syntax for type %s", "dynamic"),
-                         errdetail("Escape sequence \"\\%s\" is invalid.", extract_mb_char(s)),
-                         report_dynamic_context(lex)));
             }
-        } else if (lex->strval != NULL) {
-            if (hi_surrogate != -1)
-                ereport( ERROR,
-                    (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-                     errmsg("invalid input syntax for type %s", "dynamic"),
-                     errdetail( "Unicode low surrogate must follow a high surrogate."),
-                     report_dynamic_context(lex)));
-
-            appendStringInfoChar(lex->strval, *s);
         }
     }
 
     if (hi_surrogate != -1)
-        ereport( ERROR,
+        ereturn(lex->escontext, false,
             (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
              errmsg("invalid input syntax for type %s", "dynamic"),
              errdetail("Unicode low surrogate must follow a high surrogate."),
@@ -889,6 +1545,8 @@ static inline void dynamic_lex_string(dynamic_lex_context *lex) {
     /* Hooray, we found the end of the string! */
     lex->prev_token_terminator = lex->token_terminator;
     lex->token_terminator = s + 1;
+
+    return true;
 }
 
 /*
@@ -916,12 +1574,23 @@ static inline void dynamic_lex_string(dynamic_lex_context *lex) {
  * first character of the string if there is none.
  *
  * If num_err is not NULL, we return an error flag to *num_err rather than
- * raising an error for a badly-formed number.  Also, if total_len is not NULL
+ * reporting an error for a badly-formed number.  Also, if total_len is not NULL
  * the distance from lex->input to the token end+1 is returned to *total_len.
+ *
+ * The digits are accumulated into lex->number as they are scanned, so that
+ * integers and floats can be converted without going over the token again.
+ * The sign is left for the caller to fill in.
  */
-static inline void dynamic_lex_number(dynamic_lex_context *lex, char *s, bool *num_err, int *total_len) {
+static inline bool dynamic_lex_number(dynamic_lex_context *lex, char *s, bool *num_err, int *total_len) {
+    dynamic_number *num = &lex->number;
     bool error = false;
     int len = s - lex->input;
+    int ndigits = 0;
+
+    num->mantissa = 0;
+    num->exponent = 0;
+    num->negative = false;
+    num->inexact = false;
 
     /* assume we have an integer until proven otherwise */
     lex->token_type = DYNAMIC_TOKEN_INTEGER;
@@ -935,6 +1604,7 @@ static inline void dynamic_lex_number(dynamic_lex_context *lex, char *s, bool *n
         len++;
     } else if (len < lex->input_length && *s >= '1' && *s <= '9') {
         do {
+            dynamic_number_add_digit(num, &ndigits, *s - '0', false);
             s++;
             len++;
         } while (len < lex->input_length && *s >= '0' && *s <= '9');
@@ -953,6 +1623,7 @@ static inline void dynamic_lex_number(dynamic_lex_context *lex, char *s, bool *n
             error = true;
         } else {
             do {
+                dynamic_number_add_digit(num, &ndigits, *s - '0', true);
                 s++;
                 len++;
             } while (len < lex->input_length && *s >= '0' && *s <= '9');
@@ -992,12 +1663,16 @@ static inline void dynamic_lex_number(dynamic_lex_context *lex, char *s, bool *n
 
     /* Part (4b): parse optional exponent. */
     else if (len < lex->input_length && (*s == 'e' || *s == 'E')) {
+        bool exp_negative = false;
+        int exp_value = 0;
+
         /* since we have an exponent, we have a float */
         lex->token_type = DYNAMIC_TOKEN_FLOAT;
 
         s++;
         len++;
         if (len < lex->input_length && (*s == '+' || *s == '-')) {
+            exp_negative = (*s == '-');
             s++;
             len++;
         }
@@ -1005,10 +1680,14 @@ static inline void dynamic_lex_number(dynamic_lex_context *lex, char *s, bool *n
             error = true;
         } else {
             do {
+                /* anything this large is out of range anyway */
+                if (exp_value < 100000)
+                    exp_value = exp_value * 10 + (*s - '0');
                 s++;
                 len++;
             } while (len < lex->input_length && *s >= '0' && *s <= '9');
         }
+        num->exponent += exp_negative ? -exp_value : exp_value;
     }
 
     /*
@@ -1031,7 +1710,30 @@ static inline void dynamic_lex_number(dynamic_lex_context *lex, char *s, bool *n
         lex->token_terminator = s;
         /* handle error if any */
         if (error)
-            report_invalid_token(lex);
+            return report_invalid_token(lex);
+    }
+
+    return true;
+}
+
+/*
+ * Add the next digit of a number token to its scan. Leading zeros are not
+ * significant, so they only move the exponent of a fraction. Once the
+ * mantissa holds 19 significant digits, further integer digits scale the
+ * exponent up and further fraction digits are dropped.
+ */
+static inline void dynamic_number_add_digit(dynamic_number *num, int *ndigits, int digit, bool fraction) {
+    if (*ndigits < 19) {
+        num->mantissa = num->mantissa * 10 + digit;
+        if (num->mantissa != 0)
+            (*ndigits)++;
+        if (fraction)
+            num->exponent--;
+    } else {
+        if (digit != 0)
+            num->inexact = true;
+        if (!fraction)
+            num->exponent++;
     }
 }
 
@@ -1039,14 +1741,16 @@ static inline void dynamic_lex_number(dynamic_lex_context *lex, char *s, bool *n
  * Report a parse error.
  *
  * lex->token_start and lex->token_terminator must identify the current token.
+ * Returns false for the caller to pass on if the error went into
+ * lex->escontext.
  */
-static void report_parse_error(dynamic_parse_context ctx, dynamic_lex_context *lex) {
+static bool report_parse_error(dynamic_parse_context ctx, dynamic_lex_context *lex) {
     char *token;
     int toklen;
 
     /* Handle case where the input ended prematurely. */
     if (lex->token_start == NULL || lex->token_type == DYNAMIC_TOKEN_END)
-        ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+        ereturn(lex->escontext, false, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                         errmsg("invalid input syntax for type %s", "dynamic"),
                         errdetail("The input string ended unexpectedly."),
                         report_dynamic_context(lex)));
@@ -1059,7 +1763,7 @@ static void report_parse_error(dynamic_parse_context ctx, dynamic_lex_context *l
 
     /* Complain, with the appropriate detail message. */
     if (ctx == DYNAMIC_PARSE_END) {
-        ereport(ERROR,
+        ereturn(lex->escontext, false,
                 (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                  errmsg("invalid input syntax for type %s", "dynamic"),
                  errdetail("Expected end of input, but found \"%s\".", token),
@@ -1068,22 +1772,22 @@ static void report_parse_error(dynamic_parse_context ctx, dynamic_lex_context *l
         switch (ctx)
         {
         case DYNAMIC_PARSE_VALUE:
-            ereport(
-                ERROR,
+            ereturn(
+                lex->escontext, false,
                 (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                  errmsg("invalid input syntax for type %s", "dynamic"),
                  errdetail("Expected dynamic value, but found \"%s\".", token),
                  report_dynamic_context(lex)));
             break;
         case DYNAMIC_PARSE_STRING:
-            ereport(ERROR,
+            ereturn(lex->escontext, false,
                     (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                      errmsg("invalid input syntax for type %s", "dynamic"),
                      errdetail("Expected string, but found \"%s\".", token),
                      report_dynamic_context(lex)));
             break;
         case DYNAMIC_PARSE_ARRAY_START:
-            ereport(ERROR,
+            ereturn(lex->escontext, false,
                     (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                      errmsg("invalid input syntax for type %s", "dynamic"),
                      errdetail(
@@ -1092,7 +1796,7 @@ static void report_parse_error(dynamic_parse_context ctx, dynamic_lex_context *l
                      report_dynamic_context(lex)));
             break;
         case DYNAMIC_PARSE_ARRAY_NEXT:
-            ereport(ERROR,
+            ereturn(lex->escontext, false,
                     (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                      errmsg("invalid input syntax for type %s", "dynamic"),
                      errdetail("Expected \",\" or \"]\", but found \"%s\".",
@@ -1100,7 +1804,7 @@ static void report_parse_error(dynamic_parse_context ctx, dynamic_lex_context *l
                      report_dynamic_context(lex)));
             break;
         case DYNAMIC_PARSE_OBJECT_START:
-            ereport(ERROR,
+            ereturn(lex->escontext, false,
                     (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                      errmsg("invalid input syntax for type %s", "dynamic"),
                      errdetail("Expected string or \"}\", but found \"%s\".",
@@ -1108,14 +1812,14 @@ static void report_parse_error(dynamic_parse_context ctx, dynamic_lex_context *l
                      report_dynamic_context(lex)));
             break;
         case DYNAMIC_PARSE_OBJECT_LABEL:
-            ereport(ERROR,
+            ereturn(lex->escontext, false,
                     (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                      errmsg("invalid input syntax for type %s", "dynamic"),
                      errdetail("Expected \":\", but found \"%s\".", token),
                      report_dynamic_context(lex)));
             break;
         case DYNAMIC_PARSE_OBJECT_NEXT:
-            ereport(ERROR,
+            ereturn(lex->escontext, false,
                     (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                      errmsg("invalid input syntax for type %s", "dynamic"),
                      errdetail("Expected \",\" or \"}\", but found \"%s\".",
@@ -1123,7 +1827,7 @@ static void report_parse_error(dynamic_parse_context ctx, dynamic_lex_context *l
                      report_dynamic_context(lex)));
             break;
         case DYNAMIC_PARSE_OBJECT_COMMA:
-            ereport(ERROR,
+            ereturn(lex->escontext, false,
                     (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                      errmsg("invalid input syntax for type %s", "dynamic"),
                      errdetail("Expected string, but found \"%s\".", token),
@@ -1133,14 +1837,17 @@ static void report_parse_error(dynamic_parse_context ctx, dynamic_lex_context *l
             elog(ERROR, "unexpected dynamic parse state: %d", ctx);
         }
     }
+
+    return false;
 }
 
 /*
  * Report an invalid input token.
  *
  * lex->token_start and lex->token_terminator must identify the token.
+ * Returns false like report_parse_error.
  */
-static void report_invalid_token(dynamic_lex_context *lex) {
+static bool report_invalid_token(dynamic_lex_context *lex) {
     char *token;
     int toklen;
 
@@ -1150,12 +1857,24 @@ static void report_invalid_token(dynamic_lex_context *lex) {
     memcpy(token, lex->token_start, toklen);
     token[toklen] = '\0';
 
-    ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+    ereturn(lex->escontext, false, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
                     errmsg("invalid input syntax for type %s", "dynamic"),
                     errdetail("Token \"%s\" is invalid.", token),
                     report_dynamic_context(lex)));
 }
 
+/*
+ * Report a container nested deeper than DYNAMIC_MAX_DEPTH allows, with the
+ * error check_dynamic_depth raises for values built by other means.
+ */
+static bool report_too_deep(dynamic_lex_context *lex) {
+    ereturn(lex->escontext, false, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                    errmsg("containers are nested too deeply"),
+                    errdetail("A dynamic may nest containers at most %d levels below the root.",
+                              DYNAMIC_MAX_DEPTH),
+                    report_dynamic_context(lex)));
+}
+
 /*
  * Report a CONTEXT line for bogus dynamic input.
  *
@@ -1181,7 +1900,8 @@ static int report_dynamic_context(dynamic_lex_context *lex)
     context_start = lex->input;
     context_end = lex->token_terminator;
     line_start = context_start;
-    line_number = 1;
+    /* the incremental parser only has the current chunk at hand */
+    line_number = lex->inc != NULL ? lex->inc->line_base : 1;
     for (;;) {
         /* Always advance over newlines */
         if (context_start < context_end && *context_start == '\n') {
@@ -1246,10 +1966,12 @@ static char *extract_mb_char(char *s) {
 }
 
 /*
- * Encode 'value' of datetime type 'typid' into dynamic string in ISO format
- * using optionally preallocated buffer 'buf'.
+ * Encode 'value' of datetime type 'typid' into dynamic string in date style
+ * 'style' using optionally preallocated buffer 'buf'. With DateStyle this is
+ * what the type's output function returns, without allocating; USE_XSD_DATES
+ * gives ISO format.
  */
-char *dynamic_encode_date_time(char *buf, Datum value, Oid typid) {
+char *dynamic_encode_date_time(char *buf, Datum value, Oid typid, int style) {
     if (!buf)
         buf = palloc(MAXDATELEN + 1);
 
@@ -1262,12 +1984,12 @@ char *dynamic_encode_date_time(char *buf, Datum value, Oid typid) {
 
         date = DatumGetDateADT(value);
 
-        /* Same as date_out(), but forcing DateStyle */
+        /* Same as date_out(), but in the given style */
         if (DATE_NOT_FINITE(date)) {
             EncodeSpecialDate(date, buf);
         } else {
             j2date(date + POSTGRES_EPOCH_JDATE, &(tm.tm_year), &(tm.tm_mon), &(tm.tm_mday));
-            EncodeDateOnly(&tm, USE_XSD_DATES, buf);
+            EncodeDateOnly(&tm, style, buf);
         }
     }
     break;
@@ -1277,9 +1999,9 @@ char *dynamic_encode_date_time(char *buf, Datum value, Oid typid) {
         struct pg_tm tt, *tm = &tt;
         fsec_t fsec;
 
-        /* Same as time_out(), but forcing DateStyle */
+        /* Same as time_out(), but in the given style */
         time2tm(time, tm, &fsec);
-        EncodeTimeOnly(tm, fsec, false, 0, USE_XSD_DATES, buf);
+        EncodeTimeOnly(tm, fsec, false, 0, style, buf);
     }
     break;
     case TIMETZOID:
@@ -1289,9 +2011,9 @@ char *dynamic_encode_date_time(char *buf, Datum value, Oid typid) {
         fsec_t fsec;
         int tz;
 
-        /* Same as timetz_out(), but forcing DateStyle */
+        /* Same as timetz_out(), but in the given style */
         timetz2tm(time, tm, &fsec, &tz);
-        EncodeTimeOnly(tm, fsec, true, tz, USE_XSD_DATES, buf);
+        EncodeTimeOnly(tm, fsec, true, tz, style, buf);
     }
     break;
     case TIMESTAMPOID:
@@ -1301,11 +2023,11 @@ char *dynamic_encode_date_time(char *buf, Datum value, Oid typid) {
         fsec_t fsec;
 
         timestamp = DatumGetTimestamp(value);
-        /* Same as timestamp_out(), but forcing DateStyle */
+        /* Same as timestamp_out(), but in the given style */
         if (TIMESTAMP_NOT_FINITE(timestamp))
             EncodeSpecialTimestamp(timestamp, buf);
         else if (timestamp2tm(timestamp, NULL, &tm, &fsec, NULL, NULL) == 0)
-            EncodeDateTime(&tm, fsec, false, 0, NULL, USE_XSD_DATES, buf);
+            EncodeDateTime(&tm, fsec, false, 0, NULL, style, buf);
         else
             ereport(ERROR, (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
                             errmsg("timestamp out of range")));
@@ -1320,11 +2042,11 @@ char *dynamic_encode_date_time(char *buf, Datum value, Oid typid) {
         const char *tzn = NULL;
 
         timestamp = DatumGetTimestampTz(value);
-        /* Same as timestamptz_out(), but forcing DateStyle */
+        /* Same as timestamptz_out(), but in the given style */
         if (TIMESTAMP_NOT_FINITE(timestamp))
             EncodeSpecialTimestamp(timestamp, buf);
         else if (timestamp2tm(timestamp, &tz, &tm, &fsec, &tzn, NULL) == 0)
-            EncodeDateTime(&tm, fsec, true, tz, tzn, USE_XSD_DATES, buf);
+            EncodeDateTime(&tm, fsec, true, tz, tzn, style, buf);
         else
             ereport(ERROR, (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
                             errmsg("timestamp out of range")));
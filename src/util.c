@@ -22,9 +22,12 @@
 #include <math.h>
 
 #include "access/hash.h"
+#include "common/hashfn.h"
 #include "catalog/pg_collation.h"
+#include "mb/pg_wchar.h"
 #include "miscadmin.h"
 #include "utils/builtins.h"
+#include "utils/hsearch.h"
 #include "utils/memutils.h"
 #include "utils/date.h"
 #include "utils/timestamp.h"
@@ -35,29 +38,163 @@
 #include "utils/dynamic_ext.h"
 
 /*
- * Maximum number of elements in an array (or key/value pairs in an object).
- * This is limited by two things: the size of the gtentry array must fit
- * in MaxAllocSize, and the number of elements (or pairs) must fit in the bits
- * reserved for that in the dynamic_container.header field.
+ * Keys written so far while serializing a datum, so that repeats of them can
+ * be stored as key references. The hash table is only created once a key
+ * long enough to be worth referencing comes along. Keys written before floor
+ * are out of reach.
+ */
+typedef struct dynamic_key_table
+{
+    HTAB *positions;
+    int floor;
+} dynamic_key_table;
+
+typedef struct dynamic_key
+{
+    char *val;
+    int len;
+} dynamic_key;
+
+typedef struct dynamic_key_entry
+{
+    dynamic_key key; // hash key, must be first
+    int position;    // buffer position of the key's first copy
+} dynamic_key_entry;
+
+/*
+ * Objects with at least this many pairs have their keys deduplicated with a
+ * hash table and sorted by sort_unique_keys() rather than by sorting the
+ * pairs themselves.
+ */
+#define DYNAMIC_SORT_KEYS_MIN_PAIRS 32
+
+/*
+ * A key of an object as sort_unique_keys() sorts it. prefix holds the eight
+ * bytes of the key that follow the ones all of the object's keys start with,
+ * big-endian, so most comparisons are settled without going to the key.
+ */
+typedef struct dynamic_sort_key
+{
+    const char *val;
+    int len;
+    int index;      // position of the pair in the object, -1 once dropped
+    int order;      // of equal keys, the one with the highest order is kept
+    uint64 prefix;
+} dynamic_sort_key;
+
+/*
+ * State of dynamic_builder, which serializes a dynamic as its parts arrive
+ * instead of building a dynamic_value tree first.
+ *
+ * The data of the children of every open container is appended to a single
+ * buffer as it arrives, and their gtentries are kept in the container's
+ * frame. An array is finished by moving its data up to make room for the
+ * header and gtentries in front of it. An object is laid out again, with its
+ * keys sorted and deduplicated, followed by the values in key order.
  *
- * (The total size of an array's or object's elements is also limited by
- * GTENTRY_OFFLENMASK, but we're not concerned about that here.)
+ * While an array is open, nothing written inside it before its currently
+ * open child moves. Keys of objects that are elements of an open array are
+ * therefore remembered in key_positions as targets for key references. The
+ * distance from a reference back to its target still changes whenever a
+ * container between the two is finished, so each frame lists the references
+ * in it whose target lies outside of it, to be adjusted when it is finished.
  */
-#define DYNAMIC_MAX_ELEMS (Min(MaxAllocSize / sizeof(dynamic_value), GT_CMASK))
-#define DYNAMIC_MAX_PAIRS (Min(MaxAllocSize / sizeof(dynamic_pair), GT_CMASK))
+typedef struct dynamic_build_child
+{
+    int offset;   // buffer position of the data, after any alignment padding
+    int len;      // length of the data, without padding
+    gtentry type; // GTENTRY_IS_* bits
+} dynamic_build_child;
+
+typedef struct dynamic_build_pair
+{
+    int key_offset; // position of the key in the builder's key arena
+    int key_len;
+    int order;      // position in the input; of duplicate keys the last wins
+    dynamic_build_child value;
+} dynamic_build_pair;
+
+typedef struct dynamic_build_ref
+{
+    int position; // buffer position of the gtentry_key_ref
+    int owner;    // depth of the array holding the target
+} dynamic_build_ref;
+
+typedef struct dynamic_build_frame
+{
+    uint32 id;      // tells apart the containers that used this frame
+    bool is_object;
+    int base;       // buffer length when the container was begun
+    int start;      // int-aligned start of the container in the buffer
+    int count;      // elements, or pairs, so far
+    dynamic_build_child *elems;
+    int elems_size;
+    dynamic_build_pair *pairs;
+    int pairs_size;
+    int key_base;   // key arena length when the object was begun
+    bool vector;    // every element so far is of elem_type
+    enum dynamic_value_type elem_type;
+    dynamic_build_ref *refs;
+    int nrefs;
+    int refs_size;
+} dynamic_build_frame;
+
+typedef struct dynamic_build_key_entry
+{
+    dynamic_key key; // hash key, must be first
+    int position;    // buffer position of the key
+    int owner;       // depth of the array holding the key
+    uint32 owner_id; // id of that array, to tell whether it is still open
+} dynamic_build_key_entry;
+
+struct dynamic_builder
+{
+    StringInfoData buffer;
+    StringInfoData keys;   // keys of the pairs of the open objects
+    StringInfoData scratch; // where a container being finished is laid out
+    dynamic_build_frame *frames;
+    int depth;             // number of open containers
+    int max_depth;
+    uint32 next_id;
+    HTAB *key_positions;
+    dynamic *result;       // a raw scalar, if the value is one
+    MemoryContext cxt;     // what outlives a single call is allocated here
+};
 
 static void fill_dynamic_value(dynamic_container *container, int index,
                               char *base_addr, uint32 offset,
                               dynamic_value *result);
 static bool equals_dynamic_scalar_value(const dynamic_value *a, const dynamic_value *b);
 static dynamic *convert_to_dynamic(dynamic_value *val);
-static void convert_dynamic_value(StringInfo buffer, gtentry *header, dynamic_value *val, int level);
-static void convert_dynamic_array(StringInfo buffer, gtentry *pheader, dynamic_value *val, int level);
-static void convert_dynamic_object(StringInfo buffer, gtentry *pheader, dynamic_value *val, int level);
+static void convert_dynamic_value(StringInfo buffer, gtentry *header, dynamic_value *val, int level,
+                                  dynamic_key_table *keys);
+static void convert_dynamic_array(StringInfo buffer, gtentry *pheader, dynamic_value *val, int level,
+                                  dynamic_key_table *keys);
+static bool get_dynamic_vector_type(dynamic_value *val, uint32 *vector_type);
+static bool get_vector_elem_type(enum dynamic_value_type type, uint32 *vector_type);
+static void convert_dynamic_vector(StringInfo buffer, gtentry *pheader, dynamic_value *val, uint32 vector_type);
+static void convert_dynamic_object(StringInfo buffer, gtentry *pheader, dynamic_value *val, int level,
+                                   dynamic_key_table *keys);
+static void convert_dynamic_key(StringInfo buffer, gtentry *entry, dynamic_value *key,
+                                dynamic_key_table *keys);
 static void convert_dynamic_scalar(StringInfo buffer, gtentry *entry, dynamic_value *scalar_val);
+static void convert_dynamic_binary(StringInfo buffer, gtentry *pheader, dynamic_value *val, int level,
+                                   dynamic_key_table *keys);
+static bool dynamic_container_has_key_refs(dynamic_container *container, const char *floor);
+static bool dynamic_root_has_key_refs(dynamic_container *container);
+static dynamic_value *materialize_dynamic_container(dynamic_container *container);
+static uint32 dynamic_key_hash(const void *key, Size keysize);
+static int dynamic_key_match(const void *key1, const void *key2, Size keysize);
+static int get_dynamic_scalar_size(dynamic_value *scalar_val);
 static void append_to_buffer(StringInfo buffer, const char *data, int len);
 static void copy_to_buffer(StringInfo buffer, int offset, const char *data, int len);
 static dynamic_iterator *iterator_from_container(dynamic_container *container, dynamic_iterator *parent);
+static dynamic_iterator_token dynamic_iterator_next_as_array(dynamic_iterator **it, dynamic_value *val, bool skip_nested);
+static void get_dynamic_key(dynamic_container *container, int index, char *base_addr,
+                            dynamic_value *key);
+static void fill_dynamic_vector_value(dynamic_container *container, uint32 index, dynamic_value *result);
+static const char *check_dynamic_container(dynamic_container *container, uint32 len, int level,
+                                           const char *ref_floor);
 static dynamic_iterator *free_and_get_parent(dynamic_iterator *it);
 static dynamic_parse_state *push_state(dynamic_parse_state **pstate);
 static void append_key(dynamic_parse_state *pstate, dynamic_value *string);
@@ -65,6 +202,21 @@ static void append_value(dynamic_parse_state *pstate, dynamic_value *scalar_val)
 static void append_element(dynamic_parse_state *pstate, dynamic_value *scalar_val);
 static int length_compare_dynamic_string_value(const void *a, const void *b);
 static int length_compare_dynamic_pair(const void *a, const void *b, void *binequal);
+static int sort_unique_keys(dynamic_sort_key *keys, int num_keys);
+static int compare_dynamic_sort_key(const void *a, const void *b, void *arg);
+static void dynamic_builder_begin(dynamic_builder *builder, bool is_object);
+static void dynamic_builder_add_child(dynamic_builder *builder, dynamic_build_child *child,
+                                      enum dynamic_value_type type);
+static void dynamic_builder_end_array(dynamic_builder *builder, dynamic_build_frame *frame);
+static void dynamic_builder_end_vector(dynamic_builder *builder, dynamic_build_frame *frame,
+                                       uint32 vector_type);
+static void dynamic_builder_end_object(dynamic_builder *builder, dynamic_build_frame *frame);
+static void dynamic_builder_put_key(dynamic_builder *builder, StringInfo block, int block_start,
+                                    int depth, const char *key, int len, gtentry *type);
+static void dynamic_builder_add_ref(dynamic_builder *builder, dynamic_build_frame *frame,
+                                    int position, int owner);
+static void dynamic_builder_move_ref(char *dest, const char *src, int moved_by);
+static int compare_dynamic_build_pair(const void *a, const void *b, void *arg);
 static dynamic_value *push_dynamic_value_scalar(dynamic_parse_state **pstate,
                                               dynamic_iterator_token seq,
                                               dynamic_value *scalar_val);
@@ -165,24 +317,17 @@ dynamic *dynamic_value_to_dynamic(dynamic_value *val)
     if (IS_A_DYNAMIC_SCALAR(val))
     {
         // Scalar value 
-        dynamic_parse_state *pstate = NULL;
-        dynamic_value *res;
-        dynamic_value scalar_array;
-
-        scalar_array.type = DYNAMIC_ARRAY;
-        scalar_array.val.array.raw_scalar = true;
-        scalar_array.val.array.num_elems = 1;
-
-        push_dynamic_value(&pstate, WGT_BEGIN_ARRAY, &scalar_array);
-        push_dynamic_value(&pstate, WGT_ELEM, val);
-        res = push_dynamic_value(&pstate, WGT_END_ARRAY, NULL);
-
-        out = convert_to_dynamic(res);
+        out = scalar_value_to_dynamic(val);
     }
     else if (val->type == DYNAMIC_OBJECT || val->type == DYNAMIC_ARRAY)
     {
         out = convert_to_dynamic(val);
     }
+    else if (dynamic_root_has_key_refs(val->val.binary.data))
+    {
+        // Some keys refer to copies out of reach of the new root, so rebuild it 
+        out = convert_to_dynamic(materialize_dynamic_container(val->val.binary.data));
+    }
     else
     {
         Assert(val->type == DYNAMIC_BINARY);
@@ -194,6 +339,70 @@ dynamic *dynamic_value_to_dynamic(dynamic_value *val)
     return out;
 }
 
+/*
+ * Turn a scalar dynamic_value into a raw scalar pseudo-array dynamic.
+ *
+ * This produces the same bytes as dynamic_value_to_dynamic would through
+ * push_dynamic_value and convert_to_dynamic, but the size of the result is
+ * computed up front, so it is written into a single palloc'd chunk without
+ * building a parse state. Casts and operators that return a scalar should
+ * call this directly.
+ */
+dynamic *scalar_value_to_dynamic(dynamic_value *scalar_val)
+{
+    StringInfoData buffer;
+    gtentry entry;
+    int size;
+    dynamic *res;
+
+    Assert(IS_A_DYNAMIC_SCALAR(scalar_val));
+
+    // varlena header, container header and the gtentry of the one element 
+    size = VARHDRSZ + sizeof(uint32) + sizeof(gtentry);
+
+    /*
+     * The element's data starts int-aligned, so it never needs padding. Add
+     * a byte for the trailing null StringInfo keeps in place.
+     */
+    buffer.maxlen = size + get_dynamic_scalar_size(scalar_val) + 1;
+    buffer.data = palloc(buffer.maxlen);
+    buffer.len = size;
+    buffer.cursor = 0;
+
+    convert_dynamic_scalar(&buffer, &entry, scalar_val);
+
+    Assert(buffer.len + 1 == buffer.maxlen);
+
+    res = (dynamic *)buffer.data;
+    SET_VARSIZE(res, buffer.len);
+    res->root.header = 1 | GT_FARRAY | GT_FSCALAR;
+
+    // The only element starts an offset stride, so it stores an offset 
+    res->root.children[0] = (entry & GTENTRY_TYPEMASK) | GTE_OFFLENFLD(entry) | GTENTRY_HAS_OFF;
+
+    return res;
+}
+
+/*
+ * Number of bytes convert_dynamic_scalar appends for a scalar written at an
+ * int-aligned position.
+ */
+static int get_dynamic_scalar_size(dynamic_value *scalar_val)
+{
+    switch (scalar_val->type)
+    {
+    case DYNAMIC_NULL:
+    case DYNAMIC_BOOL:
+        return 0;
+    case DYNAMIC_STRING:
+        return scalar_val->val.string.len;
+    case DYNAMIC_NUMERIC:
+        return VARSIZE_ANY(scalar_val->val.numeric);
+    default:
+        return ag_extended_type_size(scalar_val);
+    }
+}
+
 /*
  * Get the offset of the variable-length portion of an dynamic node within
  * the variable-length-data part of its container.  The node is identified
@@ -305,8 +514,8 @@ int compare_dynamic_containers_orderability(dynamic_container *a, dynamic_contai
         dynamic_iterator_token ra;
         dynamic_iterator_token rb;
 
-        ra = dynamic_iterator_next(&ita, &va, false);
-        rb = dynamic_iterator_next(&itb, &vb, false);
+        ra = dynamic_iterator_next_as_array(&ita, &va, false);
+        rb = dynamic_iterator_next_as_array(&itb, &vb, false);
 
         if (ra == rb)
         {
@@ -378,13 +587,13 @@ int compare_dynamic_containers_orderability(dynamic_container *a, dynamic_contai
                         if (va.val.array.raw_scalar)
                         {
                             // advance iterator ita and get contained type 
-                            ra = dynamic_iterator_next(&ita, &va, false);
+                            ra = dynamic_iterator_next_as_array(&ita, &va, false);
                             res = (get_type_sort_priority(va.type) < get_type_sort_priority(vb.type)) ?  -1 : 1;
                         }
                         else
                         {
                             // advance iterator itb and get contained type 
-                            rb = dynamic_iterator_next(&itb, &vb, false);
+                            rb = dynamic_iterator_next_as_array(&itb, &vb, false);
                             res = (get_type_sort_priority(va.type) < get_type_sort_priority(vb.type)) ?  -1 : 1;
                         }
                     }
@@ -501,7 +710,19 @@ dynamic_value *find_dynamic_value_from_container(dynamic_container *container,
 
     result = palloc(sizeof(dynamic_value));
 
-    if ((flags & GT_FARRAY) && DYNAMIC_CONTAINER_IS_ARRAY(container))
+    if ((flags & GT_FARRAY) && DYNAMIC_CONTAINER_IS_VECTOR(container))
+    {
+        int i;
+
+        for (i = 0; i < count; i++)
+        {
+            fill_dynamic_vector_value(container, i, result);
+
+            if (key->type == result->type && equals_dynamic_scalar_value(key, result))
+                return result;
+        }
+    }
+    else if ((flags & GT_FARRAY) && DYNAMIC_CONTAINER_IS_ARRAY(container))
     {
         char *base_addr = (char *)(children + count);
         uint32 offset = 0;
@@ -539,11 +760,7 @@ dynamic_value *find_dynamic_value_from_container(dynamic_container *container,
 
             stop_middle = stop_low + (stop_high - stop_low) / 2;
 
-            candidate.type = DYNAMIC_STRING;
-            candidate.val.string.val =
-                base_addr + get_dynamic_offset(container, stop_middle);
-            candidate.val.string.len = get_dynamic_length(container,
-                                                         stop_middle);
+            get_dynamic_key(container, stop_middle, base_addr, &candidate);
 
             difference = length_compare_dynamic_string_value(&candidate, key);
 
@@ -572,6 +789,126 @@ dynamic_value *find_dynamic_value_from_container(dynamic_container *container,
     return NULL;
 }
 
+/*
+ * Look up a key of the top level object of a dynamic datum.
+ *
+ * A datum that is compressed or stored out of line is not detoasted as a
+ * whole. Instead the container header, the gtentrys, the keys and finally the
+ * value found are fetched as slices, so a lookup in a large document only
+ * reads a small part of it. The keys are binary searched as in
+ * find_dynamic_value_from_container.
+ *
+ * Returns a palloc()'d value, or NULL if the datum is not an object or does
+ * not have the key.
+ */
+dynamic_value *find_dynamic_object_field(Datum d, const char *key, int keylen)
+{
+    struct varlena *attr = (struct varlena *)DatumGetPointer(d);
+    dynamic_container *container;
+    dynamic_value key_val;
+    dynamic_value *result;
+    char *keys;
+    char *data;
+    uint32 header;
+    uint32 count;
+    uint32 entries_len;
+    uint32 stop_low;
+    uint32 stop_high;
+
+    key_val.type = DYNAMIC_STRING;
+    key_val.val.string.val = (char *)key;
+    key_val.val.string.len = keylen;
+
+    if (!VARATT_IS_EXTERNAL_ONDISK(attr) && !VARATT_IS_COMPRESSED(attr))
+    {
+        dynamic *agt = DATUM_GET_DYNAMIC_P(d);
+
+        if (!DYNA_ROOT_IS_OBJECT(agt))
+            return NULL;
+
+        return find_dynamic_value_from_container(&agt->root, GT_FOBJECT, &key_val);
+    }
+
+    // Container header 
+    attr = PG_DETOAST_DATUM_SLICE(d, 0, sizeof(uint32));
+    if (VARSIZE(attr) - VARHDRSZ < sizeof(uint32))
+        elog(ERROR, "dynamic value is truncated");
+
+    memcpy(&header, VARDATA(attr), sizeof(uint32));
+    count = header & GT_CMASK;
+
+    if ((header & GT_FOBJECT) == 0 || count == 0)
+        return NULL;
+
+    // The gtentrys of the keys and of the values 
+    entries_len = sizeof(uint32) + count * 2 * sizeof(gtentry);
+    attr = PG_DETOAST_DATUM_SLICE(d, 0, entries_len);
+    if (VARSIZE(attr) - VARHDRSZ < entries_len)
+        elog(ERROR, "dynamic value is truncated");
+
+    container = (dynamic_container *)VARDATA(attr);
+
+    // The keys, which are stored together ahead of the values 
+    attr = PG_DETOAST_DATUM_SLICE(d, entries_len, get_dynamic_offset(container, count));
+    keys = VARDATA(attr);
+
+    stop_low = 0;
+    stop_high = count;
+    while (stop_low < stop_high)
+    {
+        uint32 stop_middle;
+        uint32 index;
+        uint32 offset;
+        uint32 len;
+        int difference;
+        dynamic_value candidate;
+
+        stop_middle = stop_low + (stop_high - stop_low) / 2;
+
+        get_dynamic_key(container, stop_middle, keys, &candidate);
+
+        difference = length_compare_dynamic_string_value(&candidate, &key_val);
+
+        if (difference < 0)
+        {
+            stop_low = stop_middle + 1;
+            continue;
+        }
+        else if (difference > 0)
+        {
+            stop_high = stop_middle;
+            continue;
+        }
+
+        // Found our key, fetch just the bytes of the corresponding value 
+        index = stop_middle + count;
+        offset = get_dynamic_offset(container, index);
+        len = get_dynamic_length(container, index);
+
+        /*
+         * Copy the value so that it has the same alignment modulo 4 as it
+         * has within the container; fill_dynamic_value aligns from there.
+         */
+        data = palloc(len + sizeof(uint32));
+        if (len > 0)
+        {
+            attr = PG_DETOAST_DATUM_SLICE(d, entries_len + offset, len);
+            if (VARSIZE(attr) - VARHDRSZ < len)
+                elog(ERROR, "dynamic value is truncated");
+
+            memcpy(data + offset % sizeof(uint32), VARDATA(attr), len);
+        }
+
+        result = palloc(sizeof(dynamic_value));
+        fill_dynamic_value(container, index, data + offset % sizeof(uint32) - offset,
+                          offset, result);
+
+        return result;
+    }
+
+    return NULL;
+}
+
 /*
  * Get i-th value of an dynamic array.
  *
@@ -595,6 +932,12 @@ dynamic_value *get_ith_dynamic_value_from_container(dynamic_container *container
 
     result = palloc(sizeof(dynamic_value));
 
+    if (DYNAMIC_CONTAINER_IS_VECTOR(container))
+    {
+        fill_dynamic_vector_value(container, i, result);
+        return result;
+    }
+
     fill_dynamic_value(container, i, base_addr, get_dynamic_offset(container, i),
                       result);
 
@@ -637,6 +980,16 @@ static void fill_dynamic_value(dynamic_container *container, int index,
         result->val.string.len = string_len;
         Assert(result->val.string.len >= 0);
     }
+    else if (GTE_IS_KEY_REF(entry))
+    {
+        gtentry_key_ref ref;
+
+        memcpy(&ref, base_addr + offset, sizeof(gtentry_key_ref));
+
+        result->type = DYNAMIC_STRING;
+        result->val.string.val = pnstrdup(base_addr + offset - ref.distance, ref.len);
+        result->val.string.len = ref.len;
+    }
     else if (GTE_IS_NUMERIC(entry))
     {
         Numeric numeric;
@@ -681,1687 +1034,3378 @@ static void fill_dynamic_value(dynamic_container *container, int index,
 }
 
 /*
- * Push dynamic_value into dynamic_parse_state.
- *
- * Used when parsing dynamic tokens to form dynamic, or when converting an
- * in-memory dynamic_value to an dynamic.
- *
- * Initial state of *dynamic_parse_state is NULL, since it'll be allocated here
- * originally (caller will get dynamic_parse_state back by reference).
- *
- * Only sequential tokens pertaining to non-container types should pass an
- * dynamic_value.  There is one exception -- WGT_BEGIN_ARRAY callers may pass a
- * "raw scalar" pseudo array to append it - the actual scalar should be passed
- * next and it will be added as the only member of the array.
- *
- * Values of type DYNAMIC_BINARY, which are rolled up arrays and objects,
- * are unpacked before being added to the result.
+ * Point key at the bytes of the index'th key of an object, following a key
+ * reference back to the first copy of the key if need be. Unlike
+ * fill_dynamic_value, nothing is copied.
  */
-dynamic_value *push_dynamic_value(dynamic_parse_state **pstate,
-                                dynamic_iterator_token seq,
-                                dynamic_value *agtval)
+static void get_dynamic_key(dynamic_container *container, int index, char *base_addr,
+                            dynamic_value *key)
 {
-    dynamic_iterator *it;
-    dynamic_value *res = NULL;
-    dynamic_value v;
-    dynamic_iterator_token tok;
+    gtentry entry = container->children[index];
+    uint32 offset = get_dynamic_offset(container, index);
 
-    if (!agtval || (seq != WGT_ELEM && seq != WGT_VALUE) ||
-        (agtval->type != DYNAMIC_BINARY))
+    key->type = DYNAMIC_STRING;
+
+    if (GTE_IS_KEY_REF(entry))
     {
-        // drop through 
-        return push_dynamic_value_scalar(pstate, seq, agtval);
-    }
+        gtentry_key_ref ref;
 
-    // unpack the binary and add each piece to the pstate 
-    it = dynamic_iterator_init(agtval->val.binary.data);
-    while ((tok = dynamic_iterator_next(&it, &v, false)) != WGT_DONE)
+        memcpy(&ref, base_addr + offset, sizeof(gtentry_key_ref));
+        key->val.string.val = base_addr + offset - ref.distance;
+        key->val.string.len = ref.len;
+    }
+    else
     {
-        res = push_dynamic_value_scalar(pstate, tok,
-                                       tok < WGT_BEGIN_ARRAY ? &v : NULL);
+        key->val.string.val = base_addr + offset;
+        key->val.string.len = get_dynamic_length(container, index);
     }
-
-    return res;
 }
 
 /*
- * Do the actual pushing, with only scalar or pseudo-scalar-array values
- * accepted.
+ * Counterpart of fill_dynamic_value for the elements of a vector, which are
+ * located by index alone.  The elements are only int-aligned, so copy them
+ * out rather than dereferencing them in place.
  */
-static dynamic_value *push_dynamic_value_scalar(dynamic_parse_state **pstate,
-                                              dynamic_iterator_token seq,
-                                              dynamic_value *scalar_val)
+static void fill_dynamic_vector_value(dynamic_container *container, uint32 index,
+                                      dynamic_value *result)
 {
-    dynamic_value *result = NULL;
+    uint32 vector_type = DYNAMIC_VECTOR_TYPE(container);
+    char *elem = DYNAMIC_VECTOR_DATA(container) +
+                 index * DYNAMIC_VECTOR_ELEM_SIZE(vector_type);
 
-    switch (seq)
+    switch (vector_type)
     {
-    case WGT_BEGIN_ARRAY:
-        Assert(!scalar_val || scalar_val->val.array.raw_scalar);
-        *pstate = push_state(pstate);
-        result = &(*pstate)->cont_val;
-        (*pstate)->cont_val.type = DYNAMIC_ARRAY;
-        (*pstate)->cont_val.val.array.num_elems = 0;
-        (*pstate)->cont_val.val.array.raw_scalar =
-            (scalar_val && scalar_val->val.array.raw_scalar);
-        if (scalar_val && scalar_val->val.array.num_elems > 0)
-        {
-            // Assume that this array is still really a scalar 
-            Assert(scalar_val->type == DYNAMIC_ARRAY);
-            (*pstate)->size = scalar_val->val.array.num_elems;
-        }
-        else
-        {
-            (*pstate)->size = 4;
-        }
-        (*pstate)->cont_val.val.array.elems =
-            palloc(sizeof(dynamic_value) * (*pstate)->size);
-        (*pstate)->last_updated_value = NULL;
-        break;
-    case WGT_BEGIN_OBJECT:
-        Assert(!scalar_val);
-        *pstate = push_state(pstate);
-        result = &(*pstate)->cont_val;
-        (*pstate)->cont_val.type = DYNAMIC_OBJECT;
-        (*pstate)->cont_val.val.object.num_pairs = 0;
-        (*pstate)->size = 4;
-        (*pstate)->cont_val.val.object.pairs =
-            palloc(sizeof(dynamic_pair) * (*pstate)->size);
-        (*pstate)->last_updated_value = NULL;
+    case DYNA_HEADER_INTEGER:
+        result->type = DYNAMIC_INTEGER;
+        memcpy(&result->val.int_value, elem, sizeof(int64));
         break;
-    case WGT_KEY:
-        Assert(scalar_val->type == DYNAMIC_STRING);
-        append_key(*pstate, scalar_val);
+    case DYNA_HEADER_FLOAT:
+        result->type = DYNAMIC_FLOAT;
+        memcpy(&result->val.float_value, elem, sizeof(float8));
         break;
-    case WGT_VALUE:
-        Assert(IS_A_DYNAMIC_SCALAR(scalar_val));
-        append_value(*pstate, scalar_val);
+    case DYNA_HEADER_TIMESTAMP:
+        result->type = DYNAMIC_TIMESTAMP;
+        memcpy(&result->val.int_value, elem, sizeof(int64));
         break;
-    case WGT_ELEM:
-        Assert(IS_A_DYNAMIC_SCALAR(scalar_val));
-        append_element(*pstate, scalar_val);
+    case DYNA_HEADER_TIMESTAMPTZ:
+        result->type = DYNAMIC_TIMESTAMPTZ;
+        memcpy(&result->val.int_value, elem, sizeof(int64));
         break;
-    case WGT_END_OBJECT:
-        uniqueify_dynamic_object(&(*pstate)->cont_val);
-        // fall through! 
-    case WGT_END_ARRAY:
-        Assert(!scalar_val);
-        result = &(*pstate)->cont_val;
-
-        /*
-         * Pop queue and push current array/object as value in parent
-         * array/object
-         */
-        *pstate = (*pstate)->next;
-        if (*pstate)
-        {
-            switch ((*pstate)->cont_val.type)
-            {
-            case DYNAMIC_ARRAY:
-                append_element(*pstate, result);
-                break;
-            case DYNAMIC_OBJECT:
-                append_value(*pstate, result);
-                break;
-            default:
-                ereport(ERROR, (errmsg("invalid dynamic container type %d",
-                                       (*pstate)->cont_val.type)));
-            }
-        }
+    case DYNA_HEADER_DATE:
+        result->type = DYNAMIC_DATE;
+        memcpy(&result->val.date, elem, sizeof(DateADT));
         break;
     default:
-        ereport(ERROR,
-                (errmsg("unrecognized dynamic sequential processing token")));
+        ereport(ERROR, (errmsg("unknown dynamic vector type %u", vector_type)));
     }
-
-    return result;
 }
 
 /*
- * push_dynamic_value() worker:  Iteration-like forming of dynamic
+ * Check that the alignment padding in front of a child is zeroed, as our own
+ * serialization code always writes it that way.
  */
-static dynamic_parse_state *push_state(dynamic_parse_state **pstate)
+static bool dynamic_padding_is_zero(const char *base_addr, uint32 offset)
 {
-    dynamic_parse_state *ns = palloc(sizeof(dynamic_parse_state));
+    uint32 i;
 
-    ns->next = *pstate;
-    return ns;
+    for (i = offset; i < INTALIGN(offset); i++)
+    {
+        if (base_addr[i] != 0)
+            return false;
+    }
+
+    return true;
 }
 
 /*
- * push_dynamic_value() worker:  Append a pair key to state when generating
- *                              dynamic
+ * Check a single child of a container.  The child's variable-length data,
+ * including any alignment padding, is the len bytes at base_addr + offset.
+ * Returns NULL if the child is well formed, or a description of the problem.
  */
-static void append_key(dynamic_parse_state *pstate, dynamic_value *string)
+static const char *check_dynamic_child(gtentry entry, char *base_addr,
+                                       uint32 offset, uint32 len, int level,
+                                       const char *ref_floor)
 {
-    dynamic_value *object = &pstate->cont_val;
+    uint32 padlen = INTALIGN(offset) - offset;
 
-    Assert(object->type == DYNAMIC_OBJECT);
-    Assert(string->type == DYNAMIC_STRING);
+    if (GTE_IS_STRING(entry))
+    {
+        if (!pg_verifymbstr(base_addr + offset, len, true))
+            return "string is not valid in the database encoding";
+    }
+    else if (GTE_IS_BOOL(entry) || GTE_IS_NULL(entry))
+    {
+        if (len != 0)
+            return "boolean or null has a data portion";
+    }
+    else if (len < padlen)
+    {
+        return "value is shorter than its alignment padding";
+    }
+    else if (!dynamic_padding_is_zero(base_addr, offset))
+    {
+        return "alignment padding is not zeroed";
+    }
+    else if (GTE_IS_NUMERIC(entry))
+    {
+        char *numeric = base_addr + INTALIGN(offset);
 
-    if (object->val.object.num_pairs >= DYNAMIC_MAX_PAIRS)
-        ereport(
-            ERROR,
-            (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
-             errmsg(
-                 "number of dynamic object pairs exceeds the maximum allowed (%zu)",
-                 DYNAMIC_MAX_PAIRS)));
+        if (len < padlen + VARHDRSZ + sizeof(uint16) ||
+            !VARATT_IS_4B_U(numeric) || VARSIZE(numeric) != len - padlen)
+            return "numeric has an invalid length";
+    }
+    else if (GTE_IS_CONTAINER(entry))
+    {
+        if (len < padlen + sizeof(uint32))
+            return "nested container is truncated";
 
-    if (object->val.object.num_pairs >= pstate->size)
+        return check_dynamic_container((dynamic_container *)(base_addr + INTALIGN(offset)),
+                                       len - padlen, level + 1, ref_floor);
+    }
+    else if (GTE_IS_DYNAMIC(entry))
     {
-        pstate->size *= 2;
-        object->val.object.pairs = repalloc(
-            object->val.object.pairs, sizeof(dynamic_pair) * pstate->size);
+        if (!ag_validate_extended_type(base_addr, offset, len))
+            return "extended type is malformed";
+    }
+    else
+    {
+        return "unrecognized gtentry type";
     }
 
-    object->val.object.pairs[object->val.object.num_pairs].key = *string;
-    object->val.object.pairs[object->val.object.num_pairs].order =
-        object->val.object.num_pairs;
+    return NULL;
 }
 
 /*
- * push_dynamic_value() worker:  Append a pair value to state when generating an
- *                              dynamic
+ * Check that a container of len bytes, and all containers nested in it, can
+ * be safely read by the functions in this file.  Every gtentry must describe
+ * data that lies inside the container, scalars must be well formed, padding
+ * must be zeroed, nesting must not exceed DYNAMIC_MAX_DEPTH, and the keys of
+ * an object must be strings in strictly ascending length-wise order, since
+ * find_dynamic_value_from_container relies on that to binary search.  Key
+ * references must point back to bytes no earlier than ref_floor, which is
+ * the start of the enclosing top level object value, or of the root.
+ *
+ * This is a single forward pass over the gtentries that never builds a
+ * dynamic_value, so it is cheap enough to run on every value received from
+ * an untrusted source.  Returns NULL if the container is valid, otherwise a
+ * description of the first problem found.
  */
-static void append_value(dynamic_parse_state *pstate, dynamic_value *scalar_val)
+static const char *check_dynamic_container(dynamic_container *container, uint32 len, int level,
+                                           const char *ref_floor)
 {
-    dynamic_value *object = &pstate->cont_val;
-
-    Assert(object->type == DYNAMIC_OBJECT);
+    uint32 header;
+    uint32 count;
+    uint32 nchildren;
+    uint32 data_len;
+    char *base_addr;
+    uint32 offset;
+    const char *prev_key_val = NULL;
+    uint32 prev_key_len = 0;
+    uint32 i;
 
-    object->val.object.pairs[object->val.object.num_pairs].value = *scalar_val;
+    if (level > DYNAMIC_MAX_DEPTH)
+        return "containers are nested too deeply";
 
-    pstate->last_updated_value =
-        &object->val.object.pairs[object->val.object.num_pairs++].value;
-}
+    check_stack_depth();
 
-/*
- * push_dynamic_value() worker:  Append an element to state when generating an
- *                              dynamic
- */
-static void append_element(dynamic_parse_state *pstate,
-                           dynamic_value *scalar_val)
-{
-    dynamic_value *array = &pstate->cont_val;
+    if (len < sizeof(uint32))
+        return "container is truncated";
 
-    Assert(array->type == DYNAMIC_ARRAY);
+    header = container->header;
+    count = header & GT_CMASK;
 
-    if (array->val.array.num_elems >= DYNAMIC_MAX_ELEMS)
-        ereport(
-            ERROR,
-            (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
-             errmsg(
-                 "number of dynamic array elements exceeds the maximum allowed (%zu)",
-                 DYNAMIC_MAX_ELEMS)));
+    if (((header & GT_FARRAY) != 0) == ((header & GT_FOBJECT) != 0))
+        return "container is neither an array nor an object";
 
-    if (array->val.array.num_elems >= pstate->size)
+    if ((header & GT_FVECTOR) != 0)
     {
-        pstate->size *= 2;
-        array->val.array.elems = repalloc(array->val.array.elems,
-                                          sizeof(dynamic_value) * pstate->size);
-    }
+        uint32 vector_type;
 
-    array->val.array.elems[array->val.array.num_elems] = *scalar_val;
-    pstate->last_updated_value =
-        &array->val.array.elems[array->val.array.num_elems++];
-}
+        if ((header & (GT_FOBJECT | GT_FSCALAR)) != 0)
+            return "vector flag set on an invalid container";
 
-/*
- * Given an dynamic_container, expand to dynamic_iterator to iterate over items
- * fully expanded to in-memory representation for manipulation.
- *
- * See dynamic_iterator_next() for notes on memory management.
- */
-dynamic_iterator *dynamic_iterator_init(dynamic_container *container)
-{
-    return iterator_from_container(container, NULL);
-}
+        if (len < 2 * sizeof(uint32))
+            return "vector is truncated";
 
-/*
- * Get next dynamic_value while iterating
- *
- * Caller should initially pass their own, original iterator.  They may get
- * back a child iterator palloc()'d here instead.  The function can be relied
- * on to free those child iterators, lest the memory allocated for highly
- * nested objects become unreasonable, but only if callers don't end iteration
- * early (by breaking upon having found something in a search, for example).
- *
- * Callers in such a scenario, that are particularly sensitive to leaking
- * memory in a long-lived context may walk the ancestral tree from the final
- * iterator we left them with to its oldest ancestor, pfree()ing as they go.
- * They do not have to free any other memory previously allocated for iterators
- * but not accessible as direct ancestors of the iterator they're last passed
- * back.
- *
- * Returns "dynamic sequential processing" token value.  Iterator "state"
- * reflects the current stage of the process in a less granular fashion, and is
- * mostly used here to track things internally with respect to particular
- * iterators.
- *
- * Clients of this function should not have to handle any DYNAMIC_BINARY values
- * (since recursive calls will deal with this), provided skip_nested is false.
- * It is our job to expand the DYNAMIC_BINARY representation without bothering
- * them with it.  However, clients should not take it upon themselves to touch
- * array or Object element/pair buffers, since their element/pair pointers are
- * garbage.  Also, *val will not be set when returning WGT_END_ARRAY or
- * WGT_END_OBJECT, on the assumption that it's only useful to access values
- * when recursing in.
- */
-dynamic_iterator_token dynamic_iterator_next(dynamic_iterator **it,
-                                           dynamic_value *val, bool skip_nested)
-{
-    if (*it == NULL)
-        return WGT_DONE;
+        vector_type = DYNAMIC_VECTOR_TYPE(container);
+        if (vector_type != DYNA_HEADER_INTEGER && vector_type != DYNA_HEADER_FLOAT &&
+            vector_type != DYNA_HEADER_TIMESTAMP && vector_type != DYNA_HEADER_TIMESTAMPTZ &&
+            vector_type != DYNA_HEADER_DATE)
+            return "vector has an invalid element type";
 
-    /*
-     * When stepping into a nested container, we jump back here to start
-     * processing the child. We will not recurse further in one call, because
-     * processing the child will always begin in GTI_ARRAY_START or
-     * GTI_OBJECT_START state.
-     */
-recurse:
-    switch ((*it)->state)
-    {
-    case GTI_ARRAY_START:
-        // Set v to array on first array call 
-        val->type = DYNAMIC_ARRAY;
-        val->val.array.num_elems = (*it)->num_elems;
+        if ((uint64) count * DYNAMIC_VECTOR_ELEM_SIZE(vector_type) != len - 2 * sizeof(uint32))
+            return "vector length does not match its element count";
 
-        /*
-         * v->val.array.elems is not actually set, because we aren't doing
-         * a full conversion
-         */
-        val->val.array.raw_scalar = (*it)->is_scalar;
-        (*it)->curr_index = 0;
-        (*it)->curr_data_offset = 0;
-        (*it)->curr_value_offset = 0; // not actually used 
-        // Set state for next call 
-        (*it)->state = GTI_ARRAY_ELEM;
-        return WGT_BEGIN_ARRAY;
+        return NULL;
+    }
 
-    case GTI_ARRAY_ELEM:
-        if ((*it)->curr_index >= (*it)->num_elems)
-        {
-            /*
-             * All elements within array already processed.  Report this
-             * to caller, and give it back original parent iterator (which
-             * independently tracks iteration progress at its level of
-             * nesting).
-             */
-            *it = free_and_get_parent(*it);
-            return WGT_END_ARRAY;
-        }
+    if ((header & GT_FSCALAR) != 0 &&
+        ((header & GT_FARRAY) == 0 || count != 1 || level != 0))
+        return "scalar flag set on an invalid container";
 
-        fill_dynamic_value((*it)->container, (*it)->curr_index,
-                          (*it)->data_proper, (*it)->curr_data_offset, val);
+    nchildren = (header & GT_FOBJECT) ? count * 2 : count;
 
-        GTE_ADVANCE_OFFSET((*it)->curr_data_offset,
-                            (*it)->children[(*it)->curr_index]);
-        (*it)->curr_index++;
+    if ((uint64) nchildren * sizeof(gtentry) > len - sizeof(uint32))
+        return "gtentry array exceeds the container";
 
-        if (!IS_A_DYNAMIC_SCALAR(val) && !skip_nested)
-        {
-            // Recurse into container. 
-            *it = iterator_from_container(val->val.binary.data, *it);
-            goto recurse;
-        }
+    base_addr = (char *)&container->children[nchildren];
+    data_len = len - sizeof(uint32) - nchildren * sizeof(gtentry);
+
+    offset = 0;
+    for (i = 0; i < nchildren; i++)
+    {
+        gtentry entry = container->children[i];
+        const char *detail;
+        uint32 end;
+
+        if (GTE_HAS_OFF(entry))
+            end = GTE_OFFLENFLD(entry);
         else
+            end = offset + GTE_OFFLENFLD(entry);
+
+        if (end < offset || end > data_len)
+            return "gtentry points outside the container";
+
+        if ((header & GT_FOBJECT) && i < count)
         {
-            /*
-             * Scalar item in array, or a container and caller didn't want
-             * us to recurse into it.
-             */
-            return WGT_ELEM;
-        }
+            // Keys must be unique strings in length-wise order
+            const char *key_val = base_addr + offset;
+            uint32 key_len = end - offset;
 
-    case GTI_OBJECT_START:
-        // Set v to object on first object call 
-        val->type = DYNAMIC_OBJECT;
-        val->val.object.num_pairs = (*it)->num_elems;
+            if (GTE_IS_KEY_REF(entry))
+            {
+                gtentry_key_ref ref;
 
-        /*
-         * v->val.object.pairs is not actually set, because we aren't
-         * doing a full conversion
-         */
-        (*it)->curr_index = 0;
-        (*it)->curr_data_offset = 0;
-        (*it)->curr_value_offset = get_dynamic_offset((*it)->container,
-                                                     (*it)->num_elems);
-        // Set state for next call 
-        (*it)->state = GTI_OBJECT_KEY;
-        return WGT_BEGIN_OBJECT;
+                if (level == 0 || key_len != sizeof(gtentry_key_ref))
+                    return "object key reference is malformed";
 
-    case GTI_OBJECT_KEY:
-        if ((*it)->curr_index >= (*it)->num_elems)
-        {
-            /*
-             * All pairs within object already processed.  Report this to
-             * caller, and give it back original containing iterator
-             * (which independently tracks iteration progress at its level
-             * of nesting).
-             */
-            *it = free_and_get_parent(*it);
-            return WGT_END_OBJECT;
-        }
-        else
-        {
-            // Return key of a key/value pair.  
-            fill_dynamic_value((*it)->container, (*it)->curr_index,
-                              (*it)->data_proper, (*it)->curr_data_offset,
-                              val);
-            if (val->type != DYNAMIC_STRING)
-                ereport(ERROR,
-                        (errmsg("unexpected dynamic type as object key %d",
-                                val->type)));
+                memcpy(&ref, key_val, sizeof(gtentry_key_ref));
 
-            // Set state for next call 
-            (*it)->state = GTI_OBJECT_VALUE;
-            return WGT_KEY;
-        }
+                if (ref.distance == 0 || ref.len > ref.distance ||
+                    ref.distance > (uint64) (key_val - ref_floor))
+                    return "object key reference points outside the value";
 
-    case GTI_OBJECT_VALUE:
-        // Set state for next call 
-        (*it)->state = GTI_OBJECT_KEY;
+                key_val -= ref.distance;
+                key_len = ref.len;
+            }
+            else if (!GTE_IS_STRING(entry))
+            {
+                return "object key is not a string";
+            }
 
-        fill_dynamic_value((*it)->container,
-                          (*it)->curr_index + (*it)->num_elems,
-                          (*it)->data_proper, (*it)->curr_value_offset, val);
+            if (!pg_verifymbstr(key_val, key_len, true))
+                return "string is not valid in the database encoding";
 
-        GTE_ADVANCE_OFFSET((*it)->curr_data_offset,
-                            (*it)->children[(*it)->curr_index]);
-        GTE_ADVANCE_OFFSET(
-            (*it)->curr_value_offset,
-            (*it)->children[(*it)->curr_index + (*it)->num_elems]);
-        (*it)->curr_index++;
+            if (i > 0 &&
+                (key_len < prev_key_len ||
+                 (key_len == prev_key_len &&
+                  memcmp(prev_key_val, key_val, key_len) >= 0)))
+                return "object keys are not sorted";
 
-        /*
-         * Value may be a container, in which case we recurse with new,
-         * child iterator (unless the caller asked not to, by passing
-         * skip_nested).
-         */
-        if (!IS_A_DYNAMIC_SCALAR(val) && !skip_nested)
-        {
-            *it = iterator_from_container(val->val.binary.data, *it);
-            goto recurse;
+            prev_key_val = key_val;
+            prev_key_len = key_len;
         }
         else
         {
-            return WGT_VALUE;
+            if ((header & GT_FSCALAR) && GTE_IS_CONTAINER(entry))
+                return "scalar container holds a container";
+
+            // Each top level object value can be read on its own
+            if (level == 0 && (header & GT_FOBJECT))
+                ref_floor = base_addr + offset;
+
+            detail = check_dynamic_child(entry, base_addr, offset, end - offset, level,
+                                         ref_floor);
+            if (detail != NULL)
+                return detail;
         }
+
+        offset = end;
     }
 
-    ereport(ERROR, (errmsg("invalid iterator state %d", (*it)->state)));
-    return -1;
+    if (offset != data_len)
+        return "container has trailing data";
+
+    return NULL;
 }
 
 /*
- * Initialize an iterator for iterating all elements in a container.
+ * Like validate_dynamic_container, but reports the outcome instead of raising
+ * an error, so that callers can skip or count bad values.  If detail is not
+ * NULL it is set to a description of the problem, or NULL if there is none.
  */
-static dynamic_iterator *iterator_from_container(dynamic_container *container,
-                                                dynamic_iterator *parent)
+bool dynamic_container_is_valid(dynamic_container *container, uint32 len,
+                                const char **detail)
 {
-    dynamic_iterator *it;
-
-    it = palloc0(sizeof(dynamic_iterator));
-    it->container = container;
-    it->parent = parent;
-    it->num_elems = DYNAMIC_CONTAINER_SIZE(container);
+    const char *problem = check_dynamic_container(container, len, 0, (const char *)container);
 
-    // Array starts just after header 
-    it->children = container->children;
+    if (detail != NULL)
+        *detail = problem;
 
-    switch (container->header & (GT_FARRAY | GT_FOBJECT))
-    {
-    case GT_FARRAY:
-        it->data_proper = (char *)it->children +
-                          it->num_elems * sizeof(gtentry);
-        it->is_scalar = DYNAMIC_CONTAINER_IS_SCALAR(container);
-        // This is either a "raw scalar", or an array 
-        Assert(!it->is_scalar || it->num_elems == 1);
+    return problem == NULL;
+}
 
-        it->state = GTI_ARRAY_START;
-        break;
+/*
+ * Intended for data that did not come from our own serialization code, such
+ * as the native binary format accepted by dynamic_recv.  Raises an error on
+ * the first problem found; see check_dynamic_container for what is checked.
+ */
+void validate_dynamic_container(dynamic_container *container, uint32 len, int level)
+{
+    const char *detail = check_dynamic_container(container, len, level,
+                                                 (const char *)container);
 
-    case GT_FOBJECT:
-        it->data_proper = (char *)it->children +
-                          it->num_elems * sizeof(gtentry) * 2;
-        it->state = GTI_OBJECT_START;
-        break;
-    default:
-        ereport(ERROR,
-                (errmsg("unknown type of dynamic container %d",
-                        container->header & (GT_FARRAY | GT_FOBJECT))));
-    }
+    if (detail != NULL)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("invalid binary representation of dynamic"),
+                        errdetail_internal("%s", detail)));
+}
 
-    return it;
+/*
+ * Raise an error if a container at the given level, counting the root as
+ * level 0, is nested deeper than DYNAMIC_MAX_DEPTH. The text parser reports
+ * the same error on its own, since it must be able to return it softly.
+ */
+void check_dynamic_depth(int level)
+{
+    if (level > DYNAMIC_MAX_DEPTH)
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("containers are nested too deeply"),
+                        errdetail("A dynamic may nest containers at most %d levels below the root.",
+                                  DYNAMIC_MAX_DEPTH)));
 }
 
 /*
- * dynamic_iterator_next() worker: Return parent, while freeing memory for
- *                                current iterator
+ * Check the nesting of a serialized container that is taken over as it is at
+ * the given level, such as a jsonb or the binary value of an expanded
+ * dynamic. Every nested container costs at least the gtentry pointing to it
+ * and its own header, so one too small to go past the limit is not walked.
  */
-static dynamic_iterator *free_and_get_parent(dynamic_iterator *it)
+void check_dynamic_container_depth(dynamic_container *container, uint32 len, int level)
 {
-    dynamic_iterator *v = it->parent;
+    uint32 count;
+    uint32 nchildren;
+    char *base_addr;
+    uint32 offset = 0;
+    uint32 i;
 
-    pfree(it);
-    return v;
+    check_dynamic_depth(level);
+
+    if (len < (uint64) (DYNAMIC_MAX_DEPTH - level) * 2 * sizeof(uint32))
+        return;
+
+    check_stack_depth();
+
+    if (DYNAMIC_CONTAINER_IS_VECTOR(container))
+        return;
+
+    count = DYNAMIC_CONTAINER_SIZE(container);
+    nchildren = DYNAMIC_CONTAINER_IS_OBJECT(container) ? count * 2 : count;
+    base_addr = (char *)&container->children[nchildren];
+
+    for (i = 0; i < nchildren; i++)
+    {
+        gtentry entry = container->children[i];
+        uint32 start = offset;
+
+        GTE_ADVANCE_OFFSET(offset, entry);
+
+        if (GTE_IS_CONTAINER(entry))
+            check_dynamic_container_depth((dynamic_container *)(base_addr + INTALIGN(start)),
+                                          offset - INTALIGN(start), level + 1);
+    }
 }
 
 /*
- * Worker for "contains" operator's function
+ * Push dynamic_value into dynamic_parse_state.
  *
- * Formally speaking, containment is top-down, unordered subtree isomorphism.
+ * Used when parsing dynamic tokens to form dynamic, or when converting an
+ * in-memory dynamic_value to an dynamic.
  *
- * Takes iterators that belong to some container type.  These iterators
- * "belong" to those values in the sense that they've just been initialized in
- * respect of them by the caller (perhaps in a nested fashion).
+ * Initial state of *dynamic_parse_state is NULL, since it'll be allocated here
+ * originally (caller will get dynamic_parse_state back by reference).
  *
- * "val" is lhs dynamic, and m_contained is rhs dynamic when called from top
- * level. We determine if m_contained is contained within val.
+ * Only sequential tokens pertaining to non-container types should pass an
+ * dynamic_value.  There is one exception -- WGT_BEGIN_ARRAY callers may pass a
+ * "raw scalar" pseudo array to append it - the actual scalar should be passed
+ * next and it will be added as the only member of the array.
+ *
+ * Values of type DYNAMIC_BINARY, which are rolled up arrays and objects,
+ * are unpacked before being added to the result.
  */
-bool dynamic_deep_contains(dynamic_iterator **val, dynamic_iterator **m_contained)
+dynamic_value *push_dynamic_value(dynamic_parse_state **pstate,
+                                dynamic_iterator_token seq,
+                                dynamic_value *agtval)
 {
-    dynamic_value vval;
-    dynamic_value vcontained;
-    dynamic_iterator_token rval;
-    dynamic_iterator_token rcont;
-
-    /*
-     * Guard against queue overflow due to overly complex dynamic.
-     *
-     * Functions called here independently take this precaution, but that
-     * might not be sufficient since this is also a recursive function.
-     */
-    check_stack_depth();
+    dynamic_iterator *it;
+    dynamic_value *res = NULL;
+    dynamic_value v;
+    dynamic_iterator_token tok;
 
-    rval = dynamic_iterator_next(val, &vval, false);
-    rcont = dynamic_iterator_next(m_contained, &vcontained, false);
+    if (!agtval || (seq != WGT_ELEM && seq != WGT_VALUE) ||
+        (agtval->type != DYNAMIC_BINARY))
+    {
+        // drop through 
+        return push_dynamic_value_scalar(pstate, seq, agtval);
+    }
 
-    if (rval != rcont)
+    // unpack the binary and add each piece to the pstate 
+    it = dynamic_iterator_init(agtval->val.binary.data);
+    while ((tok = dynamic_iterator_next(&it, &v, false)) != WGT_DONE)
     {
-        /*
-         * The differing return values can immediately be taken as indicating
-         * two differing container types at this nesting level, which is
-         * sufficient reason to give up entirely (but it should be the case
-         * that they're both some container type).
-         */
-        Assert(rval == WGT_BEGIN_OBJECT || rval == WGT_BEGIN_ARRAY);
-        Assert(rcont == WGT_BEGIN_OBJECT || rcont == WGT_BEGIN_ARRAY);
-        return false;
+        res = push_dynamic_value_scalar(pstate, tok,
+                                       tok < WGT_BEGIN_ARRAY ? &v : NULL);
     }
-    else if (rcont == WGT_BEGIN_OBJECT)
+
+    return res;
+}
+
+/*
+ * Do the actual pushing, with only scalar or pseudo-scalar-array values
+ * accepted.
+ */
+static dynamic_value *push_dynamic_value_scalar(dynamic_parse_state **pstate,
+                                              dynamic_iterator_token seq,
+                                              dynamic_value *scalar_val)
+{
+    dynamic_value *result = NULL;
+
+    switch (seq)
     {
-        Assert(vval.type == DYNAMIC_OBJECT);
-        Assert(vcontained.type == DYNAMIC_OBJECT);
+    case WGT_BEGIN_VECTOR:
+    case WGT_BEGIN_ARRAY:
+        Assert(!scalar_val || scalar_val->val.array.raw_scalar);
+        *pstate = push_state(pstate);
+        result = &(*pstate)->cont_val;
+        (*pstate)->cont_val.type = DYNAMIC_ARRAY;
+        (*pstate)->cont_val.val.array.num_elems = 0;
+        (*pstate)->cont_val.val.array.raw_scalar =
+            (scalar_val && scalar_val->val.array.raw_scalar);
+        if (scalar_val && scalar_val->val.array.num_elems > 0)
+        {
+            // Assume that this array is still really a scalar 
+            Assert(scalar_val->type == DYNAMIC_ARRAY);
+            (*pstate)->size = scalar_val->val.array.num_elems;
+        }
+        else
+        {
+            (*pstate)->size = 4;
+        }
+        (*pstate)->cont_val.val.array.elems =
+            palloc(sizeof(dynamic_value) * (*pstate)->size);
+        (*pstate)->last_updated_value = NULL;
+        break;
+    case WGT_BEGIN_OBJECT:
+        Assert(!scalar_val);
+        *pstate = push_state(pstate);
+        result = &(*pstate)->cont_val;
+        (*pstate)->cont_val.type = DYNAMIC_OBJECT;
+        (*pstate)->cont_val.val.object.num_pairs = 0;
+        (*pstate)->size = 4;
+        (*pstate)->cont_val.val.object.pairs =
+            palloc(sizeof(dynamic_pair) * (*pstate)->size);
+        (*pstate)->last_updated_value = NULL;
+        break;
+    case WGT_KEY:
+        Assert(scalar_val->type == DYNAMIC_STRING);
+        append_key(*pstate, scalar_val);
+        break;
+    case WGT_VALUE:
+        Assert(IS_A_DYNAMIC_SCALAR(scalar_val));
+        append_value(*pstate, scalar_val);
+        break;
+    case WGT_VECTOR_VALUE:
+    case WGT_ELEM:
+        Assert(IS_A_DYNAMIC_SCALAR(scalar_val));
+        append_element(*pstate, scalar_val);
+        break;
+    case WGT_END_OBJECT:
+        uniqueify_dynamic_object(&(*pstate)->cont_val);
+        // fall through! 
+    case WGT_END_VECTOR:
+    case WGT_END_ARRAY:
+        Assert(!scalar_val);
+        result = &(*pstate)->cont_val;
 
         /*
-         * If the lhs has fewer pairs than the rhs, it can't possibly contain
-         * the rhs.  (This conclusion is safe only because we de-duplicate
-         * keys in all dynamic objects; thus there can be no corresponding
-         * optimization in the array case.)  The case probably won't arise
-         * often, but since it's such a cheap check we may as well make it.
+         * Pop queue and push current array/object as value in parent
+         * array/object
          */
-        if (vval.val.object.num_pairs < vcontained.val.object.num_pairs)
-            return false;
-
-        // Work through rhs "is it contained within?" object 
-        for (;;)
+        *pstate = (*pstate)->next;
+        if (*pstate)
         {
-            dynamic_value *lhs_val; // lhs_val is from pair in lhs object 
+            switch ((*pstate)->cont_val.type)
+            {
+            case DYNAMIC_ARRAY:
+                append_element(*pstate, result);
+                break;
+            case DYNAMIC_OBJECT:
+                append_value(*pstate, result);
+                break;
+            default:
+                ereport(ERROR, (errmsg("invalid dynamic container type %d",
+                                       (*pstate)->cont_val.type)));
+            }
+        }
+        break;
+    default:
+        ereport(ERROR,
+                (errmsg("unrecognized dynamic sequential processing token")));
+    }
 
-            rcont = dynamic_iterator_next(m_contained, &vcontained, false);
+    return result;
+}
 
-            /*
-             * When we get through caller's rhs "is it contained within?"
-             * object without failing to find one of its values, it's
-             * contained.
-             */
-            if (rcont == WGT_END_OBJECT)
-                return true;
+/*
+ * push_dynamic_value() worker:  Iteration-like forming of dynamic
+ */
+static dynamic_parse_state *push_state(dynamic_parse_state **pstate)
+{
+    dynamic_parse_state *ns = palloc(sizeof(dynamic_parse_state));
 
-            Assert(rcont == WGT_KEY);
+    ns->next = *pstate;
+    return ns;
+}
 
-            // First, find value by key... 
-            lhs_val = find_dynamic_value_from_container(
-                (*val)->container, GT_FOBJECT, &vcontained);
+/*
+ * push_dynamic_value() worker:  Append a pair key to state when generating
+ *                              dynamic
+ */
+static void append_key(dynamic_parse_state *pstate, dynamic_value *string)
+{
+    dynamic_value *object = &pstate->cont_val;
 
-            if (!lhs_val)
-                return false;
+    Assert(object->type == DYNAMIC_OBJECT);
+    Assert(string->type == DYNAMIC_STRING);
 
-            /*
-             * ...at this stage it is apparent that there is at least a key
-             * match for this rhs pair.
+    if (object->val.object.num_pairs >= DYNAMIC_MAX_PAIRS)
+        ereport(
+            ERROR,
+            (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+             errmsg(
+                 "number of dynamic object pairs exceeds the maximum allowed (%zu)",
+                 DYNAMIC_MAX_PAIRS)));
+
+    if (object->val.object.num_pairs >= pstate->size)
+    {
+        pstate->size *= 2;
+        object->val.object.pairs = repalloc(
+            object->val.object.pairs, sizeof(dynamic_pair) * pstate->size);
+    }
+
+    object->val.object.pairs[object->val.object.num_pairs].key = *string;
+    object->val.object.pairs[object->val.object.num_pairs].order =
+        object->val.object.num_pairs;
+}
+
+/*
+ * push_dynamic_value() worker:  Append a pair value to state when generating an
+ *                              dynamic
+ */
+static void append_value(dynamic_parse_state *pstate, dynamic_value *scalar_val)
+{
+    dynamic_value *object = &pstate->cont_val;
+
+    Assert(object->type == DYNAMIC_OBJECT);
+
+    object->val.object.pairs[object->val.object.num_pairs].value = *scalar_val;
+
+    pstate->last_updated_value =
+        &object->val.object.pairs[object->val.object.num_pairs++].value;
+}
+
+/*
+ * push_dynamic_value() worker:  Append an element to state when generating an
+ *                              dynamic
+ */
+static void append_element(dynamic_parse_state *pstate,
+                           dynamic_value *scalar_val)
+{
+    dynamic_value *array = &pstate->cont_val;
+
+    Assert(array->type == DYNAMIC_ARRAY);
+
+    if (array->val.array.num_elems >= DYNAMIC_MAX_ELEMS)
+        ereport(
+            ERROR,
+            (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+             errmsg(
+                 "number of dynamic array elements exceeds the maximum allowed (%zu)",
+                 DYNAMIC_MAX_ELEMS)));
+
+    if (array->val.array.num_elems >= pstate->size)
+    {
+        pstate->size *= 2;
+        array->val.array.elems = repalloc(array->val.array.elems,
+                                          sizeof(dynamic_value) * pstate->size);
+    }
+
+    array->val.array.elems[array->val.array.num_elems] = *scalar_val;
+    pstate->last_updated_value =
+        &array->val.array.elems[array->val.array.num_elems++];
+}
+
+/*
+ * Given an dynamic_container, expand to dynamic_iterator to iterate over items
+ * fully expanded to in-memory representation for manipulation.
+ *
+ * See dynamic_iterator_next() for notes on memory management.
+ */
+dynamic_iterator *dynamic_iterator_init(dynamic_container *container)
+{
+    return iterator_from_container(container, NULL);
+}
+
+/*
+ * Get next dynamic_value while iterating
+ *
+ * Caller should initially pass their own, original iterator.  They may get
+ * back a child iterator palloc()'d here instead.  The function can be relied
+ * on to free those child iterators, lest the memory allocated for highly
+ * nested objects become unreasonable, but only if callers don't end iteration
+ * early (by breaking upon having found something in a search, for example).
+ *
+ * Callers in such a scenario, that are particularly sensitive to leaking
+ * memory in a long-lived context may walk the ancestral tree from the final
+ * iterator we left them with to its oldest ancestor, pfree()ing as they go.
+ * They do not have to free any other memory previously allocated for iterators
+ * but not accessible as direct ancestors of the iterator they're last passed
+ * back.
+ *
+ * Returns "dynamic sequential processing" token value.  Iterator "state"
+ * reflects the current stage of the process in a less granular fashion, and is
+ * mostly used here to track things internally with respect to particular
+ * iterators.
+ *
+ * Clients of this function should not have to handle any DYNAMIC_BINARY values
+ * (since recursive calls will deal with this), provided skip_nested is false.
+ * It is our job to expand the DYNAMIC_BINARY representation without bothering
+ * them with it.  However, clients should not take it upon themselves to touch
+ * array or Object element/pair buffers, since their element/pair pointers are
+ * garbage.  Also, *val will not be set when returning WGT_END_ARRAY or
+ * WGT_END_OBJECT, on the assumption that it's only useful to access values
+ * when recursing in.
+ */
+dynamic_iterator_token dynamic_iterator_next(dynamic_iterator **it,
+                                           dynamic_value *val, bool skip_nested)
+{
+    if (*it == NULL)
+        return WGT_DONE;
+
+    /*
+     * When stepping into a nested container, we jump back here to start
+     * processing the child. We will not recurse further in one call, because
+     * processing the child will always begin in GTI_ARRAY_START or
+     * GTI_OBJECT_START state.
+     */
+recurse:
+    switch ((*it)->state)
+    {
+    case GTI_ARRAY_START:
+        // Set v to array on first array call 
+        val->type = DYNAMIC_ARRAY;
+        val->val.array.num_elems = (*it)->num_elems;
+
+        /*
+         * v->val.array.elems is not actually set, because we aren't doing
+         * a full conversion
+         */
+        val->val.array.raw_scalar = (*it)->is_scalar;
+        (*it)->curr_index = 0;
+        (*it)->curr_data_offset = 0;
+        (*it)->curr_value_offset = 0; // not actually used 
+        // Set state for next call 
+        (*it)->state = GTI_ARRAY_ELEM;
+        return WGT_BEGIN_ARRAY;
+
+    case GTI_ARRAY_ELEM:
+        if ((*it)->curr_index >= (*it)->num_elems)
+        {
+            /*
+             * All elements within array already processed.  Report this
+             * to caller, and give it back original parent iterator (which
+             * independently tracks iteration progress at its level of
+             * nesting).
+             */
+            *it = free_and_get_parent(*it);
+            return WGT_END_ARRAY;
+        }
+
+        fill_dynamic_value((*it)->container, (*it)->curr_index,
+                          (*it)->data_proper, (*it)->curr_data_offset, val);
+
+        GTE_ADVANCE_OFFSET((*it)->curr_data_offset,
+                            (*it)->children[(*it)->curr_index]);
+        (*it)->curr_index++;
+
+        if (!IS_A_DYNAMIC_SCALAR(val) && !skip_nested)
+        {
+            // Recurse into container. 
+            *it = iterator_from_container(val->val.binary.data, *it);
+            goto recurse;
+        }
+        else
+        {
+            /*
+             * Scalar item in array, or a container and caller didn't want
+             * us to recurse into it.
+             */
+            return WGT_ELEM;
+        }
+
+    case GTI_OBJECT_START:
+        // Set v to object on first object call 
+        val->type = DYNAMIC_OBJECT;
+        val->val.object.num_pairs = (*it)->num_elems;
+
+        /*
+         * v->val.object.pairs is not actually set, because we aren't
+         * doing a full conversion
+         */
+        (*it)->curr_index = 0;
+        (*it)->curr_data_offset = 0;
+        (*it)->curr_value_offset = get_dynamic_offset((*it)->container,
+                                                     (*it)->num_elems);
+        // Set state for next call 
+        (*it)->state = GTI_OBJECT_KEY;
+        return WGT_BEGIN_OBJECT;
+
+    case GTI_OBJECT_KEY:
+        if ((*it)->curr_index >= (*it)->num_elems)
+        {
+            /*
+             * All pairs within object already processed.  Report this to
+             * caller, and give it back original containing iterator
+             * (which independently tracks iteration progress at its level
+             * of nesting).
              */
-            rcont = dynamic_iterator_next(m_contained, &vcontained, true);
+            *it = free_and_get_parent(*it);
+            return WGT_END_OBJECT;
+        }
+        else
+        {
+            // Return key of a key/value pair.  
+            fill_dynamic_value((*it)->container, (*it)->curr_index,
+                              (*it)->data_proper, (*it)->curr_data_offset,
+                              val);
+            if (val->type != DYNAMIC_STRING)
+                ereport(ERROR,
+                        (errmsg("unexpected dynamic type as object key %d",
+                                val->type)));
+
+            // Set state for next call 
+            (*it)->state = GTI_OBJECT_VALUE;
+            return WGT_KEY;
+        }
+
+    case GTI_OBJECT_VALUE:
+        // Set state for next call 
+        (*it)->state = GTI_OBJECT_KEY;
+
+        fill_dynamic_value((*it)->container,
+                          (*it)->curr_index + (*it)->num_elems,
+                          (*it)->data_proper, (*it)->curr_value_offset, val);
+
+        GTE_ADVANCE_OFFSET((*it)->curr_data_offset,
+                            (*it)->children[(*it)->curr_index]);
+        GTE_ADVANCE_OFFSET(
+            (*it)->curr_value_offset,
+            (*it)->children[(*it)->curr_index + (*it)->num_elems]);
+        (*it)->curr_index++;
+
+        /*
+         * Value may be a container, in which case we recurse with new,
+         * child iterator (unless the caller asked not to, by passing
+         * skip_nested).
+         */
+        if (!IS_A_DYNAMIC_SCALAR(val) && !skip_nested)
+        {
+            *it = iterator_from_container(val->val.binary.data, *it);
+            goto recurse;
+        }
+        else
+        {
+            return WGT_VALUE;
+        }
+
+    case GTI_VECTOR_START:
+        val->type = DYNAMIC_ARRAY;
+        val->val.array.num_elems = (*it)->num_elems;
+        val->val.array.raw_scalar = false;
+        (*it)->curr_index = 0;
+        (*it)->state = GTI_VECTOR_ELEM;
+        return WGT_BEGIN_VECTOR;
+
+    case GTI_VECTOR_ELEM:
+        if ((*it)->curr_index >= (*it)->num_elems)
+        {
+            *it = free_and_get_parent(*it);
+            return WGT_END_VECTOR;
+        }
+
+        // Vector elements are always scalars, there is nothing to recurse into 
+        fill_dynamic_vector_value((*it)->container, (*it)->curr_index, val);
+        (*it)->curr_index++;
+
+        return WGT_VECTOR_VALUE;
+    }
+
+    ereport(ERROR, (errmsg("invalid iterator state %d", (*it)->state)));
+    return -1;
+}
+
+/*
+ * dynamic_iterator_next, except that a vector is reported with the same
+ * tokens as an ordinary array.  For callers that only care about the values.
+ */
+static dynamic_iterator_token dynamic_iterator_next_as_array(dynamic_iterator **it,
+                                                           dynamic_value *val,
+                                                           bool skip_nested)
+{
+    dynamic_iterator_token tok = dynamic_iterator_next(it, val, skip_nested);
+
+    switch (tok)
+    {
+    case WGT_BEGIN_VECTOR:
+        return WGT_BEGIN_ARRAY;
+    case WGT_VECTOR_VALUE:
+        return WGT_ELEM;
+    case WGT_END_VECTOR:
+        return WGT_END_ARRAY;
+    default:
+        return tok;
+    }
+}
+
+/*
+ * Initialize an iterator for iterating all elements in a container.
+ */
+static dynamic_iterator *iterator_from_container(dynamic_container *container,
+                                                dynamic_iterator *parent)
+{
+    dynamic_iterator *it;
+
+    it = palloc0(sizeof(dynamic_iterator));
+    it->container = container;
+    it->parent = parent;
+    it->num_elems = DYNAMIC_CONTAINER_SIZE(container);
+
+    // Array starts just after header 
+    it->children = container->children;
+
+    switch (container->header & (GT_FARRAY | GT_FOBJECT))
+    {
+    case GT_FARRAY:
+        if (DYNAMIC_CONTAINER_IS_VECTOR(container))
+        {
+            it->data_proper = DYNAMIC_VECTOR_DATA(container);
+            it->state = GTI_VECTOR_START;
+            break;
+        }
+
+        it->data_proper = (char *)it->children +
+                          it->num_elems * sizeof(gtentry);
+        it->is_scalar = DYNAMIC_CONTAINER_IS_SCALAR(container);
+        // This is either a "raw scalar", or an array 
+        Assert(!it->is_scalar || it->num_elems == 1);
+
+        it->state = GTI_ARRAY_START;
+        break;
+
+    case GT_FOBJECT:
+        it->data_proper = (char *)it->children +
+                          it->num_elems * sizeof(gtentry) * 2;
+        it->state = GTI_OBJECT_START;
+        break;
+    default:
+        ereport(ERROR,
+                (errmsg("unknown type of dynamic container %d",
+                        container->header & (GT_FARRAY | GT_FOBJECT))));
+    }
+
+    return it;
+}
+
+/*
+ * dynamic_iterator_next() worker: Return parent, while freeing memory for
+ *                                current iterator
+ */
+static dynamic_iterator *free_and_get_parent(dynamic_iterator *it)
+{
+    dynamic_iterator *v = it->parent;
+
+    pfree(it);
+    return v;
+}
+
+/*
+ * Worker for "contains" operator's function
+ *
+ * Formally speaking, containment is top-down, unordered subtree isomorphism.
+ *
+ * Takes iterators that belong to some container type.  These iterators
+ * "belong" to those values in the sense that they've just been initialized in
+ * respect of them by the caller (perhaps in a nested fashion).
+ *
+ * "val" is lhs dynamic, and m_contained is rhs dynamic when called from top
+ * level. We determine if m_contained is contained within val.
+ */
+bool dynamic_deep_contains(dynamic_iterator **val, dynamic_iterator **m_contained)
+{
+    dynamic_value vval;
+    dynamic_value vcontained;
+    dynamic_iterator_token rval;
+    dynamic_iterator_token rcont;
+
+    /*
+     * Guard against queue overflow due to overly complex dynamic.
+     *
+     * Functions called here independently take this precaution, but that
+     * might not be sufficient since this is also a recursive function.
+     */
+    check_stack_depth();
+
+    rval = dynamic_iterator_next_as_array(val, &vval, false);
+    rcont = dynamic_iterator_next_as_array(m_contained, &vcontained, false);
+
+    if (rval != rcont)
+    {
+        /*
+         * The differing return values can immediately be taken as indicating
+         * two differing container types at this nesting level, which is
+         * sufficient reason to give up entirely (but it should be the case
+         * that they're both some container type).
+         */
+        Assert(rval == WGT_BEGIN_OBJECT || rval == WGT_BEGIN_ARRAY);
+        Assert(rcont == WGT_BEGIN_OBJECT || rcont == WGT_BEGIN_ARRAY);
+        return false;
+    }
+    else if (rcont == WGT_BEGIN_OBJECT)
+    {
+        Assert(vval.type == DYNAMIC_OBJECT);
+        Assert(vcontained.type == DYNAMIC_OBJECT);
+
+        /*
+         * If the lhs has fewer pairs than the rhs, it can't possibly contain
+         * the rhs.  (This conclusion is safe only because we de-duplicate
+         * keys in all dynamic objects; thus there can be no corresponding
+         * optimization in the array case.)  The case probably won't arise
+         * often, but since it's such a cheap check we may as well make it.
+         */
+        if (vval.val.object.num_pairs < vcontained.val.object.num_pairs)
+            return false;
+
+        // Work through rhs "is it contained within?" object 
+        for (;;)
+        {
+            dynamic_value *lhs_val; // lhs_val is from pair in lhs object 
+
+            rcont = dynamic_iterator_next_as_array(m_contained, &vcontained, false);
+
+            /*
+             * When we get through caller's rhs "is it contained within?"
+             * object without failing to find one of its values, it's
+             * contained.
+             */
+            if (rcont == WGT_END_OBJECT)
+                return true;
+
+            Assert(rcont == WGT_KEY);
+
+            // First, find value by key... 
+            lhs_val = find_dynamic_value_from_container(
+                (*val)->container, GT_FOBJECT, &vcontained);
+
+            if (!lhs_val)
+                return false;
+
+            /*
+             * ...at this stage it is apparent that there is at least a key
+             * match for this rhs pair.
+             */
+            rcont = dynamic_iterator_next_as_array(m_contained, &vcontained, true);
+
+            Assert(rcont == WGT_VALUE);
+
+            /*
+             * Compare rhs pair's value with lhs pair's value just found using
+             * key
+             */
+            if (lhs_val->type != vcontained.type)
+            {
+                return false;
+            }
+            else if (IS_A_DYNAMIC_SCALAR(lhs_val))
+            {
+                if (!equals_dynamic_scalar_value(lhs_val, &vcontained))
+                    return false;
+            }
+            else
+            {
+                // Nested container value (object or array) 
+                dynamic_iterator *nestval;
+                dynamic_iterator *nest_contained;
+
+                Assert(lhs_val->type == DYNAMIC_BINARY);
+                Assert(vcontained.type == DYNAMIC_BINARY);
+
+                nestval = dynamic_iterator_init(lhs_val->val.binary.data);
+                nest_contained =
+                    dynamic_iterator_init(vcontained.val.binary.data);
+
+                /*
+                 * Match "value" side of rhs datum object's pair recursively.
+                 * It's a nested structure.
+                 *
+                 * Note that nesting still has to "match up" at the right
+                 * nesting sub-levels.  However, there need only be zero or
+                 * more matching pairs (or elements) at each nesting level
+                 * (provided the *rhs* pairs/elements *all* match on each
+                 * level), which enables searching nested structures for a
+                 * single String or other primitive type sub-datum quite
+                 * effectively (provided the user constructed the rhs nested
+                 * structure such that we "know where to look").
+                 *
+                 * In other words, the mapping of container nodes in the rhs
+                 * "vcontained" dynamic to internal nodes on the lhs is
+                 * injective, and parent-child edges on the rhs must be mapped
+                 * to parent-child edges on the lhs to satisfy the condition
+                 * of containment (plus of course the mapped nodes must be
+                 * equal).
+                 */
+                if (!dynamic_deep_contains(&nestval, &nest_contained))
+                    return false;
+            }
+        }
+    }
+    else if (rcont == WGT_BEGIN_ARRAY)
+    {
+        dynamic_value *lhs_conts = NULL;
+        uint32 num_lhs_elems = vval.val.array.num_elems;
+
+        Assert(vval.type == DYNAMIC_ARRAY);
+        Assert(vcontained.type == DYNAMIC_ARRAY);
+
+        /*
+         * Handle distinction between "raw scalar" pseudo arrays, and real
+         * arrays.
+         *
+         * A raw scalar may contain another raw scalar, and an array may
+         * contain a raw scalar, but a raw scalar may not contain an array. We
+         * don't do something like this for the object case, since objects can
+         * only contain pairs, never raw scalars (a pair is represented by an
+         * rhs object argument with a single contained pair).
+         */
+        if (vval.val.array.raw_scalar && !vcontained.val.array.raw_scalar)
+            return false;
+
+        // Work through rhs "is it contained within?" array 
+        for (;;)
+        {
+            rcont = dynamic_iterator_next_as_array(m_contained, &vcontained, true);
+
+            /*
+             * When we get through caller's rhs "is it contained within?"
+             * array without failing to find one of its values, it's
+             * contained.
+             */
+            if (rcont == WGT_END_ARRAY)
+                return true;
+
+            Assert(rcont == WGT_ELEM);
+
+            if (IS_A_DYNAMIC_SCALAR(&vcontained))
+            {
+                if (!find_dynamic_value_from_container((*val)->container,
+                                                      GT_FARRAY, &vcontained))
+                    return false;
+            }
+            else
+            {
+                uint32 i;
+
+                /*
+                 * If this is first container found in rhs array (at this
+                 * depth), initialize temp lhs array of containers
+                 */
+                if (lhs_conts == NULL)
+                {
+                    uint32 j = 0;
+
+                    // Make room for all possible values 
+                    lhs_conts = palloc(sizeof(dynamic_value) * num_lhs_elems);
+
+                    for (i = 0; i < num_lhs_elems; i++)
+                    {
+                        // Store all lhs elements in temp array 
+                        rcont = dynamic_iterator_next_as_array(val, &vval, true);
+                        Assert(rcont == WGT_ELEM);
+
+                        if (vval.type == DYNAMIC_BINARY)
+                            lhs_conts[j++] = vval;
+                    }
+
+                    // No container elements in temp array, so give up now 
+                    if (j == 0)
+                        return false;
+
+                    // We may have only partially filled array 
+                    num_lhs_elems = j;
+                }
+
+                // XXX: Nested array containment is O(N^2) 
+                for (i = 0; i < num_lhs_elems; i++)
+                {
+                    // Nested container value (object or array) 
+                    dynamic_iterator *nestval;
+                    dynamic_iterator *nest_contained;
+                    bool contains;
+
+                    nestval =
+                        dynamic_iterator_init(lhs_conts[i].val.binary.data);
+                    nest_contained =
+                        dynamic_iterator_init(vcontained.val.binary.data);
+
+                    contains = dynamic_deep_contains(&nestval, &nest_contained);
+
+                    if (nestval)
+                        pfree(nestval);
+                    if (nest_contained)
+                        pfree(nest_contained);
+                    if (contains)
+                        break;
+                }
+
+                /*
+                 * Report rhs container value is not contained if couldn't
+                 * match rhs container to *some* lhs cont
+                 */
+                if (i == num_lhs_elems)
+                    return false;
+            }
+        }
+    }
+    else
+    {
+        ereport(ERROR, (errmsg("invalid dynamic container type")));
+    }
+
+    ereport(ERROR, (errmsg("unexpectedly fell off end of dynamic container")));
+    return false;
+}
+
+/*
+ * Hash an dynamic_value scalar value, mixing the hash value into an existing
+ * hash provided by the caller.
+ *
+ * Some callers may wish to independently XOR in GT_FOBJECT and GT_FARRAY
+ * flags.
+ */
+void dynamic_hash_scalar_value(const dynamic_value *scalar_val, uint32 *hash)
+{
+    uint32 tmp;
+
+    // Compute hash value for scalar_val 
+    switch (scalar_val->type)
+    {
+    case DYNAMIC_NULL:
+        tmp = 0x01;
+        break;
+    case DYNAMIC_STRING:
+        tmp = DatumGetUInt32(
+            hash_any((const unsigned char *)scalar_val->val.string.val,
+                     scalar_val->val.string.len));
+        break;
+    case DYNAMIC_NUMERIC:
+        // Must hash equal numerics to equal hash codes 
+        tmp = DatumGetUInt32(DirectFunctionCall1(
+            hash_numeric, NumericGetDatum(scalar_val->val.numeric)));
+        break;
+    case DYNAMIC_BOOL:
+        tmp = scalar_val->val.boolean ? 0x02 : 0x04;
+        break;
+    case DYNAMIC_INTEGER:
+        tmp = DatumGetUInt32(DirectFunctionCall1(
+            hashint8, Int64GetDatum(scalar_val->val.int_value)));
+        break;
+    case DYNAMIC_FLOAT:
+        tmp = DatumGetUInt32(DirectFunctionCall1(
+            hashfloat8, Float8GetDatum(scalar_val->val.float_value)));
+        break;
+    default:
+        ereport(ERROR, (errmsg("invalid dynamic scalar type %d to compute hash",
+                               scalar_val->type)));
+        tmp = 0; // keep compiler quiet 
+        break;
+    }
+
+    /*
+     * Combine hash values of successive keys, values and elements by rotating
+     * the previous value left 1 bit, then XOR'ing in the new
+     * key/value/element's hash value.
+     */
+    *hash = (*hash << 1) | (*hash >> 31);
+    *hash ^= tmp;
+}
+
+/*
+ * Hash a value to a 64-bit value, with a seed. Otherwise, similar to
+ * dynamic_hash_scalar_value.
+ */
+void dynamic_hash_scalar_value_extended(const dynamic_value *scalar_val, uint64 *hash, uint64 seed)
+{
+    uint64 tmp = 0;
+
+    switch (scalar_val->type)
+    {
+    case DYNAMIC_NULL:
+        tmp = seed + 0x01;
+        break;
+    case DYNAMIC_STRING:
+        tmp = DatumGetUInt64(hash_any_extended(
+            (const unsigned char *)scalar_val->val.string.val,
+            scalar_val->val.string.len, seed));
+        break;
+    case DYNAMIC_NUMERIC:
+        tmp = DatumGetUInt64(DirectFunctionCall2(
+            hash_numeric_extended, NumericGetDatum(scalar_val->val.numeric),
+            UInt64GetDatum(seed)));
+        break;
+    case DYNAMIC_BOOL:
+        if (seed)
+        {
+            tmp = DatumGetUInt64(DirectFunctionCall2(
+                hashcharextended, BoolGetDatum(scalar_val->val.boolean),
+                UInt64GetDatum(seed)));
+        }
+        else
+        {
+            tmp = scalar_val->val.boolean ? 0x02 : 0x04;
+        }
+        break;
+    case DYNAMIC_INTEGER:
+        tmp = DatumGetUInt64(DirectFunctionCall2(
+            hashint8extended, Int64GetDatum(scalar_val->val.int_value),
+            UInt64GetDatum(seed)));
+        break;
+    case DYNAMIC_FLOAT:
+        tmp = DatumGetUInt64(DirectFunctionCall2(
+            hashfloat8extended, Float8GetDatum(scalar_val->val.float_value),
+            UInt64GetDatum(seed)));
+        break;
+    default:
+        ereport(
+            ERROR,
+            (errmsg("invalid dynamic scalar type %d to compute hash extended",
+                    scalar_val->type)));
+        break;
+    }
+
+    *hash = ROTATE_HIGH_AND_LOW_32BITS(*hash);
+    *hash ^= tmp;
+}
+
+/*
+ * Function to compare two floats, obviously. However, there are a few
+ * special cases that we need to cover with regards to NaN and +/-Infinity.
+ * NaN is not equal to any other number, including itself. However, for
+ * ordering, we need to allow NaN = NaN and NaN > any number including
+ * positive infinity -
+ *
+ *     -Infinity < any number < +Infinity < NaN
+ *
+ * Note: This is copied from float8_cmp_internal.
+ * Note: Special float values can cause exceptions, hence the order of the
+ *       comparisons.
+ */
+static int compare_two_floats_orderability(float8 lhs, float8 rhs)
+{
+    /*
+     * We consider all NANs to be equal and larger than any non-NAN. This is
+     * somewhat arbitrary; the important thing is to have a consistent sort
+     * order.
+     */
+    if (isnan(lhs))
+    {
+        if (isnan(rhs))
+            return 0; // NAN = NAN 
+        else
+            return 1; // NAN > non-NAN 
+    }
+    else if (isnan(rhs))
+    {
+        return -1; // non-NAN < NAN 
+    }
+    else
+    {
+        if (lhs > rhs)
+            return 1;
+        else if (lhs < rhs)
+            return -1;
+        else
+            return 0;
+    }
+}
+
+/*
+ * Are two scalar dynamic_values of the same type a and b equal?
+ */
+static bool equals_dynamic_scalar_value(const dynamic_value *a, const dynamic_value *b)
+{
+    // if the values are of the same type 
+    if (a->type == b->type)
+    {
+        switch (a->type)
+        {
+        case DYNAMIC_NULL:
+            return true;
+        case DYNAMIC_STRING:
+            return length_compare_dynamic_string_value(a, b) == 0;
+        case DYNAMIC_NUMERIC:
+            return DatumGetBool(DirectFunctionCall2(
+                numeric_eq, PointerGetDatum(a->val.numeric),
+                PointerGetDatum(b->val.numeric)));
+        case DYNAMIC_BOOL:
+            return a->val.boolean == b->val.boolean;
+        case DYNAMIC_INTEGER:
+        case DYNAMIC_TIMESTAMP:
+        case DYNAMIC_TIME:
+            return a->val.int_value == b->val.int_value;
+        case DYNAMIC_TIMESTAMPTZ:
+            return timestamptz_cmp_internal(a->val.int_value, b->val.int_value) == 0;
+        case DYNAMIC_DATE:
+            return a->val.date == b->val.date;
+        case DYNAMIC_TIMETZ:
+            return timetz_cmp_internal(&a->val.timetz, &b->val.timetz) == 0;
+        case DYNAMIC_INTERVAL:
+            return interval_cmp_internal(&a->val.interval, &b->val.interval) == 0;
+        case DYNAMIC_RANGE_INT:
+        case DYNAMIC_RANGE_NUM:
+        case DYNAMIC_RANGE_DATE:
+	case DYNAMIC_RANGE_TS:
+        case DYNAMIC_RANGE_TSTZ:
+	    return compare_range_internal(a, b) == 0;
+	case DYNAMIC_TSQUERY:
+	    return CompareTSQ(a->val.tsquery, b->val.tsquery) == 0;
+        case DYNAMIC_TSVECTOR:
+	    return silly_cmp_tsvector(a->val.tsvector, b->val.tsvector) == 0;
+	case DYNAMIC_FLOAT:
+            return a->val.float_value == b->val.float_value;
+        default:
+            ereport(ERROR, (errmsg("invalid dynamic scalar type %d for equals", a->type)));
+        }
+    }
+    // otherwise, the values are of differing type 
+    else
+        ereport(ERROR, (errmsg("dynamic input scalars must be of same type")));
+
+    // execution will never reach this point due to the ereport call 
+    return false;
+}
+
+/*
+ * Order: haspos, len, word, for all positions (pos, weight)
+ */
+static int
+silly_cmp_tsvector(const TSVector a, const TSVector b)
+{
+    if (VARSIZE(a) < VARSIZE(b))
+         return -1;
+    else if (VARSIZE(a) > VARSIZE(b))
+         return 1;
+    else if (a->size < b->size)
+         return -1;
+    else if (a->size > b->size)
+         return 1;
+    else {
+         WordEntry *aptr = ARRPTR(a);
+         WordEntry *bptr = ARRPTR(b);
+         int i = 0;
+         int res;
+
+         for (i = 0; i < a->size; i++) {
+              if (aptr->haspos != bptr->haspos) {
+                   return (aptr->haspos > bptr->haspos) ? -1 : 1;
+              } else if ((res = tsCompareString(STRPTR(a) + aptr->pos, aptr->len, STRPTR(b) + bptr->pos, bptr->len, false)) != 0) {
+                   return res;
+              } else if (aptr->haspos) {
+                   WordEntryPos *ap = POSDATAPTR(a, aptr);
+                   WordEntryPos *bp = POSDATAPTR(b, bptr);
+                   int                     j;
+
+                   if (POSDATALEN(a, aptr) != POSDATALEN(b, bptr))
+                        return (POSDATALEN(a, aptr) > POSDATALEN(b, bptr)) ? -1 : 1;
+
+                   for (j = 0; j < POSDATALEN(a, aptr); j++) {
+                        if (WEP_GETPOS(*ap) != WEP_GETPOS(*bp))
+                             return (WEP_GETPOS(*ap) > WEP_GETPOS(*bp)) ? -1 : 1;
+                        else if (WEP_GETWEIGHT(*ap) != WEP_GETWEIGHT(*bp))
+                             return (WEP_GETWEIGHT(*ap) > WEP_GETWEIGHT(*bp)) ? -1 : 1;
+                        ap++, bp++;
+                   }
+              }
+
+              aptr++;
+              bptr++;
+         }
+    }
+
+    return 0;
+}
+
+
+static int
+CompareTSQ(TSQuery a, TSQuery b) {
+    if (a->size != b->size) {
+        return (a->size < b->size) ? -1 : 1;
+    } else if (VARSIZE(a) != VARSIZE(b)) {
+        return (VARSIZE(a) < VARSIZE(b)) ? -1 : 1;
+    } else if (a->size != 0) {
+        QTNode *an = QT2QTN(GETQUERY(a), GETOPERAND(a));
+        QTNode *bn = QT2QTN(GETQUERY(b), GETOPERAND(b));
+        int res = QTNodeCompare(an, bn);
+
+        QTNFree(an);
+        QTNFree(bn);
+
+        return res;
+    }
+
+    return 0;
+}
+
+static int compare_range_internal(dynamic_value *a, dynamic_value *b) {
+    RangeType *r1 = a->val.range;
+    RangeType *r2 = b->val.range;
+    TypeCacheEntry *typcache = lookup_type_cache(RangeTypeGetOid(r1), TYPECACHE_RANGE_INFO);
+    RangeBound lower1, lower2;
+    RangeBound upper1, upper2;
+    bool empty1, empty2;
+
+    /* Different types should be prevented by ANYRANGE matching rules */
+    if (a->type != b->type)
+        elog(ERROR, "range types do not match");
+
+    range_deserialize(typcache, r1, &lower1, &upper1, &empty1);
+    range_deserialize(typcache, r2, &lower2, &upper2, &empty2);
+
+    if (empty1 && empty2) 
+         return 0;
+    if (empty1)
+         return 1;
+    if (empty2)
+         return -1;
+
+    int cmp = range_cmp_bounds(typcache, &lower1, &lower2);
+    if (cmp != 0)
+        return cmp;
+
+    return range_cmp_bounds(typcache, &upper1, &upper2);
+}
+
+
+/*
+ * Compare two scalar dynamic_values, returning -1, 0, or 1.
+ *
+ * Strings are compared using the default collation.  Used by B-tree
+ * operators, where a lexical sort order is generally expected.
+ */
+int compare_dynamic_scalar_values(dynamic_value *a, dynamic_value *b)
+{
+    if (a->type == b->type)
+    {
+        switch (a->type)
+        {
+        case DYNAMIC_NULL:
+            return 0;
+        case DYNAMIC_STRING:
+            return varstr_cmp(a->val.string.val, a->val.string.len, b->val.string.val, b->val.string.len,
+                              DEFAULT_COLLATION_OID);
+        case DYNAMIC_NUMERIC:
+            return DatumGetInt32(DirectFunctionCall2(
+                numeric_cmp, PointerGetDatum(a->val.numeric),
+                PointerGetDatum(b->val.numeric)));
+        case DYNAMIC_BOOL:
+            if (a->val.boolean == b->val.boolean)
+                return 0;
+            else if (a->val.boolean > b->val.boolean)
+                return 1;
+            else
+                return -1;
+        case DYNAMIC_TIMESTAMP:
+	    return timestamp_cmp_internal(a->val.int_value, b->val.int_value);
+	case DYNAMIC_TIMESTAMPTZ:
+	    return timestamptz_cmp_internal(a->val.int_value, b->val.int_value);
+	case DYNAMIC_INTEGER:
+	case DYNAMIC_TIME:
+            if (a->val.int_value == b->val.int_value)
+                return 0;
+            else if (a->val.int_value > b->val.int_value)
+                return 1;
+            else
+                return -1;
+	case DYNAMIC_DATE:
+            if (a->val.date == b->val.date)
+                return 0;
+            else if (a->val.date > b->val.date)
+                return 1;
+            else
+                return -1;
+	case DYNAMIC_TIMETZ:
+	    return timetz_cmp_internal(&a->val.timetz, &b->val.timetz);
+	case DYNAMIC_INTERVAL:
+	    return interval_cmp_internal(&a->val.interval, &b->val.interval);
+        case DYNAMIC_RANGE_INT:
+        case DYNAMIC_RANGE_NUM:
+        case DYNAMIC_RANGE_DATE:
+        case DYNAMIC_RANGE_TS:
+        case DYNAMIC_RANGE_TSTZ:	    
+	    return compare_range_internal(a, b);
+        case DYNAMIC_TSQUERY:
+            return CompareTSQ(a->val.tsquery, b->val.tsquery);
+        case DYNAMIC_TSVECTOR:
+            return silly_cmp_tsvector(a->val.tsvector, b->val.tsvector);
+	case DYNAMIC_FLOAT:
+            return compare_two_floats_orderability(a->val.float_value, b->val.float_value);
+	default:
+            ereport(ERROR, (errmsg("invalid dynamic scalar type %d for compare", a->type)));
+        }
+    }
+
+    // timestamp and timestamp with timezone
+    if (a->type == DYNAMIC_TIMESTAMP && b->type == DYNAMIC_TIMESTAMPTZ)
+        return timestamp_cmp_timestamptz_internal(a->val.int_value, b->val.int_value);
+
+    if (a->type == DYNAMIC_TIMESTAMPTZ && b->type == DYNAMIC_TIMESTAMP)
+        return -1 * timestamp_cmp_timestamptz_internal(b->val.int_value, a->val.int_value);
+
+    // date and timestamp
+    if (a->type == DYNAMIC_DATE && b->type == DYNAMIC_TIMESTAMP)
+        return date_cmp_timestamp_internal(a->val.date, b->val.int_value);
+
+    if (a->type == DYNAMIC_TIMESTAMP && b->type == DYNAMIC_DATE)
+        return -1 * date_cmp_timestamp_internal(b->val.date, a->val.int_value);
+
+    // date and timestamp with timezone
+    if (a->type == DYNAMIC_DATE && b->type == DYNAMIC_TIMESTAMPTZ)
+        return date_cmp_timestamptz_internal(a->val.date, b->val.int_value);
+
+    if (a->type == DYNAMIC_TIMESTAMPTZ && b->type == DYNAMIC_DATE)
+        return -1 * date_cmp_timestamptz_internal(b->val.date, a->val.int_value);
+
+    // time and time with timezone
+    if (a->type == DYNAMIC_TIME && b->type == DYNAMIC_TIMETZ) {
+         int64 b_time = DatumGetTimeADT(DirectFunctionCall1(timetz_time, TimeTzADTPGetDatum(&b->val.timetz)));
+
+         if (a->val.int_value == b_time)
+            return 0;
+         else if (a->val.int_value > b_time)
+            return 1;
+         else
+            return -1;
+    }
+
+    if (a->type == DYNAMIC_TIMETZ && b->type == DYNAMIC_TIME) {
+         int64 a_time = DatumGetTimeADT(DirectFunctionCall1(timetz_time, TimeTzADTPGetDatum(&a->val.timetz)));
+
+         if (a_time == b->val.int_value)
+            return 0;
+         else if (a_time > b->val.int_value)
+            return 1;
+         else
+            return -1; 
+    }
+
+
+    // check for integer compared to float 
+    if (a->type == DYNAMIC_INTEGER && b->type == DYNAMIC_FLOAT)
+        return compare_two_floats_orderability((float8)a->val.int_value, b->val.float_value);
+    // check for float compared to integer 
+    if (a->type == DYNAMIC_FLOAT && b->type == DYNAMIC_INTEGER)
+        return compare_two_floats_orderability(a->val.float_value, (float8)b->val.int_value);
+    // check for integer or float compared to numeric 
+  /*  if (is_numeric_result(a, b))
+    {
+        Datum numd, lhsd, rhsd;
+
+        lhsd = get_numeric_datum_from_dynamic_value(a);
+        rhsd = get_numeric_datum_from_dynamic_value(b);
+        numd = DirectFunctionCall2(numeric_cmp, lhsd, rhsd);
+
+        return DatumGetInt32(numd);
+    }*/
+
+    ereport(ERROR, (errmsg("dynamic input scalar type mismatch")));
+    return -1;
+}
+
+/*
+ * Functions for manipulating the resizeable buffer used by convert_dynamic and
+ * its subroutines.
+ */
+
+/*
+ * Reserve 'len' bytes, at the end of the buffer, enlarging it if necessary.
+ * Returns the offset to the reserved area. The caller is expected to fill
+ * the reserved area later with copy_to_buffer().
+ */
+int reserve_from_buffer(StringInfo buffer, int len)
+{
+    int offset;
+
+    // Make more room if needed 
+    enlargeStringInfo(buffer, len);
+
+    // remember current offset 
+    offset = buffer->len;
+
+    // reserve the space 
+    buffer->len += len;
+
+    /*
+     * Keep a trailing null in place, even though it's not useful for us; it
+     * seems best to preserve the invariants of StringInfos.
+     */
+    buffer->data[buffer->len] = '\0';
+
+    return offset;
+}
+
+/*
+ * Copy 'len' bytes to a previously reserved area in buffer.
+ */
+static void copy_to_buffer(StringInfo buffer, int offset, const char *data, int len)
+{
+    memcpy(buffer->data + offset, data, len);
+}
+
+/*
+ * A shorthand for reserve_from_buffer + copy_to_buffer.
+ */
+static void append_to_buffer(StringInfo buffer, const char *data, int len)
+{
+    int offset;
+
+    offset = reserve_from_buffer(buffer, len);
+    copy_to_buffer(buffer, offset, data, len);
+}
+
+/*
+ * Append padding, so that the length of the StringInfo is int-aligned.
+ * Returns the number of padding bytes appended.
+ */
+short pad_buffer_to_int(StringInfo buffer)
+{
+    int padlen;
+    int p;
+    int offset;
+
+    padlen = INTALIGN(buffer->len) - buffer->len;
+
+    offset = reserve_from_buffer(buffer, padlen);
+
+    // padlen must be small, so this is probably faster than a memset 
+    for (p = 0; p < padlen; p++)
+        buffer->data[offset + p] = '\0';
+
+    return padlen;
+}
+
+/*
+ * Given an dynamic_value, convert to dynamic. The result is palloc'd.
+ */
+static dynamic *convert_to_dynamic(dynamic_value *val)
+{
+    StringInfoData buffer;
+    gtentry aentry;
+    dynamic_key_table keys = {NULL, 0};
+    dynamic *res;
+
+    // Should not already have binary representation 
+    Assert(val->type != DYNAMIC_BINARY);
+
+    // Allocate an output buffer. It will be enlarged as needed 
+    initStringInfo(&buffer);
+
+    // Make room for the varlena header 
+    reserve_from_buffer(&buffer, VARHDRSZ);
+
+    convert_dynamic_value(&buffer, &aentry, val, 0, &keys);
+
+    if (keys.positions != NULL)
+        hash_destroy(keys.positions);
+
+    /*
+     * Note: the gtentry of the root is discarded. Therefore the root
+     * dynamic_container struct must contain enough information to tell what
+     * kind of value it is.
+     */
+
+    res = (dynamic *)buffer.data;
+
+    SET_VARSIZE(res, buffer.len);
+
+    return res;
+}
+
+
+/*
+ * Subroutine of convert_dynamic: serialize a single dynamic_value into buffer.
+ *
+ * The gtentry header for this node is returned in *header.  It is filled in
+ * with the length of this value and appropriate type bits.  If we wish to
+ * store an end offset rather than a length, it is the caller's responsibility
+ * to adjust for that.
+ *
+ * If the value is an array or an object, this recurses. 'level' is the depth
+ * of the value below the root, which may not exceed DYNAMIC_MAX_DEPTH.
+ */
+static void convert_dynamic_value(StringInfo buffer, gtentry *header,
+                                 dynamic_value *val, int level,
+                                 dynamic_key_table *keys)
+{
+    check_stack_depth();
+
+    if (!val)
+        return;
+
+    /*
+     * The root dynamic_value passed to convert_to_dynamic is never of type
+     * DYNAMIC_BINARY, but its sub-components may be: an expanded dynamic
+     * keeps its nested containers in serialized form, and they are copied
+     * over as they are, unless they hold key references.
+     */
+
+    if (IS_A_DYNAMIC_SCALAR(val))
+        convert_dynamic_scalar(buffer, header, val);
+    else if (val->type == DYNAMIC_ARRAY)
+        convert_dynamic_array(buffer, header, val, level, keys);
+    else if (val->type == DYNAMIC_OBJECT)
+        convert_dynamic_object(buffer, header, val, level, keys);
+    else if (val->type == DYNAMIC_BINARY)
+        convert_dynamic_binary(buffer, header, val, level, keys);
+    else
+        ereport(ERROR,
+                (errmsg("unknown dynamic type %d to convert", val->type)));
+}
+
+// define the type and size of the agt_header 
+#define DYNA_HEADER_TYPE uint32
+#define DYNA_HEADER_SIZE sizeof(DYNA_HEADER_TYPE)
+
+static short ag_serialize_header(StringInfo buffer, uint32 type)
+{
+    short padlen;
+    int offset;
+        
+    padlen = pad_buffer_to_int(buffer);
+    offset = reserve_from_buffer(buffer, DYNA_HEADER_SIZE);
+    *((DYNA_HEADER_TYPE *)(buffer->data + offset)) = type;
+
+    return padlen;
+}
+
+
+static void convert_dynamic_array(StringInfo buffer, gtentry *pheader,
+                                 dynamic_value *val, int level,
+                                 dynamic_key_table *keys)
+{
+    int base_offset;
+    int gtentry_offset;
+    int i;
+    int totallen;
+    uint32 header;
+    uint32 vector_type;
+    int num_elems = val->val.array.num_elems;
+    int stride = GT_OFFSET_STRIDE_FOR(num_elems);
+
+    check_dynamic_depth(level);
+
+    if (get_dynamic_vector_type(val, &vector_type))
+    {
+        convert_dynamic_vector(buffer, pheader, val, vector_type);
+        return;
+    }
+
+    // Remember where in the buffer this array starts. 
+    base_offset = buffer->len;
+
+    // Align to 4-byte boundary (any padding counts as part of my data) 
+    pad_buffer_to_int(buffer);
+
+    /*
+     * Construct the header gtentry and store it in the beginning of the
+     * variable-length payload.
+     */
+    header = num_elems | GT_FARRAY;
+    if (val->val.array.raw_scalar)
+    {
+        Assert(num_elems == 1);
+        Assert(level == 0);
+        header |= GT_FSCALAR;
+    }
+
+    append_to_buffer(buffer, (char *)&header, sizeof(uint32));
+
+    // Reserve space for the gtentrys of the elements. 
+    gtentry_offset = reserve_from_buffer(buffer, sizeof(gtentry) * num_elems);
+
+    totallen = 0;
+    for (i = 0; i < num_elems; i++)
+    {
+        dynamic_value *elem = &val->val.array.elems[i];
+        int len;
+        gtentry meta;
+
+        /*
+         * Convert element, producing a gtentry and appending its
+         * variable-length data to buffer
+         */
+        convert_dynamic_value(buffer, &meta, elem, level + 1, keys);
+
+        len = GTE_OFFLENFLD(meta);
+        totallen += len;
+
+        /*
+         * Bail out if total variable-length data exceeds what will fit in a
+         * gtentry length field.  We check this in each iteration, not just
+         * once at the end, to forestall possible integer overflow.
+         */
+        if (totallen > GTENTRY_OFFLENMASK)
+        {
+            ereport(
+                ERROR,
+                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                 errmsg(
+                     "total size of dynamic array elements exceeds the maximum of %u bytes",
+                     GTENTRY_OFFLENMASK)));
+        }
+
+        /*
+         * Convert each stride'th length to an offset.
+         */
+        if ((i % stride) == 0)
+            meta = (meta & GTENTRY_TYPEMASK) | totallen | GTENTRY_HAS_OFF;
+
+        copy_to_buffer(buffer, gtentry_offset, (char *)&meta,
+                       sizeof(gtentry));
+        gtentry_offset += sizeof(gtentry);
+    }
+
+    // Total data size is everything we've appended to buffer 
+    totallen = buffer->len - base_offset;
+
+    // Check length again, since we didn't include the metadata above 
+    if (totallen > GTENTRY_OFFLENMASK)
+    {
+        ereport(
+            ERROR,
+            (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+             errmsg(
+                 "total size of dynamic array elements exceeds the maximum of %u bytes",
+                 GTENTRY_OFFLENMASK)));
+    }
+
+    // Initialize the header of this node in the container's gtentry array 
+    *pheader = GTENTRY_IS_CONTAINER | totallen;
+}
+
+/*
+ * Copy an already serialized array or object into buffer. Everything in a
+ * container is positioned relative to its own int-aligned start, so the copy
+ * is valid wherever it lands as long as it is int-aligned too. The exception
+ * are key references to copies outside of the container, such as the keys
+ * of an object in an array referring to those of an earlier element; a
+ * container holding any is serialized again from scratch.
+ */
+static void convert_dynamic_binary(StringInfo buffer, gtentry *pheader,
+                                   dynamic_value *val, int level,
+                                   dynamic_key_table *keys)
+{
+    int base_offset;
+    int totallen;
+
+    if (dynamic_container_has_key_refs(val->val.binary.data, (char *)val->val.binary.data))
+    {
+        convert_dynamic_value(buffer, pheader,
+                              materialize_dynamic_container(val->val.binary.data),
+                              level, keys);
+        return;
+    }
+
+    check_dynamic_container_depth(val->val.binary.data, val->val.binary.len, level);
+
+    base_offset = buffer->len;
+
+    pad_buffer_to_int(buffer);
+
+    append_to_buffer(buffer, (char *)val->val.binary.data, val->val.binary.len);
+
+    totallen = buffer->len - base_offset;
+
+    if (totallen > GTENTRY_OFFLENMASK)
+    {
+        ereport(
+            ERROR,
+            (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+             errmsg(
+                 "total size of dynamic array elements exceeds the maximum of %u bytes",
+                 GTENTRY_OFFLENMASK)));
+    }
+
+    *pheader = GTENTRY_IS_CONTAINER | totallen;
+}
+
+/*
+ * Check whether a serialized container, or any container nested in it, has
+ * keys stored as references to bytes before floor. Called with floor set to
+ * the container itself, this tells whether the container still reads the
+ * same when copied on its own.
+ */
+static bool dynamic_container_has_key_refs(dynamic_container *container, const char *floor)
+{
+    uint32 count = DYNAMIC_CONTAINER_SIZE(container);
+    uint32 nchildren;
+    char *base_addr;
+    uint32 offset = 0;
+    uint32 i;
+
+    check_stack_depth();
+
+    if (DYNAMIC_CONTAINER_IS_VECTOR(container))
+        return false;
+
+    nchildren = DYNAMIC_CONTAINER_IS_OBJECT(container) ? count * 2 : count;
+    base_addr = (char *)&container->children[nchildren];
+
+    for (i = 0; i < nchildren; i++)
+    {
+        gtentry entry = container->children[i];
+
+        if (GTE_IS_KEY_REF(entry))
+        {
+            gtentry_key_ref ref;
+
+            memcpy(&ref, base_addr + offset, sizeof(gtentry_key_ref));
+            if (ref.distance > (uint64) (base_addr + offset - floor))
+                return true;
+        }
+
+        if (GTE_IS_CONTAINER(entry) &&
+            dynamic_container_has_key_refs((dynamic_container *)(base_addr + INTALIGN(offset)), floor))
+            return true;
+
+        GTE_ADVANCE_OFFSET(offset, entry);
+    }
+
+    return false;
+}
+
+/*
+ * Check whether a serialized container has key references that would break
+ * the rules for references if it was stored on its own as the root of a
+ * datum. For an object, that is any reference out of the value of one of
+ * its keys, since each of those values is read on its own, see
+ * find_dynamic_object_field.
+ */
+static bool dynamic_root_has_key_refs(dynamic_container *container)
+{
+    uint32 count = DYNAMIC_CONTAINER_SIZE(container);
+    char *base_addr;
+    uint32 offset = 0;
+    uint32 i;
+
+    if (!DYNAMIC_CONTAINER_IS_OBJECT(container))
+        return dynamic_container_has_key_refs(container, (char *)container);
+
+    base_addr = (char *)&container->children[count * 2];
+
+    for (i = 0; i < count * 2; i++)
+    {
+        gtentry entry = container->children[i];
+
+        // the keys of a top level object are never references
+        if (GTE_IS_KEY_REF(entry))
+            return true;
+
+        if (GTE_IS_CONTAINER(entry))
+        {
+            dynamic_container *value = (dynamic_container *)(base_addr + INTALIGN(offset));
+
+            if (dynamic_container_has_key_refs(value, (char *)value))
+                return true;
+        }
+
+        GTE_ADVANCE_OFFSET(offset, entry);
+    }
+
+    return false;
+}
+
+/*
+ * Turn a serialized container back into a tree of dynamic_values, resolving
+ * key references on the way.
+ */
+static dynamic_value *materialize_dynamic_container(dynamic_container *container)
+{
+    dynamic_parse_state *state = NULL;
+    dynamic_iterator *it;
+    dynamic_iterator_token tok;
+    dynamic_value v;
+    dynamic_value *result = NULL;
+
+    it = dynamic_iterator_init(container);
+    while ((tok = dynamic_iterator_next(&it, &v, false)) != WGT_DONE)
+        result = push_dynamic_value(&state, tok, tok < WGT_BEGIN_ARRAY ? &v : NULL);
+
+    return result;
+}
+
+/*
+ * Serialize an object key, as a reference to an earlier copy of the same key
+ * where possible. keys is NULL where references must not be used.
+ */
+static void convert_dynamic_key(StringInfo buffer, gtentry *entry, dynamic_value *key,
+                                dynamic_key_table *keys)
+{
+    dynamic_key lookup;
+    dynamic_key_entry *hentry;
+    bool found;
+
+    Assert(key->type == DYNAMIC_STRING);
+
+    if (keys == NULL || key->val.string.len < DYNAMIC_KEY_REF_MIN_LEN)
+    {
+        convert_dynamic_scalar(buffer, entry, key);
+        return;
+    }
+
+    if (keys->positions == NULL)
+    {
+        HASHCTL ctl;
+
+        ctl.keysize = sizeof(dynamic_key);
+        ctl.entrysize = sizeof(dynamic_key_entry);
+        ctl.hash = dynamic_key_hash;
+        ctl.match = dynamic_key_match;
+        ctl.hcxt = CurrentMemoryContext;
+
+        keys->positions = hash_create("dynamic object keys", 64, &ctl,
+                                      HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+    }
+
+    lookup.val = key->val.string.val;
+    lookup.len = key->val.string.len;
+
+    hentry = hash_search(keys->positions, &lookup, HASH_ENTER, &found);
+
+    if (found && hentry->position >= keys->floor)
+    {
+        gtentry_key_ref ref;
+
+        ref.distance = buffer->len - hentry->position;
+        ref.len = lookup.len;
+
+        append_to_buffer(buffer, (char *)&ref, sizeof(gtentry_key_ref));
+
+        *entry = GTENTRY_IS_KEY_REF | sizeof(gtentry_key_ref);
+        return;
+    }
+
+    // Strings are appended without padding, so the key starts right here 
+    hentry->position = buffer->len;
+
+    convert_dynamic_scalar(buffer, entry, key);
+}
+
+static uint32 dynamic_key_hash(const void *key, Size keysize)
+{
+    const dynamic_key *k = (const dynamic_key *)key;
+
+    return hash_bytes((const unsigned char *)k->val, k->len);
+}
+
+static int dynamic_key_match(const void *key1, const void *key2, Size keysize)
+{
+    const dynamic_key *k1 = (const dynamic_key *)key1;
+    const dynamic_key *k2 = (const dynamic_key *)key2;
+
+    if (k1->len != k2->len)
+        return 1;
+
+    return memcmp(k1->val, k2->val, k1->len);
+}
+
+/*
+ * Decide whether an array can be stored as a vector, and if so with which
+ * element type.  Only arrays long enough for the saving in gtentrys and
+ * per-element headers to matter are considered.
+ */
+static bool get_dynamic_vector_type(dynamic_value *val, uint32 *vector_type)
+{
+    enum dynamic_value_type type;
+    int num_elems = val->val.array.num_elems;
+    int i;
+
+    if (val->val.array.raw_scalar || num_elems < DYNAMIC_VECTOR_MIN_ELEMS)
+        return false;
+
+    type = val->val.array.elems[0].type;
+    if (!get_vector_elem_type(type, vector_type))
+        return false;
+
+    for (i = 1; i < num_elems; i++)
+    {
+        if (val->val.array.elems[i].type != type)
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * The DYNA_HEADER_* type of the elements of a vector holding values of the
+ * given type, if a vector can hold them.
+ */
+static bool get_vector_elem_type(enum dynamic_value_type type, uint32 *vector_type)
+{
+    switch (type)
+    {
+    case DYNAMIC_INTEGER:
+        *vector_type = DYNA_HEADER_INTEGER;
+        return true;
+    case DYNAMIC_FLOAT:
+        *vector_type = DYNA_HEADER_FLOAT;
+        return true;
+    case DYNAMIC_TIMESTAMP:
+        *vector_type = DYNA_HEADER_TIMESTAMP;
+        return true;
+    case DYNAMIC_TIMESTAMPTZ:
+        *vector_type = DYNA_HEADER_TIMESTAMPTZ;
+        return true;
+    case DYNAMIC_DATE:
+        *vector_type = DYNA_HEADER_DATE;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Subroutine of convert_dynamic_array: serialize a homogeneous array as a
+ * vector, see dynamic.h for the layout.
+ */
+static void convert_dynamic_vector(StringInfo buffer, gtentry *pheader,
+                                  dynamic_value *val, uint32 vector_type)
+{
+    int base_offset;
+    int data_offset;
+    int elem_size = DYNAMIC_VECTOR_ELEM_SIZE(vector_type);
+    int num_elems = val->val.array.num_elems;
+    int totallen;
+    uint32 header;
+    int i;
+
+    if ((uint64) num_elems * elem_size > GTENTRY_OFFLENMASK)
+    {
+        ereport(
+            ERROR,
+            (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+             errmsg(
+                 "total size of dynamic array elements exceeds the maximum of %u bytes",
+                 GTENTRY_OFFLENMASK)));
+    }
 
-            Assert(rcont == WGT_VALUE);
+    base_offset = buffer->len;
 
-            /*
-             * Compare rhs pair's value with lhs pair's value just found using
-             * key
-             */
-            if (lhs_val->type != vcontained.type)
-            {
-                return false;
-            }
-            else if (IS_A_DYNAMIC_SCALAR(lhs_val))
-            {
-                if (!equals_dynamic_scalar_value(lhs_val, &vcontained))
-                    return false;
-            }
-            else
-            {
-                // Nested container value (object or array) 
-                dynamic_iterator *nestval;
-                dynamic_iterator *nest_contained;
+    pad_buffer_to_int(buffer);
 
-                Assert(lhs_val->type == DYNAMIC_BINARY);
-                Assert(vcontained.type == DYNAMIC_BINARY);
+    header = num_elems | GT_FARRAY | GT_FVECTOR;
+    append_to_buffer(buffer, (char *)&header, sizeof(uint32));
+    append_to_buffer(buffer, (char *)&vector_type, sizeof(uint32));
 
-                nestval = dynamic_iterator_init(lhs_val->val.binary.data);
-                nest_contained =
-                    dynamic_iterator_init(vcontained.val.binary.data);
+    data_offset = reserve_from_buffer(buffer, num_elems * elem_size);
 
-                /*
-                 * Match "value" side of rhs datum object's pair recursively.
-                 * It's a nested structure.
-                 *
-                 * Note that nesting still has to "match up" at the right
-                 * nesting sub-levels.  However, there need only be zero or
-                 * more matching pairs (or elements) at each nesting level
-                 * (provided the *rhs* pairs/elements *all* match on each
-                 * level), which enables searching nested structures for a
-                 * single String or other primitive type sub-datum quite
-                 * effectively (provided the user constructed the rhs nested
-                 * structure such that we "know where to look").
-                 *
-                 * In other words, the mapping of container nodes in the rhs
-                 * "vcontained" dynamic to internal nodes on the lhs is
-                 * injective, and parent-child edges on the rhs must be mapped
-                 * to parent-child edges on the lhs to satisfy the condition
-                 * of containment (plus of course the mapped nodes must be
-                 * equal).
-                 */
-                if (!dynamic_deep_contains(&nestval, &nest_contained))
-                    return false;
-            }
-        }
-    }
-    else if (rcont == WGT_BEGIN_ARRAY)
+    for (i = 0; i < num_elems; i++)
     {
-        dynamic_value *lhs_conts = NULL;
-        uint32 num_lhs_elems = vval.val.array.num_elems;
+        dynamic_value *elem = &val->val.array.elems[i];
+        char *dest = buffer->data + data_offset + i * elem_size;
 
-        Assert(vval.type == DYNAMIC_ARRAY);
-        Assert(vcontained.type == DYNAMIC_ARRAY);
+        if (vector_type == DYNA_HEADER_DATE)
+            memcpy(dest, &elem->val.date, sizeof(DateADT));
+        else if (vector_type == DYNA_HEADER_FLOAT)
+            memcpy(dest, &elem->val.float_value, sizeof(float8));
+        else
+            memcpy(dest, &elem->val.int_value, sizeof(int64));
+    }
 
-        /*
-         * Handle distinction between "raw scalar" pseudo arrays, and real
-         * arrays.
-         *
-         * A raw scalar may contain another raw scalar, and an array may
-         * contain a raw scalar, but a raw scalar may not contain an array. We
-         * don't do something like this for the object case, since objects can
-         * only contain pairs, never raw scalars (a pair is represented by an
-         * rhs object argument with a single contained pair).
-         */
-        if (vval.val.array.raw_scalar && !vcontained.val.array.raw_scalar)
-            return false;
+    totallen = buffer->len - base_offset;
 
-        // Work through rhs "is it contained within?" array 
-        for (;;)
-        {
-            rcont = dynamic_iterator_next(m_contained, &vcontained, true);
+    if (totallen > GTENTRY_OFFLENMASK)
+    {
+        ereport(
+            ERROR,
+            (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+             errmsg(
+                 "total size of dynamic array elements exceeds the maximum of %u bytes",
+                 GTENTRY_OFFLENMASK)));
+    }
 
-            /*
-             * When we get through caller's rhs "is it contained within?"
-             * array without failing to find one of its values, it's
-             * contained.
-             */
-            if (rcont == WGT_END_ARRAY)
-                return true;
+    *pheader = GTENTRY_IS_CONTAINER | totallen;
+}
 
-            Assert(rcont == WGT_ELEM);
+/*
+ * Build a vector dynamic directly from a packed C array of num_elems
+ * elements of the given DYNA_HEADER_* type.
+ */
+dynamic *vector_to_dynamic(uint32 vector_type, const char *elems, int num_elems)
+{
+    Size data_len = (Size) num_elems * DYNAMIC_VECTOR_ELEM_SIZE(vector_type);
+    dynamic *result;
 
-            if (IS_A_DYNAMIC_SCALAR(&vcontained))
-            {
-                if (!find_dynamic_value_from_container((*val)->container,
-                                                      GT_FARRAY, &vcontained))
-                    return false;
-            }
-            else
-            {
-                uint32 i;
+    if (data_len > GTENTRY_OFFLENMASK)
+    {
+        ereport(
+            ERROR,
+            (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+             errmsg(
+                 "total size of dynamic array elements exceeds the maximum of %u bytes",
+                 GTENTRY_OFFLENMASK)));
+    }
 
-                /*
-                 * If this is first container found in rhs array (at this
-                 * depth), initialize temp lhs array of containers
-                 */
-                if (lhs_conts == NULL)
-                {
-                    uint32 j = 0;
+    result = palloc(VARHDRSZ + 2 * sizeof(uint32) + data_len);
+    SET_VARSIZE(result, VARHDRSZ + 2 * sizeof(uint32) + data_len);
 
-                    // Make room for all possible values 
-                    lhs_conts = palloc(sizeof(dynamic_value) * num_lhs_elems);
+    result->root.header = num_elems | GT_FARRAY | GT_FVECTOR;
+    DYNAMIC_VECTOR_TYPE(&result->root) = vector_type;
+    memcpy(DYNAMIC_VECTOR_DATA(&result->root), elems, data_len);
 
-                    for (i = 0; i < num_lhs_elems; i++)
-                    {
-                        // Store all lhs elements in temp array 
-                        rcont = dynamic_iterator_next(val, &vval, true);
-                        Assert(rcont == WGT_ELEM);
+    return result;
+}
 
-                        if (vval.type == DYNAMIC_BINARY)
-                            lhs_conts[j++] = vval;
-                    }
+static void convert_dynamic_object(StringInfo buffer, gtentry *pheader,
+                                  dynamic_value *val, int level,
+                                  dynamic_key_table *keys)
+{
+    int base_offset;
+    int gtentry_offset;
+    int i;
+    int totallen;
+    uint32 header;
+    int num_pairs = val->val.object.num_pairs;
+    int stride = GT_OFFSET_STRIDE_FOR(num_pairs);
 
-                    // No container elements in temp array, so give up now 
-                    if (j == 0)
-                        return false;
+    check_dynamic_depth(level);
 
-                    // We may have only partially filled array 
-                    num_lhs_elems = j;
-                }
+    // Remember where in the buffer this object starts. 
+    base_offset = buffer->len;
 
-                // XXX: Nested array containment is O(N^2) 
-                for (i = 0; i < num_lhs_elems; i++)
-                {
-                    // Nested container value (object or array) 
-                    dynamic_iterator *nestval;
-                    dynamic_iterator *nest_contained;
-                    bool contains;
+    // Align to 4-byte boundary (any padding counts as part of my data) 
+    pad_buffer_to_int(buffer);
 
-                    nestval =
-                        dynamic_iterator_init(lhs_conts[i].val.binary.data);
-                    nest_contained =
-                        dynamic_iterator_init(vcontained.val.binary.data);
+    /*
+     * Construct the header gtentry and store it in the beginning of the
+     * variable-length payload.
+     */
+    header = num_pairs | GT_FOBJECT;
+    append_to_buffer(buffer, (char *)&header, sizeof(uint32));
 
-                    contains = dynamic_deep_contains(&nestval, &nest_contained);
+    // Reserve space for the gtentrys of the keys and values. 
+    gtentry_offset = reserve_from_buffer(buffer,
+                                          sizeof(gtentry) * num_pairs * 2);
 
-                    if (nestval)
-                        pfree(nestval);
-                    if (nest_contained)
-                        pfree(nest_contained);
-                    if (contains)
-                        break;
-                }
+    /*
+     * Iterate over the keys, then over the values, since that is the ordering
+     * we want in the on-disk representation.
+     */
+    totallen = 0;
+    for (i = 0; i < num_pairs; i++)
+    {
+        dynamic_pair *pair = &val->val.object.pairs[i];
+        int len;
+        gtentry meta;
 
-                /*
-                 * Report rhs container value is not contained if couldn't
-                 * match rhs container to *some* lhs cont
-                 */
-                if (i == num_lhs_elems)
-                    return false;
-            }
+        /*
+         * Convert key, producing an gtentry and appending its variable-length
+         * data to buffer. The keys of a top level object are always stored
+         * in full.
+         */
+        convert_dynamic_key(buffer, &meta, &pair->key, level == 0 ? NULL : keys);
+
+        len = GTE_OFFLENFLD(meta);
+        totallen += len;
+
+        /*
+         * Bail out if total variable-length data exceeds what will fit in a
+         * gtentry length field.  We check this in each iteration, not just
+         * once at the end, to forestall possible integer overflow.
+         */
+        if (totallen > GTENTRY_OFFLENMASK)
+        {
+            ereport(
+                ERROR,
+                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                 errmsg(
+                     "total size of dynamic object elements exceeds the maximum of %u bytes",
+                     GTENTRY_OFFLENMASK)));
         }
+
+        /*
+         * Convert each stride'th length to an offset.
+         */
+        if ((i % stride) == 0)
+            meta = (meta & GTENTRY_TYPEMASK) | totallen | GTENTRY_HAS_OFF;
+
+        copy_to_buffer(buffer, gtentry_offset, (char *)&meta,
+                       sizeof(gtentry));
+        gtentry_offset += sizeof(gtentry);
     }
-    else
+    for (i = 0; i < num_pairs; i++)
     {
-        ereport(ERROR, (errmsg("invalid dynamic container type")));
+        dynamic_pair *pair = &val->val.object.pairs[i];
+        int len;
+        gtentry meta;
+
+        /*
+         * Convert value, producing an gtentry and appending its
+         * variable-length data to buffer. A top level object value may not
+         * refer to keys outside of it, so that it can be read on its own.
+         */
+        if (level == 0)
+            keys->floor = buffer->len;
+
+        convert_dynamic_value(buffer, &meta, &pair->value, level + 1, keys);
+
+        len = GTE_OFFLENFLD(meta);
+        totallen += len;
+
+        /*
+         * Bail out if total variable-length data exceeds what will fit in a
+         * gtentry length field.  We check this in each iteration, not just
+         * once at the end, to forestall possible integer overflow.
+         */
+        if (totallen > GTENTRY_OFFLENMASK)
+            ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                 errmsg("total size of dynamic object elements exceeds the maximum of %u bytes",
+                     GTENTRY_OFFLENMASK)));
+
+        /*
+         * Convert each stride'th length to an offset.
+         */
+        if (((i + num_pairs) % stride) == 0)
+            meta = (meta & GTENTRY_TYPEMASK) | totallen | GTENTRY_HAS_OFF;
+
+        copy_to_buffer(buffer, gtentry_offset, (char *)&meta,
+                       sizeof(gtentry));
+        gtentry_offset += sizeof(gtentry);
     }
 
-    ereport(ERROR, (errmsg("unexpectedly fell off end of dynamic container")));
-    return false;
+    // Total data size is everything we've appended to buffer 
+    totallen = buffer->len - base_offset;
+
+    // Check length again, since we didn't include the metadata above 
+    if (totallen > GTENTRY_OFFLENMASK)
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+             errmsg("total size of dynamic object elements exceeds the maximum of %u bytes", GTENTRY_OFFLENMASK)));
+
+    // Initialize the header of this node in the container's gtentry array 
+    *pheader = GTENTRY_IS_CONTAINER | totallen;
 }
 
-/*
- * Hash an dynamic_value scalar value, mixing the hash value into an existing
- * hash provided by the caller.
- *
- * Some callers may wish to independently XOR in GT_FOBJECT and GT_FARRAY
- * flags.
- */
-void dynamic_hash_scalar_value(const dynamic_value *scalar_val, uint32 *hash)
+static void convert_dynamic_scalar(StringInfo buffer, gtentry *entry, dynamic_value *scalar_val)
 {
-    uint32 tmp;
+    int numlen;
+    short padlen;
+    bool status;
 
-    // Compute hash value for scalar_val 
     switch (scalar_val->type)
     {
     case DYNAMIC_NULL:
-        tmp = 0x01;
+        *entry = GTENTRY_IS_NULL;
         break;
+
     case DYNAMIC_STRING:
-        tmp = DatumGetUInt32(
-            hash_any((const unsigned char *)scalar_val->val.string.val,
-                     scalar_val->val.string.len));
+        append_to_buffer(buffer, scalar_val->val.string.val, scalar_val->val.string.len);
+
+        *entry = scalar_val->val.string.len;
         break;
+
     case DYNAMIC_NUMERIC:
-        // Must hash equal numerics to equal hash codes 
-        tmp = DatumGetUInt32(DirectFunctionCall1(
-            hash_numeric, NumericGetDatum(scalar_val->val.numeric)));
+        numlen = VARSIZE_ANY(scalar_val->val.numeric);
+        padlen = pad_buffer_to_int(buffer);
+
+        append_to_buffer(buffer, (char *)scalar_val->val.numeric, numlen);
+
+        *entry = GTENTRY_IS_NUMERIC | (padlen + numlen);
         break;
+
     case DYNAMIC_BOOL:
-        tmp = scalar_val->val.boolean ? 0x02 : 0x04;
-        break;
-    case DYNAMIC_INTEGER:
-        tmp = DatumGetUInt32(DirectFunctionCall1(
-            hashint8, Int64GetDatum(scalar_val->val.int_value)));
-        break;
-    case DYNAMIC_FLOAT:
-        tmp = DatumGetUInt32(DirectFunctionCall1(
-            hashfloat8, Float8GetDatum(scalar_val->val.float_value)));
+        *entry = (scalar_val->val.boolean) ? GTENTRY_IS_BOOL_TRUE : GTENTRY_IS_BOOL_FALSE;
         break;
+
     default:
-        ereport(ERROR, (errmsg("invalid dynamic scalar type %d to compute hash",
-                               scalar_val->type)));
-        tmp = 0; // keep compiler quiet 
-        break;
+        // returns true if there was a valid extended type processed 
+        status = ag_serialize_extended_type(buffer, entry, scalar_val);
+        // if nothing was found, error log out 
+        if (!status)
+            ereport(ERROR, (errmsg("invalid dynamic scalar type %d to convert",
+                                   scalar_val->type)));
     }
-
-    /*
-     * Combine hash values of successive keys, values and elements by rotating
-     * the previous value left 1 bit, then XOR'ing in the new
-     * key/value/element's hash value.
-     */
-    *hash = (*hash << 1) | (*hash >> 31);
-    *hash ^= tmp;
 }
 
 /*
- * Hash a value to a 64-bit value, with a seed. Otherwise, similar to
- * dynamic_hash_scalar_value.
+ * Compare two DYNAMIC_STRING dynamic_value values, a and b.
+ *
+ * This is a special qsort() comparator used to sort strings in certain
+ * internal contexts where it is sufficient to have a well-defined sort order.
+ * In particular, object pair keys are sorted according to this criteria to
+ * facilitate cheap binary searches where we don't care about lexical sort
+ * order.
+ *
+ * a and b are first sorted based on their length.  If a tie-breaker is
+ * required, only then do we consider string binary equality.
  */
-void dynamic_hash_scalar_value_extended(const dynamic_value *scalar_val, uint64 *hash, uint64 seed)
+static int length_compare_dynamic_string_value(const void *a, const void *b)
 {
-    uint64 tmp = 0;
+    const dynamic_value *va = (const dynamic_value *)a;
+    const dynamic_value *vb = (const dynamic_value *)b;
+    int res;
 
-    switch (scalar_val->type)
+    Assert(va->type == DYNAMIC_STRING);
+    Assert(vb->type == DYNAMIC_STRING);
+
+    if (va->val.string.len == vb->val.string.len)
     {
-    case DYNAMIC_NULL:
-        tmp = seed + 0x01;
-        break;
-    case DYNAMIC_STRING:
-        tmp = DatumGetUInt64(hash_any_extended(
-            (const unsigned char *)scalar_val->val.string.val,
-            scalar_val->val.string.len, seed));
-        break;
-    case DYNAMIC_NUMERIC:
-        tmp = DatumGetUInt64(DirectFunctionCall2(
-            hash_numeric_extended, NumericGetDatum(scalar_val->val.numeric),
-            UInt64GetDatum(seed)));
-        break;
-    case DYNAMIC_BOOL:
-        if (seed)
-        {
-            tmp = DatumGetUInt64(DirectFunctionCall2(
-                hashcharextended, BoolGetDatum(scalar_val->val.boolean),
-                UInt64GetDatum(seed)));
-        }
-        else
-        {
-            tmp = scalar_val->val.boolean ? 0x02 : 0x04;
-        }
-        break;
-    case DYNAMIC_INTEGER:
-        tmp = DatumGetUInt64(DirectFunctionCall2(
-            hashint8extended, Int64GetDatum(scalar_val->val.int_value),
-            UInt64GetDatum(seed)));
-        break;
-    case DYNAMIC_FLOAT:
-        tmp = DatumGetUInt64(DirectFunctionCall2(
-            hashfloat8extended, Float8GetDatum(scalar_val->val.float_value),
-            UInt64GetDatum(seed)));
-        break;
-    default:
-        ereport(
-            ERROR,
-            (errmsg("invalid dynamic scalar type %d to compute hash extended",
-                    scalar_val->type)));
-        break;
+        res = memcmp(va->val.string.val, vb->val.string.val,
+                     va->val.string.len);
+    }
+    else
+    {
+        res = (va->val.string.len > vb->val.string.len) ? 1 : -1;
     }
 
-    *hash = ROTATE_HIGH_AND_LOW_32BITS(*hash);
-    *hash ^= tmp;
+    return res;
 }
 
 /*
- * Function to compare two floats, obviously. However, there are a few
- * special cases that we need to cover with regards to NaN and +/-Infinity.
- * NaN is not equal to any other number, including itself. However, for
- * ordering, we need to allow NaN = NaN and NaN > any number including
- * positive infinity -
+ * qsort_arg() comparator to compare dynamic_pair values.
  *
- *     -Infinity < any number < +Infinity < NaN
+ * Third argument 'binequal' may point to a bool. If it's set, *binequal is set
+ * to true iff a and b have full binary equality, since some callers have an
+ * interest in whether the two values are equal or merely equivalent.
  *
- * Note: This is copied from float8_cmp_internal.
- * Note: Special float values can cause exceptions, hence the order of the
- *       comparisons.
+ * N.B: String comparisons here are "length-wise"
+ *
+ * Pairs with equals keys are ordered such that the order field is respected.
  */
-static int compare_two_floats_orderability(float8 lhs, float8 rhs)
+static int length_compare_dynamic_pair(const void *a, const void *b,
+                                      void *binequal)
 {
+    const dynamic_pair *pa = (const dynamic_pair *)a;
+    const dynamic_pair *pb = (const dynamic_pair *)b;
+    int res;
+
+    res = length_compare_dynamic_string_value(&pa->key, &pb->key);
+    if (res == 0 && binequal)
+        *((bool *)binequal) = true;
+
     /*
-     * We consider all NANs to be equal and larger than any non-NAN. This is
-     * somewhat arbitrary; the important thing is to have a consistent sort
-     * order.
+     * Guarantee keeping order of equal pair.  Unique algorithm will prefer
+     * first element as value.
      */
-    if (isnan(lhs))
-    {
-        if (isnan(rhs))
-            return 0; // NAN = NAN 
-        else
-            return 1; // NAN > non-NAN 
-    }
-    else if (isnan(rhs))
-    {
-        return -1; // non-NAN < NAN 
-    }
-    else
-    {
-        if (lhs > rhs)
-            return 1;
-        else if (lhs < rhs)
-            return -1;
-        else
-            return 0;
-    }
+    if (res == 0)
+        res = (pa->order > pb->order) ? -1 : 1;
+
+    return res;
 }
 
 /*
- * Are two scalar dynamic_values of the same type a and b equal?
+ * Sort and unique-ify pairs in dynamic_value object
  */
-static bool equals_dynamic_scalar_value(const dynamic_value *a, const dynamic_value *b)
-{
-    // if the values are of the same type 
-    if (a->type == b->type)
-    {
-        switch (a->type)
-        {
-        case DYNAMIC_NULL:
-            return true;
-        case DYNAMIC_STRING:
-            return length_compare_dynamic_string_value(a, b) == 0;
-        case DYNAMIC_NUMERIC:
-            return DatumGetBool(DirectFunctionCall2(
-                numeric_eq, PointerGetDatum(a->val.numeric),
-                PointerGetDatum(b->val.numeric)));
-        case DYNAMIC_BOOL:
-            return a->val.boolean == b->val.boolean;
-        case DYNAMIC_INTEGER:
-        case DYNAMIC_TIMESTAMP:
-        case DYNAMIC_TIME:
-            return a->val.int_value == b->val.int_value;
-        case DYNAMIC_TIMESTAMPTZ:
-            return timestamptz_cmp_internal(a->val.int_value, b->val.int_value) == 0;
-        case DYNAMIC_DATE:
-            return a->val.date == b->val.date;
-        case DYNAMIC_TIMETZ:
-            return timetz_cmp_internal(&a->val.timetz, &b->val.timetz) == 0;
-        case DYNAMIC_INTERVAL:
-            return interval_cmp_internal(&a->val.interval, &b->val.interval) == 0;
-        case DYNAMIC_RANGE_INT:
-        case DYNAMIC_RANGE_NUM:
-        case DYNAMIC_RANGE_DATE:
-	case DYNAMIC_RANGE_TS:
-        case DYNAMIC_RANGE_TSTZ:
-	    return compare_range_internal(a, b) == 0;
-	case DYNAMIC_TSQUERY:
-	    return CompareTSQ(a->val.tsquery, b->val.tsquery) == 0;
-        case DYNAMIC_TSVECTOR:
-	    return silly_cmp_tsvector(a->val.tsvector, b->val.tsvector) == 0;
-	case DYNAMIC_FLOAT:
-            return a->val.float_value == b->val.float_value;
-        default:
-            ereport(ERROR, (errmsg("invalid dynamic scalar type %d for equals", a->type)));
+void uniqueify_dynamic_object(dynamic_value *object)
+{
+    bool has_non_uniq = false;
+
+    Assert(object->type == DYNAMIC_OBJECT);
+
+    if (object->val.object.num_pairs >= DYNAMIC_SORT_KEYS_MIN_PAIRS)
+    {
+        int num_pairs = object->val.object.num_pairs;
+        dynamic_pair *pairs = object->val.object.pairs;
+        dynamic_pair *unsorted = palloc(sizeof(dynamic_pair) * num_pairs);
+        dynamic_sort_key *keys = palloc(sizeof(dynamic_sort_key) * num_pairs);
+        int i;
+
+        memcpy(unsorted, pairs, sizeof(dynamic_pair) * num_pairs);
+
+        for (i = 0; i < num_pairs; i++)
+        {
+            keys[i].val = pairs[i].key.val.string.val;
+            keys[i].len = pairs[i].key.val.string.len;
+            keys[i].index = i;
+            keys[i].order = pairs[i].order;
         }
+
+        num_pairs = sort_unique_keys(keys, num_pairs);
+
+        for (i = 0; i < num_pairs; i++)
+            pairs[i] = unsorted[keys[i].index];
+
+        object->val.object.num_pairs = num_pairs;
+
+        pfree(unsorted);
+        pfree(keys);
+        return;
     }
-    // otherwise, the values are of differing type 
-    else
-        ereport(ERROR, (errmsg("dynamic input scalars must be of same type")));
 
-    // execution will never reach this point due to the ereport call 
-    return false;
+    if (object->val.object.num_pairs > 1)
+        qsort_arg(object->val.object.pairs, object->val.object.num_pairs,
+                  sizeof(dynamic_pair), length_compare_dynamic_pair,
+                  &has_non_uniq);
+
+    if (has_non_uniq)
+    {
+        dynamic_pair *ptr = object->val.object.pairs + 1;
+        dynamic_pair *res = object->val.object.pairs;
+
+        while (ptr - object->val.object.pairs < object->val.object.num_pairs)
+        {
+            // Avoid copying over duplicate 
+            if (length_compare_dynamic_string_value(ptr, res) != 0)
+            {
+                res++;
+                if (ptr != res)
+                    memcpy(res, ptr, sizeof(dynamic_pair));
+            }
+            ptr++;
+        }
+
+        object->val.object.num_pairs = res + 1 - object->val.object.pairs;
+    }
 }
 
 /*
- * Order: haspos, len, word, for all positions (pos, weight)
+ * Sort and deduplicate the keys of an object, given in the order the pairs
+ * are in. The result is the same as sorting the pairs with
+ * length_compare_dynamic_pair() and keeping the first of each run of equal
+ * keys, but the duplicates are found with a hash table first. That leaves
+ * the sort without ties to break, and keys of equal length are told apart
+ * by their prefix, in one comparison, unless they share it. Returns the
+ * number of keys left, which are sorted at the start of keys.
  */
-static int
-silly_cmp_tsvector(const TSVector a, const TSVector b)
+static int sort_unique_keys(dynamic_sort_key *keys, int num_keys)
 {
-    if (VARSIZE(a) < VARSIZE(b))
-         return -1;
-    else if (VARSIZE(a) > VARSIZE(b))
-         return 1;
-    else if (a->size < b->size)
-         return -1;
-    else if (a->size > b->size)
-         return 1;
-    else {
-         WordEntry *aptr = ARRPTR(a);
-         WordEntry *bptr = ARRPTR(b);
-         int i = 0;
-         int res;
+    int *slots;
+    int nslots = 1;
+    int skip;
+    int i;
+    int j;
 
-         for (i = 0; i < a->size; i++) {
-              if (aptr->haspos != bptr->haspos) {
-                   return (aptr->haspos > bptr->haspos) ? -1 : 1;
-              } else if ((res = tsCompareString(STRPTR(a) + aptr->pos, aptr->len, STRPTR(b) + bptr->pos, bptr->len, false)) != 0) {
-                   return res;
-              } else if (aptr->haspos) {
-                   WordEntryPos *ap = POSDATAPTR(a, aptr);
-                   WordEntryPos *bp = POSDATAPTR(b, bptr);
-                   int                     j;
+    while (nslots < num_keys * 2)
+        nslots <<= 1;
 
-                   if (POSDATALEN(a, aptr) != POSDATALEN(b, bptr))
-                        return (POSDATALEN(a, aptr) > POSDATALEN(b, bptr)) ? -1 : 1;
+    slots = palloc(sizeof(int) * nslots);
+    for (i = 0; i < nslots; i++)
+        slots[i] = -1;
 
-                   for (j = 0; j < POSDATALEN(a, aptr); j++) {
-                        if (WEP_GETPOS(*ap) != WEP_GETPOS(*bp))
-                             return (WEP_GETPOS(*ap) > WEP_GETPOS(*bp)) ? -1 : 1;
-                        else if (WEP_GETWEIGHT(*ap) != WEP_GETWEIGHT(*bp))
-                             return (WEP_GETWEIGHT(*ap) > WEP_GETWEIGHT(*bp)) ? -1 : 1;
-                        ap++, bp++;
-                   }
-              }
+    // Open addressing, each slot holds the key that is kept so far
+    for (i = 0; i < num_keys; i++)
+    {
+        uint32 h = hash_bytes((const unsigned char *)keys[i].val, keys[i].len) & (nslots - 1);
 
-              aptr++;
-              bptr++;
-         }
-    }
+        for (;;)
+        {
+            int k = slots[h];
 
-    return 0;
-}
+            if (k < 0)
+            {
+                slots[h] = i;
+                break;
+            }
 
+            if (keys[k].len == keys[i].len && memcmp(keys[k].val, keys[i].val, keys[i].len) == 0)
+            {
+                if (keys[i].order > keys[k].order)
+                {
+                    keys[k].index = -1;
+                    slots[h] = i;
+                }
+                else
+                {
+                    keys[i].index = -1;
+                }
+                break;
+            }
 
-static int
-CompareTSQ(TSQuery a, TSQuery b) {
-    if (a->size != b->size) {
-        return (a->size < b->size) ? -1 : 1;
-    } else if (VARSIZE(a) != VARSIZE(b)) {
-        return (VARSIZE(a) < VARSIZE(b)) ? -1 : 1;
-    } else if (a->size != 0) {
-        QTNode *an = QT2QTN(GETQUERY(a), GETOPERAND(a));
-        QTNode *bn = QT2QTN(GETQUERY(b), GETOPERAND(b));
-        int res = QTNodeCompare(an, bn);
+            h = (h + 1) & (nslots - 1);
+        }
+    }
 
-        QTNFree(an);
-        QTNFree(bn);
+    pfree(slots);
 
-        return res;
+    for (i = 0, j = 0; i < num_keys; i++)
+    {
+        if (keys[i].index >= 0)
+            keys[j++] = keys[i];
     }
+    num_keys = j;
 
-    return 0;
-}
+    // The bytes every key starts with can't tell any of them apart
+    skip = num_keys > 0 ? keys[0].len : 0;
+    for (i = 1; i < num_keys && skip > 0; i++)
+    {
+        int n = Min(skip, keys[i].len);
+        int k = 0;
 
-static int compare_range_internal(dynamic_value *a, dynamic_value *b) {
-    RangeType *r1 = a->val.range;
-    RangeType *r2 = b->val.range;
-    TypeCacheEntry *typcache = lookup_type_cache(RangeTypeGetOid(r1), TYPECACHE_RANGE_INFO);
-    RangeBound lower1, lower2;
-    RangeBound upper1, upper2;
-    bool empty1, empty2;
+        while (k < n && keys[i].val[k] == keys[0].val[k])
+            k++;
+        skip = k;
+    }
 
-    /* Different types should be prevented by ANYRANGE matching rules */
-    if (a->type != b->type)
-        elog(ERROR, "range types do not match");
+    for (i = 0; i < num_keys; i++)
+    {
+        uint64 prefix = 0;
+        int k;
 
-    range_deserialize(typcache, r1, &lower1, &upper1, &empty1);
-    range_deserialize(typcache, r2, &lower2, &upper2, &empty2);
+        for (k = skip; k < skip + (int) sizeof(uint64); k++)
+            prefix = (prefix << 8) | (k < keys[i].len ? (unsigned char)keys[i].val[k] : 0);
 
-    if (empty1 && empty2) 
-         return 0;
-    if (empty1)
-         return 1;
-    if (empty2)
-         return -1;
+        keys[i].prefix = prefix;
+    }
 
-    int cmp = range_cmp_bounds(typcache, &lower1, &lower2);
-    if (cmp != 0)
-        return cmp;
+    if (num_keys > 1)
+        qsort_arg(keys, num_keys, sizeof(dynamic_sort_key), compare_dynamic_sort_key, &skip);
 
-    return range_cmp_bounds(typcache, &upper1, &upper2);
+    return num_keys;
 }
 
-
 /*
- * Compare two scalar dynamic_values, returning -1, 0, or 1.
- *
- * Strings are compared using the default collation.  Used by B-tree
- * operators, where a lexical sort order is generally expected.
+ * qsort_arg() comparator for sort_unique_keys(), with the number of bytes
+ * all the keys start with as the argument. The keys are all different.
  */
-int compare_dynamic_scalar_values(dynamic_value *a, dynamic_value *b)
+static int compare_dynamic_sort_key(const void *a, const void *b, void *arg)
 {
-    if (a->type == b->type)
-    {
-        switch (a->type)
-        {
-        case DYNAMIC_NULL:
-            return 0;
-        case DYNAMIC_STRING:
-            return varstr_cmp(a->val.string.val, a->val.string.len, b->val.string.val, b->val.string.len,
-                              DEFAULT_COLLATION_OID);
-        case DYNAMIC_NUMERIC:
-            return DatumGetInt32(DirectFunctionCall2(
-                numeric_cmp, PointerGetDatum(a->val.numeric),
-                PointerGetDatum(b->val.numeric)));
-        case DYNAMIC_BOOL:
-            if (a->val.boolean == b->val.boolean)
-                return 0;
-            else if (a->val.boolean > b->val.boolean)
-                return 1;
-            else
-                return -1;
-        case DYNAMIC_TIMESTAMP:
-	    return timestamp_cmp_internal(a->val.int_value, b->val.int_value);
-	case DYNAMIC_TIMESTAMPTZ:
-	    return timestamptz_cmp_internal(a->val.int_value, b->val.int_value);
-	case DYNAMIC_INTEGER:
-	case DYNAMIC_TIME:
-            if (a->val.int_value == b->val.int_value)
-                return 0;
-            else if (a->val.int_value > b->val.int_value)
-                return 1;
-            else
-                return -1;
-	case DYNAMIC_DATE:
-            if (a->val.date == b->val.date)
-                return 0;
-            else if (a->val.date > b->val.date)
-                return 1;
-            else
-                return -1;
-	case DYNAMIC_TIMETZ:
-	    return timetz_cmp_internal(&a->val.timetz, &b->val.timetz);
-	case DYNAMIC_INTERVAL:
-	    return interval_cmp_internal(&a->val.interval, &b->val.interval);
-        case DYNAMIC_RANGE_INT:
-        case DYNAMIC_RANGE_NUM:
-        case DYNAMIC_RANGE_DATE:
-        case DYNAMIC_RANGE_TS:
-        case DYNAMIC_RANGE_TSTZ:	    
-	    return compare_range_internal(a, b);
-        case DYNAMIC_TSQUERY:
-            return CompareTSQ(a->val.tsquery, b->val.tsquery);
-        case DYNAMIC_TSVECTOR:
-            return silly_cmp_tsvector(a->val.tsvector, b->val.tsvector);
-	case DYNAMIC_FLOAT:
-            return compare_two_floats_orderability(a->val.float_value, b->val.float_value);
-	default:
-            ereport(ERROR, (errmsg("invalid dynamic scalar type %d for compare", a->type)));
-        }
-    }
+    const dynamic_sort_key *ka = (const dynamic_sort_key *)a;
+    const dynamic_sort_key *kb = (const dynamic_sort_key *)b;
+    int skip = *(int *)arg + (int) sizeof(uint64);
 
-    // timestamp and timestamp with timezone
-    if (a->type == DYNAMIC_TIMESTAMP && b->type == DYNAMIC_TIMESTAMPTZ)
-        return timestamp_cmp_timestamptz_internal(a->val.int_value, b->val.int_value);
+    if (ka->len != kb->len)
+        return (ka->len > kb->len) ? 1 : -1;
 
-    if (a->type == DYNAMIC_TIMESTAMPTZ && b->type == DYNAMIC_TIMESTAMP)
-        return -1 * timestamp_cmp_timestamptz_internal(b->val.int_value, a->val.int_value);
+    if (ka->prefix != kb->prefix)
+        return (ka->prefix > kb->prefix) ? 1 : -1;
 
-    // date and timestamp
-    if (a->type == DYNAMIC_DATE && b->type == DYNAMIC_TIMESTAMP)
-        return date_cmp_timestamp_internal(a->val.date, b->val.int_value);
+    if (ka->len <= skip)
+        return 0;
 
-    if (a->type == DYNAMIC_TIMESTAMP && b->type == DYNAMIC_DATE)
-        return -1 * date_cmp_timestamp_internal(b->val.date, a->val.int_value);
+    return memcmp(ka->val + skip, kb->val + skip, ka->len - skip);
+}
 
-    // date and timestamp with timezone
-    if (a->type == DYNAMIC_DATE && b->type == DYNAMIC_TIMESTAMPTZ)
-        return date_cmp_timestamptz_internal(a->val.date, b->val.int_value);
+/*
+ * Start building a dynamic from a sequence of begin, key, scalar and end
+ * calls, in the order the text input function produces them. See
+ * dynamic_build_frame for how the value is put together.
+ *
+ * The builder and the result live in the current memory context. The calls
+ * may be made in shorter lived contexts, which only get temporary data.
+ */
+dynamic_builder *dynamic_builder_create(void)
+{
+    dynamic_builder *builder = palloc0(sizeof(dynamic_builder));
 
-    if (a->type == DYNAMIC_TIMESTAMPTZ && b->type == DYNAMIC_DATE)
-        return -1 * date_cmp_timestamptz_internal(b->val.date, a->val.int_value);
+    builder->cxt = CurrentMemoryContext;
 
-    // time and time with timezone
-    if (a->type == DYNAMIC_TIME && b->type == DYNAMIC_TIMETZ) {
-         int64 b_time = DatumGetTimeADT(DirectFunctionCall1(timetz_time, TimeTzADTPGetDatum(&b->val.timetz)));
+    initStringInfo(&builder->buffer);
+    initStringInfo(&builder->keys);
+    initStringInfo(&builder->scratch);
 
-         if (a->val.int_value == b_time)
-            return 0;
-         else if (a->val.int_value > b_time)
-            return 1;
-         else
-            return -1;
-    }
+    // Make room for the varlena header 
+    reserve_from_buffer(&builder->buffer, VARHDRSZ);
 
-    if (a->type == DYNAMIC_TIMETZ && b->type == DYNAMIC_TIME) {
-         int64 a_time = DatumGetTimeADT(DirectFunctionCall1(timetz_time, TimeTzADTPGetDatum(&a->val.timetz)));
+    builder->max_depth = 8;
+    builder->frames = palloc0(sizeof(dynamic_build_frame) * builder->max_depth);
 
-         if (a_time == b->val.int_value)
-            return 0;
-         else if (a_time > b->val.int_value)
-            return 1;
-         else
-            return -1; 
-    }
+    return builder;
+}
+
+void dynamic_builder_begin_array(dynamic_builder *builder)
+{
+    dynamic_builder_begin(builder, false);
+}
+
+void dynamic_builder_begin_object(dynamic_builder *builder)
+{
+    dynamic_builder_begin(builder, true);
+}
 
+static void dynamic_builder_begin(dynamic_builder *builder, bool is_object)
+{
+    dynamic_build_frame *frame;
 
-    // check for integer compared to float 
-    if (a->type == DYNAMIC_INTEGER && b->type == DYNAMIC_FLOAT)
-        return compare_two_floats_orderability((float8)a->val.int_value, b->val.float_value);
-    // check for float compared to integer 
-    if (a->type == DYNAMIC_FLOAT && b->type == DYNAMIC_INTEGER)
-        return compare_two_floats_orderability(a->val.float_value, (float8)b->val.int_value);
-    // check for integer or float compared to numeric 
-  /*  if (is_numeric_result(a, b))
+    check_dynamic_depth(builder->depth);
+
+    if (builder->depth == builder->max_depth)
     {
-        Datum numd, lhsd, rhsd;
+        builder->frames = repalloc(builder->frames,
+                                   sizeof(dynamic_build_frame) * builder->max_depth * 2);
+        memset(&builder->frames[builder->max_depth], 0,
+               sizeof(dynamic_build_frame) * builder->max_depth);
+        builder->max_depth *= 2;
+    }
 
-        lhsd = get_numeric_datum_from_dynamic_value(a);
-        rhsd = get_numeric_datum_from_dynamic_value(b);
-        numd = DirectFunctionCall2(numeric_cmp, lhsd, rhsd);
+    frame = &builder->frames[builder->depth++];
+    frame->id = ++builder->next_id;
+    frame->is_object = is_object;
+    frame->base = builder->buffer.len;
 
-        return DatumGetInt32(numd);
-    }*/
+    // Align to 4-byte boundary (any padding counts as part of my data) 
+    pad_buffer_to_int(&builder->buffer);
 
-    ereport(ERROR, (errmsg("dynamic input scalar type mismatch")));
-    return -1;
+    frame->start = builder->buffer.len;
+    frame->count = 0;
+    frame->key_base = builder->keys.len;
+    frame->vector = true;
+    frame->nrefs = 0;
 }
 
 /*
- * Functions for manipulating the resizeable buffer used by convert_dynamic and
- * its subroutines.
+ * Add the key of the next pair to the innermost open object. Its value is
+ * the next scalar or container added.
  */
+void dynamic_builder_key(dynamic_builder *builder, const char *key, int len)
+{
+    dynamic_build_frame *frame = &builder->frames[builder->depth - 1];
+    dynamic_build_pair *pair;
+
+    Assert(builder->depth > 0 && frame->is_object);
+
+    if (frame->count >= DYNAMIC_MAX_PAIRS)
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("number of dynamic object pairs exceeds the maximum allowed (%zu)",
+                               DYNAMIC_MAX_PAIRS)));
+
+    if (frame->count >= frame->pairs_size)
+    {
+        frame->pairs_size = Max(frame->pairs_size * 2, 4);
+        if (frame->pairs == NULL)
+            frame->pairs = MemoryContextAlloc(builder->cxt, sizeof(dynamic_build_pair) * frame->pairs_size);
+        else
+            frame->pairs = repalloc(frame->pairs, sizeof(dynamic_build_pair) * frame->pairs_size);
+    }
+
+    pair = &frame->pairs[frame->count];
+    pair->key_offset = builder->keys.len;
+    pair->key_len = len;
+    pair->order = frame->count;
+
+    appendBinaryStringInfo(&builder->keys, key, len);
+}
 
 /*
- * Reserve 'len' bytes, at the end of the buffer, enlarging it if necessary.
- * Returns the offset to the reserved area. The caller is expected to fill
- * the reserved area later with copy_to_buffer().
+ * Add a scalar to the innermost open container. A scalar added when no
+ * container is open is the whole value.
  */
-int reserve_from_buffer(StringInfo buffer, int len)
+void dynamic_builder_scalar(dynamic_builder *builder, dynamic_value *scalar_val)
 {
-    int offset;
+    dynamic_build_child child;
+    gtentry entry;
 
-    // Make more room if needed 
-    enlargeStringInfo(buffer, len);
+    Assert(IS_A_DYNAMIC_SCALAR(scalar_val));
 
-    // remember current offset 
-    offset = buffer->len;
+    if (builder->depth == 0)
+    {
+        MemoryContext oldcxt = MemoryContextSwitchTo(builder->cxt);
 
-    // reserve the space 
-    buffer->len += len;
+        builder->result = scalar_value_to_dynamic(scalar_val);
+        MemoryContextSwitchTo(oldcxt);
+        return;
+    }
 
-    /*
-     * Keep a trailing null in place, even though it's not useful for us; it
-     * seems best to preserve the invariants of StringInfos.
-     */
-    buffer->data[buffer->len] = '\0';
+    child.offset = builder->buffer.len;
 
-    return offset;
+    convert_dynamic_scalar(&builder->buffer, &entry, scalar_val);
+
+    child.type = entry & GTENTRY_TYPEMASK;
+    if (child.type == GTENTRY_IS_NUMERIC || child.type == GTENTRY_IS_DYNAMIC)
+        child.offset = INTALIGN(child.offset);
+    child.len = builder->buffer.len - child.offset;
+
+    dynamic_builder_add_child(builder, &child, scalar_val->type);
 }
 
-/*
- * Copy 'len' bytes to a previously reserved area in buffer.
- */
-static void copy_to_buffer(StringInfo buffer, int offset, const char *data, int len)
+static void dynamic_builder_add_child(dynamic_builder *builder, dynamic_build_child *child,
+                                      enum dynamic_value_type type)
 {
-    memcpy(buffer->data + offset, data, len);
+    dynamic_build_frame *frame = &builder->frames[builder->depth - 1];
+
+    if (frame->is_object)
+    {
+        frame->pairs[frame->count++].value = *child;
+        return;
+    }
+
+    if (frame->count >= DYNAMIC_MAX_ELEMS)
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("number of dynamic array elements exceeds the maximum allowed (%zu)",
+                               DYNAMIC_MAX_ELEMS)));
+
+    if (frame->count >= frame->elems_size)
+    {
+        frame->elems_size = Max(frame->elems_size * 2, 8);
+        if (frame->elems == NULL)
+            frame->elems = MemoryContextAlloc(builder->cxt, sizeof(dynamic_build_child) * frame->elems_size);
+        else
+            frame->elems = repalloc(frame->elems, sizeof(dynamic_build_child) * frame->elems_size);
+    }
+
+    if (frame->count == 0)
+        frame->elem_type = type;
+    else if (type != frame->elem_type)
+        frame->vector = false;
+
+    frame->elems[frame->count++] = *child;
 }
 
 /*
- * A shorthand for reserve_from_buffer + copy_to_buffer.
+ * Finish the innermost open container, and add it to the one around it.
  */
-static void append_to_buffer(StringInfo buffer, const char *data, int len)
+void dynamic_builder_end(dynamic_builder *builder)
 {
-    int offset;
+    dynamic_build_frame *frame = &builder->frames[builder->depth - 1];
+    dynamic_build_frame *parent;
+    dynamic_build_child child;
+    uint32 vector_type;
+    int i;
 
-    offset = reserve_from_buffer(buffer, len);
-    copy_to_buffer(buffer, offset, data, len);
+    Assert(builder->depth > 0);
+
+    if (frame->is_object)
+        dynamic_builder_end_object(builder, frame);
+    else if (frame->vector && frame->count >= DYNAMIC_VECTOR_MIN_ELEMS &&
+             get_vector_elem_type(frame->elem_type, &vector_type))
+        dynamic_builder_end_vector(builder, frame, vector_type);
+    else
+        dynamic_builder_end_array(builder, frame);
+
+    // Total data size is everything appended to the buffer since it began 
+    if (builder->buffer.len - frame->base > GTENTRY_OFFLENMASK)
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("total size of dynamic %s elements exceeds the maximum of %u bytes",
+                               frame->is_object ? "object" : "array", GTENTRY_OFFLENMASK)));
+
+    if (--builder->depth == 0)
+        return;
+
+    parent = &builder->frames[builder->depth - 1];
+
+    // References to keys outside of the parent too are its to adjust now 
+    for (i = 0; i < frame->nrefs; i++)
+    {
+        if (frame->refs[i].owner < builder->depth - 1)
+            dynamic_builder_add_ref(builder, parent, frame->refs[i].position, frame->refs[i].owner);
+    }
+
+    child.offset = frame->start;
+    child.len = builder->buffer.len - frame->start;
+    child.type = GTENTRY_IS_CONTAINER;
+
+    dynamic_builder_add_child(builder, &child, frame->is_object ? DYNAMIC_OBJECT : DYNAMIC_ARRAY);
 }
 
 /*
- * Append padding, so that the length of the StringInfo is int-aligned.
- * Returns the number of padding bytes appended.
+ * Return the finished dynamic, once every container has been ended.
  */
-short pad_buffer_to_int(StringInfo buffer)
+dynamic *dynamic_builder_finish(dynamic_builder *builder)
 {
-    int padlen;
-    int p;
-    int offset;
+    dynamic *res;
 
-    padlen = INTALIGN(buffer->len) - buffer->len;
+    Assert(builder->depth == 0);
 
-    offset = reserve_from_buffer(buffer, padlen);
+    if (builder->key_positions != NULL)
+        hash_destroy(builder->key_positions);
 
-    // padlen must be small, so this is probably faster than a memset 
-    for (p = 0; p < padlen; p++)
-        buffer->data[offset + p] = '\0';
+    // after the outermost object it can be as large as the result
+    pfree(builder->scratch.data);
 
-    return padlen;
+    if (builder->result != NULL)
+        return builder->result;
+
+    res = (dynamic *)builder->buffer.data;
+    SET_VARSIZE(res, builder->buffer.len);
+
+    return res;
 }
 
 /*
- * Given an dynamic_value, convert to dynamic. The result is palloc'd.
+ * Return a copy of the finished dynamic, allocated in the current memory
+ * context, and start over with the next one. The buffers and frames are
+ * kept, so a batch of values is built without setting them up again for
+ * each one. key_positions is dropped along with its copies of the keys, as
+ * none of its entries can match again and they would pile up over a long
+ * batch.
  */
-static dynamic *convert_to_dynamic(dynamic_value *val)
+dynamic *dynamic_builder_next(dynamic_builder *builder)
 {
-    StringInfoData buffer;
-    gtentry aentry;
     dynamic *res;
 
-    // Should not already have binary representation 
-    Assert(val->type != DYNAMIC_BINARY);
-
-    // Allocate an output buffer. It will be enlarged as needed 
-    initStringInfo(&buffer);
+    Assert(builder->depth == 0);
 
-    // Make room for the varlena header 
-    reserve_from_buffer(&buffer, VARHDRSZ);
+    if (builder->result != NULL)
+    {
+        res = builder->result;
+        builder->result = NULL;
+    }
+    else
+    {
+        res = (dynamic *)palloc(builder->buffer.len);
+        memcpy(res, builder->buffer.data, builder->buffer.len);
+        SET_VARSIZE(res, builder->buffer.len);
+    }
 
-    convert_dynamic_value(&buffer, &aentry, val, 0);
+    if (builder->key_positions != NULL)
+    {
+        HASH_SEQ_STATUS status;
+        dynamic_build_key_entry *hentry;
 
-    /*
-     * Note: the gtentry of the root is discarded. Therefore the root
-     * dynamic_container struct must contain enough information to tell what
-     * kind of value it is.
-     */
+        hash_seq_init(&status, builder->key_positions);
+        while ((hentry = hash_seq_search(&status)) != NULL)
+            pfree(hentry->key.val);
 
-    res = (dynamic *)buffer.data;
+        hash_destroy(builder->key_positions);
+        builder->key_positions = NULL;
+    }
 
-    SET_VARSIZE(res, buffer.len);
+    resetStringInfo(&builder->buffer);
+    reserve_from_buffer(&builder->buffer, VARHDRSZ);
+    resetStringInfo(&builder->keys);
 
     return res;
 }
 
-
 /*
- * Subroutine of convert_dynamic: serialize a single dynamic_value into buffer.
- *
- * The gtentry header for this node is returned in *header.  It is filled in
- * with the length of this value and appropriate type bits.  If we wish to
- * store an end offset rather than a length, it is the caller's responsibility
- * to adjust for that.
- *
- * If the value is an array or an object, this recurses. 'level' is only used
- * for debugging purposes.
+ * Finish an array by moving its data up behind the header and the gtentrys.
+ * The elements keep their alignment, since the gtentrys take up a multiple
+ * of 4 bytes.
  */
-static void convert_dynamic_value(StringInfo buffer, gtentry *header,
-                                 dynamic_value *val, int level)
+static void dynamic_builder_end_array(dynamic_builder *builder, dynamic_build_frame *frame)
 {
-    check_stack_depth();
+    StringInfo buffer = &builder->buffer;
+    int num_elems = frame->count;
+    int stride = GT_OFFSET_STRIDE_FOR(num_elems);
+    int header_len = sizeof(uint32) + sizeof(gtentry) * num_elems;
+    int data_len = buffer->len - frame->start;
+    uint32 header = num_elems | GT_FARRAY;
+    gtentry *children;
+    int prev_end = 0;
+    int i;
 
-    if (!val)
-        return;
+    reserve_from_buffer(buffer, header_len);
+    memmove(buffer->data + frame->start + header_len, buffer->data + frame->start, data_len);
 
-    /*
-     * An dynamic_value passed as val should never have a type of DYNAMIC_BINARY,
-     * and neither should any of its sub-components. Those values will be
-     * produced by convert_dynamic_array and convert_dynamic_object, the results
-     * of which will not be passed back to this function as an argument.
-     */
+    copy_to_buffer(buffer, frame->start, (char *)&header, sizeof(uint32));
+    children = (gtentry *)(buffer->data + frame->start + sizeof(uint32));
 
-    if (IS_A_DYNAMIC_SCALAR(val))
-        convert_dynamic_scalar(buffer, header, val);
-    else if (val->type == DYNAMIC_ARRAY)
-        convert_dynamic_array(buffer, header, val, level);
-    else if (val->type == DYNAMIC_OBJECT)
-        convert_dynamic_object(buffer, header, val, level);
-    else
-        ereport(ERROR,
-                (errmsg("unknown dynamic type %d to convert", val->type)));
-}
+    for (i = 0; i < num_elems; i++)
+    {
+        dynamic_build_child *elem = &frame->elems[i];
+        int end = elem->offset + elem->len - frame->start;
 
-// define the type and size of the agt_header 
-#define DYNA_HEADER_TYPE uint32
-#define DYNA_HEADER_SIZE sizeof(DYNA_HEADER_TYPE)
+        if (end > GTENTRY_OFFLENMASK)
+            ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                            errmsg("total size of dynamic array elements exceeds the maximum of %u bytes",
+                                   GTENTRY_OFFLENMASK)));
 
-static short ag_serialize_header(StringInfo buffer, uint32 type)
-{
-    short padlen;
-    int offset;
-        
-    padlen = pad_buffer_to_int(buffer);
-    offset = reserve_from_buffer(buffer, DYNA_HEADER_SIZE);
-    *((DYNA_HEADER_TYPE *)(buffer->data + offset)) = type;
+        // Convert each stride'th length to an offset. 
+        if ((i % stride) == 0)
+            children[i] = elem->type | end | GTENTRY_HAS_OFF;
+        else
+            children[i] = elem->type | (end - prev_end);
 
-    return padlen;
-}
+        prev_end = end;
+    }
 
+    for (i = 0; i < frame->nrefs; i++)
+    {
+        char *ref = buffer->data + frame->refs[i].position + header_len;
 
-static void convert_dynamic_array(StringInfo buffer, gtentry *pheader,
-                                 dynamic_value *val, int level)
+        dynamic_builder_move_ref(ref, ref, header_len);
+        frame->refs[i].position += header_len;
+    }
+}
+
+/*
+ * Finish an array whose elements can be stored as a vector, see dynamic.h.
+ */
+static void dynamic_builder_end_vector(dynamic_builder *builder, dynamic_build_frame *frame,
+                                       uint32 vector_type)
 {
-    int base_offset;
-    int gtentry_offset;
+    StringInfo buffer = &builder->buffer;
+    int num_elems = frame->count;
+    int elem_size = DYNAMIC_VECTOR_ELEM_SIZE(vector_type);
+    uint32 header = num_elems | GT_FARRAY | GT_FVECTOR;
+    char *elems;
     int i;
-    int totallen;
-    uint32 header;
-    int num_elems = val->val.array.num_elems;
-
-    // Remember where in the buffer this array starts. 
-    base_offset = buffer->len;
 
-    // Align to 4-byte boundary (any padding counts as part of my data) 
-    pad_buffer_to_int(buffer);
+    if ((uint64) num_elems * elem_size > GTENTRY_OFFLENMASK)
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("total size of dynamic array elements exceeds the maximum of %u bytes",
+                               GTENTRY_OFFLENMASK)));
 
-    /*
-     * Construct the header gtentry and store it in the beginning of the
-     * variable-length payload.
-     */
-    header = num_elems | GT_FARRAY;
-    if (val->val.array.raw_scalar)
+    // Read the elements back before they are overwritten 
+    resetStringInfo(&builder->scratch);
+    enlargeStringInfo(&builder->scratch, num_elems * elem_size);
+    elems = builder->scratch.data;
+    for (i = 0; i < num_elems; i++)
     {
-        Assert(num_elems == 1);
-        Assert(level == 0);
-        header |= GT_FSCALAR;
+        dynamic_value v;
+        char *dest = elems + i * elem_size;
+
+        ag_deserialize_extended_type(buffer->data, frame->elems[i].offset, &v);
+
+        if (vector_type == DYNA_HEADER_DATE)
+            memcpy(dest, &v.val.date, sizeof(DateADT));
+        else if (vector_type == DYNA_HEADER_FLOAT)
+            memcpy(dest, &v.val.float_value, sizeof(float8));
+        else
+            memcpy(dest, &v.val.int_value, sizeof(int64));
     }
 
+    buffer->len = frame->start;
     append_to_buffer(buffer, (char *)&header, sizeof(uint32));
+    append_to_buffer(buffer, (char *)&vector_type, sizeof(uint32));
+    append_to_buffer(buffer, elems, num_elems * elem_size);
+}
 
-    // Reserve space for the gtentrys of the elements. 
-    gtentry_offset = reserve_from_buffer(buffer, sizeof(gtentry) * num_elems);
+/*
+ * Finish an object. The pairs are sorted and deduplicated, and the object is
+ * laid out again in a separate block that then replaces its data: the header
+ * and gtentrys, the keys, and the values in key order.
+ */
+static void dynamic_builder_end_object(dynamic_builder *builder, dynamic_build_frame *frame)
+{
+    StringInfo buffer = &builder->buffer;
+    int depth = builder->depth - 1;
+    int num_pairs = frame->count;
+    int nrefs = frame->nrefs;
+    int *ref_order = NULL;
+    int *ref_delta = NULL;
+    int *new_offsets = NULL;
+    StringInfo block = &builder->scratch;
+    uint32 header;
+    int data_start;
+    int stride;
+    int prev_end = 0;
+    int i;
+    int j;
 
-    totallen = 0;
-    for (i = 0; i < num_elems; i++)
+    /*
+     * Find the value each reference in the object is in, while the pairs are
+     * still in input order, which is the order of their values in the buffer.
+     */
+    if (nrefs > 0)
     {
-        dynamic_value *elem = &val->val.array.elems[i];
-        int len;
-        gtentry meta;
+        ref_order = palloc(sizeof(int) * nrefs);
+        ref_delta = palloc(sizeof(int) * nrefs);
+        new_offsets = palloc(sizeof(int) * num_pairs);
 
-        /*
-         * Convert element, producing a gtentry and appending its
-         * variable-length data to buffer
-         */
-        convert_dynamic_value(buffer, &meta, elem, level + 1);
+        for (i = 0; i < nrefs; i++)
+        {
+            int position = frame->refs[i].position;
+            int lo = 0;
+            int hi = num_pairs - 1;
 
-        len = GTE_OFFLENFLD(meta);
-        totallen += len;
+            while (lo < hi)
+            {
+                int mid = (lo + hi + 1) / 2;
 
-        /*
-         * Bail out if total variable-length data exceeds what will fit in a
-         * gtentry length field.  We check this in each iteration, not just
-         * once at the end, to forestall possible integer overflow.
-         */
-        if (totallen > GTENTRY_OFFLENMASK)
-        {
-            ereport(
-                ERROR,
-                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
-                 errmsg(
-                     "total size of dynamic array elements exceeds the maximum of %u bytes",
-                     GTENTRY_OFFLENMASK)));
-        }
+                if (frame->pairs[mid].value.offset <= position)
+                    lo = mid;
+                else
+                    hi = mid - 1;
+            }
 
-        /*
-         * Convert each GT_OFFSET_STRIDE'th length to an offset.
-         */
-        if ((i % GT_OFFSET_STRIDE) == 0)
-            meta = (meta & GTENTRY_TYPEMASK) | totallen | GTENTRY_HAS_OFF;
+            ref_order[i] = lo;
+            ref_delta[i] = position - frame->pairs[lo].value.offset;
+        }
 
-        copy_to_buffer(buffer, gtentry_offset, (char *)&meta,
-                       sizeof(gtentry));
-        gtentry_offset += sizeof(gtentry);
+        for (i = 0; i < num_pairs; i++)
+            new_offsets[i] = -1;
     }
 
-    // Total data size is everything we've appended to buffer 
-    totallen = buffer->len - base_offset;
+    if (num_pairs >= DYNAMIC_SORT_KEYS_MIN_PAIRS)
+    {
+        dynamic_build_pair *unsorted = palloc(sizeof(dynamic_build_pair) * num_pairs);
+        dynamic_sort_key *keys = palloc(sizeof(dynamic_sort_key) * num_pairs);
+
+        memcpy(unsorted, frame->pairs, sizeof(dynamic_build_pair) * num_pairs);
+
+        for (i = 0; i < num_pairs; i++)
+        {
+            keys[i].val = builder->keys.data + frame->pairs[i].key_offset;
+            keys[i].len = frame->pairs[i].key_len;
+            keys[i].index = i;
+            keys[i].order = frame->pairs[i].order;
+        }
+
+        num_pairs = sort_unique_keys(keys, num_pairs);
 
-    // Check length again, since we didn't include the metadata above 
-    if (totallen > GTENTRY_OFFLENMASK)
-    {
-        ereport(
-            ERROR,
-            (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
-             errmsg(
-                 "total size of dynamic array elements exceeds the maximum of %u bytes",
-                 GTENTRY_OFFLENMASK)));
+        for (i = 0; i < num_pairs; i++)
+            frame->pairs[i] = unsorted[keys[i].index];
+
+        pfree(unsorted);
+        pfree(keys);
     }
+    else if (num_pairs > 1)
+    {
+        qsort_arg(frame->pairs, num_pairs, sizeof(dynamic_build_pair),
+                  compare_dynamic_build_pair, builder->keys.data);
 
-    // Initialize the header of this node in the container's gtentry array 
-    *pheader = GTENTRY_IS_CONTAINER | totallen;
-}
+        // Of each run of equal keys, the first is the one to keep 
+        for (i = 1, j = 0; i < num_pairs; i++)
+        {
+            dynamic_build_pair *pair = &frame->pairs[i];
+            dynamic_build_pair *kept = &frame->pairs[j];
 
-static void convert_dynamic_object(StringInfo buffer, gtentry *pheader,
-                                  dynamic_value *val, int level)
-{
-    int base_offset;
-    int gtentry_offset;
-    int i;
-    int totallen;
-    uint32 header;
-    int num_pairs = val->val.object.num_pairs;
+            if (pair->key_len != kept->key_len ||
+                memcmp(builder->keys.data + pair->key_offset,
+                       builder->keys.data + kept->key_offset, pair->key_len) != 0)
+                frame->pairs[++j] = *pair;
+        }
 
-    // Remember where in the buffer this object starts. 
-    base_offset = buffer->len;
+        num_pairs = j + 1;
+    }
 
-    // Align to 4-byte boundary (any padding counts as part of my data) 
-    pad_buffer_to_int(buffer);
+    stride = GT_OFFSET_STRIDE_FOR(num_pairs);
 
-    /*
-     * Construct the header gtentry and store it in the beginning of the
-     * variable-length payload.
-     */
-    header = num_pairs | GT_FOBJECT;
-    append_to_buffer(buffer, (char *)&header, sizeof(uint32));
+    resetStringInfo(block);
 
-    // Reserve space for the gtentrys of the keys and values. 
-    gtentry_offset = reserve_from_buffer(buffer,
-                                          sizeof(gtentry) * num_pairs * 2);
+    header = num_pairs | GT_FOBJECT;
+    append_to_buffer(block, (char *)&header, sizeof(uint32));
+    reserve_from_buffer(block, sizeof(gtentry) * num_pairs * 2);
+    data_start = block->len;
 
-    /*
-     * Iterate over the keys, then over the values, since that is the ordering
-     * we want in the on-disk representation.
-     */
-    totallen = 0;
-    for (i = 0; i < num_pairs; i++)
+    for (i = 0; i < num_pairs * 2; i++)
     {
-        dynamic_pair *pair = &val->val.object.pairs[i];
-        int len;
-        gtentry meta;
+        dynamic_build_pair *pair = &frame->pairs[i % num_pairs];
+        gtentry type;
+        int end;
 
-        /*
-         * Convert key, producing an gtentry and appending its variable-length
-         * data to buffer
-         */
-        convert_dynamic_scalar(buffer, &meta, &pair->key);
+        if (i < num_pairs)
+        {
+            dynamic_builder_put_key(builder, block, frame->start, depth,
+                                    builder->keys.data + pair->key_offset, pair->key_len, &type);
+        }
+        else
+        {
+            type = pair->value.type;
+            if (type != GTENTRY_IS_STRING && type != GTENTRY_IS_NULL &&
+                type != GTENTRY_IS_BOOL_TRUE && type != GTENTRY_IS_BOOL_FALSE)
+                pad_buffer_to_int(block);
 
-        len = GTE_OFFLENFLD(meta);
-        totallen += len;
+            if (new_offsets != NULL)
+                new_offsets[pair->order] = block->len;
 
-        /*
-         * Bail out if total variable-length data exceeds what will fit in a
-         * gtentry length field.  We check this in each iteration, not just
-         * once at the end, to forestall possible integer overflow.
-         */
-        if (totallen > GTENTRY_OFFLENMASK)
-        {
-            ereport(
-                ERROR,
-                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
-                 errmsg(
-                     "total size of dynamic object elements exceeds the maximum of %u bytes",
-                     GTENTRY_OFFLENMASK)));
+            append_to_buffer(block, buffer->data + pair->value.offset, pair->value.len);
         }
 
-        /*
-         * Convert each GT_OFFSET_STRIDE'th length to an offset.
-         */
-        if ((i % GT_OFFSET_STRIDE) == 0)
-            meta = (meta & GTENTRY_TYPEMASK) | totallen | GTENTRY_HAS_OFF;
+        end = block->len - data_start;
 
-        copy_to_buffer(buffer, gtentry_offset, (char *)&meta,
-                       sizeof(gtentry));
-        gtentry_offset += sizeof(gtentry);
+        if (end > GTENTRY_OFFLENMASK)
+            ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                            errmsg("total size of dynamic object elements exceeds the maximum of %u bytes",
+                                   GTENTRY_OFFLENMASK)));
+
+        // Convert each stride'th length to an offset. 
+        if ((i % stride) == 0)
+            type |= end | GTENTRY_HAS_OFF;
+        else
+            type |= end - prev_end;
+
+        copy_to_buffer(block, sizeof(uint32) + i * sizeof(gtentry), (char *)&type, sizeof(gtentry));
+
+        prev_end = end;
     }
-    for (i = 0; i < num_pairs; i++)
+
+    /*
+     * The references that were in the values moved along with them. Those in
+     * values dropped as duplicates are gone. References added for the keys of
+     * this object follow them in the list.
+     */
+    for (i = 0, j = 0; i < frame->nrefs; i++)
     {
-        dynamic_pair *pair = &val->val.object.pairs[i];
-        int len;
-        gtentry meta;
+        dynamic_build_ref ref = frame->refs[i];
 
-        /*
-         * Convert value, producing an gtentry and appending its
-         * variable-length data to buffer
-         */
-        convert_dynamic_value(buffer, &meta, &pair->value, level + 1);
+        if (i < nrefs)
+        {
+            int new_offset = new_offsets[ref_order[i]];
+            int position;
 
-        len = GTE_OFFLENFLD(meta);
-        totallen += len;
+            if (new_offset < 0)
+                continue;
 
-        /*
-         * Bail out if total variable-length data exceeds what will fit in a
-         * gtentry length field.  We check this in each iteration, not just
-         * once at the end, to forestall possible integer overflow.
-         */
-        if (totallen > GTENTRY_OFFLENMASK)
-            ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
-                 errmsg("total size of dynamic object elements exceeds the maximum of %u bytes",
-                     GTENTRY_OFFLENMASK)));
+            position = frame->start + new_offset + ref_delta[i];
 
-        /*
-         * Convert each GT_OFFSET_STRIDE'th length to an offset.
-         */
-        if (((i + num_pairs) % GT_OFFSET_STRIDE) == 0)
-            meta = (meta & GTENTRY_TYPEMASK) | totallen | GTENTRY_HAS_OFF;
+            dynamic_builder_move_ref(block->data + position - frame->start,
+                                     buffer->data + ref.position, position - ref.position);
+            ref.position = position;
+        }
 
-        copy_to_buffer(buffer, gtentry_offset, (char *)&meta,
-                       sizeof(gtentry));
-        gtentry_offset += sizeof(gtentry);
+        frame->refs[j++] = ref;
     }
+    frame->nrefs = j;
 
-    // Total data size is everything we've appended to buffer 
-    totallen = buffer->len - base_offset;
+    buffer->len = frame->start;
+    append_to_buffer(buffer, block->data, block->len);
 
-    // Check length again, since we didn't include the metadata above 
-    if (totallen > GTENTRY_OFFLENMASK)
-        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
-             errmsg("total size of dynamic object elements exceeds the maximum of %u bytes", GTENTRY_OFFLENMASK)));
+    // The keys of the object are no longer needed 
+    builder->keys.len = frame->key_base;
 
-    // Initialize the header of this node in the container's gtentry array 
-    *pheader = GTENTRY_IS_CONTAINER | totallen;
+    if (nrefs > 0)
+    {
+        pfree(ref_order);
+        pfree(ref_delta);
+        pfree(new_offsets);
+    }
 }
 
-static void convert_dynamic_scalar(StringInfo buffer, gtentry *entry, dynamic_value *scalar_val)
+/*
+ * Append an object key to the block the object at the given depth is laid
+ * out in, which will be copied to block_start in the buffer. The key is
+ * stored as a reference if an earlier copy of it is in reach, otherwise it
+ * is written in full and, if the object is an element of an array, becomes
+ * the copy that later ones refer to.
+ */
+static void dynamic_builder_put_key(dynamic_builder *builder, StringInfo block, int block_start,
+                                    int depth, const char *key, int len, gtentry *type)
 {
-    int numlen;
-    short padlen;
-    bool status;
+    dynamic_build_frame *parent;
+    dynamic_build_key_entry *hentry;
+    dynamic_key lookup;
+    int position = block_start + block->len;
+    bool found;
+
+    // The keys of a top level object are always stored in full 
+    if (depth == 0 || len < DYNAMIC_KEY_REF_MIN_LEN)
+    {
+        append_to_buffer(block, key, len);
+        *type = GTENTRY_IS_STRING;
+        return;
+    }
 
-    switch (scalar_val->type)
+    parent = &builder->frames[depth - 1];
+
+    if (builder->key_positions == NULL)
     {
-    case DYNAMIC_NULL:
-        *entry = GTENTRY_IS_NULL;
-        break;
+        HASHCTL ctl;
 
-    case DYNAMIC_STRING:
-        append_to_buffer(buffer, scalar_val->val.string.val, scalar_val->val.string.len);
+        if (parent->is_object)
+        {
+            append_to_buffer(block, key, len);
+            *type = GTENTRY_IS_STRING;
+            return;
+        }
 
-        *entry = scalar_val->val.string.len;
-        break;
+        ctl.keysize = sizeof(dynamic_key);
+        ctl.entrysize = sizeof(dynamic_build_key_entry);
+        ctl.hash = dynamic_key_hash;
+        ctl.match = dynamic_key_match;
+        ctl.hcxt = builder->cxt;
 
-    case DYNAMIC_NUMERIC:
-        numlen = VARSIZE_ANY(scalar_val->val.numeric);
-        padlen = pad_buffer_to_int(buffer);
+        builder->key_positions = hash_create("dynamic object keys", 64, &ctl,
+                                             HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+    }
 
-        append_to_buffer(buffer, (char *)scalar_val->val.numeric, numlen);
+    lookup.val = (char *)key;
+    lookup.len = len;
 
-        *entry = GTENTRY_IS_NUMERIC | (padlen + numlen);
-        break;
+    hentry = hash_search(builder->key_positions, &lookup,
+                         parent->is_object ? HASH_FIND : HASH_ENTER, &found);
 
-    case DYNAMIC_BOOL:
-        *entry = (scalar_val->val.boolean) ? GTENTRY_IS_BOOL_TRUE : GTENTRY_IS_BOOL_FALSE;
-        break;
+    // A key is in reach for as long as the array holding it is open 
+    if (found && hentry->owner < depth &&
+        builder->frames[hentry->owner].id == hentry->owner_id)
+    {
+        gtentry_key_ref ref;
 
-    default:
-        // returns true if there was a valid extended type processed 
-        status = ag_serialize_extended_type(buffer, entry, scalar_val);
-        // if nothing was found, error log out 
-        if (!status)
-            ereport(ERROR, (errmsg("invalid dynamic scalar type %d to convert",
-                                   scalar_val->type)));
+        ref.distance = position - hentry->position;
+        ref.len = len;
+
+        append_to_buffer(block, (char *)&ref, sizeof(gtentry_key_ref));
+        *type = GTENTRY_IS_KEY_REF;
+
+        if (hentry->owner < depth - 1)
+            dynamic_builder_add_ref(builder, &builder->frames[depth], position, hentry->owner);
+
+        return;
     }
-}
 
-/*
- * Compare two DYNAMIC_STRING dynamic_value values, a and b.
- *
- * This is a special qsort() comparator used to sort strings in certain
- * internal contexts where it is sufficient to have a well-defined sort order.
- * In particular, object pair keys are sorted according to this criteria to
- * facilitate cheap binary searches where we don't care about lexical sort
- * order.
- *
- * a and b are first sorted based on their length.  If a tie-breaker is
- * required, only then do we consider string binary equality.
- */
-static int length_compare_dynamic_string_value(const void *a, const void *b)
-{
-    const dynamic_value *va = (const dynamic_value *)a;
-    const dynamic_value *vb = (const dynamic_value *)b;
-    int res;
+    append_to_buffer(block, key, len);
+    *type = GTENTRY_IS_STRING;
 
-    Assert(va->type == DYNAMIC_STRING);
-    Assert(vb->type == DYNAMIC_STRING);
+    if (hentry == NULL)
+        return;
 
-    if (va->val.string.len == vb->val.string.len)
+    if (!found)
     {
-        res = memcmp(va->val.string.val, vb->val.string.val,
-                     va->val.string.len);
+        hentry->key.val = MemoryContextAlloc(builder->cxt, len);
+        memcpy(hentry->key.val, key, len);
     }
-    else
+
+    hentry->position = position;
+    hentry->owner = depth - 1;
+    hentry->owner_id = parent->id;
+}
+
+static void dynamic_builder_add_ref(dynamic_builder *builder, dynamic_build_frame *frame,
+                                    int position, int owner)
+{
+    if (frame->nrefs >= frame->refs_size)
     {
-        res = (va->val.string.len > vb->val.string.len) ? 1 : -1;
+        frame->refs_size = Max(frame->refs_size * 2, 8);
+        if (frame->refs == NULL)
+            frame->refs = MemoryContextAlloc(builder->cxt, sizeof(dynamic_build_ref) * frame->refs_size);
+        else
+            frame->refs = repalloc(frame->refs, sizeof(dynamic_build_ref) * frame->refs_size);
     }
 
-    return res;
+    frame->refs[frame->nrefs].position = position;
+    frame->refs[frame->nrefs].owner = owner;
+    frame->nrefs++;
 }
 
 /*
- * qsort_arg() comparator to compare dynamic_pair values.
- *
- * Third argument 'binequal' may point to a bool. If it's set, *binequal is set
- * to true iff a and b have full binary equality, since some callers have an
- * interest in whether the two values are equal or merely equivalent.
- *
- * N.B: String comparisons here are "length-wise"
- *
- * Pairs with equals keys are ordered such that the order field is respected.
+ * Write the key reference at src to dest, for a reference that moved by
+ * moved_by bytes while its target stayed in place.
  */
-static int length_compare_dynamic_pair(const void *a, const void *b,
-                                      void *binequal)
+static void dynamic_builder_move_ref(char *dest, const char *src, int moved_by)
 {
-    const dynamic_pair *pa = (const dynamic_pair *)a;
-    const dynamic_pair *pb = (const dynamic_pair *)b;
-    int res;
-
-    res = length_compare_dynamic_string_value(&pa->key, &pb->key);
-    if (res == 0 && binequal)
-        *((bool *)binequal) = true;
-
-    /*
-     * Guarantee keeping order of equal pair.  Unique algorithm will prefer
-     * first element as value.
-     */
-    if (res == 0)
-        res = (pa->order > pb->order) ? -1 : 1;
+    gtentry_key_ref ref;
 
-    return res;
+    memcpy(&ref, src, sizeof(gtentry_key_ref));
+    ref.distance += moved_by;
+    memcpy(dest, &ref, sizeof(gtentry_key_ref));
 }
 
 /*
- * Sort and unique-ify pairs in dynamic_value object
+ * qsort_arg() comparator for the pairs of an object being built, with the
+ * key arena as the argument. Keys are ordered length-wise like in
+ * length_compare_dynamic_pair, and of equal keys the last one comes first.
  */
-void uniqueify_dynamic_object(dynamic_value *object)
+static int compare_dynamic_build_pair(const void *a, const void *b, void *arg)
 {
-    bool has_non_uniq = false;
-
-    Assert(object->type == DYNAMIC_OBJECT);
-
-    if (object->val.object.num_pairs > 1)
-        qsort_arg(object->val.object.pairs, object->val.object.num_pairs,
-                  sizeof(dynamic_pair), length_compare_dynamic_pair,
-                  &has_non_uniq);
+    const dynamic_build_pair *pa = (const dynamic_build_pair *)a;
+    const dynamic_build_pair *pb = (const dynamic_build_pair *)b;
+    const char *keys = (const char *)arg;
+    int res;
 
-    if (has_non_uniq)
-    {
-        dynamic_pair *ptr = object->val.object.pairs + 1;
-        dynamic_pair *res = object->val.object.pairs;
+    if (pa->key_len != pb->key_len)
+        return (pa->key_len > pb->key_len) ? 1 : -1;
 
-        while (ptr - object->val.object.pairs < object->val.object.num_pairs)
-        {
-            // Avoid copying over duplicate 
-            if (length_compare_dynamic_string_value(ptr, res) != 0)
-            {
-                res++;
-                if (ptr != res)
-                    memcpy(res, ptr, sizeof(dynamic_pair));
-            }
-            ptr++;
-        }
+    res = memcmp(keys + pa->key_offset, keys + pb->key_offset, pa->key_len);
+    if (res == 0)
+        res = (pa->order > pb->order) ? -1 : 1;
 
-        object->val.object.num_pairs = res + 1 - object->val.object.pairs;
-    }
+    return res;
 }
 
 char *dynamic_value_type_to_string(enum dynamic_value_type type)
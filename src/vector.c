@@ -0,0 +1,240 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Casts between dynamic arrays and PostgreSQL float8[] and int8[].
+ *
+ * When the dynamic side is a vector (see dynamic.h) of the matching element
+ * type, the elements are already laid out the way an array without nulls
+ * stores them, so the conversion is a single memcpy in either direction.
+ */
+
+#include "postgres.h"
+
+#include "catalog/pg_type.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+#include "utils/palloc.h"
+#include "fmgr.h"
+#include "utils/fmgrprotos.h"
+
+#include "utils/dynamic.h"
+
+#include "dynamic_typecasting.h"
+
+static ArrayType *vector_to_array(dynamic_container *agtc, Oid elmtype);
+static ArrayType *dynamic_to_array(dynamic *agt, Oid elmtype,
+                                   coearce_function func, const char *sqltype);
+static dynamic *array_to_dynamic(ArrayType *array, enum dynamic_value_type type,
+                                 uint32 vector_type);
+
+/*
+ * Typecasting
+ */
+PG_FUNCTION_INFO_V1(dynamic_to_float8_array);
+Datum
+dynamic_to_float8_array(PG_FUNCTION_ARGS) {
+    dynamic *agt = AG_GET_ARG_DYNAMIC_P(0);
+    ArrayType *result;
+
+    if (DYNA_ROOT_IS_VECTOR(agt) && DYNAMIC_VECTOR_TYPE(&agt->root) == DYNA_HEADER_FLOAT)
+        result = vector_to_array(&agt->root, FLOAT8OID);
+    else
+        result = dynamic_to_array(agt, FLOAT8OID, dynamic_to_float8_internal, "float8[]");
+
+    PG_FREE_IF_COPY(agt, 0);
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+PG_FUNCTION_INFO_V1(float8_array_to_dynamic);
+Datum
+float8_array_to_dynamic(PG_FUNCTION_ARGS) {
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(0);
+
+    AG_RETURN_DYNAMIC_P(array_to_dynamic(array, DYNAMIC_FLOAT, DYNA_HEADER_FLOAT));
+}
+
+PG_FUNCTION_INFO_V1(dynamic_to_int8_array);
+Datum
+dynamic_to_int8_array(PG_FUNCTION_ARGS) {
+    dynamic *agt = AG_GET_ARG_DYNAMIC_P(0);
+    ArrayType *result;
+
+    if (DYNA_ROOT_IS_VECTOR(agt) && DYNAMIC_VECTOR_TYPE(&agt->root) == DYNA_HEADER_INTEGER)
+        result = vector_to_array(&agt->root, INT8OID);
+    else
+        result = dynamic_to_array(agt, INT8OID, dynamic_to_int8_internal, "int8[]");
+
+    PG_FREE_IF_COPY(agt, 0);
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+PG_FUNCTION_INFO_V1(int8_array_to_dynamic);
+Datum
+int8_array_to_dynamic(PG_FUNCTION_ARGS) {
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(0);
+
+    AG_RETURN_DYNAMIC_P(array_to_dynamic(array, DYNAMIC_INTEGER, DYNA_HEADER_INTEGER));
+}
+
+Datum
+dynamic_to_float8_internal(dynamic_value *gtv) {
+    if (gtv->type == DYNAMIC_FLOAT)
+        return Float8GetDatum(gtv->val.float_value);
+    else if (gtv->type == DYNAMIC_INTEGER)
+        return Float8GetDatum((float8) gtv->val.int_value);
+    else if (gtv->type == DYNAMIC_NUMERIC)
+        return DirectFunctionCall1Coll(numeric_float8, InvalidOid, NumericGetDatum(gtv->val.numeric));
+    else if (gtv->type == DYNAMIC_STRING)
+        return DirectFunctionCall1Coll(float8in, InvalidOid,
+                                       CStringGetDatum(pnstrdup(gtv->val.string.val, gtv->val.string.len)));
+    else
+        cannot_cast_dynamic_value(gtv->type, "float8");
+
+    // cannot reach
+    return 0;
+}
+
+/*
+ * Copy the elements of an 8 byte vector into a one dimensional array without
+ * nulls, which stores them back to back right after the header.
+ */
+static ArrayType *
+vector_to_array(dynamic_container *agtc, Oid elmtype) {
+    int num_elems = DYNAMIC_CONTAINER_SIZE(agtc);
+    Size data_len = (Size) num_elems * sizeof(int64);
+    Size nbytes = ARR_OVERHEAD_NONULLS(1) + data_len;
+    ArrayType *result;
+
+    result = (ArrayType *) palloc0(nbytes);
+    SET_VARSIZE(result, nbytes);
+    result->ndim = 1;
+    result->dataoffset = 0;
+    result->elemtype = elmtype;
+    ARR_DIMS(result)[0] = num_elems;
+    ARR_LBOUND(result)[0] = 1;
+
+    memcpy(ARR_DATA_PTR(result), DYNAMIC_VECTOR_DATA(agtc), data_len);
+
+    return result;
+}
+
+/*
+ * Convert any other dynamic array element by element. dynamic nulls become
+ * SQL nulls.
+ */
+static ArrayType *
+dynamic_to_array(dynamic *agt, Oid elmtype, coearce_function func, const char *sqltype) {
+    dynamic_iterator *it;
+    dynamic_iterator_token tok;
+    dynamic_value v;
+    Datum *elems;
+    bool *nulls;
+    int num_elems;
+    int dims[1];
+    int lbs[1] = {1};
+    int16 typlen;
+    bool typbyval;
+    char typalign;
+    int i = 0;
+
+    if (!DYNA_ROOT_IS_ARRAY(agt) || DYNA_ROOT_IS_SCALAR(agt))
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE), errmsg("cannot cast non-array dynamic to %s", sqltype)));
+
+    num_elems = DYNA_ROOT_COUNT(agt);
+    if (num_elems == 0)
+        return construct_empty_array(elmtype);
+
+    elems = palloc(sizeof(Datum) * num_elems);
+    nulls = palloc(sizeof(bool) * num_elems);
+
+    it = dynamic_iterator_init(&agt->root);
+    while ((tok = dynamic_iterator_next(&it, &v, true)) != WGT_DONE) {
+        if (tok != WGT_ELEM && tok != WGT_VECTOR_VALUE)
+            continue;
+
+        if (v.type == DYNAMIC_NULL) {
+            elems[i] = (Datum) 0;
+            nulls[i] = true;
+        } else {
+            if (v.type == DYNAMIC_BINARY)
+                cannot_cast_dynamic_value(DYNAMIC_BINARY, sqltype);
+
+            elems[i] = func(&v);
+            nulls[i] = false;
+        }
+        i++;
+    }
+
+    dims[0] = num_elems;
+    get_typlenbyvalalign(elmtype, &typlen, &typbyval, &typalign);
+
+    return construct_md_array(elems, nulls, 1, dims, lbs, elmtype, typlen, typbyval, typalign);
+}
+
+/*
+ * Build a dynamic array from a float8[] or int8[]. Arrays without nulls that
+ * are long enough to be stored as a vector are copied over directly, anything
+ * else goes through the regular conversion, which will still choose a vector
+ * where it can.
+ */
+static dynamic *
+array_to_dynamic(ArrayType *array, enum dynamic_value_type type, uint32 vector_type) {
+    dynamic_value result;
+    Datum *elems;
+    bool *nulls;
+    int num_elems;
+    int i;
+
+    if (ARR_NDIM(array) > 1)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE), errmsg("cannot cast multidimensional array to dynamic")));
+
+    num_elems = ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+
+    if (!ARR_HASNULL(array) && num_elems >= DYNAMIC_VECTOR_MIN_ELEMS)
+        return vector_to_dynamic(vector_type, ARR_DATA_PTR(array), num_elems);
+
+    deconstruct_array(array, ARR_ELEMTYPE(array), sizeof(int64), FLOAT8PASSBYVAL, TYPALIGN_DOUBLE,
+                      &elems, &nulls, &num_elems);
+
+    result.type = DYNAMIC_ARRAY;
+    result.val.array.num_elems = num_elems;
+    result.val.array.raw_scalar = false;
+    result.val.array.elems = palloc(sizeof(dynamic_value) * Max(num_elems, 1));
+
+    for (i = 0; i < num_elems; i++) {
+        dynamic_value *elem = &result.val.array.elems[i];
+
+        if (nulls[i]) {
+            elem->type = DYNAMIC_NULL;
+        } else if (type == DYNAMIC_FLOAT) {
+            elem->type = DYNAMIC_FLOAT;
+            elem->val.float_value = DatumGetFloat8(elems[i]);
+        } else {
+            elem->type = DYNAMIC_INTEGER;
+            elem->val.int_value = DatumGetInt64(elems[i]);
+        }
+    }
+
+    return dynamic_value_to_dynamic(&result);
+}